@@ -0,0 +1,71 @@
+/**
+ * @file arena.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief A bump allocator for the arrays of short-lived boards.
+ *
+ * Memory is mapped once and handed out in 64-byte aligned chunks, which are
+ * never freed one by one: reset() reclaims all of them at once and keeps the
+ * pages, so that a run reusing the arena neither calls the allocator nor
+ * faults the pages in again. Large blocks are backed by transparent huge
+ * pages where the system supports them. An arena is not thread safe: give
+ * each thread its own.
+ */
+class Arena {
+   private:
+    struct Block {
+        char* base;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    // Bytes handed out of the last block
+    size_t used = 0;
+    void grow(size_t size);
+
+   public:
+    static constexpr size_t alignment = 64;
+    /**
+     * @param capacity Bytes to map up front, the arena grows as needed.
+     */
+    Arena(size_t capacity = 0);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    /**
+     * @brief Hand out a chunk of memory, which is not zeroed.
+     */
+    void* allocate(size_t size);
+    /**
+     * @brief Reclaim everything allocated from the arena.
+     *
+     * If the arena had to grow, its blocks are replaced by a single one
+     * large enough for all of them, so that the next run fits in it.
+     */
+    void reset();
+    /**
+     * @brief Get the number of bytes the arena can hand out before growing.
+     */
+    size_t getCapacity();
+};
@@ -0,0 +1,539 @@
+/**
+ * @file board.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "footprint.hpp"
+#include "workers.hpp"
+
+typedef unsigned char uchar;
+
+/**
+ * @brief A density stored in 16-bit fixed point, from 0 to 1 in steps of
+ * 1/65535.
+ */
+typedef uint16_t Fixed16;
+
+inline float decodeDensity(float density) { return density; }
+inline double decodeDensity(double density) { return density; }
+inline float decodeDensity(Fixed16 density) {
+    return density * (1.f / 65535.f);
+}
+/**
+ * @brief Round a density to the nearest fixed-point one, in [0, 1].
+ */
+inline Fixed16 encodeDensity(float density) {
+    return (Fixed16)std::lrint(std::min(std::max(density, 0.f), 1.f) *
+                               65535.f);
+}
+
+enum Dir { North, South, West, East };
+constexpr Dir directions[4] = {Dir::North, Dir::South, Dir::West, Dir::East};
+
+struct Cell {
+    enum Type : uchar { Wall, Floor, Emitter, Escape };
+};
+
+/**
+ * @brief A steady draft blowing over a rectangle of the board, from a fan or
+ * an open door, see Board::addWind().
+ */
+struct Wind {
+    uint row, col, rows, cols;
+    Dir dir;
+    float strength;
+};
+
+/**
+ * @brief The simulation grid, stored as a structure of arrays.
+ *
+ * Each per-cell quantity lives in its own contiguous array, so that the update
+ * loop only streams the data it actually needs. The arrays are surrounded by a
+ * one-cell border of walls: every cell on the board has four neighbours that
+ * are reached with plain offsets (see neighbourOf()) and never need to be
+ * bounds-checked. Row and column are recomputed from the index.
+ */
+class Board {
+   public:
+    /**
+     * How the densities are stored between ticks. Fixed storage halves the
+     * memory taken by the densities and streamed by each synchronous tick, at
+     * a resolution of 1/65535, while double storage computes every tick in
+     * double precision, for long runs that must conserve mass. With either,
+     * the float densities are a copy, only allocated once they are read and
+     * decoded again whenever they are read after a tick: writing to them has
+     * no effect.
+     */
+    enum Storage { Float, Fixed, Double };
+
+   private:
+    uint width;
+    uint height;
+    size_t stride;
+    Cell::Type* type;
+    char* cost;
+    float* omega_in;
+    float* omega_out;
+    float* density;
+    float* density_next;
+    Storage storage;
+    Fixed16* fixed;
+    Fixed16* fixed_next;
+    double* precise;
+    double* precise_next;
+    bool decoded;
+    uchar* rate_index;
+    float rates[256];
+    uint rate_count;
+    // Rates that belong to one cell each, and those no cell has any more
+    std::bitset<256> claimed_rates;
+    std::vector<uchar> spare_rates;
+    float* flow;
+    float* flow_in;
+    float* flow_out[4];
+    uchar* links;
+    bool flow_precalc;
+    float flow_bias;
+    bool flow_valid;
+    std::vector<Wind> winds;
+    // Where the arrays are allocated from, or null for the heap
+    Arena* arena = nullptr;
+    // Generation each row was last changed in, see markRows()
+    std::vector<unsigned long> row_generations;
+    unsigned long generation = 0;
+    unsigned long cell_generation = 0;
+    void markCells(uint begin, uint end);
+    Board() = default;
+    void allocateArrays();
+    void decodeDensities();
+    void ownWeights();
+    uchar indexOfRate(float rate);
+    void spareRate(size_t idx);
+    void computeFlowOf(size_t idx, bool use_precalc_weights,
+                       const float* scales, const float* push);
+    void computeFlowAround(uint row, uint col);
+    void computeFlowOfCells(const std::vector<size_t>& cells);
+    void writeDensity(size_t idx, float density);
+
+   public:
+    /**
+     * The cells are decoded and their weights computed in one pass over the
+     * layout, split between threads on large boards. Emitters change the
+     * weights of their neighbours, so call computeWeightsAround() after
+     * placing each of them.
+     *
+     * @param layout Layout characters, row by row.
+     * @param layout_stride Distance between the first characters of two
+     * consecutive rows of the layout, or 0 if they are tightly packed.
+     * @param topology If not null, the topology bytes of a binary layout,
+     * see board_file.hpp, row by row: the weights are taken from them rather
+     * than from the neighbours of each cell.
+     */
+    Board(uint width, uint height, const char* const layout,
+          size_t layout_stride = 0, const uchar* topology = nullptr);
+    /**
+     * @brief Make an independent copy of a board, densities included.
+     *
+     * Copying a board that has already been loaded is much cheaper than
+     * parsing its layout again.
+     */
+    Board(const Board& other) : Board(other, nullptr) {}
+    /**
+     * @brief Make a copy of a board whose arrays, including those it
+     * allocates later on, come from an arena.
+     *
+     * The board, and any fork of it, must be deleted before the arena is
+     * reset. Forks allocate their own arrays from the heap.
+     */
+    Board(const Board& other, Arena* arena);
+    /**
+     * @brief Make a board of walls, to have its state restored by
+     * readCheckpoint().
+     */
+    Board(uint width, uint height, Storage storage);
+    Board& operator=(const Board&) = delete;
+    /**
+     * @brief Make a copy of the board that shares its arrays with it until
+     * either of them writes one.
+     *
+     * Forking costs nothing whatever the size of the board: each array is
+     * only copied once it is written, first by the board that writes it.
+     * Board methods take care of it themselves, but densities written
+     * through the pointers the getters return need ownDensities() first.
+     */
+    Board* fork();
+    /**
+     * @brief Copy the density buffers of the current storage if they are
+     * shared with a fork, so that they can be written.
+     */
+    void ownDensities();
+    /**
+     * @brief Copy the current densities of rows [begin, end), with the walls
+     * on either side, over the write buffer, which has to be owned.
+     */
+    void syncDensities(uint begin, uint end);
+    ~Board();
+    uint getWidth() { return this->width; }
+    uint getHeight() { return this->height; }
+    /**
+     * @brief Get the number of cells on the board, excluding the border.
+     */
+    size_t getSize() { return (size_t)this->width * this->height; }
+    /**
+     * @brief Get the distance between two vertically adjacent cells.
+     */
+    size_t getStride() { return this->stride; }
+    /**
+     * @brief Get the length of each array, including the border.
+     */
+    size_t getPaddedSize() { return this->stride * (this->height + 2); }
+    Cell::Type* getTypes() { return this->type; }
+    char* getCosts() { return this->cost; }
+    float* getOmegaIn() { return this->omega_in; }
+    float* getOmegaOut() { return this->omega_out; }
+    Storage getStorage() { return this->storage; }
+    /**
+     * @brief Change how the densities are stored, converting them.
+     */
+    void setStorage(Storage storage);
+    float* getDensities() {
+        if (!this->decoded) this->decodeDensities();
+        return this->density;
+    }
+    /**
+     * @brief Read the density of one cell in the storage of the board,
+     * without decoding the others.
+     */
+    float getDensity(size_t idx) {
+        switch (this->storage) {
+            case Board::Storage::Fixed:
+                return decodeDensity(this->fixed[idx]);
+            case Board::Storage::Double:
+                return (float)this->precise[idx];
+            default:
+                return this->density[idx];
+        }
+    }
+    /**
+     * @brief Get the write buffer used by synchronous updates, or null unless
+     * the storage is float.
+     */
+    float* getNextDensities() { return this->density_next; }
+    /**
+     * @brief Get the densities in fixed storage, or null in any other.
+     */
+    Fixed16* getFixedDensities() { return this->fixed; }
+    Fixed16* getNextFixedDensities() { return this->fixed_next; }
+    /**
+     * @brief Get the densities in double storage, or null in any other.
+     */
+    double* getDoubleDensities() { return this->precise; }
+    double* getNextDoubleDensities() { return this->precise_next; }
+    /**
+     * @brief Note that the densities were written in place, so that the
+     * float densities are decoded again when they are a copy.
+     */
+    void touchDensities() {
+        if (this->storage != Board::Storage::Float) this->decoded = false;
+    }
+    /**
+     * @brief Note that the densities or the cells of rows [begin, end) have
+     * changed, for instance over a tick.
+     *
+     * Every change starts a new generation, numbered across all boards, so
+     * that a display can tell which rows it has to redraw since it last drew
+     * any board. New boards start with every row changed.
+     */
+    void markRows(uint begin, uint end);
+    unsigned long getGeneration() { return this->generation; }
+    /**
+     * @brief Get the generation the cell types or the rates last changed in,
+     * which is much rarer than the densities changing.
+     */
+    unsigned long getCellGeneration() { return this->cell_generation; }
+    /**
+     * @brief Get the rows changed after a generation, as [*begin, *end),
+     * which is empty when none has.
+     */
+    void getChangedRows(unsigned long since, uint* begin, uint* end);
+    /**
+     * @brief Make the write buffer current, after a synchronous update.
+     */
+    void swapDensities() {
+        switch (this->storage) {
+            case Board::Storage::Float:
+                std::swap(this->density, this->density_next);
+                break;
+            case Board::Storage::Fixed:
+                std::swap(this->fixed, this->fixed_next);
+                this->decoded = false;
+                break;
+            case Board::Storage::Double:
+                std::swap(this->precise, this->precise_next);
+                this->decoded = false;
+                break;
+        }
+    }
+    /**
+     * @brief Add the bytes of the arrays of the board to a footprint, as
+     * "cells", "weights", "flows" and "densities", those of arrays it shares
+     * with other boards split between them.
+     */
+    void addFootprint(Footprint* footprint);
+    /**
+     * @brief Add the bytes the arrays of the board will take once it has
+     * ticked in a storage, to a footprint, by the parts of addFootprint().
+     * @param decoded Count the float copy of the densities of fixed and
+     * double storage, which is only allocated once they are read.
+     */
+    void planFootprint(Footprint* footprint, Storage storage, bool decoded);
+    /**
+     * @brief Get the index of the rate of each emitter and escape.
+     *
+     * Rates scale the global emission and escape rates of the simulation
+     * for one cell, and are stored once in a table of at most 256 distinct
+     * values, indexed by cell. Index 0 is always a rate of 1.
+     */
+    const uchar* getRateIndices() { return this->rate_index; }
+    const float* getRates() { return this->rates; }
+    float getRate(size_t idx) { return this->rates[this->rate_index[idx]]; }
+    /**
+     * @brief Check whether every emitter and escape has a rate of 1.
+     */
+    bool hasUniformRates() { return this->rate_count == 1; }
+    uint getRateCount() { return this->rate_count; }
+    /**
+     * @brief Replace the table of rates, when restoring the rate indices.
+     */
+    void setRates(const float* rates, uint count);
+    /**
+     * @brief Give an emitter or escape a rate of its own, that no other cell
+     * shares, so that it can change on every tick in place, see
+     * setClaimedRate().
+     *
+     * Setting the rate of the cell otherwise gives the claimed rate up.
+     */
+    void claimRate(uint row, uint col);
+    bool hasClaimedRate(uint row, uint col) {
+        return this->claimed_rates[this->rate_index[this->indexOf(row, col)]];
+    }
+    /**
+     * @brief Change the rate a cell claimed, which no other cell sees.
+     */
+    void setClaimedRate(uint row, uint col, float rate);
+    /**
+     * @brief Give the rate a cell claimed up, the cell keeping its value.
+     */
+    void releaseRate(uint row, uint col);
+    /**
+     * @brief List the arrays that hold the state of the board, as pointers
+     * and sizes in bytes.
+     *
+     * The cell types, floor heights, weights, rate indices and current
+     * densities, in their storage, so that the board can be saved and
+     * restored without looking at each cell. Call touchDensities() after
+     * restoring them.
+     */
+    std::vector<std::pair<void*, size_t>> getStateArrays();
+    /**
+     * @brief Turn a floor cell into an emitter.
+     * @param rate Scales the global emission rate for this emitter.
+     */
+    void placeEmitter(uint row, uint col, float rate = 1.f);
+    /**
+     * @brief Set the rate of an emitter, 0 turning it off.
+     * @param rate Scales the global emission rate for this emitter.
+     */
+    void setEmitterRate(uint row, uint col, float rate);
+    /**
+     * @brief Set the rate of an escape.
+     * @param rate Scales the global escape rate for this escape.
+     */
+    void setEscapeRate(uint row, uint col, float rate);
+    /**
+     * @brief Turn a cell into a wall, a floor or an escape, for instance to
+     * close or open a door during a run.
+     *
+     * Only the weights of the cell and of its neighbours are recomputed, and
+     * their flow coefficients when the others are up to date, so editing a
+     * cell costs the same whatever the size of the board. The cell starts
+     * out empty, level at height 0 as a floor and with a rate of 1 as an
+     * escape: any smoke it held is lost. Emitters cannot be set or changed.
+     */
+    void setCellType(uint row, uint col, Cell::Type type);
+    /**
+     * @brief Set the type of a batch of cells, for instance painted with a
+     * brush, emitters included.
+     *
+     * Cells start out like setCellType() leaves them, emitters full, and
+     * emitters and escapes with their rate. Cells are changed first, then
+     * the weights and flow coefficients of the cells changed and of their
+     * neighbours are recomputed once for the whole batch.
+     *
+     * @param cells Indices of the cells, which can be of any type.
+     * @param rate Scales the global rate of emitters and escapes.
+     * @return The indices of the cells that changed.
+     */
+    std::vector<size_t> paintCells(const std::vector<size_t>& cells,
+                                   Cell::Type type, float rate = 1.f);
+    /**
+     * @brief Set the density of the floor cells of a batch, for instance
+     * painted with a brush, leaving the other cells as they are.
+     * @return The indices of the cells that changed.
+     */
+    std::vector<size_t> paintSmoke(const std::vector<size_t>& cells,
+                                   float density);
+    /**
+     * @brief Count the neighbours smoke can flow in from and out to.
+     */
+    void countNeighbours(size_t idx, uint* ins, uint* outs);
+    /**
+     * @brief Set the precalculated weights of a cell from its neighbours.
+     */
+    void setWeights(size_t idx, uint ins, uint outs) {
+        this->ownWeights();
+        this->flow_valid = false;
+        this->omega_in[idx] = (ins == 0) ? .0f : 1.f / (float)ins;
+        this->omega_out[idx] = (outs == 0) ? .0f : 1.f / (float)outs;
+    }
+    /**
+     * @brief Calculate the precalculated weights of every cell.
+     *
+     * Must be called again whenever the cell types change.
+     */
+    void computeWeights() { this->computeWeights(0, this->height); }
+    /**
+     * @brief Calculate the precalculated weights of the cells of the rows
+     * from begin to end, excluded, so that large boards can be done in
+     * bands.
+     */
+    void computeWeights(uint begin, uint end);
+    /**
+     * @brief Recalculate the weights of a cell and of its neighbours.
+     *
+     * Cheaper than computeWeights() after changing the type of one cell.
+     */
+    void computeWeightsAround(uint row, uint col);
+    /**
+     * @brief Make smoke drift with a wind over a rectangle of cells.
+     *
+     * The flow out of each cell of the rectangle towards the direction of
+     * the wind is scaled by exp(strength) and the flow against it by
+     * exp(-strength), before the scales are normalised like those of floor
+     * heights, see computeFlowCoefficients(). Winds that overlap add up.
+     * They are folded into the flow coefficients, so they cost nothing per
+     * tick.
+     */
+    void addWind(const Wind& wind);
+    void clearWinds() {
+        this->winds.clear();
+        this->flow_valid = false;
+    }
+    const std::vector<Wind>& getWinds() { return this->winds; }
+    /**
+     * @brief Precompute the coefficients of the flows between neighbours.
+     *
+     * Folds the weight mode and the floor heights into a coefficient of the
+     * flow into each cell and one of the flow out of it towards each
+     * neighbour, so the transition function does not have to pick between
+     * them. Uniform weights are 1/4 whatever the neighbours. Floor heights
+     * scale the flow out of a cell towards a neighbour by exp(bias * rise),
+     * the rise being the difference between their floor heights, and the
+     * scales of the neighbours smoke can flow out to are normalised to
+     * average 1. Emitters and escapes are level with their neighbours, winds
+     * scale the flows further, see addWind(). Must be called again whenever
+     * the cell types, the weights or the winds change.
+     *
+     * @param workers If not null, the workers compute a band of rows each,
+     * see WorkerPool::getBand(), so that the pages of each band are first
+     * touched by the worker that goes on to update it.
+     * @param band_rows Rows the bands are whole multiples of.
+     */
+    void computeFlowCoefficients(bool use_precalc_weights, float bias,
+                                 WorkerPool* workers = nullptr,
+                                 uint band_rows = 1);
+    /**
+     * @brief Check whether the flow coefficients are up to date for a weight
+     * mode and a bias.
+     */
+    bool hasFlowCoefficients(bool use_precalc_weights, float bias) {
+        return this->flow_valid &&
+               this->flow_precalc == use_precalc_weights &&
+               this->flow_bias == bias;
+    }
+    float* getInflowCoefficients() { return this->flow_in; }
+    /**
+     * @brief Get the coefficients of the flow out of each cell, by direction.
+     */
+    float* const* getOutflowCoefficients() { return this->flow_out; }
+    /**
+     * @brief Get the types of the neighbours of each floor cell, packed in a
+     * byte, computed with the flow coefficients.
+     *
+     * The type of the neighbour in direction dir is (links >> 2 * dir) & 3.
+     * Every other cell reads 0, like a floor cell walled in on all sides, so
+     * that the transition function reads one byte per cell instead of five
+     * types, and skips every cell that reads 0 without looking at its type.
+     */
+    const uchar* getLinks() { return this->links; }
+    bool contains(uint row, uint col) {
+        return row < this->height && col < this->width;
+    }
+    size_t indexOf(uint row, uint col) {
+        return ((size_t)row + 1) * this->stride + (col + 1);
+    }
+    uint rowOf(size_t idx) { return idx / this->stride - 1; }
+    uint colOf(size_t idx) { return idx % this->stride - 1; }
+    /**
+     * @brief Get the offset from a cell to its neighbour.
+     */
+    ptrdiff_t offsetOf(Dir dir) {
+        switch (dir) {
+            case Dir::North:
+                return -(ptrdiff_t)this->stride;
+            case Dir::South:
+                return this->stride;
+            case Dir::West:
+                return -1;
+            case Dir::East:
+                return 1;
+        }
+        return 0;
+    }
+    /**
+     * @brief Find the index of the neighbour of a cell.
+     *
+     * Neighbours of cells on the edge of the board are border walls.
+     */
+    size_t neighbourOf(Dir dir, size_t idx) {
+        return idx + this->offsetOf(dir);
+    }
+};
@@ -0,0 +1,126 @@
+/**
+ * @file board_file.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "board.hpp"
+
+/* Binary layouts start with a BoardFileHeader, followed by:
+ *
+ *  - width * height cell bytes, row by row, using the same characters as the
+ *    text layouts ('/' for walls, '0'-'9' for floor heights, ':' for escapes);
+ *  - if BoardFile::Topology is set, width * height topology bytes holding the
+ *    number of neighbours smoke can flow in from (low nibble) and out to (high
+ *    nibble), from which the precalculated weights are rebuilt without
+ *    scanning the neighbourhood of every cell;
+ *  - emitter_count (row, col) pairs of uint32_t;
+ *  - if BoardFile::Rates is set, the float rate of each emitter, in the same
+ *    order, then a uint32_t count of escapes with a rate other than 1 and the
+ *    (row, col, rate) of each of them, as uint32_t, uint32_t and float.
+ *
+ * All fields are stored in host byte order. The topology depends on where the
+ * emitters are, so it is only valid together with the stored emitter list. */
+
+constexpr char board_file_magic[4] = {'S', 'M', 'K', 'B'};
+constexpr uint32_t board_file_version = 1;
+
+struct BoardFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+    uint32_t emitter_count;
+};
+
+namespace BoardFile {
+enum Flags : uint32_t { Topology = 1 << 0, Rates = 1 << 1 };
+}
+
+/**
+ * @brief Check whether a file is a binary layout rather than a text one.
+ */
+bool isBoardFile(const std::string& path);
+
+/**
+ * @brief Load a binary layout.
+ *
+ * Emitters are placed and the weights are ready, taken from the topology if
+ * the file carries it.
+ *
+ * @param has_weights If not null, set to whether the weights are ready, which
+ * they always are.
+ */
+Board* readBoardFile(const std::string& path, bool* has_weights = nullptr);
+
+/**
+ * @brief Save a board, its emitters and their rates, and optionally its
+ * topology.
+ *
+ * The weights of the board must be up to date if with_topology is set.
+ */
+void writeBoardFile(Board& board, const std::string& path,
+                    bool with_topology = true);
+
+/**
+ * @brief Directory that parsed text layouts are cached in, see
+ * loadCachedLayout().
+ *
+ * That is $SMOKEY_CACHE_DIR if set, and smokey under $XDG_CACHE_HOME or
+ * ~/.cache otherwise. Setting SMOKEY_CACHE_DIR to an empty string turns the
+ * cache off, in which case the directory is empty.
+ */
+std::string layoutCacheDir();
+
+/**
+ * @brief Load a text layout, without emitters, through the layout cache.
+ *
+ * The cache holds a binary layout with its topology for each text layout
+ * that was loaded, named after a hash of the contents of the text, so that
+ * loading the same text again, from any path, maps the binary layout instead
+ * of validating the text and counting the neighbours of every cell. The
+ * precalculated weights and the uniform ones are both rebuilt from the
+ * topology, so the same entry serves either weight mode. Entries are written
+ * to a temporary file and renamed, so concurrent loads never see half of one,
+ * and a cache that cannot be read or written is skipped.
+ */
+Board* loadCachedLayout(const std::string& path);
+
+/**
+ * @brief Check whether a layout comes with emitters of its own, as binary
+ * layouts, floorplan images and synthetic layouts do, rather than being a
+ * text layout.
+ */
+bool hasOwnEmitters(const std::string& path);
+
+/**
+ * @brief Load a board from a text or a binary layout, from a floorplan
+ * image, see image.hpp, or generate a synthetic one, see synthetic.hpp.
+ *
+ * Text layouts go through the layout cache, see loadCachedLayout().
+ *
+ * @param has_weights Set to whether the weights are already computed, for the
+ * emitters the layout comes with, which they always are: placing more calls
+ * for Board::computeWeightsAround().
+ */
+Board* loadBoard(const std::string& path, bool* has_weights);
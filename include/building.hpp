@@ -0,0 +1,105 @@
+/**
+ * @file building.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sim.hpp"
+#include "workers.hpp"
+
+/**
+ * @brief A stair or a shaft from a floor cell of one storey of a building to
+ * one of the storey above, see Building.
+ */
+struct Stairwell {
+    uint floor;
+    uint row, col;
+    uint upper_row, upper_col;
+};
+
+/**
+ * @brief A stack of storeys, each a simulation of its own board, that smoke
+ * moves between through stairwells.
+ *
+ * Each tick advances every storey by one tick of its own, the storeys
+ * concurrently, then moves smoke along each stairwell in the order they
+ * were given: up by rise_rate of the density of the lower cell, down by
+ * sink_rate of that of the upper one, each at most by the room left in the
+ * cell it goes to, like the flows of the transition function.
+ *
+ * Stairwells only link the storeys, which keep their own settings, tiles
+ * and kernels, rather than making one board of them, so that each storey
+ * runs at the speed of a board of its own.
+ *
+ * Building files hold one storey, stairwell or emitter per line, and '#'
+ * starts a comment:
+ *
+ *     floor PATH                  A storey above the previous ones, its
+ *                                 layout relative to the building file
+ *     stairs FLOOR ROW COL [UPPER_ROW UPPER_COL]
+ *                                 Link a floor cell of storey FLOOR to one
+ *                                 of the storey above, by default at the
+ *                                 same position
+ *     emitter FLOOR ROW COL [RATE]
+ *                                 Place an emitter on a storey
+ */
+class Building {
+   private:
+    std::vector<Sim*> floors;
+    std::vector<Stairwell> stairwells;
+    WorkerPool* workers = nullptr;
+    unsigned int ticks = 0;
+    void climb();
+
+   public:
+    /**
+     * Share of the smoke of the lower cell of a stairwell that rises to the
+     * upper one on each tick.
+     */
+    float rise_rate = .25f;
+    /**
+     * Share of the smoke of the upper cell of a stairwell that sinks to the
+     * lower one on each tick.
+     */
+    float sink_rate = .05f;
+    /**
+     * Storeys advanced at the same time, each by a worker of its own.
+     */
+    uint threads = 1;
+    /**
+     * @brief Load a building file, see Building, and the layouts of its
+     * storeys.
+     */
+    Building(const std::string& path);
+    ~Building();
+    Building(const Building&) = delete;
+    Building& operator=(const Building&) = delete;
+    uint getFloorCount() { return this->floors.size(); }
+    Sim& getFloor(uint floor) { return *this->floors[floor]; }
+    const std::vector<Stairwell>& getStairwells() { return this->stairwells; }
+    unsigned int getTicks() { return this->ticks; }
+    /**
+     * @brief Advance every storey by one tick, then move smoke through the
+     * stairwells.
+     */
+    void tick();
+};
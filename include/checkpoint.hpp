@@ -0,0 +1,94 @@
+/**
+ * @file checkpoint.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "sim.hpp"
+
+/* Checkpoints start with a CheckpointHeader, followed by rate_count float
+ * rates and wind_count winds, then by the arrays listed by
+ * Board::getStateArrays(), border included, exactly as they are held in
+ * memory, and by the arrival map and the doses when the Arrivals and Doses
+ * flags are set. The whole file is written and read with a single gathering
+ * system call, and is only valid for the host that wrote it. The flow
+ * coefficients and the activity of the tiles are rebuilt by the first tick
+ * after a restore, which continues exactly where the saved simulation left
+ * off. */
+
+constexpr char checkpoint_magic[4] = {'S', 'M', 'K', 'C'};
+constexpr uint32_t checkpoint_version = 5;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t storage;
+    uint32_t flags;
+    uint32_t ticks;
+    uint32_t rate_count;
+    float emitter_rate;
+    float escape_rate;
+    float elevation_bias;
+    float tolerance;
+    uint32_t wind_count;
+    float draft_noise;
+    float arrival_threshold;
+    uint64_t draft_seed;
+};
+
+namespace Checkpoint {
+enum Flags : uint32_t {
+    PrecalcWeights = 1 << 0,
+    Synchronous = 1 << 1,
+    Moore = 1 << 2,
+    RedBlack = 1 << 3,
+    Arrivals = 1 << 4,
+    Doses = 1 << 5
+};
+}
+
+/**
+ * @brief Check whether a file is a checkpoint.
+ */
+bool isCheckpoint(const std::string& path);
+
+/**
+ * @brief Save the state of a simulation: its board, densities, winds, tick
+ * count, rates, drafts, arrival map, doses, weight mode and update mode.
+ *
+ * Simulations with emitters on a growth curve are refused, as the curves
+ * and the tick each started on are not saved, and so are those with quiet
+ * tiles, whose state is rebuilt with the activity of the tiles. A backend
+ * is downloaded from first. The checkpoint is written next to the file and
+ * renamed over it, so an interrupted save leaves the last one intact.
+ */
+void writeCheckpoint(Sim& sim, const std::string& path);
+
+/**
+ * @brief Restore a simulation from a checkpoint.
+ *
+ * The settings that are not saved, like the number of threads or the
+ * kernel, are left to their defaults.
+ */
+Sim* readCheckpoint(const std::string& path);
@@ -0,0 +1,52 @@
+/**
+ * @file coarse.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "board.hpp"
+
+/**
+ * @brief Make a coarse copy of a board, each of its cells standing for a
+ * block of factor × factor cells of the board, for a fast preview of a large
+ * layout.
+ *
+ * A block with an emitter becomes an emitter, else one with an escape an
+ * escape, at the highest rate among them, else a floor if at least half of
+ * its cells are floors, so that corridors one cell wide stay open, at their
+ * mean height, and a wall otherwise. The weights are computed for the coarse
+ * cells, winds cover the blocks they blow over with the same strength, and
+ * each coarse floor takes the mean density of the floor cells of its block.
+ *
+ * Smoke spreads over as many coarse cells on each tick as over fine ones, so
+ * a coarse tick stands for about factor² ticks of the board, though winds
+ * drift smoke factor times less far than over that many ticks.
+ */
+Board* coarsenBoard(Board* board, uint factor);
+
+/**
+ * @brief Write the densities of a coarse board, see coarsenBoard(), onto the
+ * floor cells of the board it was made from, to warm-start it.
+ *
+ * Each floor cell takes the density of the coarse cell of its block, or the
+ * mean of the coarse floors next to it if the block became a wall. The
+ * densities of the emitters and escapes are kept.
+ */
+void prolongDensities(Board* coarse, Board* fine, uint factor);
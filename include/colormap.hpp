@@ -0,0 +1,146 @@
+/**
+ * @file colormap.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <climits>
+#include <cstdint>
+
+#include "sim.hpp"
+
+constexpr uint32_t palette[] = {0x5D432CFF, 0xEFEF80FF, 0xDFDF80FF, 0xCFCF80FF,
+                                0xBFBF80FF, 0xAFAF80FF, 0x9F9F80FF, 0x8F8F80FF,
+                                0x7F7F80FF, 0x6F6F80FF, 0x5F5F80FF, 0x0000FFFF};
+
+constexpr uint32_t wall_color = 0x4D5D53FF;     // Seal Gray
+constexpr uint32_t floor_color = 0xFFFFFFFF;    // White
+constexpr uint32_t escape_color = 0x0000FFFF;   // Blue
+constexpr uint32_t emitter_color = 0xFF0000FF;  // Red
+
+inline uint32_t packRGBA(uchar r, uchar g, uchar b) {
+    uint32_t rgba = 0x00;
+    rgba |= (r << 24);
+    rgba |= (g << 16);
+    rgba |= (b << 8);
+    rgba |= 0xFF;  // a
+    return rgba;
+}
+
+/**
+ * @brief Colour maps of the floor densities, from clear to dense.
+ */
+enum Palette { Grey, Smoke, Heat, PaletteCount };
+extern const char* const palette_names[PaletteCount];
+
+/**
+ * Levels the densities are quantised to, and the palettes indexed by.
+ */
+constexpr uint palette_levels = 256;
+/**
+ * Level of the floor cells smoke has not reached yet, see toArrivalLevels().
+ */
+constexpr uint8_t not_arrived_level = 255;
+
+/**
+ * @brief A part of the board to display: every step-th cell, in both
+ * directions, of the rows [row, row + rows) and the columns [col, col +
+ * cols).
+ */
+struct BoardView {
+    uint row = 0, col = 0;
+    uint rows = 0, cols = 0;
+    uint step = 1;
+    bool operator==(const BoardView& other) const {
+        return this->row == other.row && this->col == other.col &&
+               this->rows == other.rows && this->cols == other.cols &&
+               this->step == other.step;
+    }
+    bool operator!=(const BoardView& other) const { return !(*this == other); }
+    /**
+     * @brief Get the number of rows of cells displayed.
+     */
+    uint getHeight() const {
+        return (this->rows + this->step - 1) / this->step;
+    }
+    uint getWidth() const {
+        return (this->cols + this->step - 1) / this->step;
+    }
+};
+
+/**
+ * @brief Get the colours of a palette, one per level.
+ */
+void buildPalette(Palette palette, uint32_t colors[palette_levels]);
+
+/**
+ * @brief Get the colour the display gives a wall, emitter or escape, like
+ * the cellColour() shader does: the stronger the rate, the redder an
+ * emitter and the bluer an escape.
+ * @param rate The rate of the cell times the global rate of its kind.
+ */
+uint32_t getCellColor(Cell::Type type, float rate);
+
+/**
+ * @brief Quantise the densities of a simulation to the levels a palette is
+ * indexed by.
+ *
+ * This is only meant to be called when a frame is actually displayed, the
+ * simulation itself never touches the levels. The colours, those of walls,
+ * emitters and escapes included, are left to the display.
+ *
+ * @param sim The simulation to read from.
+ * @param levels A buffer of a level for each cell displayed, row by row.
+ * @param densities Halo-padded densities to display instead of the current
+ * ones, e.g. a snapshot taken from another thread.
+ * @param begin, end Only quantise the displayed rows in [begin, end), into
+ * the start of the levels.
+ */
+void toDensityLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                     const float* densities = nullptr, uint begin = 0,
+                     uint end = UINT_MAX);
+
+/**
+ * @brief Quantise when smoke first reached each floor cell instead of its
+ * density, see Sim::getArrivals().
+ *
+ * The earliest arrival so far on the whole board is level 0 and the latest
+ * level 254, cells the smoke has not reached are not_arrived_level.
+ *
+ * @param arrivals Halo-padded arrival map, e.g. a snapshot taken from
+ * another thread.
+ */
+void toArrivalLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                     const uint* arrivals);
+
+/**
+ * @brief Quantise the dose of each floor cell instead of its density, see
+ * Sim::getDoses().
+ *
+ * Doses are scaled to the fractional effective dose, a limit being level
+ * 255, so that the cells where occupants would no longer be able to escape
+ * are the densest colour of the palette.
+ *
+ * @param doses Halo-padded doses, e.g. a snapshot taken from another
+ * thread.
+ * @param limit Dose occupants can tolerate, in density ticks.
+ */
+void toDoseLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                  const double* doses, float limit, uint begin = 0,
+                  uint end = UINT_MAX);
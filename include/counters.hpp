@@ -0,0 +1,83 @@
+/**
+ * @file counters.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Hardware performance counters of the process, read through Linux
+ * perf events.
+ *
+ * Cycles, instructions, cache misses and branch misses are counted in user
+ * space for the calling thread and every thread it starts from then on, such
+ * as worker pools and simulation threads, only while started. Events the
+ * processor or the kernel do not offer read 0, see has(). Counters are only
+ * supported on Linux, where perf_event_paranoid must allow counting the
+ * process itself.
+ */
+class PerfCounters {
+   public:
+    enum Event { Cycles, Instructions, CacheMisses, BranchMisses, EventCount };
+
+   private:
+    int fds[EventCount];
+    unsigned int depth = 0;
+
+   public:
+    /**
+     * @brief Open the counters, stopped. Throws if none can be opened.
+     */
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    bool has(Event event) { return this->fds[event] >= 0; }
+    /**
+     * @brief Start counting, unless already started: starts and stops nest.
+     */
+    void start();
+    void stop();
+    /**
+     * @brief Read the count of an event since the counters were opened,
+     * scaled up to the time it was started for when the processor had to
+     * share its counters between events.
+     */
+    uint64_t read(Event event);
+};
+
+/**
+ * @brief Counts the hardware events of a scope, unless the counters are null.
+ */
+class CounterScope {
+   private:
+    PerfCounters* counters;
+
+   public:
+    CounterScope(PerfCounters* counters) {
+        this->counters = counters;
+        if (this->counters != nullptr) this->counters->start();
+    }
+    ~CounterScope() {
+        if (this->counters != nullptr) this->counters->stop();
+    }
+    CounterScope(const CounterScope&) = delete;
+    CounterScope& operator=(const CounterScope&) = delete;
+};
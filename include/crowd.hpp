@@ -0,0 +1,193 @@
+/**
+ * @file crowd.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "sim.hpp"
+#include "workers.hpp"
+
+/**
+ * @brief An occupant of the board, standing on a floor cell, see Crowd.
+ */
+struct Occupant {
+    enum Status { Moving, Evacuated, Incapacitated };
+    uint row, col;
+    Status status = Moving;
+    // Share of a step walked towards the next cell
+    float progress = 0.f;
+    // Densities of the cells stood on, added up after each tick
+    double dose = 0.;
+    // Tick count after the tick the occupant escaped or was overcome on
+    unsigned int end_tick = 0;
+};
+
+/**
+ * @brief A set of cell indices, each holding the lowest value inserted with
+ * it, that many threads can insert into at once.
+ *
+ * Open addressing with linear probing, sized for a number of keys when it
+ * is cleared, so that it takes memory for the occupants rather than for
+ * every cell of the board.
+ */
+class CellHash {
+   private:
+    static constexpr size_t empty = SIZE_MAX;
+    std::vector<std::atomic<size_t>> keys;
+    std::vector<std::atomic<uint>> values;
+    size_t mask = 0;
+    size_t slotOf(size_t key) const {
+        return (key * 0x9E3779B97F4A7C15ull >> 16) & this->mask;
+    }
+
+   public:
+    static constexpr uint none = UINT_MAX;
+    /**
+     * @brief Empty the set, making room for count keys, from one thread.
+     */
+    void clear(size_t count);
+    size_t getCapacity() const { return this->keys.size(); }
+    /**
+     * @brief Insert a key, or lower the value it holds to the one given.
+     */
+    void insert(size_t key, uint value);
+    /**
+     * @brief Get the value of a key, or none if it was not inserted.
+     */
+    uint find(size_t key) const;
+};
+
+/**
+ * @brief Occupants evacuating a simulation, each walking towards the
+ * nearest escape and breathing the smoke of the cells it crosses.
+ *
+ * The distance of each floor cell to the nearest escape, in steps between
+ * neighbours, is found once by a breadth-first search from every escape,
+ * and kept up to date when doors open or close by searching again only
+ * from the cells whose distance changes, see updateCell(). Each tick, an
+ * occupant walks speed cells towards its nearest escape, stepping to the
+ * neighbour closest to an escape among those nearer than its own cell and
+ * not taken by someone else, and adds the density of the cell it ends up
+ * on to its dose. Occupants whose dose reaches dose_limit stop where they
+ * are, and those that step onto an escape leave the board.
+ *
+ * Every occupant moves at the same time, in parallel: cells hold one
+ * occupant each, and who stands where is kept in a CellHash, which
+ * occupants claim the cells they step to in. The lowest numbered occupant
+ * claiming a cell gets it, and cells are only free once left on the tick
+ * before, so that the moves do not depend on the number of threads. The
+ * crowd does not own the simulation, which it only reads.
+ */
+class Crowd {
+   private:
+    Sim* sim;
+    std::vector<uint> distances;
+    std::vector<Occupant> occupants;
+    // Cell each occupant steps to, or its own if it stays
+    std::vector<size_t> targets;
+    CellHash occupied, claims;
+    WorkerPool* workers = nullptr;
+    uint pool_threads = 0;
+    uint evacuated = 0, incapacitated = 0;
+    bool isWalkable(size_t idx);
+    void computeDistances();
+    void relax(std::vector<size_t>& queue);
+    void fillOccupied(uint threads);
+    template <typename Job>
+    void forEachOccupant(uint threads, const Job& job);
+
+   public:
+    /**
+     * Distance of the cells no escape can be reached from.
+     */
+    static constexpr uint unreachable = UINT_MAX;
+    /**
+     * Cells walked per tick, up to one.
+     */
+    float speed = 1.f;
+    /**
+     * Dose that overcomes an occupant, in density ticks, or 0 if none does,
+     * see Sim::getDoses().
+     */
+    float dose_limit = 0.f;
+    /**
+     * Threads the occupants are moved by.
+     */
+    uint threads = 1;
+    /**
+     * @brief Evacuate the board of a simulation, finding the distance of
+     * each cell to the nearest escape.
+     */
+    Crowd(Sim* sim);
+    ~Crowd();
+    Crowd(const Crowd&) = delete;
+    Crowd& operator=(const Crowd&) = delete;
+    /**
+     * @brief Place an occupant on a free floor cell.
+     * @return The number of the occupant, in the order they were placed.
+     */
+    uint add(uint row, uint col);
+    /**
+     * @brief Place occupants on free floor cells drawn at random, among those
+     * an escape can be reached from.
+     */
+    void scatter(uint count, uint64_t seed);
+    /**
+     * @brief Bring the distances up to date after a cell of the board changed
+     * type, see Sim::setCellType().
+     *
+     * Opening a cell only searches from it, through the cells it brings
+     * nearer to an escape. Closing one first finds the cells whose every
+     * shortest path went through it, then searches again from their
+     * neighbours, so either costs about the cells whose distance changes.
+     */
+    void updateCell(uint row, uint col);
+    /**
+     * @brief Change the type of a cell of the simulation, and the distances
+     * with it.
+     */
+    void setCellType(uint row, uint col, Cell::Type type);
+    /**
+     * @brief Move every occupant by one tick, and dose it with the densities
+     * the simulation is at.
+     */
+    void move();
+    /**
+     * @brief Advance the simulation by one tick, then move the occupants.
+     */
+    void tick();
+    Sim* getSim() { return this->sim; }
+    /**
+     * @brief Get the distance of each cell to the nearest escape, by cell
+     * index, or unreachable.
+     */
+    const uint* getDistances() { return this->distances.data(); }
+    uint getDistance(uint row, uint col) {
+        return this->distances[this->sim->board->indexOf(row, col)];
+    }
+    const std::vector<Occupant>& getOccupants() { return this->occupants; }
+    uint getSize() { return this->occupants.size(); }
+    uint getEvacuated() { return this->evacuated; }
+    uint getIncapacitated() { return this->incapacitated; }
+};
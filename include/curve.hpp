@@ -0,0 +1,82 @@
+/**
+ * @file curve.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * @brief How the rate of an emitter grows after it ignites, such as the
+ * t-squared growth of a fire, as a share of its full rate on each tick.
+ *
+ * The curve is sampled once into a table of one share per tick, up to the
+ * last tick it changes on, so that reading it on a tick is one array read
+ * whatever its shape. Curves are given as:
+ *
+ *     t2:GROWTH                   (t / GROWTH)^2, reaching the full rate
+ *                                 after GROWTH ticks
+ *     ramp:BEGIN:END              Growing linearly from 0 at tick BEGIN to
+ *                                 the full rate at tick END
+ *     step:TICK                   Off until tick TICK, then at the full rate
+ *     PATH                        A CSV file of TICK,SHARE lines, in order
+ *                                 of tick, interpolated linearly in between
+ *                                 and held before the first and after the
+ *                                 last, '#' starting a comment
+ *
+ * Ticks count from when the curve is set on the emitter.
+ */
+class GrowthCurve {
+   private:
+    std::vector<float> table;
+    GrowthCurve() = default;
+
+   public:
+    /**
+     * @brief Sample a curve spec, see GrowthCurve, reading the file it names
+     * if it is not one of the shapes.
+     */
+    static GrowthCurve parse(const std::string& spec);
+    /**
+     * @brief Check whether a curve spec is one of the shapes, rather than a
+     * file.
+     */
+    static bool isShape(const std::string& spec);
+    /**
+     * @brief Sample a curve through points (tick, share), in order of tick,
+     * interpolated linearly in between.
+     */
+    static GrowthCurve fromPoints(
+        const std::vector<std::pair<unsigned long, float>>& points);
+    /**
+     * @brief Get the share of the full rate a number of ticks after the
+     * curve was set.
+     */
+    float at(unsigned long tick) const {
+        return this->table[std::min<unsigned long>(tick,
+                                                   this->table.size() - 1)];
+    }
+    /**
+     * @brief Get the number of ticks sampled, after which the share stays
+     * the same.
+     */
+    size_t getLength() const { return this->table.size(); }
+};
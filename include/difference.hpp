@@ -0,0 +1,86 @@
+/**
+ * @file difference.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief Norms of the difference between the densities of a board and those
+ * of a reference, over the floor cells of the board.
+ */
+struct DifferenceNorms {
+    // Sum of the absolute differences
+    double l1 = 0.;
+    // Square root of the sum of the squared differences
+    double l2 = 0.;
+    // Largest absolute difference
+    double linf = 0.;
+    // Sum of the differences: the smoke the board holds beyond the reference
+    double mass = 0.;
+    size_t cells = 0;
+};
+
+/**
+ * @brief Compares the densities of a board with those of a reference board
+ * of the same size, e.g. two runs on a layout with and without a vent.
+ *
+ * The norms are kept row by row, so that comparing again only goes over the
+ * rows either board changed since, see Board::markRows(), and adds the rows
+ * up, which keeps up with a run on a large board whose smoke only covers a
+ * part of it.
+ */
+class DensityDifference {
+   private:
+    struct Row {
+        double l1 = 0.;
+        double l2 = 0.;
+        double mass = 0.;
+        float linf = 0.f;
+        uint cells = 0;
+    };
+    std::vector<Row> rows;
+    // Boards last compared, and their generations, or 0 for anything else
+    Board* board = nullptr;
+    Board* reference = nullptr;
+    unsigned long generation = 0;
+    unsigned long reference_generation = 0;
+    DifferenceNorms norms;
+    void compareRows(const float* densities, uint begin, uint end);
+
+   public:
+    /**
+     * @brief Compare every row again on the next call, e.g. after a board
+     * was replaced by another at the same address.
+     */
+    void reset() { this->board = this->reference = nullptr; }
+    /**
+     * @brief Compare the densities of a board with those of a reference.
+     * @param densities Halo-padded densities to compare instead of the
+     * current ones, e.g. a snapshot taken from another thread, which
+     * compares every row again.
+     * @return The norms of the board minus the reference.
+     */
+    const DifferenceNorms& compare(Board* board, Board* reference,
+                                   const float* densities = nullptr);
+    const DifferenceNorms& getNorms() { return this->norms; }
+};
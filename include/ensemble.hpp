@@ -0,0 +1,125 @@
+/**
+ * @file ensemble.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief Many runs of one layout that only differ in where their emitter is,
+ * or where an escape is, advanced together by synchronous ticks.
+ *
+ * The densities of the members are interleaved by cell, so that one sweep
+ * over the cell types and flow coefficients of the layout, which the members
+ * share, advances all of them with the members in the lanes of each vector.
+ * The few cells whose update depends on the cell of a member are then
+ * updated again, for that member alone, from a copy of its own coefficients
+ * around that cell. Every member ends up with the densities of a
+ * synchronous Sim of the layout with its cell changed, rounded like the
+ * vectorised kernel rounds them. Activity is not tracked: every tick updates
+ * the whole board.
+ */
+class Ensemble {
+   private:
+    /* The cell types, rates and flow coefficients of a member in the window
+     * of cells around its cell, row by row, see patch_size. */
+    struct Patch {
+        uint row, col;
+        std::vector<Cell::Type> type;
+        std::vector<uchar> rate_index;
+        std::vector<float> flow_in;
+        std::vector<float> flow_out[4];
+        std::vector<float> rates;
+    };
+    Board* layout;
+    std::vector<std::pair<uint, uint>> emitters;
+    // What the cell of each member is turned into
+    Cell::Type member_type;
+    // Members rounded up to whole vectors, the extra lanes have no emitter
+    uint lanes;
+    std::vector<float> density, density_next;
+    std::vector<Patch> patches;
+    bool prepared = false;
+    bool prepared_precalc = false;
+    float prepared_bias = 0.f;
+    unsigned int ticks = 0;
+    std::vector<float> max_change;
+    void prepare();
+    void updateShared();
+    void updatePatch(uint member);
+    void measureChange();
+
+   public:
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    float elevation_bias = 0.f;
+    /**
+     * Whether to measure the largest change of each member's densities over
+     * a tick, see getMaxChange().
+     */
+    bool measure_change = false;
+    /**
+     * @brief Run an emitter at each of the given cells of a layout, which must
+     * have its weights computed and is left as it is.
+     *
+     * The emitters are placed on top of those already on the layout, which
+     * every member shares.
+     * @param type Cell::Emitter, or Cell::Escape to open an escape at each of
+     * the cells instead, on a floor or a wall, with the rate of 1.
+     */
+    Ensemble(Board* layout, const std::vector<std::pair<uint, uint>>& emitters,
+             Cell::Type type = Cell::Emitter);
+    ~Ensemble() { delete this->layout; }
+    Ensemble(const Ensemble&) = delete;
+    Ensemble& operator=(const Ensemble&) = delete;
+    uint getSize() { return this->emitters.size(); }
+    unsigned int getTicks() { return this->ticks; }
+    /**
+     * @brief Advance every member by one synchronous tick.
+     */
+    void tick();
+    /**
+     * @brief Get the layout every member runs on.
+     */
+    Board* getLayout() { return this->layout; }
+    /**
+     * @brief Get the number of densities stored for each cell, the members
+     * rounded up to whole vectors.
+     */
+    uint getLanes() { return this->lanes; }
+    /**
+     * @brief Get the densities of every member, those of a cell next to each
+     * other, see getLanes(), and the cells padded like those of the layout.
+     */
+    const float* getDensities() { return this->density.data(); }
+    float getDensity(uint member, uint row, uint col) {
+        return this->density[this->layout->indexOf(row, col) * this->lanes +
+                             member];
+    }
+    /**
+     * @brief Get the largest change of a member's densities over the last
+     * tick, if measure_change was set for it.
+     */
+    float getMaxChange(uint member) { return this->max_change[member]; }
+};
@@ -0,0 +1,101 @@
+/**
+ * @file footprint.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Bytes taken by the parts of a run, such as the cell arrays of its
+ * board, the buffers of its recorder or its textures, each part added up
+ * from the arrays of its name.
+ *
+ * Arrays that boards share copy-on-write are split between them, so that
+ * the footprints of the simulations of a process add up to what they hold
+ * together.
+ */
+class Footprint {
+   public:
+    struct Part {
+        std::string name;
+        size_t bytes;
+    };
+
+   private:
+    std::vector<Part> parts;
+
+   public:
+    /**
+     * @brief Add bytes to a part, which is listed after the others the first
+     * time it is added to.
+     */
+    void add(const std::string& name, size_t bytes);
+    /**
+     * @brief Add every part of another footprint.
+     */
+    void add(const Footprint& other);
+    const std::vector<Part>& getParts() const { return this->parts; }
+    /**
+     * @brief Get the bytes of a part, or 0 if it was never added to.
+     */
+    size_t get(const std::string& name) const;
+    size_t getTotal() const;
+};
+
+/**
+ * @brief Bytes shared by the runs of a process, which each reserve what they
+ * are planned to take before they start and release it when done, so that
+ * runs are turned down rather than killed when memory runs out.
+ */
+class MemoryBudget {
+   private:
+    std::mutex mutex;
+    size_t limit;
+    size_t used = 0;
+
+   public:
+    MemoryBudget(size_t limit) { this->limit = limit; }
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+    size_t getLimit() { return this->limit; }
+    /**
+     * @brief Get the bytes no run has reserved yet.
+     */
+    size_t getAvailable();
+    /**
+     * @brief Reserve bytes if that many are available.
+     * @return Whether they were.
+     */
+    bool reserve(size_t bytes);
+    void release(size_t bytes);
+};
+
+/**
+ * @brief Parse a count of bytes, with an optional K, M or G suffix for
+ * powers of 1024, throwing if it is not one.
+ */
+size_t parseBytes(const std::string& text);
+/**
+ * @brief Format a count of bytes for people, in B, KiB, MiB or GiB.
+ */
+std::string formatBytes(size_t bytes);
@@ -0,0 +1,56 @@
+/**
+ * @file gl_util.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/gl.h>
+
+#include <string>
+
+#include "colormap.hpp"
+
+/**
+ * A vertex shader drawing a single triangle that covers the viewport, from
+ * gl_VertexID alone.
+ */
+extern const char* const fullscreen_vertex_shader;
+/**
+ * Start of the fragment shaders that colour cells: the GLSL version and
+ * cellColour(type, rate, level), which draws walls, emitters and escapes
+ * with the same colours as the CPU and floors with the palette bound to the
+ * "palette" sampler.
+ */
+extern const char* const cell_colour_shader;
+
+GLuint compileShader(GLenum type, const char* source);
+/**
+ * @brief Link a fragment shader with fullscreen_vertex_shader.
+ *
+ * The "density", "cells" and "palette" samplers are bound to texture units
+ * 0, 1 and 2, in the shaders that have them.
+ */
+GLuint linkProgram(const std::string& fragment_source);
+GLuint createTexture(GLint format, GLsizei width, GLsizei height,
+                     GLenum data_format, GLenum data_type, const void* data);
+GLuint createFramebuffer(GLuint texture);
+/**
+ * @brief Create the palette_levels x 1 texture of a palette.
+ */
+GLuint createPaletteTexture(Palette palette);
@@ -0,0 +1,73 @@
+/**
+ * @file gpu_backend.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/gl.h>
+
+#include "colormap.hpp"
+#include "sim.hpp"
+
+/**
+ * @brief Transition function running as a fragment shader.
+ *
+ * Densities live in a pair of single-channel float textures that are rendered
+ * into alternately (ping-pong), one synchronous tick per draw call. The cell
+ * types and weights are uploaded once. render() colour-maps the current
+ * densities into a texture on the GPU, so displaying a frame never needs a
+ * readback. Updates are always synchronous, whatever the update mode of the
+ * simulation. Requires an OpenGL 3.0 context to be current whenever any method
+ * is called.
+ */
+class GpuBackend : public Backend {
+   private:
+    uint width, height;
+    size_t stride, rows;
+    GLuint cells = 0;
+    GLuint densities[2] = {0, 0};
+    GLuint framebuffers[2] = {0, 0};
+    GLuint display = 0;
+    GLuint display_framebuffer = 0;
+    GLuint vertex_array = 0;
+    GLuint step_program = 0;
+    GLuint display_program = 0;
+    GLuint palette = 0;
+    Palette palette_shown = Palette::Grey;
+    uint current = 0;
+    void draw(GLuint framebuffer, GLsizei width, GLsizei height);
+    void release();
+
+   public:
+    /**
+     * @brief Upload the board of a simulation to the GPU.
+     */
+    GpuBackend(Sim& sim);
+    ~GpuBackend();
+    GpuBackend(const GpuBackend&) = delete;
+    GpuBackend& operator=(const GpuBackend&) = delete;
+    void tick(Sim& sim, float emitter_rate, float escape_rate,
+              bool use_precalc_weights) override;
+    void download(Sim& sim) override;
+    /**
+     * @brief Colour-map the current densities into the display texture.
+     */
+    void render(Sim& sim, Palette palette = Palette::Grey);
+    GLuint getTexture() { return this->display; }
+};
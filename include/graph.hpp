@@ -0,0 +1,130 @@
+/**
+ * @file graph.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief A simulation on cells of any shape and size, linked by a list of
+ * neighbours each, for floorplans that a grid would have to sample finely
+ * everywhere to resolve in a few places.
+ *
+ * Cells are floors, emitters or escapes, walls being left out, and the
+ * transition function is that of the grid, run over the neighbours of each
+ * cell instead of the four of a grid cell. The neighbours are kept in CSR
+ * form, the edges of cell c being edges[edge_begin[c]] to
+ * edges[edge_begin[c + 1]], with the outflow coefficient of each edge and
+ * that of its reverse next to it. Ticks are synchronous, and are
+ * deterministic whatever the order of the cells in memory, see reorder().
+ *
+ * Graph files hold one cell or edge per line, and '#' starts a comment:
+ *
+ *     cell X Y floor|emitter|escape [RATE]
+ *                                 A cell at (X, Y), numbered from 0 in the
+ *                                 order of the file, with RATE scaling the
+ *                                 global rate of an emitter or escape
+ *     edge A B [WEIGHT [BACK]]    Link cells A and B, the flow from A to B
+ *                                 weighed by WEIGHT and the flow back by
+ *                                 BACK, both 1 by default
+ *
+ * The weights of the edges a cell flows out through split its outflow
+ * between them, like floor heights and winds do on the grid, and
+ * positions only matter to reorder().
+ */
+class Graph {
+   private:
+    std::vector<Cell::Type> type;
+    std::vector<float> x, y;
+    std::vector<float> rate;
+    // Cell numbers in the file, and the position of each number
+    std::vector<uint> id, slot;
+    std::vector<float> density, density_next;
+    std::vector<float> flow_in;
+    std::vector<size_t> edge_begin;
+    struct Edge {
+        uint cell;
+        float weight;
+        float flow_out;
+        float flow_back;
+    };
+    std::vector<Edge> edges;
+    unsigned int ticks = 0;
+    void computeFlows(bool use_precalc_weights);
+    void linkBack();
+
+   public:
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    /**
+     * @brief Orders of the cells in memory, see reorder().
+     */
+    enum Order { File, Morton, Hilbert };
+    /**
+     * @brief Load a graph file, see Graph.
+     * @param use_precalc_weights Weigh the flows of each cell by its number
+     * of neighbours, like Board::computeWeights(), rather than all by one
+     * over the most neighbours any cell has, at most 1/4 like on the grid.
+     */
+    Graph(const std::string& path, bool use_precalc_weights);
+    /**
+     * @brief Make the graph of a board in float storage, its cells numbered
+     * row by row, with the flow coefficients of the board, winds and floor
+     * heights included, and its densities.
+     *
+     * A synchronous Sim of the board and the graph then update every cell
+     * alike.
+     */
+    Graph(Board* board, bool use_precalc_weights, float elevation_bias);
+    /**
+     * @brief Write the graph in the format of graph files, its cells in the
+     * order they were numbered in. Edges are weighed by their outflow
+     * coefficients, which loads back the same flows, though the densities
+     * can round differently, as cells can list their neighbours in another
+     * order.
+     */
+    void save(const std::string& path);
+    /**
+     * @brief Lay the cells out in memory along a space-filling curve through
+     * their positions, so that neighbours are stored close to each other,
+     * or back in the order of the file.
+     *
+     * Cells keep their numbers, and each keeps its neighbours in the same
+     * order, so the densities do not depend on the order.
+     */
+    void reorder(Order order);
+    /**
+     * @brief Advance the graph by one synchronous tick.
+     */
+    void tick();
+    uint getSize() { return this->type.size(); }
+    size_t getEdgeCount() { return this->edges.size() / 2; }
+    unsigned int getTicks() { return this->ticks; }
+    float getX(uint cell) { return this->x[this->slot[cell]]; }
+    float getY(uint cell) { return this->y[this->slot[cell]]; }
+    float getDensity(uint cell) { return this->density[this->slot[cell]]; }
+    /**
+     * @brief Add up the densities of the floor cells.
+     */
+    double getMass();
+};
@@ -0,0 +1,59 @@
+/**
+ * @file image.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "board.hpp"
+
+/* Floorplan images are colour-coded, each pixel becoming a cell:
+ *
+ *  - transparent pixels (alpha below one half) and pixels darker than
+ *    image_wall_grey are walls;
+ *  - pure red pixels (red above 191, green and blue below 64) are emitters
+ *    on the ground floor;
+ *  - pure green pixels (green above 191, red and blue below 64) are escapes;
+ *  - any other pixel is floor, its height given by its grey level, white
+ *    being the ground floor and the darkest grey above the walls height 9.
+ *
+ * PNG images of any colour type and bit depth are supported when built with
+ * libpng, as are binary PGM and PPM images (P5 and P6) up to 8 bits per
+ * channel. */
+
+constexpr unsigned char image_wall_grey = 32;
+
+/**
+ * @brief Check whether a file is a floorplan image rather than a layout.
+ */
+bool isImageFile(const std::string& path);
+
+/**
+ * @brief Load a floorplan image, see image.hpp, with its emitters placed and
+ * the weights ready.
+ *
+ * Rows are classified in bands, one per thread, straight from a mapping of
+ * PGM and PPM images. PNG images are inflated by the calling thread, as
+ * each row is filtered against the one before, and classified in bands
+ * once decoded.
+ *
+ * @param threads Threads classifying rows, or 0 for one per core.
+ */
+Board* loadImage(const std::string& path, uint threads = 0);
@@ -0,0 +1,77 @@
+/**
+ * @file job_server.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Runs jobs submitted over TCP on a fixed set of threads, for a
+ * daemon that keeps its state warm between jobs.
+ *
+ * A connection submits one job, either as a single line of text or as the
+ * body of an HTTP POST request, such as curl -d sends. The job waits in a
+ * queue until one of the job threads is free, which runs the handler on the
+ * request and replies with what it returns, as a line or as the body of an
+ * HTTP response, then closes the connection. If the handler throws, the
+ * reply is a JSON object holding the error message, with HTTP status 400.
+ * Handlers run concurrently, one per job thread.
+ */
+class JobServer {
+   public:
+    using Handler = std::function<std::string(const std::string& request)>;
+
+   private:
+    int listener = -1;
+    Handler handler;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<int> queue;
+    bool quit = false;
+    void loop();
+    void answer(int fd);
+
+   public:
+    /**
+     * @brief Listen for jobs on a TCP port.
+     * @param address IPv4 address to listen on, such as 127.0.0.1 for this
+     * machine only or 0.0.0.0 for every interface.
+     * @param jobs Jobs run at the same time.
+     */
+    JobServer(const std::string& address, uint port, uint jobs,
+              Handler handler);
+    /**
+     * @brief Finish the jobs being run, drop the queued ones and stop.
+     */
+    ~JobServer();
+    JobServer(const JobServer&) = delete;
+    JobServer& operator=(const JobServer&) = delete;
+    /**
+     * @brief Accept jobs on the calling thread, until accepting fails.
+     */
+    void serve();
+};
@@ -0,0 +1,262 @@
+/**
+ * @file kernel.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "board.hpp"
+
+/**
+ * @brief Everything the transition function reads during one tick.
+ */
+struct KernelArgs {
+    const Cell::Type* type;
+    // Types of the neighbours of each floor cell, see Board::getLinks()
+    const uchar* links;
+    /* Coefficients of the flow into each cell and out of it in each
+     * direction, see Board::computeFlowCoefficients(). */
+    const float* flow_in;
+    const float* const* flow_out;
+    const float* src;
+    float* dst;
+    /* Densities in fixed or double storage, read instead of src and dst when
+     * not null. */
+    const Fixed16* src_fixed;
+    Fixed16* dst_fixed;
+    const double* src_double;
+    double* dst_double;
+    /* Rates of the emitters and escapes, see Board::getRates(), or null if
+     * they are all 1. */
+    const uchar* rate_index;
+    const float* rates;
+    size_t stride;
+    float emitter_rate;
+    float escape_rate;
+    // Whether every flow coefficient is 1/4, so kernels need not read them
+    bool uniform_flow;
+};
+
+/**
+ * @brief Get the densities a kernel specialised for their storage reads.
+ */
+template <typename T>
+const T* sourceOf(const KernelArgs& args);
+template <>
+inline const float* sourceOf<float>(const KernelArgs& args) {
+    return args.src;
+}
+template <>
+inline const Fixed16* sourceOf<Fixed16>(const KernelArgs& args) {
+    return args.src_fixed;
+}
+template <>
+inline const double* sourceOf<double>(const KernelArgs& args) {
+    return args.src_double;
+}
+
+/**
+ * @brief Get the densities a kernel specialised for their storage writes.
+ */
+template <typename T>
+T* targetOf(const KernelArgs& args);
+template <>
+inline float* targetOf<float>(const KernelArgs& args) {
+    return args.dst;
+}
+template <>
+inline Fixed16* targetOf<Fixed16>(const KernelArgs& args) {
+    return args.dst_fixed;
+}
+template <>
+inline double* targetOf<double>(const KernelArgs& args) {
+    return args.dst_double;
+}
+
+/**
+ * @brief Get the type of the neighbour in a direction from the links of a
+ * cell.
+ */
+inline Cell::Type linkOf(uchar links, int dir) {
+    return (Cell::Type)((links >> (2 * dir)) & 3);
+}
+
+/**
+ * @brief Find the first cell in [cur, end) with any link, skipping the
+ * interiors of walls eight cells at a time.
+ */
+inline size_t skipUnlinked(const uchar* links, size_t cur, size_t end) {
+    uint64_t word = 0;
+    while (cur + 8 <= end) {
+        std::memcpy(&word, links + cur, sizeof(word));
+        if (word != 0) break;
+        cur += 8;
+    }
+    while (cur < end && links[cur] == 0) cur++;
+    return cur;
+}
+
+inline void storeDensity(float* density, float value) { *density = value; }
+inline void storeDensity(Fixed16* density, float value) {
+    *density = encodeDensity(value);
+}
+inline void storeDensity(double* density, double value) { *density = value; }
+
+/**
+ * @brief Check whether a vectorised kernel is available on this CPU.
+ */
+bool hasSimdKernel();
+
+/**
+ * @brief Run the synchronous transition function on a span of cells.
+ *
+ * Processes the cells at indices [begin, end) in whole vectors, without
+ * branching on the cell types, and leaves any remainder to the caller. The span
+ * must lie within a row of the board, and src must not alias dst. Spans that
+ * do not border any emitter or escape run a faster kernel. Densities in fixed
+ * storage are decoded into floats and rounded back when stored, those in
+ * double storage are left to the scalar kernel.
+ *
+ * @param sources Whether any cell of the span borders an emitter or escape.
+ * @return The number of cells processed, always a multiple of the vector width
+ * and zero when no vectorised kernel is available.
+ */
+size_t updateSpanSimd(const KernelArgs& args, size_t begin, size_t end,
+                      bool sources);
+
+/**
+ * @brief Share of the outflow of a cell that goes to each side neighbour and
+ * to each corner neighbour under the Moore stencil, see Sim::Stencil.
+ */
+constexpr float moore_side = .2f;
+constexpr float moore_corner = .05f;
+
+/**
+ * @brief Run the synchronous transition function of the Moore stencil on a
+ * span of cells, like updateSpanSimd(), with uniform weights.
+ *
+ * @return The number of cells processed, a multiple of the vector width.
+ */
+size_t updateMooreSimd(const KernelArgs& args, size_t begin, size_t end,
+                       bool sources);
+
+/**
+ * @brief The coefficients the transition function reads around one floor
+ * cell, for kernels that advance several boards which share them.
+ */
+struct CellFlows {
+    float flow_in;
+    float flow_out[4];
+    // Those of each neighbour, in N/S/W/E order
+    Cell::Type adj_type[4];
+    float adj_flow_in[4];
+    float adj_flow_out[4];
+    /* The rate of each emitter or escape neighbour, already multiplied by
+     * the emitter or escape rate. */
+    float adj_rate[4];
+};
+
+/**
+ * @brief Read the coefficients around a floor cell of a board.
+ */
+inline void gatherFlows(const KernelArgs& args, size_t cur, CellFlows* flows) {
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    flows->flow_in = args.uniform_flow ? .25f : args.flow_in[cur];
+    for (int dir = 0; dir < 4; dir++) {
+        size_t adj = cur + offsets[dir];
+        Cell::Type type = linkOf(args.links[cur], dir);
+        flows->flow_out[dir] =
+            args.uniform_flow ? .25f : args.flow_out[dir][cur];
+        flows->adj_type[dir] = type;
+        flows->adj_flow_in[dir] = args.uniform_flow ? .25f : args.flow_in[adj];
+        flows->adj_flow_out[dir] =
+            args.uniform_flow ? .25f : args.flow_out[dir ^ 1][adj];
+        flows->adj_rate[dir] =
+            type == Cell::Emitter ? args.emitter_rate : args.escape_rate;
+        if (args.rates != nullptr)
+            flows->adj_rate[dir] *= args.rates[args.rate_index[adj]];
+    }
+}
+
+/**
+ * @brief Run the synchronous transition function on one floor cell of boards
+ * whose densities are interleaved, see Ensemble.
+ *
+ * Reads the densities of the cell on each board from density and those of
+ * its neighbours from adj_density, in N/S/W/E order, and writes the next ones
+ * to next. Rounds like updateSpanSimd().
+ *
+ * @param lanes Number of boards, a multiple of 4.
+ * @return Whether a vectorised kernel is available, nothing is written
+ * otherwise.
+ */
+bool updateLanesSimd(const CellFlows& flows, const float* density,
+                     const float* const* adj_density, float* next,
+                     size_t lanes);
+
+/**
+ * @brief Run the synchronous transition function on one floor cell of boards
+ * whose densities are interleaved, like updateLanesSimd(), without the
+ * vectorised kernel when it is not available.
+ */
+inline void updateLanes(const CellFlows& flows, const float* density,
+                        const float* const* adj_density, float* next,
+                        size_t lanes) {
+    if (updateLanesSimd(flows, density, adj_density, next, lanes)) return;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        float d = density[lane];
+        float intake = .0f, outtake = .0f;
+        for (int dir = 0; dir < 4; dir++) {
+            float a = adj_density[dir][lane];
+            if (flows.adj_type[dir] == Cell::Floor) {
+                outtake += std::min(flows.flow_out[dir] * d,
+                                    flows.adj_flow_in[dir] * (1 - a));
+                intake += std::min(flows.adj_flow_out[dir] * a,
+                                   flows.flow_in * (1 - d));
+            } else if (flows.adj_type[dir] == Cell::Emitter) {
+                intake += flows.adj_rate[dir] *
+                          std::min(flows.adj_flow_out[dir] * a,
+                                   flows.flow_in * (1 - d));
+            } else if (flows.adj_type[dir] == Cell::Escape) {
+                outtake += flows.adj_rate[dir] * flows.flow_out[dir] * d;
+            }
+        }
+        next[lane] = d + (intake - outtake);
+    }
+}
+
+/**
+ * @brief Run the synchronous transition function on the cells at indices
+ * [begin, end) of boards that share their cell types and coefficients, and
+ * whose densities are interleaved in src and dst, lanes to a cell.
+ *
+ * Rounds like updateSpanSimd(), and reads the coefficients of each cell once
+ * for all the boards.
+ *
+ * @param lanes Number of boards, a multiple of 4.
+ * @return Whether a vectorised kernel is available, nothing is written
+ * otherwise.
+ */
+bool updateCellsSimd(const KernelArgs& args, size_t lanes, size_t begin,
+                     size_t end);
@@ -0,0 +1,46 @@
+/**
+ * @file layout.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief A validated view of a layout file.
+ *
+ * The file is memory-mapped and never copied: row r starts at data + r * stride
+ * and is cols characters long, so rows keep their line terminators.
+ */
+struct Layout {
+    uint rows, cols;
+    size_t stride;
+    const char* data;
+    Layout(const std::string& path);
+    ~Layout();
+    Layout(const Layout&) = delete;
+    Layout& operator=(const Layout&) = delete;
+
+   private:
+    void* mapping;
+    size_t length;
+};
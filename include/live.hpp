@@ -0,0 +1,113 @@
+/**
+ * @file live.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sim.hpp"
+
+/* Live segments are POSIX shared memory objects holding a LiveHeader and,
+ * from densities_offset on, the width * height densities of the board, row
+ * by row, as floats, in host byte order. The sequence is odd while the
+ * densities and the tick are being written, and goes up by two each time
+ * they are published, so that readers check it before and after copying
+ * them and retry if it was odd or changed: the number of ticks published is
+ * sequence / 2. Writers never wait for readers. */
+
+constexpr char live_magic[8] = {'S', 'M', 'K', 'Y', 'L', 'I', 'V', 'E'};
+constexpr uint32_t live_version = 1;
+
+struct LiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t densities_offset;
+    std::atomic<uint64_t> sequence;
+    uint64_t tick;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Live segments need lock-free 64-bit atomics.");
+
+/**
+ * @brief Publishes the densities of a simulation to a shared memory
+ * segment, for viewers in other processes to read at their own rate, see
+ * LiveView.
+ *
+ * publish() copies the densities into the segment without waiting for
+ * readers, so it costs a copy of the board. The segment is removed when the
+ * export is destroyed.
+ */
+class LiveExport {
+   private:
+    std::string name;
+    LiveHeader* header;
+    float* densities;
+    size_t size;
+
+   public:
+    /**
+     * @brief Create a segment for a board, replacing any of the same name.
+     * @param name Name of the segment, starting with '/'.
+     */
+    LiveExport(const std::string& name, uint width, uint height);
+    ~LiveExport();
+    LiveExport(const LiveExport&) = delete;
+    LiveExport& operator=(const LiveExport&) = delete;
+    /**
+     * @brief Publish the current densities and tick count of a simulation.
+     */
+    void publish(Sim& sim);
+};
+
+/**
+ * @brief Reads the densities another process publishes with LiveExport.
+ */
+class LiveView {
+   private:
+    const LiveHeader* header;
+    const float* densities;
+    size_t size;
+    uint64_t last = 0;
+
+   public:
+    /**
+     * @brief Map an existing segment for reading.
+     */
+    LiveView(const std::string& name);
+    ~LiveView();
+    LiveView(const LiveView&) = delete;
+    LiveView& operator=(const LiveView&) = delete;
+    uint getWidth() { return this->header->width; }
+    uint getHeight() { return this->header->height; }
+    /**
+     * @brief Copy the latest densities published, unless they were read
+     * already.
+     * @param tick If not null, set to the tick they were published after.
+     * @return Whether newer densities were copied.
+     */
+    bool read(std::vector<float>* densities, uint64_t* tick = nullptr);
+};
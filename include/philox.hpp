@@ -0,0 +1,59 @@
+/**
+ * @file philox.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/**
+ * @brief The Philox4x32-10 counter-based generator of Salmon et al.
+ *
+ * Each counter is scrambled into four random words on its own, without any
+ * state, so the numbers a cell draws on a tick do not depend on which thread
+ * draws them, or in which order.
+ */
+namespace Philox {
+
+typedef std::array<uint32_t, 4> Counter;
+typedef std::array<uint32_t, 2> Key;
+
+/**
+ * @brief Scramble a counter under a key.
+ */
+inline Counter scramble(Counter counter, Key key) {
+    for (int round = 0; round < 10; round++) {
+        uint64_t lo = (uint64_t)0xD2511F53u * counter[0];
+        uint64_t hi = (uint64_t)0xCD9E8D57u * counter[2];
+        counter = {(uint32_t)(hi >> 32) ^ counter[1] ^ key[0], (uint32_t)hi,
+                   (uint32_t)(lo >> 32) ^ counter[3] ^ key[1], (uint32_t)lo};
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+    return counter;
+}
+
+/**
+ * @brief Map a random word to a float in [0, 1), keeping the 24 bits a float
+ * can hold.
+ */
+inline float toUnit(uint32_t word) { return (word >> 8) * 0x1p-24f; }
+
+}  // namespace Philox
@@ -0,0 +1,85 @@
+/**
+ * @file probe.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief A rectangle of the board, such as a room or a corridor, whose
+ * densities are sampled on every tick.
+ */
+struct Probe {
+    std::string name;
+    uint row, col;
+    uint rows, cols;
+};
+
+/**
+ * @brief The densities of the floor of a probe, when it was last sampled.
+ */
+struct ProbeSample {
+    double mean = 0.;
+    float max = 0.f;
+};
+
+/**
+ * @brief Samples the mean and the highest floor density of many probes.
+ *
+ * The floor cells of every probe are indexed once, as runs of consecutive
+ * cells of the same row, so that a sample only reads the cells of the probes
+ * and never checks their types. The densities are read in the storage of the
+ * board, without decoding the rest of it. The index has to be rebuilt when
+ * the cell types change, for instance by placing an emitter in a probe.
+ */
+class ProbeSet {
+   private:
+    struct Run {
+        size_t begin, end;
+    };
+    std::vector<Probe> probes;
+    // The runs of each probe start at its first run, and end at the next's
+    std::vector<Run> runs;
+    std::vector<size_t> first_run;
+    std::vector<size_t> floor_cells;
+    std::vector<ProbeSample> samples;
+    template <typename T>
+    void sample(const T* density);
+
+   public:
+    /**
+     * @brief Index the floor of each probe, which must lie within the board.
+     */
+    ProbeSet(Board& board, const std::vector<Probe>& probes);
+    /**
+     * @brief Sample every probe from the current densities of a board.
+     */
+    void sample(Board& board);
+    const std::vector<Probe>& getProbes() { return this->probes; }
+    /**
+     * @brief Get the last sample of each probe, in the order they were given.
+     *
+     * Probes without any floor always read 0.
+     */
+    const std::vector<ProbeSample>& getSamples() { return this->samples; }
+};
@@ -0,0 +1,201 @@
+/**
+ * @file recording.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sim.hpp"
+
+/* Recordings start with a RecordingHeader, followed by one chunk per frame:
+ * a RecordingChunk, then size bytes of zlib stream. A frame holds the width
+ * * height densities of the board, row by row, as floats. Unless the chunk
+ * is a key frame, the bit pattern of each density is stored as its
+ * difference from that of the previous frame, modulo 2^32: densities are
+ * never negative, so their bit patterns are ordered like them and a density
+ * that changed little leaves a small difference. The bytes of the frame are
+ * then split into planes, the most significant byte of every density first,
+ * so that the leading bytes line up for the compressor. All fields are
+ * stored in host byte order. */
+
+constexpr char recording_magic[4] = {'S', 'M', 'K', 'R'};
+constexpr uint32_t recording_version = 1;
+
+struct RecordingHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    // Ticks between frames
+    uint32_t every;
+};
+
+struct RecordingChunk {
+    uint32_t tick;
+    uint32_t flags;
+    uint32_t size;
+};
+
+namespace Recording {
+enum Flags : uint32_t { KeyFrame = 1 << 0 };
+}
+
+/**
+ * @brief Streams the densities of a simulation to a compressed recording.
+ *
+ * capture() only copies the densities: frames are encoded, compressed and
+ * written on a thread of the recorder, so that the simulation does not wait
+ * for the disk. It only waits when max_pending frames are already queued,
+ * which keeps the memory taken by the queue bounded if the disk cannot keep
+ * up.
+ */
+class Recorder {
+   private:
+    FILE* fp;
+    uint width, height;
+    uint every;
+    size_t max_pending;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable room;
+    struct Frame {
+        unsigned int tick;
+        std::vector<float> densities;
+    };
+    std::deque<Frame> pending;
+    std::vector<std::vector<float>> spare;
+    bool quit = false;
+    std::exception_ptr error;
+    unsigned long stalls = 0;
+    // Only touched by the recorder thread
+    std::vector<float> previous;
+    std::vector<unsigned char> planes;
+    std::vector<unsigned char> compressed;
+    unsigned long frames = 0;
+    void loop();
+    void write(Frame& frame);
+
+   public:
+    /**
+     * Frames between key frames, which do not depend on the previous one.
+     */
+    static constexpr unsigned long key_interval = 64;
+    /**
+     * @brief Create a recording of a board, truncating the file.
+     * @param every Ticks between frames.
+     */
+    Recorder(const std::string& path, uint width, uint height, uint every,
+             size_t max_pending = 8);
+    /**
+     * @brief Write every pending frame and close the file, ignoring errors.
+     */
+    ~Recorder();
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+    /**
+     * @brief Queue the densities of the simulation, if a frame is due at its
+     * tick.
+     *
+     * Rethrows the error of the recorder thread, if it failed.
+     */
+    void capture(Sim& sim);
+    /**
+     * @brief Write every pending frame and close the file.
+     */
+    void close();
+    /**
+     * @brief Get how many times capture() had to wait for the recorder
+     * thread.
+     */
+    unsigned long getStalls() { return this->stalls; }
+    /**
+     * @brief Add the most bytes a recorder of a board can take to a
+     * footprint, as "recorder buffers": the frames queued or spare and the
+     * buffers the frame being written is encoded and compressed in.
+     */
+    static void planFootprint(Footprint* footprint, uint width, uint height,
+                              size_t max_pending = 8);
+};
+
+/**
+ * @brief Reads the frames of a recording back, in order or at any tick.
+ *
+ * The file is mapped in memory and indexed when opened, by walking the
+ * headers of its chunks, so that seeking to a frame decodes the key frame
+ * before it and the frames in between, and nothing else. The last key frame
+ * decoded is kept, and so is the frame last returned, so that stepping
+ * forward decodes one frame and stepping backward at most key_interval - 1.
+ */
+class Playback {
+   private:
+    const unsigned char* data;
+    size_t size;
+    RecordingHeader header;
+    struct Entry {
+        unsigned int tick;
+        bool key;
+        uint32_t size;
+        // Of the zlib stream, from the start of the file
+        size_t offset;
+    };
+    std::vector<Entry> frames;
+    // The densities of the key frame and of the frame last decoded
+    std::vector<float> key, current;
+    long key_frame = -1, current_frame = -1;
+    std::vector<unsigned char> planes;
+    size_t cursor = 0;
+    void decode(size_t frame, std::vector<float>& densities);
+
+   public:
+    Playback(const std::string& path);
+    ~Playback();
+    Playback(const Playback&) = delete;
+    Playback& operator=(const Playback&) = delete;
+    uint getWidth() { return this->header.width; }
+    uint getHeight() { return this->header.height; }
+    uint getInterval() { return this->header.every; }
+    size_t getFrameCount() { return this->frames.size(); }
+    unsigned int getTick(size_t frame) { return this->frames[frame].tick; }
+    /**
+     * @brief Find the last frame recorded at or before a tick, or the first
+     * frame if there is none.
+     */
+    size_t findFrame(unsigned int tick);
+    /**
+     * @brief Decode a frame, which stays valid until the next call.
+     * @return The width * height densities, row by row.
+     */
+    const std::vector<float>& seek(size_t frame);
+    /**
+     * @brief Read the frame after the one last read, from the first.
+     * @param densities Set to the width * height densities, row by row.
+     * @return false at the end of the recording.
+     */
+    bool next(unsigned int* tick, std::vector<float>& densities);
+};
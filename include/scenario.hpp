@@ -0,0 +1,136 @@
+/**
+ * @file scenario.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <climits>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "board.hpp"
+#include "crowd.hpp"
+#include "curve.hpp"
+#include "sim.hpp"
+
+/**
+ * @brief A change a scenario makes to a simulation once it has run a number
+ * of ticks, see Scenario.
+ */
+struct ScenarioEvent {
+    enum Kind {
+        Emitter,
+        Escape,
+        EmitterRate,
+        EscapeRate,
+        Curve,
+        SetCell,
+        Checkpoint,
+        Stop
+    };
+    unsigned long tick;
+    Kind kind;
+    uint row = 0, col = 0;
+    float rate = 0.f;
+    Cell::Type type = Cell::Floor;
+    std::string path;
+    // Null to take the emitter off its curve
+    std::shared_ptr<const GrowthCurve> curve;
+};
+
+/**
+ * @brief A timeline of events replayed against a simulation between ticks.
+ *
+ * Scenario files hold one event per line, after the tick of the simulation
+ * it happens at, and '#' starts a comment:
+ *
+ *     TICK emitter ROW COL RATE   Set the rate of an emitter, 0 turning it
+ *                                 off, or place one on a floor cell
+ *     TICK escape ROW COL RATE    Set the rate of an escape, 0 closing it
+ *     TICK emitter-rate R         Set the global emission rate, in [0, 1]
+ *     TICK escape-rate R          Set the global escape rate, in [0, 1]
+ *     TICK curve ROW COL CURVE|none
+ *                                 Grow an emitter along a curve from then
+ *                                 on, see GrowthCurve, or put it back at
+ *                                 its full rate
+ *     TICK cell ROW COL wall|floor|escape
+ *                                 Turn a cell into a wall, a floor or an
+ *                                 escape, to close or open a door
+ *     TICK checkpoint PATH        Save the state of the simulation
+ *     TICK stop                   Stop the run
+ *
+ * Files, the checkpoints and the CSV files of curves, are relative to the
+ * scenario unless their path is absolute.
+ *
+ * The whole file is parsed up front and its events sorted by tick, those of
+ * the same tick staying in the order of the file, so that replaying them
+ * never parses anything, curves included: a runner advances the simulation
+ * up to the tick of the next event, in as few calls as it likes, then
+ * applies the events due.
+ * Events at tick T are applied once the simulation has run T ticks, before
+ * the next one, and ticks are those of the simulation, so a resumed run
+ * keeps the schedule.
+ */
+class Scenario {
+   private:
+    std::vector<ScenarioEvent> events;
+    size_t next = 0;
+
+   public:
+    /**
+     * @brief A scenario without any event.
+     */
+    Scenario() = default;
+    /**
+     * @brief Parse a scenario file.
+     * @param check_path If not null, called on the path of each file the
+     * scenario names, as it is written, to refuse it by throwing.
+     */
+    Scenario(const std::string& path,
+             std::function<void(const std::string&)> check_path = nullptr);
+    const std::vector<ScenarioEvent>& getEvents() { return this->events; }
+    /**
+     * @brief Get the tick of the next event, or ULONG_MAX once all of them
+     * have been applied.
+     */
+    unsigned long nextTick() {
+        return this->next < this->events.size() ? this->events[this->next].tick
+                                                : ULONG_MAX;
+    }
+    bool isDone() { return this->next == this->events.size(); }
+    /**
+     * @brief Skip the events before a tick, which a resumed simulation has
+     * already been through.
+     */
+    void seek(unsigned long tick);
+    /**
+     * @brief Apply the events due at the current tick of a simulation.
+     *
+     * @param cells_changed If not null, set to whether any cell changed
+     * type, which calls for rebuilding what indexes the cells, like a
+     * ProbeSet.
+     * @param crowd If not null, a crowd evacuating the simulation, whose
+     * distances are updated for every cell that changes type.
+     * @return false if one of them stops the run.
+     */
+    bool apply(Sim& sim, bool* cells_changed = nullptr,
+               Crowd* crowd = nullptr);
+};
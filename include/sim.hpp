@@ -20,307 +20,737 @@
 
 #pragma once
 
-#include <GL/gl.h>
-
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include "imgui.h"
+#include "board.hpp"
+#include "counters.hpp"
+#include "curve.hpp"
+#include "footprint.hpp"
+#include "kernel.hpp"
+#include "trace.hpp"
+#include "workers.hpp"
 
-typedef unsigned char uchar;
+class Sim;
 
-constexpr GLuint palette[] = {0x5D432CFF, 0xEFEF80FF, 0xDFDF80FF, 0xCFCF80FF,
-                              0xBFBF80FF, 0xAFAF80FF, 0x9F9F80FF, 0x8F8F80FF,
-                              0x7F7F80FF, 0x6F6F80FF, 0x5F5F80FF, 0x0000FFFF};
+/**
+ * @brief An alternative implementation of the transition function.
+ *
+ * A backend keeps its own copy of the densities while it is attached to a
+ * simulation: the board is only brought up to date by download().
+ */
+class Backend {
+   public:
+    virtual ~Backend() {}
+    /**
+     * @brief Advance the densities by one synchronous tick.
+     */
+    virtual void tick(Sim& sim, float emitter_rate, float escape_rate,
+                      bool use_precalc_weights) = 0;
+    /**
+     * @brief Copy the current densities back to the board.
+     */
+    virtual void download(Sim& sim) = 0;
+};
 
-constexpr GLuint wall_color = 0x4D5D53FF;     // Seal Gray
-constexpr GLuint floor_color = 0xFFFFFFFF;    // White
-constexpr GLuint escape_color = 0x0000FFFF;   // Blue
-constexpr GLuint emitter_color = 0xFF0000FF;  // Red
+/**
+ * @brief An observer that Sim::advance() only calls on every `every`th tick,
+ * see Sim::every().
+ */
+template <typename Observer>
+struct Every {
+    uint every;
+    Observer observer;
+};
 
-enum Dir { North, South, West, East };
-constexpr Dir directions[4] = {Dir::North, Dir::South, Dir::West, Dir::East};
+/**
+ * @brief A dab of a brush painting a disc of cells, see Sim::paint().
+ */
+struct BrushDab {
+    /**
+     * @brief What the dab paints: a cell type, numbered like Cell::Type, or
+     * smoke over the floor cells.
+     */
+    enum Paint : uchar { Wall, Floor, Emitter, Escape, Smoke };
+    uint row, col;
+    // Cells within about radius cells of the centre, just it by default
+    uint radius = 0;
+    Paint paint = Wall;
+    // The rate of emitters and escapes, or the density of smoke
+    float value = 1.f;
+};
+
+/**
+ * @brief The floor densities after a tick, sorted into bins of equal width
+ * over [0, 1], see Sim::histogram_bins.
+ */
+struct DensityHistogram {
+    std::vector<size_t> bins;
+    // Floor cells, and those holding more than Sim::occupied_density
+    size_t cells = 0, occupied = 0;
+    float max = 0.f;
+    double mean = 0.;
+};
 
 class Sim {
    private:
-    struct Cell {
-        enum Type { Wall, Floor, Emitter, Escape };
-        Cell::Type type = Type::Floor;
-        char cost = 0;
-        uint row = 0, col = 0;
-        float omega_in = 0.f, omega_out = 0.f;
-        float density = 0.f, outtake = 0.f, intake = 0.f;
-    };
-
-    class Board {
-       private:
-        uint width;
-        uint height;
-        GLuint* pixmap;
-        Cell* cells;
-
-       public:
-        Board(uint width, uint height, const char* const layout) {
-            this->width = width;
-            this->height = height;
-            this->pixmap = (GLuint*)malloc(width * height * sizeof(GLuint));
-            this->cells = (Cell*)malloc(width * height * sizeof(Cell));
-            for (uint row = 0; row < this->height; row++) {
-                for (uint col = 0; col < this->width; col++) {
-                    size_t idx = row * this->width + col;
-                    this->cells[idx].row = row;
-                    this->cells[idx].col = col;
-                    /* \0123456789:
-                     * Add -0x30 -> Obtain values in range [-1, 10], where 0-9
-                     * is floor height, -1 is a wall, and 10 is an opening. Add
-                     * 1 to obtain a valid palette index. */
-                    // printf("%c", layout[idx]);
-                    int cost = layout[idx] - 0x30;
-                    if (cost <= -1) {
-                        cost = -1;
-                        this->cells[idx].type = Cell::Type::Wall;
-                        this->pixmap[idx] = wall_color;
-                    } else if (cost >= 10) {
-                        cost = 10;
-                        this->cells[idx].type = Cell::Type::Escape;
-                        this->pixmap[idx] = escape_color;
-                    } else {
-                        this->cells[idx].type = Cell::Type::Floor;
-                        this->pixmap[idx] = floor_color;
-                    }
-                    this->cells[idx].cost = cost;
-                    this->cells[idx].density = 0;
-                    // this->pixmap[idx] = palette[cost + 1];
-                }
-                // printf("\n");
-            }
-        };
-        ~Board() {
-            free(this->pixmap);
-            free(this->cells);
-        }
-        uint getWidth() { return this->width; }
-        uint getHeight() { return this->height; }
-        void toTexture(GLuint* texture) {
-            GLuint temp;
-            glGenTextures(1, &temp);
-            glBindTexture(GL_TEXTURE_2D, temp);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->width, this->height,
-                         0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, this->pixmap);
-            if (temp == 0)
-                throw std::runtime_error("Failed to create texture.");
-            *texture = temp;
-        }
-        Cell* cellAt(uint row, uint col) {
-            if (row < 0 || row >= this->height || col < 0 ||
-                col >= this->width) {
-                return nullptr;
-            }
-            return &this->cells[row * this->width + col];
-        }
-        Cell* cellAt(Dir dir, uint row, uint col) {
-            switch (dir) {
-                case Dir::North:
-                    return this->cellAt(row - 1, col);
-                case Dir::South:
-                    return this->cellAt(row + 1, col);
-                case Dir::West:
-                    return this->cellAt(row, col - 1);
-                case Dir::East:
-                    return this->cellAt(row, col + 1);
-            }
-        }
-        void writePixel(uint row, uint col, GLubyte r, GLubyte g, GLubyte b) {
-            GLuint rgba = 0x00;
-            rgba |= (r << 24);
-            rgba |= (g << 16);
-            rgba |= (b << 8);
-            rgba |= 0xFF;  // a
-            this->pixmap[row * this->width + col] = rgba;
-        }
-        void writePixel(uint row, uint col, GLuint rgba) {
-            this->pixmap[row * this->width + col] = rgba;
-        }
-    };
     enum State { Stop, Run, Step };
     State state = Sim::State::Stop;
     unsigned int ticks = 0;
+    int frame_skip_counter = 0;
+    WorkerPool* workers = nullptr;
+    Backend* backend = nullptr;
+    /* Activity of each tile, see track_activity. A tile is active when it
+     * has to be updated in the next tick, live when it held smoke after the
+     * last one. Activity goes stale whenever a tick runs without tracking
+     * it, and is then rebuilt with every tile active. */
+    uint tile_rows = 0, tile_cols = 0;
+    std::vector<uchar> tile_active;
+    std::vector<uchar> tile_was_active;
+    std::vector<uchar> tile_live;
+    bool activity_stale = true;
+    bool activity_tracked = false;
+    bool activity_synchronous = false;
+    // Whether activity spread to the tiles on the corners of live ones
+    bool activity_diagonal = false;
+    void resetActivity();
+    void updateActivity(bool diagonal);
+    /* Whether each tile is quiet, see quiet_threshold, the largest change of
+     * each over the last tick, and the quiet tiles skipped on this one. */
+    std::vector<uchar> tile_quiet;
+    std::vector<float> tile_change;
+    std::vector<uchar> tile_skipped;
+    bool quiet_tracked = false;
+    size_t quiet_skips = 0;
+    template <typename T>
+    void flowIntoSkipped(const KernelArgs& args, uint row, size_t tile,
+                         size_t span_end);
+    /* Whether each tile borders an emitter or an escape, so that the others
+     * can skip the source terms of the transition function. */
+    std::vector<uchar> tile_sources;
+    void resetSources();
+    void markSources(uint row, uint col);
+    /* Runs of linked cells along each row, see Board::getLinks(), those of
+     * a row being runs[run_rows[row]] to runs[run_rows[row + 1]], so that
+     * synchronous ticks only visit the open cells of mostly walled boards.
+     * Runs are whole groups of cells, see run_group. The rest of the
+     * cells never change over a tick, as long as both buffers agree on them,
+     * which is restored on rows [unsynced_begin, unsynced_end) after the
+     * densities are written between ticks. */
+    struct LinkRun {
+        size_t begin, end;
+    };
+    std::vector<LinkRun> runs;
+    std::vector<size_t> run_rows;
+    bool runs_stale = true;
+    uint unsynced_begin = 0, unsynced_end = UINT_MAX;
+    void findRuns(uint row, std::vector<LinkRun>* runs);
+    void resetRuns();
+    void resetRuns(uint row);
+    void unsync(uint begin, uint end);
+    bool canAdvanceBlocked();
+    void tickBlocked(uint depth);
+    /* Floor cells that flow out to an escape, with the direction of the
+     * escape and its index, rebuilt with the sources. */
+    struct Outlet {
+        size_t idx;
+        Dir dir;
+        uint escape;
+    };
+    std::vector<Outlet> outlets;
+    std::vector<size_t> escape_cells;
+    std::vector<double> escape_outflows;
+    void resetOutlets();
+    size_t paintCells(const std::vector<size_t>& cells, Cell::Type type,
+                      float rate);
+    double outflow = 0.;
+    template <typename T>
+    void measureOutflow(const KernelArgs& args, const T* density);
+    uint block_tiles = 0;
+    /* How much the densities changed over the last tick. */
+    struct Change {
+        float max = 0.f;
+        double squares = 0.;
+    };
+    float max_change = 0.f;
+    double change_norm = 0.;
+    bool converged = false;
+    /* Compensated sum of the floor densities after the last tick. */
+    struct Mass {
+        double sum = 0.;
+        double carry = 0.;
+    };
+    double mass = 0.;
+    /* Histogram of the last tick, merged from one per worker. Floor cells
+     * of inactive tiles hold no smoke and are not visited, so they are put
+     * in the first bin afterwards, from a count kept per cell generation. */
+    DensityHistogram histogram;
+    size_t floor_cells = 0;
+    unsigned long floor_generation = ULONG_MAX;
+    size_t countFloorCells();
+    /* Tick count after the tick each cell first exceeded the threshold the
+     * map was started with, see getArrivals(). */
+    std::vector<uint> arrivals;
+    float arrivals_threshold = 0.f;
+    bool arrivals_tracked = false;
+    /* Density of each cell added up over the ticks, see getDoses(). */
+    std::vector<double> doses;
+    bool doses_tracked = false;
+    /* Emitters growing along a curve from a tick on, at a share of their
+     * rate, see setEmitterCurve(). */
+    struct CurvedEmitter {
+        uint row, col;
+        float rate;
+        unsigned int start;
+        std::shared_ptr<const GrowthCurve> curve;
+    };
+    std::vector<CurvedEmitter> curves;
+    // Whether a curve still changes the rate of its emitter after this tick
+    bool curves_growing = false;
+    void applyCurves();
+    KernelArgs kernelArgs(const float* src, float* dst, float emitter_rate,
+                          float escape_rate, bool use_precalc_weights,
+                          WorkerPool* workers = nullptr);
+    WorkerPool* workerPool(uint threads);
+    template <typename Job>
+    void runBlocks(WorkerPool* workers, uint threads, size_t block_rows,
+                   size_t row_blocks, Job update);
+    void markUpdatedRows();
+    template <typename T>
+    void updateBlock(const KernelArgs& args, size_t block, Change* change,
+                     Mass* mass, DensityHistogram* histogram);
+    template <typename T>
+    void advanceBlock(const KernelArgs& args, size_t block, uint depth,
+                      const uchar* due, T* scratch);
+    template <typename T>
+    void updateInPlace(float emitter_rate, float escape_rate,
+                       bool use_precalc_weights, Change* change, Mass* mass,
+                       DensityHistogram* histogram);
+    template <typename T>
+    void updateRedBlack(KernelArgs args, WorkerPool* workers, uint threads,
+                        std::vector<Change>* changes,
+                        std::vector<Mass>* masses,
+                        std::vector<DensityHistogram>* histograms);
+    void copySettings(Sim* copy);
+    template <typename Observer>
+    static uint periodOf(const Every<Observer>& observer) {
+        return observer.every;
+    }
+    template <typename Observer>
+    static uint periodOf(const Observer&) {
+        return 1;
+    }
+    template <typename Observer>
+    bool notify(Every<Observer>& observer) {
+        if (this->ticks % observer.every != 0) return true;
+        return this->notify(observer.observer);
+    }
+    template <typename Observer>
+    bool notify(Observer& observer) {
+        if constexpr (std::is_same<decltype(observer(*this)), bool>::value) {
+            return observer(*this);
+        } else {
+            observer(*this);
+            return true;
+        }
+    }
 
    public:
+    /**
+     * In-place updates overwrite each density as soon as it is computed in
+     * row-major order, so cells see the new values of their north and west
+     * neighbours: a Gauss-Seidel sweep, kept as the legacy update whose
+     * results depend on that order. Synchronous updates read from one buffer
+     * and write to the other, so the result does not depend on the traversal
+     * order. Red-black updates are in-place sweeps over the cells whose row
+     * and column add up to an even number, then over the others, each cell
+     * seeing the new values of all of its neighbours or of none: they settle
+     * about as fast as in-place ones, and each half of the sweep can be
+     * shared between threads. They run the von Neumann stencil without
+     * drafts.
+     */
+    enum Update { InPlace, Synchronous, RedBlack };
     int tick_rate = 1;
     float emitter_rate = 1.f;
     float escape_rate = 1.f;
     bool use_precalc_weights = false;
+    Update update_mode = Sim::Update::InPlace;
+    /**
+     * Number of threads used by synchronous and red-black updates, which
+     * share the tiles of the board between them. In-place updates are always
+     * serial.
+     */
+    uint threads = 1;
+    /**
+     * Pin each worker thread but the calling one to a core of its own.
+     * Workers update their own band of the board first, and compute its
+     * flow coefficients, so that with pinned workers most of the memory
+     * each of them streams is first touched, and placed, on its NUMA node.
+     */
+    bool pin_threads = false;
+    /**
+     * Synchronous updates use a branch-free vectorised kernel on the inner
+     * cells of the board when the CPU supports one (AVX2 or NEON).
+     */
+    enum Kernel { Scalar, Simd };
+    Kernel kernel = Sim::Kernel::Simd;
+    /**
+     * The von Neumann stencil lets smoke flow between each cell and its four
+     * side neighbours, which spreads it in diamonds over open floors. The
+     * Moore stencil also lets it flow to the four corner neighbours, a
+     * fifth of the outflow of a cell going to each side and a twentieth to
+     * each corner, the weights of the isotropic nine-point Laplacian, so
+     * that plumes spread in rounder shapes. Smoke does not cut corners: it
+     * only flows to a corner neighbour when neither side neighbour between
+     * the two is a wall. The Moore stencil runs synchronous ticks on the
+     * CPU, with kernels of its own, and needs uniform weights, level floors
+     * and no winds, drafts or outflow measurement.
+     */
+    enum Stencil { VonNeumann, Moore };
+    Stencil stencil = Sim::Stencil::VonNeumann;
+    /**
+     * Only update the tiles of the board that hold smoke or border one that
+     * does, which makes the early ticks of a run on a large board much
+     * cheaper. The results are the same as updating the whole board.
+     */
+    bool track_activity = true;
+    /**
+     * Side of the square tiles activity is tracked on, in cells.
+     */
+    static constexpr uint tile_size = 32;
+    /**
+     * Let the tiles that changed by less than this over the last tick, no
+     * density of theirs moving further, be updated once every quiet_period
+     * ticks only, in turns, or update every active tile on every tick if 0.
+     * A skipped tile keeps its densities, save for the flows across its
+     * edges with the tiles updated around it, which it takes from them as
+     * they give them, so no smoke is created or lost: only the flows inside
+     * it are held back, each tick it skips changing its densities by about
+     * the threshold at most. Applies to synchronous von Neumann ticks on
+     * the CPU without drafts, and needs track_activity.
+     */
+    float quiet_threshold = 0.f;
+    uint quiet_period = 4;
+    /**
+     * Number of synchronous ticks advance() runs over each small block of
+     * tiles while it is in cache, before moving on to the next one, at most
+     * tile_size. Each block is advanced together with a halo of the cells
+     * its smoke can reach, which shrinks by a cell on every tick, so the
+     * results are the same as ticking the whole board each time.
+     */
+    uint time_block = 1;
+    /**
+     * How strongly smoke prefers rising to higher floors, see
+     * Board::computeFlowCoefficients(). Floor heights are ignored when 0.
+     */
+    float elevation_bias = 0.f;
+    /**
+     * Largest share of the flow across each edge between two cells that a
+     * random draft holds back on a tick, in [0, 1], or 0 for the
+     * deterministic model. Each edge draws its share on each tick from a
+     * counter-based generator keyed by the seed, the edge and the tick, so a
+     * run is reproduced whatever the number of threads, and both cells of an
+     * edge see the same share, so no smoke is created or lost. Stochastic
+     * ticks only run on the CPU, with the scalar kernel.
+     */
+    float draft_noise = 0.f;
+    uint64_t draft_seed = 0;
+    /**
+     * Stop running once no density changes by more than this over a tick, or
+     * never if 0. The change is only measured on the CPU, and only when a
+     * tolerance is set.
+     */
+    float tolerance = 0.f;
+    /**
+     * Add the densities of the floor up as each tick writes them, with
+     * Kahan-compensated sums, so conservation can be checked without
+     * reading the board again. The mass is only tracked on the CPU.
+     */
+    bool track_mass = false;
+    /**
+     * Sort the floor densities into this many bins as each tick writes
+     * them, and find their largest value, their mean and how many cells hold
+     * more than occupied_density, see getHistogram(), or never if 0. Each
+     * worker counts the cells it updates on its own, and the counts are
+     * merged once the tick is done, so the board is not read again. The
+     * mean is that of the mass, which is tracked along. The histogram is
+     * only measured on the CPU.
+     */
+    uint histogram_bins = 0;
+    float occupied_density = 1e-3f;
+    /**
+     * Records every tick, and the share of it each worker ran, when not
+     * null. The tracer is not owned by the simulation.
+     */
+    Tracer* tracer = nullptr;
+    /**
+     * Counts the hardware events of every tick, those of the workers
+     * included, when not null. The counters are not owned by the
+     * simulation, nor copied to its forks, so that they only count one run.
+     */
+    PerfCounters* counters = nullptr;
+    /**
+     * Map the first tick after which the density of each floor cell exceeds
+     * this threshold, see getArrivals(), or stop mapping if 0. Cells are
+     * checked as each tick writes them, and only on the CPU.
+     */
+    float arrival_threshold = 0.f;
+    /**
+     * Measure how much smoke flows out through each escape over each tick,
+     * from the densities the tick starts from, see getEscapeOutflows(). The
+     * outflow is only measured on the CPU.
+     */
+    bool track_outflow = false;
+    /**
+     * Add the density of each floor cell after every tick to its dose, see
+     * getDoses(). Doses are added as each tick writes the cells, and only on
+     * the CPU; turning this off keeps them.
+     */
+    bool track_dose = false;
+    /**
+     * Arrival of the cells the density has not exceeded the threshold in.
+     */
+    static constexpr uint not_arrived = UINT_MAX;
     Board* board;
     Sim(uint board_width, uint board_height, const char* const layout,
-        uint emitter_row, uint emitter_col) {
-        this->board = new Board(board_width, board_height, layout);
-        {
-            // Emitter placement
-            Cell* emitter = this->board->cellAt(emitter_row, emitter_col);
-            if (emitter == nullptr) {
-                throw std::runtime_error("Emitter coordinates out of bounds.");
-            } else if (emitter->cost < 0 || emitter->cost > 9) {
-                delete this->board;
-                throw std::runtime_error("Emitter not on floor tile.");
-            }
-            emitter->type = Cell::Type::Emitter;
-            emitter->density = 1.f;
-        }
-        this->board->writePixel(emitter_row, emitter_col, emitter_color);
-        /* Calculate how many inputs and outputs a cell has. This in turn
-         * will affect the propagation rate. */
-        for (uint row = 0; row < this->board->getHeight(); row++) {
-            for (uint col = 0; col < this->board->getWidth(); col++) {
-                ushort ins = 0, outs = 0;
-                for (auto dir : directions) {
-                    Cell* adj = this->board->cellAt(dir, row, col);
-                    if (adj == nullptr) {
-                        continue;
-                    } else {
-                        switch (adj->type) {
-                            case Cell::Wall:
-                                break;
-                            case Cell::Floor:
-                                ins++;
-                                outs++;
-                                break;
-                            case Cell::Emitter:
-                                ins++;
-                                break;
-                            case Cell::Escape:
-                                outs++;
-                                break;
-                        }
-                    }
-                }
-                Cell* cur = this->board->cellAt(row, col);
-                if (ins == 0)
-                    cur->omega_in = .0f;
-                else
-                    cur->omega_in = 1.f / (float)ins;
-                if (outs == 0)
-                    cur->omega_out = .0f;
-                else
-                    cur->omega_out = 1.f / (float)outs;
-                /* printf("%d,%d] iw:%f, ow:%f\n", row, col, cur->in_w,
-                       cur->out_w); */
-            }
-        }
+        uint emitter_row, uint emitter_col, size_t layout_stride = 0);
+    /**
+     * @brief Simulate on a board that has already been set up.
+     *
+     * The simulation takes ownership of the board, which must have its
+     * emitters placed and its weights computed.
+     */
+    Sim(Board* board);
+    ~Sim() {
+        delete this->workers;
+        delete this->board;
+    }
+    /**
+     * @brief Make a stopped copy of the simulation that can diverge from it.
+     *
+     * The copy has the same tick count and settings, and forks the board, so
+     * forking is cheap and the two only copy the arrays they go on to write,
+     * typically the densities on their next tick. A backend is downloaded
+     * from and not shared. The copies can then be ticked concurrently, each
+     * on its own thread.
+     */
+    Sim* fork();
+    /**
+     * @brief Make a stopped copy of the simulation on a coarse copy of its
+     * board, see coarsenBoard(), for a fast preview of a large layout.
+     *
+     * The copy has the same settings, and its ticks stand for factor² ticks
+     * of the simulation, so it starts at its tick count over factor².
+     */
+    Sim* coarsen(uint factor);
+    /**
+     * @brief Warm-start the simulation from the densities of a coarse copy
+     * of it, see coarsen() and prolongDensities(), taking factor² times its
+     * tick count.
+     */
+    void prolong(Sim& coarse, uint factor);
+    /**
+     * @brief Note that the board was changed between ticks, for instance by
+     * placing an emitter, so that the next tick updates every tile.
+     */
+    void touchBoard() {
+        this->activity_stale = true;
+        this->unsync(0, UINT_MAX);
+    }
+    /**
+     * @brief Note that the densities of rows [begin, end) were written between
+     * ticks, so that the next tick updates their tiles and those next to
+     * them, without updating the whole board.
+     */
+    void touchRows(uint begin, uint end);
+    /**
+     * @brief Note that the density of a cell was written between ticks, so
+     * that the next tick updates its tile and those of its neighbours.
+     */
+    void touchCell(uint row, uint col);
+    /**
+     * @brief Turn a cell into a wall, a floor or an escape between ticks, for
+     * instance to close or open a door, see Board::setCellType().
+     *
+     * Keeps the state of the run, and only the tiles of the cell and of its
+     * neighbours are updated on the next tick for it, so doors can be
+     * toggled on large boards without rebuilding the simulation. Escapes
+     * keep their order by cell index in getEscapeCells(). Cells cannot be
+     * changed while a backend is attached.
+     */
+    void setCellType(uint row, uint col, Cell::Type type);
+    /**
+     * @brief Apply a batch of brush dabs between ticks, in order, like
+     * setCellType() but for emitters too and for many cells at once.
+     *
+     * Consecutive dabs of the same paint are applied together, so that the
+     * weights and flow coefficients of the cells they touch and of their
+     * neighbours are recomputed once for each stroke rather than for each
+     * cell, and only the tiles around the cells that changed are updated on
+     * the next tick. Cells outside the board are skipped. Cells cannot be
+     * changed while a backend is attached.
+     *
+     * @return The number of cells that changed.
+     */
+    size_t paint(const std::vector<BrushDab>& dabs);
+    /**
+     * @brief Grow an emitter along a curve from the next tick on, as a share
+     * of the rate it has, or set it back to that rate if the curve is null.
+     *
+     * The emitter claims a rate of its own on the board, see
+     * Board::claimRate(), that each tick sets from the table of the curve
+     * before running, so the kernels read it like any other rate. Setting
+     * the rate of the emitter on the board takes it off the curve. Curves
+     * drive the CPU kernels only, and cannot be checkpointed.
+     */
+    void setEmitterCurve(uint row, uint col,
+                         std::shared_ptr<const GrowthCurve> curve);
+    /**
+     * @brief Grow every emitter of the board along a curve, see
+     * setEmitterCurve().
+     */
+    void setEmitterCurves(std::shared_ptr<const GrowthCurve> curve);
+    /**
+     * @brief Check whether any emitter is still on a curve, see
+     * setEmitterCurve().
+     */
+    bool hasEmitterCurves();
+    /**
+     * @brief Run the transition function on a backend instead of the CPU.
+     *
+     * The backend is not owned by the simulation. Passing nullptr detaches
+     * the current backend, after downloading its densities to the board.
+     */
+    void setBackend(Backend* backend) {
+        if (this->backend != nullptr) this->backend->download(*this);
+        this->backend = backend;
+    }
+    Backend* getBackend() { return this->backend; }
+    void start() {
+        this->state = Sim::State::Run;
+        this->frame_skip_counter = this->tick_rate;
     }
-    ~Sim() { delete this->board; }
-    void start() { state = Sim::State::Run; }
     void stop() { state = Sim::State::Stop; }
     bool isRunning() {
         if (this->state == Sim::State::Run) return true;
         return false;
     }
     unsigned int getTicks() { return this->ticks; }
-    void cycle() {
-        static int frame_skip_counter = this->tick_rate;
-        static float emitter_rate = this->emitter_rate;
-        static float escape_rate = this->escape_rate;
-        static bool use_precalc_weights = this->use_precalc_weights;
-        /* Check if we're running: if so, decrement the Frame Skip Counter until
-         * we reach zero, then run the update cycle. We're assuming this is
-         * executed once per frame. */
-        if (this->state == Sim::State::Stop ||
-            (this->state == Sim::State::Run && (--frame_skip_counter) != 0))
-            return;
-        for (uint row = 0; row < this->board->getHeight(); row++) {
-            for (uint col = 0; col < this->board->getWidth(); col++) {
-                Cell* cur = this->board->cellAt(row, col);
-                if (cur == nullptr) {
-                    throw std::runtime_error(
-                        "Unexpected missing Cell in valid location.");
-                }
-                static uchar l;
-                static float cur_omega_out, cur_omega_in, adj_omega_out,
-                    adj_omega_in;
-                if (use_precalc_weights) {
-                    // Use precalculated weights
-                    cur_omega_out = cur->omega_out;
-                    cur_omega_in = cur->omega_in;
-                } else {
-                    // Use 1/4 weights independently from the number of
-                    // neighbors
-                    cur_omega_out = .25f;
-                    cur_omega_in = .25f;
-                }
-                cur->intake = .0f;
-                cur->outtake = .0f;
-                switch (cur->type) {
-                    case Cell::Wall:
-                        break;
-                    case Cell::Floor:
-                        for (auto dir : directions) {
-                            Cell* adj = this->board->cellAt(dir, row, col);
-                            if (adj == nullptr) continue;
-                            if (use_precalc_weights) {
-                                adj_omega_out = adj->omega_out;
-                                adj_omega_in = adj->omega_in;
-                            } else {
-                                adj_omega_out = .25f;
-                                adj_omega_in = .25f;
-                            }
-                            adj->intake = .0f;
-                            adj->outtake = .0f;
-                            switch (adj->type) {
-                                case Cell::Wall:
-                                    break;
-                                case Cell::Floor:
-                                    adj->intake = std::min(
-                                        cur_omega_out * cur->density,
-                                        adj_omega_in * (1 - adj->density));
-                                    adj->outtake = std::min(
-                                        adj_omega_out * adj->density,
-                                        cur_omega_in * (1 - cur->density));
-                                    break;
-                                case Cell::Emitter:
-                                    adj->outtake =
-                                        emitter_rate *
-                                        std::min(
-                                            adj_omega_out * adj->density,
-                                            cur_omega_in * (1 - cur->density));
-                                    break;
-                                case Cell::Escape:
-                                    adj->intake = escape_rate * cur_omega_out *
-                                                  cur->density;
-                                    break;
-                            }
-                            cur->intake += adj->outtake;
-                            cur->outtake += adj->intake;
-                        }
-                        cur->density += cur->intake - cur->outtake;
-                        l = 255 - (255 * cur->density);
-                        /*printf("s:%f, delta:%f\n", cur->smoke,
-                               cur->intake - cur->outtake);*/
-                        this->board->writePixel(row, col, l, l, l);
-                        break;
-                    case Cell::Emitter:
-                        l = 255 * emitter_rate;
-                        this->board->writePixel(row, col, l, 255 - l, 255 - l);
-                        break;
-                    case Cell::Escape:
-                        l = 255 * escape_rate;
-                        this->board->writePixel(row, col, 255 - l, 255 - l, l);
-                        break;
-                }
-            }
+    /**
+     * @brief Set the tick count, when resuming a simulation.
+     */
+    void setTicks(unsigned int ticks) { this->ticks = ticks; }
+    /**
+     * @brief Get the largest change of a density over the last tick.
+     */
+    float getMaxChange() { return this->max_change; }
+    /**
+     * @brief Get the L2 norm of the change of the densities over the last
+     * tick.
+     */
+    double getChangeNorm() { return this->change_norm; }
+    /**
+     * @brief Check whether the last tick changed the densities by less than
+     * the tolerance.
+     */
+    bool hasConverged() { return this->converged; }
+    /**
+     * @brief Get the total density of the floor after the last tick, or 0
+     * unless it tracked the mass or a histogram.
+     */
+    double getMass() { return this->mass; }
+    /**
+     * @brief Get the histogram of the floor densities after the last tick,
+     * which has no bins unless it was measured, see histogram_bins.
+     */
+    const DensityHistogram& getHistogram() { return this->histogram; }
+    /**
+     * @brief Get the number of quiet tiles the last tick skipped, see
+     * quiet_threshold.
+     */
+    size_t getSkippedTiles() { return this->quiet_skips; }
+    /**
+     * @brief Get the arrival map, by cell index, or null unless a threshold
+     * has been set.
+     *
+     * Holds the tick count after the tick each floor cell first exceeded the
+     * threshold, or not_arrived. Changing the threshold starts the map over,
+     * from the densities of the next tick.
+     */
+    const uint* getArrivals() {
+        return this->arrivals.empty() ? nullptr : this->arrivals.data();
+    }
+    float getArrivalThreshold() { return this->arrivals_threshold; }
+    /**
+     * @brief Restore an arrival map, as getArrivals() gives it, mapped at a
+     * threshold that it goes on being mapped at while arrival_threshold is
+     * the same.
+     */
+    void setArrivals(std::vector<uint> arrivals, float threshold) {
+        this->arrivals = std::move(arrivals);
+        this->arrivals_threshold = threshold;
+    }
+    /**
+     * @brief Get the dose of each cell, by cell index, or null unless doses
+     * have ever been tracked.
+     *
+     * The dose of a floor cell is its density integrated over time, added
+     * up after each tick it was tracked over, in density ticks: dividing it
+     * by the dose occupants can tolerate gives their fractional effective
+     * dose, see toDoseLevels(). Other cells have none.
+     */
+    const double* getDoses() {
+        return this->doses.empty() ? nullptr : this->doses.data();
+    }
+    /**
+     * @brief Start the doses over from the next tick.
+     */
+    void resetDoses() { this->doses.clear(); }
+    /**
+     * @brief Restore the doses, as getDoses() gives them.
+     */
+    void setDoses(std::vector<double> doses) {
+        this->doses = std::move(doses);
+    }
+    /**
+     * @brief Get the index of the cell of each escape, in row-major order.
+     *
+     * The escapes are only listed once the simulation has ticked.
+     */
+    const std::vector<size_t>& getEscapeCells() { return this->escape_cells; }
+    /**
+     * @brief Get how much smoke flowed out through each escape over the last
+     * tick, in the order of getEscapeCells(), or zeros unless it tracked the
+     * outflow.
+     */
+    const std::vector<double>& getEscapeOutflows() {
+        return this->escape_outflows;
+    }
+    /**
+     * @brief Get how much smoke flowed out through every escape over the
+     * last tick, or 0 unless it tracked the outflow.
+     */
+    double getOutflow() { return this->outflow; }
+    float getDensity(uint row, uint col) {
+        if (!this->board->contains(row, col)) {
+            throw std::runtime_error("Cell coordinates out of bounds.");
+        }
+        return this->board->getDensity(this->board->indexOf(row, col));
+    }
+    /**
+     * @brief Add the bytes the simulation holds to a footprint: those of its
+     * board, see Board::addFootprint(), of its tiles and runs as "tiles",
+     * and of its arrivals, doses, histogram and outflows as "tracking".
+     */
+    void addFootprint(Footprint* footprint);
+    /**
+     * @brief Add the bytes the simulation will hold once it has ticked with
+     * its settings and its board in a storage, to a footprint, by the parts
+     * of addFootprint() and "scratch" for the buffers of time blocks.
+     *
+     * The footprint is planned before anything is allocated, so that a run
+     * can pick settings that fit a memory budget before it starts.
+     * @param decoded Count the float copy of the densities, see
+     * Board::planFootprint().
+     */
+    void planFootprint(Footprint* footprint, Board::Storage storage,
+                       bool decoded);
+    /**
+     * @brief Advance the simulation by one tick if it is due.
+     * @return true if a tick was run, false if it was skipped.
+     */
+    bool cycle();
+    /**
+     * @brief Advance the simulation by one tick, whatever its state.
+     */
+    void tick();
+    /**
+     * @brief Advance the simulation by a number of ticks, whatever its state,
+     * or until it converges.
+     *
+     * Ticks are run time_block at a time when nothing has to see the
+     * densities in between: synchronous updates on the CPU without a
+     * tolerance, mass, arrival, dose or outflow tracking, a histogram, or
+     * growth curves.
+     * Ticks that have to be measured are run one at a time.
+     *
+     * @return The number of ticks run.
+     */
+    unsigned long advance(unsigned long count);
+    /**
+     * @brief Advance the simulation like advance(), calling observers after
+     * the ticks they are due on, in the order they were given.
+     *
+     * An observer is any callable taking the simulation, which it must only
+     * read, such as its densities, and is called after every tick, or on
+     * every Kth tick of the simulation if wrapped by every(). Observers
+     * returning a bool stop the run by returning false, once every observer
+     * has been called for that tick. The ticks in between are left to run in
+     * time blocks. Observers are bound at compile time, so advance() without
+     * any costs what it did before there were observers.
+     *
+     * @return The number of ticks run.
+     */
+    template <typename Observer, typename... Observers>
+    unsigned long advance(unsigned long count, Observer&& observer,
+                          Observers&&... observers);
+    /**
+     * @brief Wrap an observer for advance() so that it is only called after
+     * the ticks whose count is a multiple of period, like checkpoints, which
+     * keeps the schedule when resuming.
+     */
+    template <typename Observer>
+    static Every<std::decay_t<Observer>> every(uint period,
+                                               Observer&& observer) {
+        if (period == 0) {
+            throw std::runtime_error(
+                "Observers must be called once every tick at most.");
         }
-        this->ticks++;
-        // Avoid resetting the FSC if we're single-stepping.
-        if (this->state == Sim::State::Run)
-            frame_skip_counter = this->tick_rate;
-        emitter_rate = this->emitter_rate;
-        escape_rate = this->escape_rate;
-        use_precalc_weights = this->use_precalc_weights;
+        return {period, std::forward<Observer>(observer)};
     }
+    /**
+     * @brief Compute the steady state directly, instead of ticking to it.
+     *
+     * Relaxes the densities in place until no density changes by tolerance
+     * or more over a sweep, using the current rates and weights. The tick
+     * count is left alone and the densities are only guaranteed to be a
+     * steady state if hasConverged() is true afterwards.
+     *
+     * @param relaxation Over-relaxation factor in (0, 2), 1 being plain
+     * in-place ticks.
+     * @return The number of sweeps run.
+     */
+    unsigned long solve(float tolerance, unsigned long max_sweeps,
+                        float relaxation = 1.9f);
     void step() {
         this->state = Sim::State::Step;
         this->cycle();
         this->state = Sim::State::Stop;
     }
 };
+
+template <typename Observer, typename... Observers>
+unsigned long Sim::advance(unsigned long count, Observer&& observer,
+                           Observers&&... observers) {
+    unsigned long ticks = 0;
+    while (ticks < count) {
+        // Up to the next tick an observer is due on
+        unsigned long due = count - ticks;
+        for (uint period : {periodOf(observer), periodOf(observers)...})
+            due = std::min<unsigned long>(due, period - this->ticks % period);
+        unsigned long run = this->advance(due);
+        ticks += run;
+        bool running = true;
+        for (bool keep : {this->notify(observer), this->notify(observers)...})
+            running = running && keep;
+        if (!running || run < due) break;
+    }
+    return ticks;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file sim_loader.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "sim.hpp"
+
+/**
+ * @brief Builds a simulation on its own thread, so that large layouts can be
+ * loaded without holding up the UI.
+ *
+ * The thread only touches the simulation it is building, so any other one
+ * can keep running and rendering until the new one is taken. Progress is
+ * reported by stages, most of the work for text layouts being building the
+ * board. Deleting the loader waits for the thread to finish.
+ */
+class SimLoader {
+   private:
+    std::thread thread;
+    std::atomic<bool> done{false};
+    std::atomic<float> progress{0.f};
+    std::atomic<const char*> stage{""};
+    Sim* sim = nullptr;
+    std::string error;
+    void buildLayout(std::string path, uint emitter_row, uint emitter_col);
+    void buildCheckpoint(std::string path);
+
+   public:
+    SimLoader() = default;
+    ~SimLoader();
+    SimLoader(const SimLoader&) = delete;
+    SimLoader& operator=(const SimLoader&) = delete;
+    /**
+     * @brief Start loading a layout, either a text or a binary one, and
+     * placing an emitter on it unless it is binary and comes with its own.
+     */
+    void loadLayout(const std::string& path, uint emitter_row,
+                    uint emitter_col);
+    /**
+     * @brief Start restoring a simulation from a checkpoint.
+     */
+    void loadCheckpoint(const std::string& path);
+    bool isDone() { return this->done; }
+    /**
+     * @brief Get the share of the loading done, from 0 to 1.
+     */
+    float getProgress() { return this->progress; }
+    /**
+     * @brief Get a description of what is being done.
+     */
+    const char* getStage() { return this->stage; }
+    /**
+     * @brief Hand the simulation over, once done, or throw the error that
+     * stopped the loading.
+     */
+    Sim* take();
+};
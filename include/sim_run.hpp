@@ -0,0 +1,105 @@
+/**
+ * @file sim_run.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <iterator>
+
+#include "sim.hpp"
+
+/**
+ * @brief A run of a simulation that is advanced a little at a time, for
+ * tools that embed the simulation and share their thread with other work.
+ *
+ * Each call to resume() runs at most a given number of ticks and returns,
+ * so the caller can interleave runs with anything else:
+ *
+ *     SimRun run(sim, 100000);
+ *     while (run.resume(16) > 0) pollEvents();
+ *
+ * Iterating over a run advances it by one tick per step, each step yielding
+ * the simulation itself, which is not copied and must only be read:
+ *
+ *     for (Sim& state : SimRun(sim, 1000))
+ *         sample(state.board);
+ *
+ * A run ends after its count of ticks, or once the simulation converges.
+ * Ticks are the smallest unit a run stops at: a tick updates the board
+ * from one buffer to the other, or in place, and is only complete once
+ * every tile is.
+ */
+class SimRun {
+   private:
+    Sim* sim;
+    unsigned long count;
+    unsigned long ticks = 0;
+    bool converged = false;
+
+   public:
+    class iterator {
+       private:
+        SimRun* run;
+
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Sim;
+        using difference_type = long;
+        using pointer = Sim*;
+        using reference = Sim&;
+        iterator(SimRun* run) { this->run = run; }
+        Sim& operator*() const { return *this->run->sim; }
+        Sim* operator->() const { return this->run->sim; }
+        iterator& operator++() {
+            if (this->run->resume(1) == 0) this->run = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator& other) const {
+            return this->run == other.run;
+        }
+        bool operator!=(const iterator& other) const {
+            return this->run != other.run;
+        }
+    };
+    /**
+     * @brief Prepare to run a simulation for a number of ticks, none of
+     * which are run until the run is resumed or iterated over.
+     */
+    SimRun(Sim& sim, unsigned long count) {
+        this->sim = &sim;
+        this->count = count;
+    }
+    /**
+     * @brief Run at most a number of the ticks left, in time blocks where
+     * the simulation allows them.
+     * @return The number of ticks run, 0 once the run is done.
+     */
+    unsigned long resume(unsigned long ticks);
+    bool isDone() { return this->converged || this->ticks >= this->count; }
+    /**
+     * @brief Get the number of ticks run so far.
+     */
+    unsigned long getTicks() { return this->ticks; }
+    /**
+     * @brief Advance by one tick and point at the simulation, or at the end
+     * if no ticks are left.
+     */
+    iterator begin() { return iterator(this->resume(1) > 0 ? this : nullptr); }
+    iterator end() { return iterator(nullptr); }
+};
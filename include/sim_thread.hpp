@@ -0,0 +1,94 @@
+/**
+ * @file sim_thread.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "sim.hpp"
+#include "snapshot.hpp"
+
+/**
+ * @brief Runs a simulation on its own thread, decoupled from the UI.
+ *
+ * The thread ticks as fast as possible or at a target rate and holds the
+ * simulation mutex while it does so. Anything else touching the simulation
+ * while the thread exists must hold the lock returned by acquire(), which
+ * takes priority over the next tick. The densities of each tick are
+ * published as a snapshot that can be taken without the lock, see
+ * latest().
+ */
+class SimThread {
+   private:
+    Sim* sim;
+    std::thread thread;
+    std::mutex mutex;
+    std::atomic<bool> running{false};
+    std::atomic<int> waiting{0};
+    unsigned long tick_limit = 0;
+    SnapshotBuffer snapshots;
+    void loop();
+
+   public:
+    /**
+     * Ticks per second to aim for, or 0 to run as fast as possible.
+     */
+    std::atomic<double> target_rate{0.};
+    /**
+     * Whether snapshots include the arrival map.
+     */
+    std::atomic<bool> snapshot_arrivals{false};
+    /**
+     * Whether snapshots include the doses.
+     */
+    std::atomic<bool> snapshot_doses{false};
+    SimThread(Sim* sim) { this->sim = sim; }
+    ~SimThread() { this->stop(); }
+    SimThread(const SimThread&) = delete;
+    SimThread& operator=(const SimThread&) = delete;
+    /**
+     * @brief Start ticking, until the simulation converges.
+     * @param tick_limit Stop after this many ticks, or never if 0.
+     */
+    void start(unsigned long tick_limit = 0);
+    /**
+     * @brief Stop ticking and wait for the current tick to complete.
+     */
+    void stop();
+    bool isRunning() { return this->running; }
+    /**
+     * @brief Lock the simulation against the thread.
+     */
+    std::unique_lock<std::mutex> acquire();
+    /**
+     * @brief Take the snapshot of the latest completed tick, without waiting
+     * for the thread, from a single thread only.
+     *
+     * The snapshot stays valid until the next call.
+     * @param taken If not null, set to whether it is newer than the one
+     * taken before.
+     * @return The snapshot, or null if no tick was completed yet.
+     */
+    const Snapshot* latest(bool* taken = nullptr) {
+        return this->snapshots.take(taken);
+    }
+};
@@ -0,0 +1,81 @@
+/**
+ * @file snapshot.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "sim.hpp"
+
+/**
+ * @brief The densities of a simulation after a tick, padded like those of
+ * its board.
+ */
+struct Snapshot {
+    std::vector<float> densities;
+    // Empty unless asked for and the simulation maps arrivals
+    std::vector<uint> arrivals;
+    // Empty unless asked for and the simulation has doses
+    std::vector<double> doses;
+    unsigned int ticks = 0;
+    // What the copy was last brought up to date with
+    const Board* board = nullptr;
+    unsigned long generation = 0;
+};
+
+/**
+ * @brief Hands snapshots of completed ticks over from the thread running a
+ * simulation to another one, without either of them ever waiting.
+ *
+ * Three snapshots take turns (triple buffering): the writer fills its own
+ * and swaps it with the shared one, and the reader swaps its own with the
+ * shared one whenever a newer one was published, each in a single atomic
+ * exchange. Either side only touches the snapshot it holds, so the reader
+ * always gets the latest complete tick, and it never tears. A snapshot only
+ * gets the densities of the rows that changed since it was last written,
+ * two publications ago at most.
+ */
+class SnapshotBuffer {
+   private:
+    Snapshot slots[3];
+    // The shared slot, with fresh set until the reader takes it
+    static constexpr uint fresh = 4;
+    std::atomic<uint> shared{0};
+    uint back = 1, front = 2;
+
+   public:
+    /**
+     * @brief Copy the state of a simulation after a tick and publish it,
+     * from the writer only.
+     * @param arrivals Also copy the arrival map.
+     * @param doses Also copy the doses.
+     */
+    void publish(Sim& sim, bool arrivals, bool doses);
+    /**
+     * @brief Take the latest snapshot published, from the reader only.
+     *
+     * The snapshot stays the reader's until it takes another one.
+     * @param taken If not null, set to whether it is newer than the one
+     * taken before.
+     * @return The snapshot, or null if none was ever published.
+     */
+    const Snapshot* take(bool* taken = nullptr);
+};
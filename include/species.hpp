@@ -0,0 +1,109 @@
+/**
+ * @file species.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief An emitter of one species, see Species.
+ */
+struct SpeciesSource {
+    uint species;
+    uint row, col;
+    float rate = 1.f;
+};
+
+/**
+ * @brief Several species of smoke, or smoke and tracer gases, each from
+ * emitters of its own, carried through one board by synchronous ticks.
+ *
+ * The densities of the species are interleaved by cell, like the members of
+ * an Ensemble, so that one sweep over the cell types and flow coefficients
+ * of the board advances every species, vectorised across them. Species
+ * share the board, its emitters included: each emitter is full of its own
+ * species and empty of the others, so it only emits its own, and the
+ * others never flow into it, as into any emitter. Each species then has the
+ * densities of a synchronous Sim of the board whose other emitters are
+ * empty, rounded like the vectorised kernel rounds them. Species do not
+ * share the room left in a cell, each filling it up to 1 on its own.
+ *
+ * Four species take one vector of four lanes, eight one of eight, where
+ * separate runs would each read the whole board. Activity is not tracked:
+ * every tick updates the whole board.
+ */
+class Species {
+   private:
+    Board* board;
+    uint count;
+    // Species rounded up to whole vectors, the extra lanes stay empty
+    uint lanes;
+    std::vector<float> density, density_next;
+    unsigned int ticks = 0;
+
+   public:
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    float elevation_bias = 0.f;
+    /**
+     * @brief Carry count species through a layout, which must have its
+     * weights computed and is left as it is, from the given emitters.
+     *
+     * Emitters already on the layout emit species 0, which starts with the
+     * densities of the layout.
+     */
+    Species(Board* layout, uint count,
+            const std::vector<SpeciesSource>& sources);
+    ~Species() { delete this->board; }
+    Species(const Species&) = delete;
+    Species& operator=(const Species&) = delete;
+    uint getSize() { return this->count; }
+    unsigned int getTicks() { return this->ticks; }
+    /**
+     * @brief Advance every species by one synchronous tick.
+     */
+    void tick();
+    /**
+     * @brief Get the board the species share, with every emitter placed.
+     */
+    Board* getBoard() { return this->board; }
+    /**
+     * @brief Get the number of densities stored for each cell, the species
+     * rounded up to whole vectors.
+     */
+    uint getLanes() { return this->lanes; }
+    /**
+     * @brief Get the densities of every species, those of a cell next to
+     * each other, see getLanes(), and the cells padded like those of the
+     * board.
+     */
+    const float* getDensities() { return this->density.data(); }
+    float getDensity(uint species, uint row, uint col) {
+        return this->density[this->board->indexOf(row, col) * this->lanes +
+                             species];
+    }
+    /**
+     * @brief Add up the densities of one species over the floor cells.
+     */
+    double getMass(uint species);
+};
@@ -0,0 +1,127 @@
+/**
+ * @file stream.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sim.hpp"
+
+/* Streams send each frame as a binary WebSocket message: a StreamHeader,
+ * then a zlib stream of the width * height densities of the board, row by
+ * row, each quantised to a byte, 255 standing for 1. Unless the frame is a
+ * key frame, each byte is stored as its difference from that of the
+ * previous frame the client was sent, modulo 256. Fields are stored in host
+ * byte order, which the viewer page takes to be little-endian. */
+
+constexpr char stream_magic[4] = {'S', 'M', 'K', 'S'};
+
+struct StreamHeader {
+    char magic[4];
+    uint32_t tick;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+};
+
+namespace Streaming {
+enum Flags : uint32_t { KeyFrame = 1 << 0 };
+}
+
+/**
+ * @brief Serves the densities of a simulation to remote viewers, over
+ * WebSocket, at a capped rate.
+ *
+ * offer() quantises the densities into a queue of max_pending frames at
+ * most, dropping the oldest frame instead of waiting when the queue is full,
+ * and only when a frame is due at the rate. A thread of the stream encodes
+ * and sends the latest frame of the queue to every client, so the
+ * simulation never waits for the network. A client that has not taken the
+ * last frame yet skips the next ones, and gets a key frame once it catches
+ * up. Plain HTTP requests get a page that shows the stream.
+ */
+class FrameStream {
+   private:
+    uint width, height;
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point due;
+    size_t max_pending;
+    int listener = -1;
+    int wake[2] = {-1, -1};
+    std::thread thread;
+    std::mutex mutex;
+    struct Frame {
+        unsigned int tick;
+        std::vector<unsigned char> densities;
+    };
+    std::deque<Frame> pending;
+    std::vector<std::vector<unsigned char>> spare;
+    bool quit = false;
+    unsigned long dropped = 0;
+    // Only touched by the stream thread
+    struct Client {
+        int fd;
+        bool upgraded = false;
+        bool synced = false;
+        bool closing = false;
+        std::string request;
+        std::string output;
+    };
+    std::vector<Client> clients;
+    std::vector<unsigned char> previous;
+    void loop();
+    void accept();
+    void receive(Client& client);
+    void flush(Client& client);
+    void disconnect(Client& client);
+    void send(Frame& frame);
+    std::string encode(const Frame& frame, bool key);
+
+   public:
+    /**
+     * @brief Listen for viewers of a board on a TCP port, on every interface.
+     * @param rate Frames per second at most.
+     * @param max_pending Frames queued at most, the oldest dropped first.
+     */
+    FrameStream(uint port, uint width, uint height, float rate,
+                size_t max_pending = 2);
+    /**
+     * @brief Stop serving and disconnect every client.
+     */
+    ~FrameStream();
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+    /**
+     * @brief Queue the densities of the simulation, if a frame is due at the
+     * rate of the stream.
+     */
+    void offer(Sim& sim);
+    /**
+     * @brief Get how many frames were dropped from the queue, stale before
+     * the stream thread could send them.
+     */
+    unsigned long getDropped();
+};
@@ -0,0 +1,219 @@
+/**
+ * @file sweep.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "board.hpp"
+#include "curve.hpp"
+#include "sim.hpp"
+
+/**
+ * @brief The parameters of one run of a sweep.
+ */
+struct SweepPoint {
+    /**
+     * Whether to add an emitter at (emitter_row, emitter_col), on top of the
+     * emitters already on the layout.
+     */
+    bool place_emitter = false;
+    uint emitter_row = 0, emitter_col = 0;
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    Board::Storage storage = Board::Storage::Float;
+    /**
+     * If set, the growth curve of every emitter of the run, see
+     * Sim::setEmitterCurves(). Curved runs are never put in ensembles.
+     */
+    std::shared_ptr<const GrowthCurve> curve;
+};
+
+/**
+ * @brief The state of the board at the end of one run of a sweep.
+ */
+struct SweepResult {
+    unsigned int ticks = 0;
+    double mass = 0.;
+    float peak = 0.f;
+};
+
+/**
+ * @brief Runs many independent simulations of the same layout.
+ *
+ * The layout is loaded and its weights computed once: every run copies it
+ * and only places its own emitter. Runs are single-threaded and are
+ * handed out to the workers one at a time, so that workers that finish
+ * early pick up the remaining runs instead of idling. Each worker copies
+ * the layout into an arena it resets after every run, so that runs after
+ * the first neither call the allocator nor fault pages in.
+ */
+class Sweep {
+   private:
+    Board* layout;
+    SweepResult run(const SweepPoint& point, Arena* arena);
+    void runEnsemble(const std::vector<SweepPoint>& points,
+                     const std::vector<size_t>& members,
+                     std::vector<SweepResult>* results);
+
+   public:
+    /**
+     * Maximum number of ticks per run, runs stop early once their densities
+     * change by less than the tolerance.
+     */
+    unsigned long ticks = 100;
+    float tolerance = 0.f;
+    Sim::Update update_mode = Sim::Update::InPlace;
+    Sim::Kernel kernel = Sim::Kernel::Simd;
+    /**
+     * Number of runs that only differ in where their emitter is to advance
+     * together as one Ensemble, which needs synchronous updates and float
+     * storage. Other runs, and all of them if 1, are run on their own.
+     */
+    uint ensemble_size = 1;
+    /**
+     * @brief Sweep over a layout, which must have its weights computed.
+     *
+     * The sweep takes ownership of the layout and never modifies it.
+     */
+    Sweep(Board* layout) { this->layout = layout; }
+    ~Sweep() { delete this->layout; }
+    Sweep(const Sweep&) = delete;
+    Sweep& operator=(const Sweep&) = delete;
+    /**
+     * @brief Run every point of the sweep.
+     * @param jobs Number of runs to execute concurrently.
+     * @return The result of each point, in the same order.
+     */
+    std::vector<SweepResult> run(const std::vector<SweepPoint>& points,
+                                 uint jobs);
+};
+
+/**
+ * @brief How one candidate of an escape search did, see EscapeSearch.
+ */
+struct EscapeCandidate {
+    uint row = 0, col = 0;
+    /**
+     * The metric at the end of the run, or for a pruned candidate the one it
+     * had reached when it was dropped.
+     */
+    double score = 0.;
+    unsigned int ticks = 0;
+    bool pruned = false;
+};
+
+/**
+ * @brief Searches where one more escape on a layout clears its smoke best.
+ *
+ * Each candidate cell, a floor or a wall, is turned into an escape in a run
+ * of its own, all runs starting from the layout with its emitters. The
+ * candidates are the members of ensembles, see Ensemble, that are handed out
+ * to the workers one at a time like the runs of a sweep, so that one
+ * synchronous sweep of the layout advances several of them.
+ *
+ * Both metrics only grow over a run, so a candidate whose metric already
+ * exceeds the final one of a candidate that ran to the end cannot beat it,
+ * and is dropped there; an ensemble stops once all its members are. The
+ * best candidate is never dropped, so it does not depend on the number of
+ * jobs, though which others are does.
+ */
+class EscapeSearch {
+   private:
+    Board* layout;
+    // The lowest final metric so far, that candidates are pruned above
+    std::atomic<double> bound;
+    void runEnsemble(const std::vector<size_t>& members,
+                     std::vector<EscapeCandidate>* candidates);
+
+   public:
+    /**
+     * @brief What the search minimises, per floor cell of the layout: the
+     * dose, the density added up over the ticks, or the exposure, the ticks
+     * spent above the threshold.
+     */
+    enum Metric { Dose, Exposure };
+    Metric metric = Metric::Dose;
+    float threshold = .3f;
+    unsigned long ticks = 100;
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    /**
+     * Candidates advanced together as one Ensemble.
+     */
+    uint ensemble_size = 8;
+    /**
+     * @brief Search over a layout in float storage, which must have its
+     * weights computed.
+     *
+     * The search takes ownership of the layout and never modifies it.
+     */
+    EscapeSearch(Board* layout) { this->layout = layout; }
+    ~EscapeSearch() { delete this->layout; }
+    EscapeSearch(const EscapeSearch&) = delete;
+    EscapeSearch& operator=(const EscapeSearch&) = delete;
+    /**
+     * @brief List the floor cells of a layout next to a wall or to the edge
+     * of the board, where a door or a vent could open, row by row.
+     * @param step Keep every step-th of them only.
+     */
+    static std::vector<std::pair<uint, uint>> findCandidates(Board* layout,
+                                                             uint step = 1);
+    /**
+     * @brief Run every candidate, pruning those that cannot be the best.
+     * @param jobs Number of ensembles to advance concurrently.
+     * @return How each candidate did, in the same order.
+     */
+    std::vector<EscapeCandidate> run(
+        const std::vector<std::pair<uint, uint>>& cells, uint jobs);
+};
+
+/**
+ * @brief A change a branch makes to the board it forks: the rate of an
+ * escape, 0 closing it, or a new emitter on a floor cell.
+ */
+struct BranchChange {
+    uint row, col;
+    float rate;
+};
+
+/**
+ * @brief Continue a simulation along several branches, concurrently.
+ *
+ * Each branch forks the trunk, which is left as it is, makes its changes and
+ * runs for the given number of ticks or until it converges. The branches
+ * share the arrays of the trunk they do not write, so the common prefix is
+ * neither simulated nor stored again. Branches are single-threaded and are
+ * handed out to the workers one at a time, like the runs of a sweep.
+ *
+ * @param finish If set, called on each branch once it is done, from the
+ * thread that ran it.
+ * @return The result of each branch, in the same order.
+ */
+std::vector<SweepResult> runBranches(
+    Sim& trunk, const std::vector<std::vector<BranchChange>>& branches,
+    unsigned long ticks, uint jobs,
+    const std::function<void(size_t, Sim&)>& finish = nullptr);
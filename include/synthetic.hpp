@@ -0,0 +1,91 @@
+/**
+ * @file synthetic.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "board.hpp"
+
+/**
+ * @brief Settings of a generated layout, see generateLayout().
+ *
+ * Synthetic layouts can be opened wherever a layout file is expected by
+ * giving "synthetic:KIND:WIDTHxHEIGHT[:WALLS[:SEED]]" as its path, KIND
+ * being rooms, maze or hall and WALLS the wall fraction.
+ */
+struct Synthetic {
+    /**
+     * @brief Shapes of generated layouts:
+     *
+     *  - Rooms: a grid of rooms, each with a door to each of its neighbours,
+     *    cut by a corridor every fourth row and column of rooms, their walls
+     *    covering at most a quarter of it;
+     *  - Maze: a perfect maze, every floor cell reachable along one path,
+     *    its corridors as wide as the wall fraction allows;
+     *  - Hall: an open floor scattered with 2x2 pillars, at most 40% of it.
+     */
+    enum Kind { Rooms, Maze, Hall };
+    Kind kind = Rooms;
+    uint width = 1024;
+    uint height = 1024;
+    /**
+     * Share of the cells that are walls, which the rooms and mazes only
+     * approach, as their walls are one cell thick and their rooms and
+     * corridors a whole number of cells wide.
+     */
+    float wall_fraction = .2f;
+    uint32_t seed = 0;
+    /**
+     * @brief Parse "KIND:WIDTHxHEIGHT[:WALLS[:SEED]]".
+     */
+    static Synthetic parse(const std::string& spec);
+};
+
+/**
+ * @brief Prefix of the paths that stand for a synthetic layout.
+ */
+constexpr char synthetic_prefix[] = "synthetic:";
+
+/**
+ * @brief Check whether a path stands for a synthetic layout.
+ */
+bool isSyntheticLayout(const std::string& path);
+
+/**
+ * @brief Generate the characters of a synthetic layout, row by row with no
+ * line terminators, with an escape in each corner.
+ *
+ * Rows are generated in bands, one per thread, each cell drawing its random
+ * numbers from a counter-based generator, so that the layout only depends on
+ * the settings, whatever the number of threads.
+ *
+ * @param threads Threads generating rows, or 0 for one per core.
+ */
+std::vector<char> generateLayout(const Synthetic& synthetic,
+                                 uint threads = 0);
+
+/**
+ * @brief Generate a synthetic layout and make a board of it, with an emitter
+ * on the floor cell closest to its centre and the weights ready.
+ */
+Board* generateBoard(const Synthetic& synthetic, uint threads = 0);
@@ -0,0 +1,184 @@
+/**
+ * @file texture.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <GL/gl.h>
+
+#include "colormap.hpp"
+#include "sim.hpp"
+
+/**
+ * @brief A texture displaying the state of a simulation.
+ *
+ * Only the densities are uploaded, quantised to one byte per cell, and a
+ * fragment shader colour-maps them with the palette, along with the walls,
+ * emitters and escapes, whose types and rates are only uploaded again when
+ * they change. Storage is allocated once per board size and the levels are
+ * streamed with glTexSubImage2D through a pair of pixel buffer objects, so
+ * that they are written straight into driver memory and the upload can
+ * proceed asynchronously. Updates from the board itself only quantise and
+ * upload the rows it changed since the texture last showed it, see
+ * Board::markRows(), and do nothing at all when nothing changed in between.
+ *
+ * Only a view of the board is displayed, typically the part of it that is
+ * on screen, downsampled when zoomed out so that there is at most a texel
+ * per pixel. Display costs then follow the size of the screen rather than
+ * that of the board, which can be larger than any texture. Requires an
+ * OpenGL 3.0 context to be current whenever any method is called.
+ *
+ * The texture can also show how the densities differ from those of a
+ * reference board, see setReference(). The densities of both are then
+ * uploaded as floats, each only in the rows its board changed, and the
+ * difference is taken and colour-mapped in a shader.
+ */
+class BoardTexture {
+   private:
+    GLuint display = 0;
+    GLuint framebuffer = 0;
+    GLuint levels = 0;
+    GLuint cells = 0;
+    GLuint palette_texture = 0;
+    GLuint program = 0;
+    // Densities of the board and of the reference, when showing both
+    GLuint values = 0;
+    GLuint reference_values = 0;
+    GLuint difference_program = 0;
+    GLuint vertex_array = 0;
+    GLuint pbos[2] = {0, 0};
+    size_t pbo_bytes[2] = {0, 0};
+    uint next_pbo = 0;
+    // Size of the textures, which may be larger than the view shown
+    uint width = 0;
+    uint height = 0;
+    BoardView view;
+    BoardView view_shown;
+    // Generations of the board last shown, or 0 if it was anything else
+    unsigned long generation = 0;
+    unsigned long cell_generation = 0;
+    Board* reference = nullptr;
+    Board* reference_shown = nullptr;
+    unsigned long reference_generation = 0;
+    float difference_scale_shown = 0.f;
+    bool showed_arrivals = false;
+    bool showed_doses = false;
+    bool showed_difference = false;
+    float dose_limit_shown = 0.f;
+    Palette palette_shown = Palette::Grey;
+    float emitter_rate = -1.f;
+    float escape_rate = -1.f;
+    void allocate(uint width, uint height);
+    void release();
+    void uploadLevels(Sim& sim, const float* densities, const uint* arrivals,
+                      const double* doses, uint begin, uint end);
+    void uploadValues(GLuint texture, Board* board, const float* densities,
+                      uint begin, uint end);
+    void uploadCells(Sim& sim);
+    void render();
+    BoardView clampView(Board* board);
+    void getChangedRows(Board* board, unsigned long since, uint* begin,
+                        uint* end);
+
+   public:
+    /**
+     * Colour map of the floor densities, applied on the next update.
+     */
+    Palette palette = Palette::Grey;
+    /**
+     * Dose occupants can tolerate, in density ticks, that doses are scaled
+     * to on the next update, see toDoseLevels().
+     */
+    float dose_limit = 100.f;
+    /**
+     * Difference from the reference shown in the strongest colour, red
+     * where the board is denser and blue where the reference is.
+     */
+    float difference_scale = .1f;
+    /**
+     * Milliseconds spent quantising the densities and handing them over to
+     * the driver, added up over every update until the caller resets them.
+     * Uploads from a pixel buffer proceed after update() returns, so the
+     * upload time is only what it costs the calling thread, colour-mapping
+     * on the GPU included.
+     */
+    double pixmap_time = 0.;
+    double upload_time = 0.;
+    BoardTexture() = default;
+    ~BoardTexture();
+    BoardTexture(const BoardTexture&) = delete;
+    BoardTexture& operator=(const BoardTexture&) = delete;
+    GLuint getTexture() { return this->display; }
+    /**
+     * @brief Add the bytes of the textures to a footprint, as "textures",
+     * and of the pixel buffers the levels are streamed through, as "pixmap".
+     * Both are held by the driver, typically in video memory.
+     */
+    void addFootprint(Footprint* footprint);
+    /**
+     * @brief Get the texture coordinates of the far corner of the view.
+     */
+    void getExtent(float* u, float* v) {
+        *u = this->width > 0 ? (float)this->view_shown.getWidth() / this->width
+                             : 0.f;
+        *v = this->height > 0
+                 ? (float)this->view_shown.getHeight() / this->height
+                 : 0.f;
+    }
+    /**
+     * @brief Display a view of the board from the next update on, or the
+     * whole board if the view is empty.
+     * @return Whether the view changed, which redraws all of it.
+     */
+    bool setView(const BoardView& view) {
+        if (view == this->view) return false;
+        this->view = view;
+        return true;
+    }
+    /**
+     * @brief Get the view last displayed, clamped to the board.
+     */
+    const BoardView& getView() { return this->view_shown; }
+    /**
+     * @brief Show the densities minus those of a reference board from the
+     * next update on, instead of the densities, or the densities again if
+     * null.
+     *
+     * The reference must be the size of the board, and is only uploaded in
+     * the rows it changed since, so it has to mark them, see
+     * Board::markRows().
+     */
+    void setReference(Board* reference) { this->reference = reference; }
+    /**
+     * @brief Colour-map the simulation into the texture.
+     * @param densities Densities to display instead of the current ones,
+     * which redraws the whole board.
+     * @param arrivals Arrival map to display instead of the densities, see
+     * toArrivalLevels(). It is scaled to the latest arrival, so the whole
+     * board is uploaded again whenever it changes.
+     * @param doses Doses to display instead of the densities, unless
+     * arrivals are, see toDoseLevels(). Every dose changes on each tick, so
+     * the whole board is uploaded again whenever it does.
+     *
+     * Arrivals and doses are not shown while a reference is.
+     */
+    void update(Sim& sim, const float* densities = nullptr,
+                const uint* arrivals = nullptr,
+                const double* doses = nullptr);
+};
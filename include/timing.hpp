@@ -0,0 +1,84 @@
+/**
+ * @file timing.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Adds the time spent in a scope to a total, in milliseconds.
+ */
+class ScopedTimer {
+   private:
+    double* total;
+    std::chrono::steady_clock::time_point begin;
+
+   public:
+    ScopedTimer(double* total) {
+        this->total = total;
+        this->begin = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer() {
+        *this->total += std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - this->begin)
+                            .count();
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+/**
+ * @brief The last samples of a measurement, oldest first once the window is
+ * full.
+ *
+ * Samples are kept in a ring buffer, in the layout ImGui::PlotLines() takes
+ * with getOffset() as its values_offset.
+ */
+class RollingStats {
+   private:
+    std::vector<float> samples;
+    size_t next = 0;
+    size_t count = 0;
+    mutable std::vector<float> sorted;
+
+   public:
+    /**
+     * @param window Number of samples kept.
+     */
+    RollingStats(size_t window) : samples(window) {}
+    void add(float sample);
+    void clear() { this->next = this->count = 0; }
+    const float* getSamples() const { return this->samples.data(); }
+    size_t getCount() const { return this->count; }
+    size_t getOffset() const {
+        return this->count < this->samples.size() ? 0 : this->next;
+    }
+    float getMin() const;
+    float getMax() const;
+    float getAverage() const;
+    float getSum() const;
+    /**
+     * @brief Get the smallest sample that a fraction of the samples are not
+     * above, or 0 if there are none.
+     */
+    float getPercentile(float fraction) const;
+};
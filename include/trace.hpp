@@ -0,0 +1,122 @@
+/**
+ * @file trace.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Records timed events into a ring buffer, for offline analysis.
+ *
+ * Every event covers a span of time on one thread. Once the buffer is full
+ * the oldest events are overwritten, so a trace always holds the most
+ * recent ones. Events can be recorded from any thread.
+ */
+class Tracer {
+   private:
+    struct Event {
+        const char* name;
+        uint thread;
+        int64_t begin;
+        int64_t duration;
+        const char* arg_name;
+        long arg;
+    };
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex mutex;
+    std::vector<Event> events;
+    size_t next = 0;
+    size_t count = 0;
+
+   public:
+    /**
+     * Whether events are recorded, so that tracing can be paused without
+     * detaching the tracer.
+     */
+    std::atomic<bool> enabled{true};
+    /**
+     * @param capacity Number of events kept.
+     */
+    Tracer(size_t capacity = 1 << 16);
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    /**
+     * @brief Get the time since the tracer was created, in nanoseconds.
+     */
+    int64_t now();
+    /**
+     * @brief Record an event that began at a time returned by now() and ends
+     * now.
+     *
+     * @param name A string that outlives the tracer, usually a literal, like
+     * arg_name.
+     * @param arg_name The name of a value shown along with the event, or null
+     * for none.
+     */
+    void record(const char* name, int64_t begin,
+                const char* arg_name = nullptr, long arg = 0);
+    /**
+     * @brief Forget every event recorded so far.
+     */
+    void clear();
+    /**
+     * @brief Write the events as a Chrome trace, which Perfetto and
+     * chrome://tracing can open.
+     */
+    void write(const std::string& path);
+};
+
+/**
+ * @brief Records the time spent in a scope as one event, unless the tracer is
+ * null.
+ */
+class TraceScope {
+   private:
+    Tracer* tracer;
+    const char* name;
+    const char* arg_name;
+    long arg;
+    int64_t begin = 0;
+
+   public:
+    TraceScope(Tracer* tracer, const char* name,
+               const char* arg_name = nullptr, long arg = 0) {
+        this->tracer =
+            tracer != nullptr && tracer->enabled ? tracer : nullptr;
+        this->name = name;
+        this->arg_name = arg_name;
+        this->arg = arg;
+        if (this->tracer != nullptr) this->begin = this->tracer->now();
+    }
+    ~TraceScope() {
+        if (this->tracer != nullptr)
+            this->tracer->record(this->name, this->begin, this->arg_name,
+                                 this->arg);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
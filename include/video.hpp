@@ -0,0 +1,131 @@
+/**
+ * @file video.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "colormap.hpp"
+#include "sim.hpp"
+
+/**
+ * @brief Streams the densities of a simulation, colour-mapped like the
+ * display shows them, to a video encoded by ffmpeg.
+ *
+ * capture() only quantises the densities of the cells shown to the levels
+ * of the palette: frames are coloured, scaled and piped to ffmpeg on a
+ * thread of the exporter, so that the simulation does not wait for the
+ * encoder. It only waits when max_pending frames are already queued, which
+ * keeps the memory taken by the queue bounded if the encoder cannot keep
+ * up.
+ *
+ * Frames are at most width pixels wide: boards wider than that show every
+ * step-th cell, in both directions, the smallest step that fits, and
+ * narrower ones draw each cell as a square of as many pixels as fit.
+ */
+class VideoExporter {
+   private:
+    FILE* pipe;
+    uint board_width, board_height;
+    uint every;
+    BoardView view;
+    // Pixels per cell shown, in both directions
+    uint scale;
+    size_t max_pending;
+    uint32_t colors[palette_levels];
+    /* The colour of each cell shown that is not a floor, 0 for floors,
+     * shared by the frames until the cells or the rates change. */
+    std::shared_ptr<const std::vector<uint32_t>> cells;
+    unsigned long cell_generation = 0;
+    float emitter_rate = 0.f, escape_rate = 0.f;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable room;
+    struct Frame {
+        std::vector<uint8_t> levels;
+        std::shared_ptr<const std::vector<uint32_t>> cells;
+    };
+    std::deque<Frame> pending;
+    std::vector<std::vector<uint8_t>> spare;
+    bool quit = false;
+    std::exception_ptr error;
+    unsigned long stalls = 0;
+    // Only touched by the exporter thread
+    std::vector<uint8_t> pixels;
+    void loop();
+    void write(const Frame& frame);
+    void paintCells(Sim& sim);
+
+   public:
+    /**
+     * @brief Start ffmpeg encoding a video of a board, truncating the file.
+     * @param width Pixels across the video at most.
+     * @param every Ticks between frames.
+     * @param fps Frames per second of the video.
+     */
+    VideoExporter(const std::string& path, uint board_width,
+                  uint board_height, uint width, uint every, float fps,
+                  Palette palette, size_t max_pending = 8);
+    /**
+     * @brief Encode every pending frame and wait for ffmpeg, ignoring
+     * errors.
+     */
+    ~VideoExporter();
+    VideoExporter(const VideoExporter&) = delete;
+    VideoExporter& operator=(const VideoExporter&) = delete;
+    uint getWidth() { return this->view.getWidth() * this->scale; }
+    uint getHeight() { return this->view.getHeight() * this->scale; }
+    /**
+     * @brief Add the most bytes an exporter of a board can take to a
+     * footprint, as "recorder buffers": the frames queued or spare, the
+     * colours of the cells they show and the pixels of the frame being
+     * written.
+     */
+    static void planFootprint(Footprint* footprint, uint board_width,
+                              uint board_height, uint width,
+                              size_t max_pending = 8);
+    /**
+     * @brief Queue the densities of the simulation, if a frame is due at its
+     * tick.
+     *
+     * Rethrows the error of the exporter thread, if it failed.
+     */
+    void capture(Sim& sim);
+    /**
+     * @brief Encode every pending frame and wait for ffmpeg to finish the
+     * video.
+     */
+    void close();
+    /**
+     * @brief Get how many times capture() had to wait for the exporter
+     * thread.
+     */
+    unsigned long getStalls() { return this->stalls; }
+};
@@ -0,0 +1,87 @@
+/**
+ * @file workers.hpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A persistent pool of worker threads.
+ *
+ * Threads are spawned once and parked on a condition variable between jobs,
+ * so dispatching a job every tick only costs a wake-up and a barrier.
+ */
+class WorkerPool {
+   private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(uint)>* job = nullptr;
+    unsigned long generation = 0;
+    uint pending = 0;
+    bool quit = false;
+    bool pinned = false;
+    void loop(uint worker);
+
+   public:
+    /**
+     * @param size Number of workers, including the calling thread.
+     * @param pin Pin each worker but the calling thread to a core, the n-th
+     * worker to the n-th core the process may run on, so that the memory
+     * it touches first stays on its NUMA node. Only supported on Linux.
+     */
+    WorkerPool(uint size, bool pin = false);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    uint getSize() { return this->threads.size() + 1; }
+    /**
+     * @brief Check whether the workers were meant to be pinned.
+     */
+    bool isPinned() { return this->pinned; }
+    /**
+     * @brief Get the band of items a worker owns when count of them are
+     * split between workers, in contiguous bands that are whole multiples of
+     * granularity but for the last.
+     *
+     * The split only depends on its arguments, so that jobs splitting the
+     * same items hand each worker the same band.
+     */
+    static void getBand(uint worker, uint workers, size_t count,
+                        size_t granularity, size_t* begin, size_t* end) {
+        size_t units = (count + granularity - 1) / granularity;
+        *begin = std::min(units * worker / workers * granularity, count);
+        *end = std::min(units * (worker + 1) / workers * granularity, count);
+    }
+    /**
+     * @brief Run job(worker) once on each worker and wait for all of them.
+     *
+     * The calling thread takes part as worker 0.
+     */
+    void run(const std::function<void(uint)>& job);
+};
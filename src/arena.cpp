@@ -0,0 +1,81 @@
+/**
+ * @file arena.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "arena.hpp"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+// Blocks are mapped in multiples of the size of a huge page
+constexpr size_t block_granularity = 2 << 20;
+
+Arena::Arena(size_t capacity) {
+    if (capacity > 0) this->grow(capacity);
+}
+
+Arena::~Arena() {
+    for (auto& block : this->blocks) munmap(block.base, block.size);
+}
+
+void Arena::grow(size_t size) {
+    // Each block at least doubles the capacity, like a vector
+    size = std::max(size, this->getCapacity());
+    size = (size + block_granularity - 1) / block_granularity *
+           block_granularity;
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        throw std::runtime_error("Not enough memory for the arena.");
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+    this->blocks.push_back({(char*)base, size});
+    this->used = 0;
+}
+
+void* Arena::allocate(size_t size) {
+    size = (size + alignment - 1) / alignment * alignment;
+    if (this->blocks.empty() ||
+        this->blocks.back().size - this->used < size) {
+        this->grow(size);
+    }
+    void* chunk = this->blocks.back().base + this->used;
+    this->used += size;
+    return chunk;
+}
+
+void Arena::reset() {
+    if (this->blocks.size() > 1) {
+        size_t capacity = this->getCapacity();
+        for (auto& block : this->blocks) munmap(block.base, block.size);
+        this->blocks.clear();
+        this->grow(capacity);
+    }
+    this->used = 0;
+}
+
+size_t Arena::getCapacity() {
+    size_t capacity = 0;
+    for (auto& block : this->blocks) capacity += block.size;
+    return capacity;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file bench.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project Includes
+#include "board_file.hpp"
+#include "sim.hpp"
+#include "synthetic.hpp"
+
+#ifdef SMOKEY_BENCH_GPU
+#include "egl_context.hpp"
+#include "gpu_backend.hpp"
+#endif
+
+/* Every benchmark ticks the whole board, so that the cost of a tick does not
+ * depend on how far the smoke has spread, and reports it per cell. */
+
+enum Variant { InPlace, Scalar, Simd, Threaded, MooreScalar, MooreSimd, Gpu };
+
+static const char* const variant_names[] = {
+    "inplace", "scalar", "simd", "threaded", "moore_scalar", "moore_simd",
+    "gpu"};
+
+/**
+ * @brief Place an emitter on the floor cell closest to the centre of a board
+ * and compute its weights.
+ */
+static void placeCentralEmitter(Board* board) {
+    uint rows = board->getHeight(), cols = board->getWidth();
+    long best = -1;
+    uint best_row = 0, best_col = 0;
+    for (uint row = 0; row < rows; row++) {
+        for (uint col = 0; col < cols; col++) {
+            if (board->getTypes()[board->indexOf(row, col)] != Cell::Floor)
+                continue;
+            long drow = (long)row - rows / 2, dcol = (long)col - cols / 2;
+            long distance = drow * drow + dcol * dcol;
+            if (best < 0 || distance < best) {
+                best = distance;
+                best_row = row;
+                best_col = col;
+            }
+        }
+    }
+    if (best < 0) throw std::runtime_error("The board has no floor.");
+    board->placeEmitter(best_row, best_col);
+    board->computeWeightsAround(best_row, best_col);
+}
+
+static Board* loadLayout(const std::string& name) {
+    bool has_weights;
+    Board* board = loadBoard(
+        std::string(SMOKEY_LAYOUT_DIR "/") + name + ".txt", &has_weights);
+    try {
+        placeCentralEmitter(board);
+    } catch (std::runtime_error& e) {
+        delete board;
+        throw;
+    }
+    return board;
+}
+
+/**
+ * @brief Build a square board of rooms, walled every room_size cells with a
+ * door in the middle of each wall, or a single open floor if room_size is 0.
+ */
+static Board* makeRooms(uint size, uint room_size) {
+    std::string layout((size_t)size * size, '0');
+    for (uint row = 0; room_size > 0 && row < size; row++) {
+        for (uint col = 0; col < size; col++) {
+            bool wall = row % room_size == 0 || col % room_size == 0;
+            bool door = row % room_size == room_size / 2 ||
+                        col % room_size == room_size / 2;
+            if (wall && !door) layout[(size_t)row * size + col] = '/';
+        }
+    }
+    Board* board = new Board(size, size, layout.c_str(), size);
+    placeCentralEmitter(board);
+    return board;
+}
+
+/**
+ * @brief Time Sim::cycle() on a copy of a board.
+ */
+static void benchCycle(benchmark::State& state, const Board* prototype,
+                       Variant variant) {
+    Sim sim(new Board(*prototype));
+    sim.track_activity = false;
+    sim.update_mode = variant == Variant::InPlace ? Sim::Update::InPlace
+                                                  : Sim::Update::Synchronous;
+    sim.kernel = variant == Variant::Scalar || variant == Variant::MooreScalar
+                     ? Sim::Kernel::Scalar
+                     : Sim::Kernel::Simd;
+    if (variant == Variant::MooreScalar || variant == Variant::MooreSimd)
+        sim.stencil = Sim::Stencil::Moore;
+    if (variant == Variant::Threaded)
+        sim.threads = std::max(1u, std::thread::hardware_concurrency());
+#ifdef SMOKEY_BENCH_GPU
+    GpuBackend* gpu = nullptr;
+    if (variant == Variant::Gpu) {
+        if (!makeHeadlessContext()) {
+            state.SkipWithError("No OpenGL context is available.");
+            return;
+        }
+        try {
+            gpu = new GpuBackend(sim);
+        } catch (std::runtime_error& e) {
+            state.SkipWithError(e.what());
+            return;
+        }
+        sim.setBackend(gpu);
+    }
+#endif
+    // The first tick also builds the flow coefficients
+    sim.tick();
+    sim.start();
+    for (auto _ : state) {
+        sim.cycle();
+#ifdef SMOKEY_BENCH_GPU
+        // Draw calls return long before the tick is done
+        if (gpu != nullptr) glFinish();
+#endif
+    }
+#ifdef SMOKEY_BENCH_GPU
+    if (gpu != nullptr) {
+        sim.setBackend(nullptr);
+        delete gpu;
+    }
+#endif
+    double cells = (double)sim.board->getWidth() * sim.board->getHeight();
+    state.SetItemsProcessed(state.iterations() * (int64_t)cells);
+    state.counters["per_cell"] = benchmark::Counter(
+        cells, benchmark::Counter::kIsIterationInvariantRate |
+                   benchmark::Counter::kInvert);
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    // The boards are kept for the whole run, each benchmark ticks a copy
+    std::vector<std::pair<std::string, Board*>> boards;
+    try {
+        for (auto name : {"room_8x8", "room_128x128", "corridor", "abnd_ship",
+                          "snake_9x9_obr"})
+            boards.push_back({name, loadLayout(name)});
+        boards.push_back({"open_1024", makeRooms(1024, 0)});
+        boards.push_back({"rooms_2048", makeRooms(2048, 32)});
+        // Generated boards far larger than the caches, see synthetic.hpp
+        for (auto kind : {"rooms", "maze", "hall"}) {
+            std::string spec = std::string(kind) + ":4096x4096";
+            boards.push_back({std::string("synthetic_") + kind + "_4096",
+                              generateBoard(Synthetic::parse(spec))});
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    int variants = Variant::Gpu;
+#ifdef SMOKEY_BENCH_GPU
+    variants = Variant::Gpu + 1;
+#endif
+    for (auto& board : boards) {
+        for (int variant = 0; variant < variants; variant++) {
+            std::string name = std::string("cycle/") + board.first + "/" +
+                               variant_names[variant];
+            benchmark::RegisterBenchmark(name.c_str(), benchCycle,
+                                         board.second, (Variant)variant)
+                ->UseRealTime();
+        }
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    for (auto& board : boards) delete board.second;
+    return 0;
+}
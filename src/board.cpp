@@ -0,0 +1,1069 @@
+/**
+ * @file board.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "board.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/* Every array is preceded by a count of the boards that hold it, so that
+ * forks can share the arrays of their board until they write them, and by
+ * whether it came from an arena, which frees it on reset instead. The
+ * header keeps the arrays as aligned as calloc() leaves them. */
+struct alignas(64) ArrayHeader {
+    std::atomic<uint> refs;
+    bool pooled;
+};
+
+// Cells below which a band of rows is not worth a thread of its own
+constexpr size_t band_cells = 1 << 16;
+
+// Generations are numbered across boards, so that none is ever reused
+static std::atomic<unsigned long> next_generation{0};
+
+static ArrayHeader* headerOf(const void* array) {
+    return (ArrayHeader*)((char*)array - sizeof(ArrayHeader));
+}
+
+/**
+ * @brief Allocate a zero-filled array for the board.
+ *
+ * Each quantity gets its own allocation, so even multi-million-cell boards
+ * never need a single giant block. Large callocs are served by fresh mappings
+ * whose pages are only committed when first touched, while arrays from an
+ * arena reuse pages that already are.
+ */
+template <typename T>
+static T* allocate(size_t count, Arena* arena) {
+    size_t size = sizeof(ArrayHeader) + count * sizeof(T);
+    void* block;
+    if (arena != nullptr) {
+        block = arena->allocate(size);
+        std::memset(block, 0, size);
+    } else {
+        block = calloc(1, size);
+        if (block == nullptr) {
+            throw std::runtime_error("Not enough memory for the board.");
+        }
+    }
+    new (block) ArrayHeader{{1}, arena != nullptr};
+    return (T*)((char*)block + sizeof(ArrayHeader));
+}
+
+/**
+ * @brief Drop a board's hold on an array, freeing it if it was the last.
+ */
+static void release(void* array) {
+    if (array == nullptr) return;
+    ArrayHeader* header = headerOf(array);
+    if (header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        bool pooled = header->pooled;
+        header->~ArrayHeader();
+        if (!pooled) free(header);
+    }
+}
+
+template <typename T>
+static T* share(T* array) {
+    if (array != nullptr)
+        headerOf(array)->refs.fetch_add(1, std::memory_order_relaxed);
+    return array;
+}
+
+static bool isShared(const void* array) {
+    return array != nullptr &&
+           headerOf(array)->refs.load(std::memory_order_acquire) > 1;
+}
+
+/**
+ * @brief Get the bytes of an array of the board, split evenly between the
+ * boards that share it.
+ */
+template <typename T>
+static size_t bytesOf(const T* array, size_t count) {
+    if (array == nullptr) return 0;
+    uint refs = headerOf(array)->refs.load(std::memory_order_acquire);
+    return count * sizeof(T) / std::max(refs, 1u);
+}
+
+/**
+ * @brief Give a board its own copy of an array before writing it, if the
+ * array is shared with a fork.
+ */
+template <typename T>
+static void own(T** array, size_t count, Arena* arena) {
+    if (!isShared(*array)) return;
+    T* copy = allocate<T>(count, arena);
+    std::copy(*array, *array + count, copy);
+    release(*array);
+    *array = copy;
+}
+
+void Board::allocateArrays() {
+    size_t size = this->getPaddedSize();
+    this->type = nullptr;
+    this->cost = nullptr;
+    this->omega_in = nullptr;
+    this->omega_out = nullptr;
+    this->density = nullptr;
+    this->density_next = nullptr;
+    this->storage = Board::Storage::Float;
+    this->fixed = nullptr;
+    this->fixed_next = nullptr;
+    this->precise = nullptr;
+    this->precise_next = nullptr;
+    this->decoded = true;
+    this->rate_index = nullptr;
+    this->flow = nullptr;
+    this->flow_in = nullptr;
+    for (auto dir : directions) this->flow_out[dir] = nullptr;
+    this->links = nullptr;
+    this->flow_precalc = false;
+    this->flow_bias = 0.f;
+    this->flow_valid = false;
+    try {
+        this->type = allocate<Cell::Type>(size, this->arena);
+        this->cost = allocate<char>(size, this->arena);
+        this->omega_in = allocate<float>(size, this->arena);
+        this->omega_out = allocate<float>(size, this->arena);
+        this->density = allocate<float>(size, this->arena);
+        this->density_next = allocate<float>(size, this->arena);
+        this->rate_index = allocate<uchar>(size, this->arena);
+    } catch (std::runtime_error& e) {
+        release(this->type);
+        release(this->cost);
+        release(this->omega_in);
+        release(this->omega_out);
+        release(this->density);
+        release(this->density_next);
+        throw;
+    }
+    this->rates[0] = 1.f;
+    this->rate_count = 1;
+    this->markCells(0, this->height);
+}
+
+/**
+ * @brief Get the type of cell a layout character stands for.
+ */
+static Cell::Type cellOf(char c) {
+    if (c - '0' <= -1) return Cell::Type::Wall;
+    if (c - '0' >= 10) return Cell::Type::Escape;
+    return Cell::Type::Floor;
+}
+
+/* Whether smoke can flow in from and out to a neighbour, by its type. */
+static const uchar flows_in[] = {0, 1, 1, 0};
+static const uchar flows_out[] = {0, 1, 0, 1};
+
+/**
+ * @brief Run fn(begin, end) on bands of the rows from begin to end, one per
+ * hardware thread, and wait for all of them.
+ *
+ * Boards too small to be worth the threads are done on the calling thread.
+ */
+static void forEachBand(uint begin, uint end, uint width,
+                        const std::function<void(uint, uint)>& fn) {
+    if (end <= begin) return;
+    size_t cells = (size_t)(end - begin) * width;
+    uint bands = std::max(1u, std::thread::hardware_concurrency());
+    bands = std::min<size_t>(bands, std::max<size_t>(1, cells / band_cells));
+    bands = std::min(bands, end - begin);
+    std::vector<std::thread> threads;
+    for (uint band = 1; band < bands; band++) {
+        threads.emplace_back(fn, begin + (end - begin) * band / bands,
+                             begin + (end - begin) * (band + 1) / bands);
+    }
+    fn(begin, begin + (end - begin) / bands);
+    for (auto& thread : threads) thread.join();
+}
+
+Board::Board(uint width, uint height, const char* const layout,
+             size_t layout_stride, const uchar* topology) {
+    if (layout_stride == 0) layout_stride = width;
+    this->width = width;
+    this->height = height;
+    this->stride = (size_t)width + 2;
+    this->allocateArrays();
+    /* The cells are decoded and weighted in a single pass over the layout,
+     * split in bands of rows between threads. The weights are those of a
+     * board without emitters, and each band decodes the rows around it on
+     * its own, so bands never wait on each other. */
+    forEachBand(0, height, width, [&](uint begin, uint end) {
+        // Types of the rows above, at and below the current one, padded
+        std::vector<Cell::Type> rows[3];
+        auto decode = [&](uint row, std::vector<Cell::Type>& types) {
+            types.assign(this->stride, Cell::Wall);
+            // Rows outside the board, the one before the first included
+            if (row >= height) return;
+            const char* line = layout + row * layout_stride;
+            for (uint col = 0; col < width; col++)
+                types[col + 1] = cellOf(line[col]);
+        };
+        decode(begin - 1, rows[0]);
+        decode(begin, rows[1]);
+        if (begin == 0) {
+            std::fill(this->type, this->type + this->stride, Cell::Wall);
+            std::fill(this->cost, this->cost + this->stride, -1);
+        }
+        for (uint row = begin; row < end; row++) {
+            decode(row + 1, rows[(row - begin + 2) % 3]);
+            const Cell::Type* above = rows[(row - begin) % 3].data();
+            const Cell::Type* here = rows[(row - begin + 1) % 3].data();
+            const Cell::Type* below = rows[(row - begin + 2) % 3].data();
+            const char* line = layout + row * layout_stride;
+            size_t pad = this->indexOf(row, 0) - 1;
+            std::copy(here, here + this->stride, this->type + pad);
+            this->cost[pad] = this->cost[pad + width + 1] = -1;
+            for (uint col = 0; col < width; col++) {
+                /* \0123456789:
+                 * Add -0x30 -> Obtain values in range [-1, 10], where 0-9
+                 * is floor height, -1 is a wall, and 10 is an opening. Add
+                 * 1 to obtain a valid palette index. */
+                int cost = line[col] - 0x30;
+                this->cost[pad + col + 1] = std::min(std::max(cost, -1), 10);
+                if (topology != nullptr) {
+                    uchar counts = topology[(size_t)row * width + col];
+                    this->setWeights(pad + col + 1, counts & 0xF, counts >> 4);
+                    continue;
+                }
+                Cell::Type north = above[col + 1], south = below[col + 1];
+                Cell::Type west = here[col], east = here[col + 2];
+                this->setWeights(pad + col + 1,
+                                 flows_in[north] + flows_in[south] +
+                                     flows_in[west] + flows_in[east],
+                                 flows_out[north] + flows_out[south] +
+                                     flows_out[west] + flows_out[east]);
+            }
+        }
+        if (end == height) {
+            size_t last = this->getPaddedSize() - this->stride;
+            std::fill(this->type + last, this->type + last + this->stride,
+                      Cell::Wall);
+            std::fill(this->cost + last, this->cost + last + this->stride,
+                      -1);
+        }
+    });
+}
+
+Board::Board(const Board& other, Arena* arena) {
+    this->arena = arena;
+    this->width = other.width;
+    this->height = other.height;
+    this->stride = other.stride;
+    size_t size = this->getPaddedSize();
+    this->allocateArrays();
+    std::copy(other.type, other.type + size, this->type);
+    std::copy(other.cost, other.cost + size, this->cost);
+    std::copy(other.omega_in, other.omega_in + size, this->omega_in);
+    std::copy(other.omega_out, other.omega_out + size, this->omega_out);
+    if (other.storage == Board::Storage::Float) {
+        std::copy(other.density, other.density + size, this->density);
+        std::copy(other.density_next, other.density_next + size,
+                  this->density_next);
+    } else {
+        release(this->density);
+        release(this->density_next);
+        this->density = nullptr;
+        this->density_next = nullptr;
+        if (other.storage == Board::Storage::Fixed) {
+            this->fixed = allocate<Fixed16>(size, this->arena);
+            this->fixed_next = allocate<Fixed16>(size, this->arena);
+            std::copy(other.fixed, other.fixed + size, this->fixed);
+            std::copy(other.fixed_next, other.fixed_next + size,
+                      this->fixed_next);
+        } else {
+            this->precise = allocate<double>(size, this->arena);
+            this->precise_next = allocate<double>(size, this->arena);
+            std::copy(other.precise, other.precise + size, this->precise);
+            std::copy(other.precise_next, other.precise_next + size,
+                      this->precise_next);
+        }
+        this->storage = other.storage;
+        this->decoded = false;
+    }
+    std::copy(other.rate_index, other.rate_index + size, this->rate_index);
+    std::copy(other.rates, other.rates + other.rate_count, this->rates);
+    this->rate_count = other.rate_count;
+    this->claimed_rates = other.claimed_rates;
+    this->spare_rates = other.spare_rates;
+    this->winds = other.winds;
+    if (other.flow_valid) {
+        this->flow = allocate<float>(5 * size, this->arena);
+        std::copy(other.flow, other.flow + 5 * size, this->flow);
+        this->flow_in = this->flow;
+        for (auto dir : directions) {
+            this->flow_out[dir] =
+                this->flow + (other.flow_out[dir] - other.flow);
+        }
+        this->links = allocate<uchar>(size, this->arena);
+        std::copy(other.links, other.links + size, this->links);
+        this->flow_precalc = other.flow_precalc;
+        this->flow_bias = other.flow_bias;
+        this->flow_valid = true;
+    }
+}
+
+Board::Board(uint width, uint height, Storage storage) {
+    this->width = width;
+    this->height = height;
+    this->stride = (size_t)width + 2;
+    size_t size = this->getPaddedSize();
+    this->allocateArrays();
+    std::fill(this->cost, this->cost + size, -1);
+    this->setStorage(storage);
+}
+
+Board* Board::fork() {
+    Board* copy = new Board();
+    copy->width = this->width;
+    copy->height = this->height;
+    copy->stride = this->stride;
+    copy->type = share(this->type);
+    copy->cost = share(this->cost);
+    copy->omega_in = share(this->omega_in);
+    copy->omega_out = share(this->omega_out);
+    copy->storage = this->storage;
+    // The float densities of other storages are a copy, and not shared
+    if (this->storage == Board::Storage::Float) {
+        copy->density = share(this->density);
+        copy->density_next = share(this->density_next);
+    } else {
+        copy->density = nullptr;
+        copy->density_next = nullptr;
+    }
+    copy->fixed = share(this->fixed);
+    copy->fixed_next = share(this->fixed_next);
+    copy->precise = share(this->precise);
+    copy->precise_next = share(this->precise_next);
+    copy->decoded = this->storage == Board::Storage::Float;
+    copy->rate_index = share(this->rate_index);
+    std::copy(this->rates, this->rates + this->rate_count, copy->rates);
+    copy->rate_count = this->rate_count;
+    copy->claimed_rates = this->claimed_rates;
+    copy->spare_rates = this->spare_rates;
+    copy->flow = share(this->flow);
+    copy->flow_in = copy->flow;
+    for (auto dir : directions) {
+        copy->flow_out[dir] =
+            this->flow != nullptr
+                ? copy->flow + (this->flow_out[dir] - this->flow)
+                : nullptr;
+    }
+    copy->links = share(this->links);
+    copy->flow_precalc = this->flow_precalc;
+    copy->flow_bias = this->flow_bias;
+    copy->flow_valid = this->flow_valid;
+    copy->winds = this->winds;
+    copy->markCells(0, copy->height);
+    return copy;
+}
+
+void Board::ownDensities() {
+    size_t size = this->getPaddedSize();
+    switch (this->storage) {
+        case Board::Storage::Float:
+            own(&this->density, size, this->arena);
+            own(&this->density_next, size, this->arena);
+            break;
+        case Board::Storage::Fixed:
+            own(&this->fixed, size, this->arena);
+            own(&this->fixed_next, size, this->arena);
+            break;
+        case Board::Storage::Double:
+            own(&this->precise, size, this->arena);
+            own(&this->precise_next, size, this->arena);
+            break;
+    }
+}
+
+void Board::syncDensities(uint begin, uint end) {
+    if (begin >= end) return;
+    size_t first = (size_t)(begin + 1) * this->stride,
+           last = (size_t)(end + 1) * this->stride;
+    switch (this->storage) {
+        case Board::Storage::Float:
+            std::copy(this->density + first, this->density + last,
+                      this->density_next + first);
+            break;
+        case Board::Storage::Fixed:
+            std::copy(this->fixed + first, this->fixed + last,
+                      this->fixed_next + first);
+            break;
+        case Board::Storage::Double:
+            std::copy(this->precise + first, this->precise + last,
+                      this->precise_next + first);
+            break;
+    }
+}
+
+void Board::ownWeights() {
+    size_t size = this->getPaddedSize();
+    own(&this->omega_in, size, this->arena);
+    own(&this->omega_out, size, this->arena);
+}
+
+Board::~Board() {
+    release(this->type);
+    release(this->cost);
+    release(this->omega_in);
+    release(this->omega_out);
+    release(this->density);
+    release(this->density_next);
+    release(this->fixed);
+    release(this->fixed_next);
+    release(this->precise);
+    release(this->precise_next);
+    release(this->rate_index);
+    release(this->flow);
+    release(this->links);
+}
+
+void Board::addFootprint(Footprint* footprint) {
+    size_t size = this->getPaddedSize();
+    footprint->add("cells",
+                   bytesOf(this->type, size) + bytesOf(this->cost, size) +
+                       bytesOf(this->rate_index, size) +
+                       bytesOf(this->links, size) +
+                       this->row_generations.capacity() *
+                           sizeof(unsigned long));
+    footprint->add("weights", bytesOf(this->omega_in, size) +
+                                  bytesOf(this->omega_out, size));
+    footprint->add("flows", bytesOf(this->flow, 5 * size));
+    footprint->add("densities",
+                   bytesOf(this->density, size) +
+                       bytesOf(this->density_next, size) +
+                       bytesOf(this->fixed, size) +
+                       bytesOf(this->fixed_next, size) +
+                       bytesOf(this->precise, size) +
+                       bytesOf(this->precise_next, size));
+}
+
+void Board::planFootprint(Footprint* footprint, Storage storage,
+                          bool decoded) {
+    size_t size = this->getPaddedSize();
+    footprint->add("cells", 4 * size + this->height * sizeof(unsigned long));
+    footprint->add("weights", 2 * size * sizeof(float));
+    footprint->add("flows", 5 * size * sizeof(float));
+    size_t densities = 0;
+    switch (storage) {
+        case Board::Storage::Float:
+            densities = 2 * size * sizeof(float);
+            break;
+        case Board::Storage::Fixed:
+            densities = 2 * size * sizeof(Fixed16);
+            break;
+        case Board::Storage::Double:
+            densities = 2 * size * sizeof(double);
+            break;
+    }
+    if (storage != Board::Storage::Float && decoded)
+        densities += size * sizeof(float);
+    footprint->add("densities", densities);
+}
+
+uchar Board::indexOfRate(float rate) {
+    if (!(rate >= 0.f)) {
+        throw std::runtime_error("Rates must not be negative.");
+    }
+    for (uint i = 0; i < this->rate_count; i++) {
+        if (this->rates[i] == rate && !this->claimed_rates[i]) return i;
+    }
+    if (this->rate_count == 256) {
+        throw std::runtime_error("Too many distinct emitter and escape rates.");
+    }
+    this->rates[this->rate_count] = rate;
+    return this->rate_count++;
+}
+
+void Board::setRates(const float* rates, uint count) {
+    if (count == 0 || count > 256 || rates[0] != 1.f) {
+        throw std::runtime_error("Invalid table of rates.");
+    }
+    std::copy(rates, rates + count, this->rates);
+    this->rate_count = count;
+    this->claimed_rates.reset();
+    this->spare_rates.clear();
+    this->flow_valid = false;
+    // Emitters and escapes are coloured by their rates
+    this->markCells(0, this->height);
+}
+
+void Board::claimRate(uint row, uint col) {
+    if (!this->contains(row, col))
+        throw std::runtime_error("Cell coordinates out of bounds.");
+    size_t idx = this->indexOf(row, col);
+    if (this->type[idx] != Cell::Emitter && this->type[idx] != Cell::Escape)
+        throw std::runtime_error("Only emitters and escapes have rates.");
+    uchar index = this->rate_index[idx];
+    if (this->claimed_rates[index]) return;
+    uchar claimed;
+    if (!this->spare_rates.empty()) {
+        claimed = this->spare_rates.back();
+        this->spare_rates.pop_back();
+    } else if (this->rate_count < 256) {
+        claimed = this->rate_count++;
+        this->claimed_rates.set(claimed);
+    } else {
+        throw std::runtime_error("Too many distinct emitter and escape rates.");
+    }
+    this->rates[claimed] = this->rates[index];
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->rate_index[idx] = claimed;
+}
+
+void Board::setClaimedRate(uint row, uint col, float rate) {
+    if (!this->contains(row, col) || !this->hasClaimedRate(row, col))
+        throw std::runtime_error("The cell has not claimed a rate.");
+    if (!(rate >= 0.f))
+        throw std::runtime_error("Rates must not be negative.");
+    uchar index = this->rate_index[this->indexOf(row, col)];
+    if (this->rates[index] == rate) return;
+    this->rates[index] = rate;
+    this->markCells(row, row + 1);
+}
+
+void Board::releaseRate(uint row, uint col) {
+    if (!this->contains(row, col) || !this->hasClaimedRate(row, col))
+        return;
+    size_t idx = this->indexOf(row, col);
+    uchar index = this->rate_index[idx];
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->spareRate(idx);
+    this->rate_index[idx] = this->indexOfRate(this->rates[index]);
+}
+
+void Board::spareRate(size_t idx) {
+    uchar index = this->rate_index[idx];
+    if (this->claimed_rates[index]) this->spare_rates.push_back(index);
+}
+
+std::vector<std::pair<void*, size_t>> Board::getStateArrays() {
+    size_t size = this->getPaddedSize();
+    std::vector<std::pair<void*, size_t>> arrays = {
+        {this->type, size * sizeof(Cell::Type)},
+        {this->cost, size * sizeof(char)},
+        {this->omega_in, size * sizeof(float)},
+        {this->omega_out, size * sizeof(float)},
+        {this->rate_index, size * sizeof(uchar)}};
+    switch (this->storage) {
+        case Board::Storage::Float:
+            arrays.push_back({this->density, size * sizeof(float)});
+            break;
+        case Board::Storage::Fixed:
+            arrays.push_back({this->fixed, size * sizeof(Fixed16)});
+            break;
+        case Board::Storage::Double:
+            arrays.push_back({this->precise, size * sizeof(double)});
+            break;
+    }
+    return arrays;
+}
+
+void Board::placeEmitter(uint row, uint col, float rate) {
+    if (!this->contains(row, col)) {
+        throw std::runtime_error("Emitter coordinates out of bounds.");
+    }
+    size_t idx = this->indexOf(row, col);
+    if (this->type[idx] != Cell::Type::Floor) {
+        throw std::runtime_error("Emitter not on floor tile.");
+    }
+    own(&this->type, this->getPaddedSize(), this->arena);
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->ownDensities();
+    this->rate_index[idx] = this->indexOfRate(rate);
+    this->type[idx] = Cell::Type::Emitter;
+    this->flow_valid = false;
+    this->markCells(row, row + 1);
+    this->writeDensity(idx, 1.f);
+}
+
+/**
+ * @brief Allocate both density buffers of a storage, or neither.
+ */
+template <typename T>
+static void allocateDensities(size_t size, T** current, T** next,
+                              Arena* arena) {
+    *current = allocate<T>(size, arena);
+    try {
+        *next = allocate<T>(size, arena);
+    } catch (std::runtime_error& e) {
+        release(*current);
+        *current = nullptr;
+        throw;
+    }
+}
+
+void Board::setStorage(Storage storage) {
+    if (storage == this->storage) return;
+    size_t size = this->getPaddedSize();
+    // Converting can round the densities
+    this->markRows(0, this->height);
+    // Conversions go through float storage
+    if (this->storage != Board::Storage::Float) {
+        this->decodeDensities();
+        this->density_next = allocate<float>(size, this->arena);
+        for (size_t idx = 0; idx < size; idx++) {
+            this->density_next[idx] =
+                this->storage == Board::Storage::Fixed
+                    ? decodeDensity(this->fixed_next[idx])
+                    : (float)this->precise_next[idx];
+        }
+        release(this->fixed);
+        release(this->fixed_next);
+        release(this->precise);
+        release(this->precise_next);
+        this->fixed = nullptr;
+        this->fixed_next = nullptr;
+        this->precise = nullptr;
+        this->precise_next = nullptr;
+        this->storage = Board::Storage::Float;
+    }
+    if (storage == Board::Storage::Float) return;
+    if (storage == Board::Storage::Fixed) {
+        allocateDensities(size, &this->fixed, &this->fixed_next,
+                          this->arena);
+        for (size_t idx = 0; idx < size; idx++) {
+            this->fixed[idx] = encodeDensity(this->density[idx]);
+            this->fixed_next[idx] = encodeDensity(this->density_next[idx]);
+        }
+    } else {
+        allocateDensities(size, &this->precise, &this->precise_next,
+                          this->arena);
+        std::copy(this->density, this->density + size, this->precise);
+        std::copy(this->density_next, this->density_next + size,
+                  this->precise_next);
+    }
+    release(this->density);
+    release(this->density_next);
+    this->density = nullptr;
+    this->density_next = nullptr;
+    this->storage = storage;
+    this->decoded = false;
+}
+
+void Board::decodeDensities() {
+    size_t size = this->getPaddedSize();
+    if (this->density == nullptr)
+        this->density = allocate<float>(size, this->arena);
+    if (this->storage == Board::Storage::Fixed) {
+        for (size_t idx = 0; idx < size; idx++)
+            this->density[idx] = decodeDensity(this->fixed[idx]);
+    } else {
+        for (size_t idx = 0; idx < size; idx++)
+            this->density[idx] = (float)this->precise[idx];
+    }
+    this->decoded = true;
+}
+
+void Board::setEscapeRate(uint row, uint col, float rate) {
+    if (!this->contains(row, col)) {
+        throw std::runtime_error("Escape coordinates out of bounds.");
+    }
+    size_t idx = this->indexOf(row, col);
+    if (this->type[idx] != Cell::Type::Escape) {
+        throw std::runtime_error("Not an escape tile.");
+    }
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->spareRate(idx);
+    this->rate_index[idx] = this->indexOfRate(rate);
+    this->markCells(row, row + 1);
+}
+
+void Board::setEmitterRate(uint row, uint col, float rate) {
+    if (!this->contains(row, col)) {
+        throw std::runtime_error("Emitter coordinates out of bounds.");
+    }
+    size_t idx = this->indexOf(row, col);
+    if (this->type[idx] != Cell::Type::Emitter) {
+        throw std::runtime_error("Not an emitter tile.");
+    }
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->spareRate(idx);
+    this->rate_index[idx] = this->indexOfRate(rate);
+    this->markCells(row, row + 1);
+}
+
+void Board::setCellType(uint row, uint col, Cell::Type type) {
+    if (!this->contains(row, col)) {
+        throw std::runtime_error("Cell coordinates out of bounds.");
+    }
+    if (type == Cell::Type::Emitter) {
+        throw std::runtime_error("Emitters are placed with placeEmitter().");
+    }
+    size_t idx = this->indexOf(row, col);
+    if (this->type[idx] == Cell::Type::Emitter) {
+        throw std::runtime_error("Emitters cannot be changed.");
+    }
+    if (this->type[idx] == type) return;
+    bool flow_valid = this->flow_valid;
+    own(&this->type, this->getPaddedSize(), this->arena);
+    own(&this->cost, this->getPaddedSize(), this->arena);
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->ownDensities();
+    this->type[idx] = type;
+    // Like the layout characters, see Board()
+    this->cost[idx] = type == Cell::Type::Wall     ? -1
+                      : type == Cell::Type::Escape ? 10
+                                                   : 0;
+    this->spareRate(idx);
+    this->rate_index[idx] = 0;
+    this->markCells(row, row + 1);
+    this->writeDensity(idx, 0.f);
+    this->computeWeightsAround(row, col);
+    if (flow_valid) this->computeFlowAround(row, col);
+}
+
+void Board::writeDensity(size_t idx, float density) {
+    switch (this->storage) {
+        case Board::Storage::Float:
+            this->density[idx] = density;
+            this->density_next[idx] = density;
+            break;
+        case Board::Storage::Fixed:
+            this->fixed[idx] = encodeDensity(density);
+            this->fixed_next[idx] = encodeDensity(density);
+            this->decoded = false;
+            break;
+        case Board::Storage::Double:
+            this->precise[idx] = density;
+            this->precise_next[idx] = density;
+            this->decoded = false;
+            break;
+    }
+}
+
+std::vector<size_t> Board::paintCells(const std::vector<size_t>& cells,
+                                      Cell::Type type, float rate) {
+    if (!(rate >= 0.f))
+        throw std::runtime_error("Rates must not be negative.");
+    bool sourced = type == Cell::Type::Emitter || type == Cell::Type::Escape;
+    std::vector<size_t> changed;
+    for (size_t idx : cells) {
+        if (this->type[idx] != type ||
+            (sourced && this->rates[this->rate_index[idx]] != rate))
+            changed.push_back(idx);
+    }
+    if (changed.empty()) return changed;
+    bool flow_valid = this->flow_valid;
+    own(&this->type, this->getPaddedSize(), this->arena);
+    own(&this->cost, this->getPaddedSize(), this->arena);
+    own(&this->rate_index, this->getPaddedSize(), this->arena);
+    this->ownDensities();
+    uchar index = sourced ? this->indexOfRate(rate) : 0;
+    uint first = this->height, last = 0;
+    for (size_t idx : changed) {
+        this->type[idx] = type;
+        // Like the layout characters, see Board()
+        this->cost[idx] = type == Cell::Type::Wall     ? -1
+                          : type == Cell::Type::Escape ? 10
+                                                       : 0;
+        this->spareRate(idx);
+        this->rate_index[idx] = index;
+        this->writeDensity(idx, type == Cell::Type::Emitter ? 1.f : 0.f);
+        first = std::min(first, this->rowOf(idx));
+        last = std::max(last, this->rowOf(idx) + 1);
+    }
+    this->markCells(first, last);
+    // The cells changed and their neighbours, each once
+    std::vector<size_t> around;
+    around.reserve(changed.size() * 5);
+    for (size_t idx : changed) {
+        around.push_back(idx);
+        for (auto dir : directions) {
+            size_t adj = this->neighbourOf(dir, idx);
+            if (this->contains(this->rowOf(adj), this->colOf(adj)))
+                around.push_back(adj);
+        }
+    }
+    std::sort(around.begin(), around.end());
+    around.erase(std::unique(around.begin(), around.end()), around.end());
+    for (size_t idx : around) {
+        uint ins, outs;
+        this->countNeighbours(idx, &ins, &outs);
+        this->setWeights(idx, ins, outs);
+    }
+    if (flow_valid) this->computeFlowOfCells(around);
+    return changed;
+}
+
+std::vector<size_t> Board::paintSmoke(const std::vector<size_t>& cells,
+                                      float density) {
+    if (!(density >= 0.f && density <= 1.f))
+        throw std::runtime_error("Densities must be in [0, 1].");
+    const float* current = this->getDensities();
+    std::vector<size_t> changed;
+    for (size_t idx : cells) {
+        if (this->type[idx] == Cell::Type::Floor && current[idx] != density)
+            changed.push_back(idx);
+    }
+    if (changed.empty()) return changed;
+    this->ownDensities();
+    uint first = this->height, last = 0;
+    for (size_t idx : changed) {
+        this->writeDensity(idx, density);
+        first = std::min(first, this->rowOf(idx));
+        last = std::max(last, this->rowOf(idx) + 1);
+    }
+    this->markRows(first, last);
+    return changed;
+}
+
+void Board::addWind(const Wind& wind) {
+    // Sizes are checked against what is left of the board, as the far
+    // corner could wrap around
+    if (!this->contains(wind.row, wind.col) || wind.rows == 0 ||
+        wind.cols == 0 || wind.rows > this->height - wind.row ||
+        wind.cols > this->width - wind.col) {
+        throw std::runtime_error("Winds must lie within the board.");
+    }
+    if (!std::isfinite(wind.strength))
+        throw std::runtime_error("The strength of a wind must be finite.");
+    this->winds.push_back(wind);
+    this->flow_valid = false;
+}
+
+void Board::markRows(uint begin, uint end) {
+    if (begin >= end) return;
+    this->row_generations.resize(this->height, 0);
+    this->generation = ++next_generation;
+    std::fill(this->row_generations.begin() + begin,
+              this->row_generations.begin() + end, this->generation);
+}
+
+void Board::markCells(uint begin, uint end) {
+    this->markRows(begin, end);
+    this->cell_generation = this->generation;
+}
+
+void Board::getChangedRows(unsigned long since, uint* begin, uint* end) {
+    *begin = *end = 0;
+    if (this->generation <= since) return;
+    uint row = 0;
+    while (row < this->height && this->row_generations[row] <= since) row++;
+    *begin = row;
+    *end = this->height;
+    while (*end > row && this->row_generations[*end - 1] <= since) (*end)--;
+}
+
+void Board::countNeighbours(size_t idx, uint* ins, uint* outs) {
+    *ins = 0;
+    *outs = 0;
+    for (auto dir : directions) {
+        Cell::Type neighbour = this->type[this->neighbourOf(dir, idx)];
+        *ins += flows_in[neighbour];
+        *outs += flows_out[neighbour];
+    }
+}
+
+/* Calculate how many inputs and outputs a cell has. This in turn will affect
+ * the propagation rate. */
+void Board::computeWeights(uint begin, uint end) {
+    this->flow_valid = false;
+    // Each cell only writes its own weights, so bands can go in parallel
+    forEachBand(begin, std::min(end, this->height), this->width,
+                [&](uint begin, uint end) {
+                    for (uint row = begin; row < end; row++) {
+                        for (uint col = 0; col < this->width; col++) {
+                            size_t idx = this->indexOf(row, col);
+                            uint ins, outs;
+                            this->countNeighbours(idx, &ins, &outs);
+                            this->setWeights(idx, ins, outs);
+                        }
+                    }
+                });
+}
+
+void Board::computeWeightsAround(uint row, uint col) {
+    this->flow_valid = false;
+    // Rows and columns before the first one wrap around and are skipped
+    for (uint r = row - 1; r != row + 2; r++) {
+        for (uint c = col - 1; c != col + 2; c++) {
+            if ((r != row && c != col) || !this->contains(r, c)) continue;
+            size_t idx = this->indexOf(r, c);
+            uint ins, outs;
+            this->countNeighbours(idx, &ins, &outs);
+            this->setWeights(idx, ins, outs);
+        }
+    }
+}
+
+/**
+ * @brief Get the scale of the flow towards a neighbour by the rise to it, from
+ * -9 to 9 as floor heights go from 0 to 9.
+ */
+static void riseScales(float bias, float* scales) {
+    for (int rise = -9; rise <= 9; rise++)
+        scales[rise + 9] = std::exp(bias * rise);
+}
+
+void Board::computeFlowOf(size_t idx, bool use_precalc_weights,
+                          const float* scales, const float* push) {
+    float omega_in = .25f, omega_out = .25f;
+    if (use_precalc_weights) {
+        omega_in = this->omega_in[idx];
+        omega_out = this->omega_out[idx];
+    }
+    this->flow_in[idx] = omega_in;
+    uchar links = 0;
+    for (auto dir : directions) {
+        if (this->type[idx] != Cell::Floor) break;
+        links |= this->type[this->neighbourOf(dir, idx)] << (2 * dir);
+    }
+    this->links[idx] = links;
+    float lift[4] = {1.f, 1.f, 1.f, 1.f};
+    if (this->type[idx] == Cell::Floor || this->type[idx] == Cell::Emitter) {
+        float scale[4] = {0.f, 0.f, 0.f, 0.f}, total = 0.f;
+        uint outs = 0;
+        for (auto dir : directions) {
+            size_t adj = this->neighbourOf(dir, idx);
+            if (this->type[adj] == Cell::Floor) {
+                scale[dir] = scales[this->cost[adj] - this->cost[idx] + 9];
+            } else if (this->type[adj] == Cell::Escape) {
+                scale[dir] = 1.f;
+            } else {
+                continue;
+            }
+            if (push != nullptr && push[dir] != 0.f)
+                scale[dir] *= std::exp(push[dir]);
+            total += scale[dir];
+            outs++;
+        }
+        for (auto dir : directions) {
+            if (scale[dir] > 0.f) lift[dir] = outs * scale[dir] / total;
+        }
+    }
+    for (auto dir : directions)
+        this->flow_out[dir][idx] = omega_out * lift[dir];
+}
+
+void Board::computeFlowCoefficients(bool use_precalc_weights, float bias,
+                                    WorkerPool* workers, uint band_rows) {
+    size_t size = this->getPaddedSize();
+    /* The inflow coefficients and the outflow ones of every direction share
+     * one allocation. Without floor heights the four directions are the same
+     * and read the same plane, which keeps it in the cache. */
+    if (isShared(this->flow)) {
+        // Every coefficient is rewritten, there is nothing to copy
+        release(this->flow);
+        release(this->links);
+        this->flow = nullptr;
+        this->links = nullptr;
+    }
+    if (this->flow == nullptr) {
+        this->flow = allocate<float>(5 * size, this->arena);
+        this->links = allocate<uchar>(size, this->arena);
+    }
+    this->flow_in = this->flow;
+    bool isotropic = bias == 0.f && this->winds.empty();
+    for (auto dir : directions)
+        this->flow_out[dir] = this->flow + (isotropic ? 1 : 1 + dir) * size;
+    float scales[19];
+    riseScales(bias, scales);
+    auto compute = [&](uint begin, uint end) {
+        // Clear the rows of every plane first, their border included
+        size_t first = begin == 0 ? 0 : (size_t)(begin + 1) * this->stride;
+        size_t last = end == this->height ? size
+                                          : (size_t)(end + 1) * this->stride;
+        for (size_t plane = 0; plane < 5; plane++) {
+            std::fill(this->flow + plane * size + first,
+                      this->flow + plane * size + last, 0.f);
+        }
+        std::fill(this->links + first, this->links + last, 0);
+        for (uint row = begin; row < end; row++) {
+            // How hard the winds over the row push each cell in each direction
+            std::vector<std::array<float, 4>> push;
+            for (auto& wind : this->winds) {
+                if (row < wind.row || row >= wind.row + wind.rows) continue;
+                if (push.empty())
+                    push.assign(this->width, {0.f, 0.f, 0.f, 0.f});
+                for (uint col = wind.col; col < wind.col + wind.cols; col++) {
+                    push[col][wind.dir] += wind.strength;
+                    push[col][wind.dir ^ 1] -= wind.strength;
+                }
+            }
+            for (uint col = 0; col < this->width; col++) {
+                this->computeFlowOf(this->indexOf(row, col),
+                                    use_precalc_weights, scales,
+                                    push.empty() ? nullptr : push[col].data());
+            }
+        }
+    };
+    if (workers == nullptr) {
+        compute(0, this->height);
+    } else {
+        // Each worker first touches the pages of the band it updates
+        workers->run([&](uint worker) {
+            size_t begin, end;
+            WorkerPool::getBand(worker, workers->getSize(), this->height,
+                                band_rows, &begin, &end);
+            compute(begin, end);
+        });
+    }
+    this->flow_precalc = use_precalc_weights;
+    this->flow_bias = bias;
+    this->flow_valid = true;
+}
+
+void Board::computeFlowAround(uint row, uint col) {
+    std::vector<size_t> cells;
+    // Rows and columns before the first one wrap around and are skipped
+    for (uint r = row - 1; r != row + 2; r++) {
+        for (uint c = col - 1; c != col + 2; c++) {
+            if ((r != row && c != col) || !this->contains(r, c)) continue;
+            cells.push_back(this->indexOf(r, c));
+        }
+    }
+    this->computeFlowOfCells(cells);
+}
+
+void Board::computeFlowOfCells(const std::vector<size_t>& cells) {
+    size_t size = this->getPaddedSize();
+    size_t planes[4];
+    for (auto dir : directions) planes[dir] = this->flow_out[dir] - this->flow;
+    own(&this->flow, 5 * size, this->arena);
+    own(&this->links, size, this->arena);
+    this->flow_in = this->flow;
+    for (auto dir : directions) this->flow_out[dir] = this->flow + planes[dir];
+    float scales[19];
+    riseScales(this->flow_bias, scales);
+    for (size_t idx : cells) {
+        uint r = this->rowOf(idx), c = this->colOf(idx);
+        float push[4] = {0.f, 0.f, 0.f, 0.f};
+        for (auto& wind : this->winds) {
+            if (r < wind.row || r >= wind.row + wind.rows || c < wind.col ||
+                c >= wind.col + wind.cols)
+                continue;
+            push[wind.dir] += wind.strength;
+            push[wind.dir ^ 1] -= wind.strength;
+        }
+        this->computeFlowOf(idx, this->flow_precalc, scales, push);
+    }
+    this->flow_valid = true;
+}
@@ -0,0 +1,338 @@
+/**
+ * @file board_file.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "board_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "image.hpp"
+#include "layout.hpp"
+#include "synthetic.hpp"
+
+bool isBoardFile(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) return false;
+    char magic[4];
+    bool is_board =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        std::memcmp(magic, board_file_magic, sizeof(magic)) == 0;
+    fclose(fp);
+    return is_board;
+}
+
+Board* readBoardFile(const std::string& path, bool* has_weights) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BoardFileHeader)) {
+        close(fd);
+        throw std::runtime_error("Truncated binary layout.");
+    }
+    size_t length = st.st_size;
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the file.");
+    }
+    const char* data = (const char*)mapping;
+    BoardFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    size_t cells = (size_t)header.width * header.height;
+    size_t expected = sizeof(header) + cells +
+                      ((header.flags & BoardFile::Topology) ? cells : 0) +
+                      header.emitter_count * 2 * sizeof(uint32_t);
+    const char* error = nullptr;
+    if (std::memcmp(header.magic, board_file_magic, sizeof(header.magic)))
+        error = "Not a binary layout.";
+    else if (header.version != board_file_version)
+        error = "Unsupported binary layout version.";
+    else if (cells == 0)
+        error = "The layout must not be empty.";
+    else if (length < expected)
+        error = "Truncated binary layout.";
+    const char* end = data + length;
+    if (error == nullptr && (header.flags & BoardFile::Rates)) {
+        // The escapes with a rate follow the rates of the emitters
+        const char* rates = data + expected;
+        uint32_t escape_count = 0;
+        if ((size_t)(end - rates) <
+            header.emitter_count * sizeof(float) + sizeof(escape_count)) {
+            error = "Truncated binary layout.";
+        } else {
+            rates += header.emitter_count * sizeof(float);
+            std::memcpy(&escape_count, rates, sizeof(escape_count));
+            if ((size_t)(end - rates - sizeof(escape_count)) / 12 <
+                escape_count)
+                error = "Truncated binary layout.";
+        }
+    }
+    if (error != nullptr) {
+        munmap(mapping, length);
+        throw std::runtime_error(error);
+    }
+    data += sizeof(header);
+    Board* board = nullptr;
+    try {
+        const uchar* topology = nullptr;
+        if (header.flags & BoardFile::Topology)
+            topology = (const uchar*)data + cells;
+        // The stored weights already account for the emitters
+        board = new Board(header.width, header.height, data, 0, topology);
+        data += topology != nullptr ? 2 * cells : cells;
+        const char* emitters = data;
+        const char* rates =
+            emitters + header.emitter_count * 2 * sizeof(uint32_t);
+        for (uint32_t i = 0; i < header.emitter_count; i++) {
+            uint32_t pos[2];
+            std::memcpy(pos, emitters, sizeof(pos));
+            emitters += sizeof(pos);
+            float rate = 1.f;
+            if (header.flags & BoardFile::Rates) {
+                std::memcpy(&rate, rates, sizeof(rate));
+                rates += sizeof(rate);
+            }
+            board->placeEmitter(pos[0], pos[1], rate);
+            if (topology == nullptr)
+                board->computeWeightsAround(pos[0], pos[1]);
+        }
+        if (header.flags & BoardFile::Rates) {
+            uint32_t escape_count;
+            std::memcpy(&escape_count, rates, sizeof(escape_count));
+            rates += sizeof(escape_count);
+            for (uint32_t i = 0; i < escape_count; i++) {
+                uint32_t pos[2];
+                float rate;
+                std::memcpy(pos, rates, sizeof(pos));
+                std::memcpy(&rate, rates + sizeof(pos), sizeof(rate));
+                rates += sizeof(pos) + sizeof(rate);
+                board->setEscapeRate(pos[0], pos[1], rate);
+            }
+        }
+    } catch (std::runtime_error& e) {
+        delete board;
+        munmap(mapping, length);
+        throw;
+    }
+    munmap(mapping, length);
+    if (has_weights != nullptr) *has_weights = true;
+    return board;
+}
+
+void writeBoardFile(Board& board, const std::string& path,
+                    bool with_topology) {
+    uint width = board.getWidth(), height = board.getHeight();
+    const Cell::Type* type = board.getTypes();
+    const char* cost = board.getCosts();
+    std::vector<char> cells;
+    std::vector<uchar> topology;
+    std::vector<uint32_t> emitters;
+    std::vector<float> emitter_rates;
+    // Rows and columns of the escapes, with their rates as raw bits
+    std::vector<uint32_t> escapes;
+    cells.reserve(board.getSize());
+    if (with_topology) topology.reserve(board.getSize());
+    for (uint row = 0; row < height; row++) {
+        size_t idx = board.indexOf(row, 0);
+        for (uint col = 0; col < width; col++, idx++) {
+            cells.push_back(cost[idx] + 0x30);
+            if (type[idx] == Cell::Emitter) {
+                emitters.push_back(row);
+                emitters.push_back(col);
+                emitter_rates.push_back(board.getRate(idx));
+            } else if (type[idx] == Cell::Escape && board.getRate(idx) != 1.f) {
+                float rate = board.getRate(idx);
+                uint32_t bits;
+                std::memcpy(&bits, &rate, sizeof(bits));
+                escapes.push_back(row);
+                escapes.push_back(col);
+                escapes.push_back(bits);
+            }
+            if (with_topology) {
+                uint ins, outs;
+                board.countNeighbours(idx, &ins, &outs);
+                topology.push_back(ins | (outs << 4));
+            }
+        }
+    }
+    BoardFileHeader header;
+    std::memcpy(header.magic, board_file_magic, sizeof(header.magic));
+    header.version = board_file_version;
+    header.width = width;
+    header.height = height;
+    bool with_rates = !board.hasUniformRates();
+    header.flags = (with_topology ? (uint32_t)BoardFile::Topology : 0) |
+                   (with_rates ? (uint32_t)BoardFile::Rates : 0);
+    header.emitter_count = emitters.size() / 2;
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(cells.data(), 1, cells.size(), fp) == cells.size() &&
+              fwrite(topology.data(), 1, topology.size(), fp) ==
+                  topology.size() &&
+              fwrite(emitters.data(), sizeof(uint32_t), emitters.size(), fp) ==
+                  emitters.size();
+    if (ok && with_rates) {
+        uint32_t escape_count = escapes.size() / 3;
+        ok = fwrite(emitter_rates.data(), sizeof(float), emitter_rates.size(),
+                    fp) == emitter_rates.size() &&
+             fwrite(&escape_count, sizeof(escape_count), 1, fp) == 1 &&
+             fwrite(escapes.data(), sizeof(uint32_t), escapes.size(), fp) ==
+                 escapes.size();
+    }
+    if (fclose(fp) != 0 || !ok) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
+
+std::string layoutCacheDir() {
+    const char* dir = getenv("SMOKEY_CACHE_DIR");
+    if (dir != nullptr) return dir;
+    dir = getenv("XDG_CACHE_HOME");
+    if (dir != nullptr && dir[0] == '/') return std::string(dir) + "/smokey";
+    dir = getenv("HOME");
+    if (dir != nullptr && dir[0] != '\0')
+        return std::string(dir) + "/.cache/smokey";
+    return "";
+}
+
+/**
+ * @brief Hash the contents of a file, eight bytes at a time, for the name of
+ * its cache entry.
+ *
+ * This is FNV-1a over 64-bit words rather than bytes, as the text is hashed
+ * on every load, hits included, and the length is hashed in as well.
+ */
+static uint64_t hashContents(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    size_t length = st.st_size;
+    if (length == 0) {
+        close(fd);
+        throw std::runtime_error("The layout must not be empty.");
+    }
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the file.");
+    }
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    const char* data = (const char*)mapping;
+    uint64_t hash = 0xcbf29ce484222325ull ^ length;
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= length; offset += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + offset, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + offset, length - offset);
+    hash = (hash ^ tail) * 0x100000001b3ull;
+    munmap(mapping, length);
+    return hash;
+}
+
+/**
+ * @brief Make a directory and any of its parents that are missing.
+ */
+static bool makeDirs(const std::string& dir) {
+    for (size_t slash = dir.find('/', 1);; slash = dir.find('/', slash + 1)) {
+        std::string parent = dir.substr(0, slash);
+        if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (slash == std::string::npos) return true;
+    }
+}
+
+Board* loadCachedLayout(const std::string& path) {
+    std::string dir = layoutCacheDir();
+    if (dir.empty()) {
+        Layout layout(path);
+        return new Board(layout.cols, layout.rows, layout.data,
+                         layout.stride);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.smkb",
+             (unsigned long long)hashContents(path));
+    std::string entry = dir + name;
+    if (access(entry.c_str(), R_OK) == 0) {
+        try {
+            return readBoardFile(entry);
+        } catch (std::runtime_error& e) {
+            // A damaged or outdated entry, replaced below
+        }
+    }
+    Layout layout(path);
+    Board* board =
+        new Board(layout.cols, layout.rows, layout.data, layout.stride);
+    std::string temp = entry + ".XXXXXX";
+    if (!makeDirs(dir)) return board;
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0) return board;
+    close(fd);
+    try {
+        writeBoardFile(*board, temp);
+        if (rename(temp.c_str(), entry.c_str()) != 0) unlink(temp.c_str());
+    } catch (std::runtime_error& e) {
+        unlink(temp.c_str());
+    }
+    return board;
+}
+
+bool hasOwnEmitters(const std::string& path) {
+    return isSyntheticLayout(path) || isBoardFile(path) || isImageFile(path);
+}
+
+Board* loadBoard(const std::string& path, bool* has_weights) {
+    *has_weights = true;
+    if (isSyntheticLayout(path)) {
+        return generateBoard(
+            Synthetic::parse(path.substr(std::strlen(synthetic_prefix))));
+    }
+    if (isBoardFile(path)) return readBoardFile(path, has_weights);
+    if (isImageFile(path)) return loadImage(path);
+    return loadCachedLayout(path);
+}
@@ -0,0 +1,201 @@
+/**
+ * @file building.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "building.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "board_file.hpp"
+
+/**
+ * @brief Check that a cell of a storey is a floor cell smoke can go through
+ * a stairwell from.
+ */
+static bool isStairCell(Board* board, uint row, uint col) {
+    if (!board->contains(row, col)) return false;
+    Cell::Type type = board->getTypes()[board->indexOf(row, col)];
+    return type == Cell::Type::Floor;
+}
+
+Building::Building(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    // Layouts are found next to the building file
+    size_t slash = path.find_last_of('/');
+    std::string dir =
+        slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    try {
+        std::string text;
+        for (uint number = 1; std::getline(file, text); number++) {
+            size_t comment = text.find('#');
+            if (comment != std::string::npos) text.erase(comment);
+            std::istringstream line(text);
+            std::string kind, rest;
+            if (!(line >> kind)) continue;
+            bool valid = false;
+            if (kind == "floor") {
+                std::string layout;
+                if (line >> layout && !(line >> rest)) {
+                    if (layout[0] != '/') layout = dir + layout;
+                    bool has_weights;
+                    Board* board = loadBoard(layout, &has_weights);
+                    if (!has_weights) board->computeWeights();
+                    this->floors.push_back(new Sim(board));
+                    valid = true;
+                }
+            } else if (kind == "stairs") {
+                Stairwell stairs;
+                if (line >> stairs.floor >> stairs.row >> stairs.col) {
+                    if (!(line >> stairs.upper_row >> stairs.upper_col)) {
+                        line.clear();
+                        stairs.upper_row = stairs.row;
+                        stairs.upper_col = stairs.col;
+                    }
+                    valid = !(line >> rest);
+                    this->stairwells.push_back(stairs);
+                }
+            } else if (kind == "emitter") {
+                uint floor, row, col;
+                float rate;
+                if (line >> floor >> row >> col) {
+                    if (!(line >> rate)) {
+                        line.clear();
+                        rate = 1.f;
+                    }
+                    // Emitters go on storeys that were listed before them
+                    valid = !(line >> rest) && floor < this->floors.size();
+                    if (valid) {
+                        Sim* sim = this->floors[floor];
+                        sim->board->placeEmitter(row, col, rate);
+                        sim->board->computeWeightsAround(row, col);
+                        sim->touchBoard();
+                    }
+                }
+            }
+            if (!valid) {
+                std::stringstream ss;
+                ss << "Invalid storey, stairwell or emitter at line "
+                   << number << " of the building.";
+                throw std::runtime_error(ss.str().c_str());
+            }
+        }
+        if (file.bad()) {
+            throw std::runtime_error(
+                "An I/O error occurred while reading the file.");
+        }
+        if (this->floors.empty())
+            throw std::runtime_error("The building has no storeys.");
+        for (auto& stairs : this->stairwells) {
+            if (stairs.floor + 1 >= this->floors.size() ||
+                !isStairCell(this->floors[stairs.floor]->board, stairs.row,
+                             stairs.col) ||
+                !isStairCell(this->floors[stairs.floor + 1]->board,
+                             stairs.upper_row, stairs.upper_col)) {
+                throw std::runtime_error(
+                    "Stairwells must link floor cells of a storey and of "
+                    "the one above it.");
+            }
+        }
+        for (Sim* floor : this->floors) {
+            if (floor->board->getStorage() != Board::Storage::Float) {
+                throw std::runtime_error(
+                    "Buildings only support float storage.");
+            }
+        }
+    } catch (...) {
+        for (Sim* floor : this->floors) delete floor;
+        throw;
+    }
+}
+
+Building::~Building() {
+    delete this->workers;
+    for (Sim* floor : this->floors) delete floor;
+}
+
+void Building::climb() {
+    for (Sim* floor : this->floors) {
+        if (floor->board->getStorage() != Board::Storage::Float) {
+            throw std::runtime_error("Buildings only support float storage.");
+        }
+        floor->board->ownDensities();
+    }
+    // In the order of the file, so that stairwells sharing a cell move the
+    // same smoke whatever the number of threads
+    for (auto& stairs : this->stairwells) {
+        Board* lower = this->floors[stairs.floor]->board;
+        Board* upper = this->floors[stairs.floor + 1]->board;
+        float* below = &lower->getDensities()[lower->indexOf(stairs.row,
+                                                               stairs.col)];
+        float* above = &upper->getDensities()[upper->indexOf(
+            stairs.upper_row, stairs.upper_col)];
+        float rise = this->rise_rate * std::min(*below, 1.f - *above);
+        float sink = this->sink_rate * std::min(*above, 1.f - *below);
+        *below += sink - rise;
+        *above += rise - sink;
+    }
+    for (auto& stairs : this->stairwells) {
+        Sim* lower = this->floors[stairs.floor];
+        Sim* upper = this->floors[stairs.floor + 1];
+        lower->board->markRows(stairs.row, stairs.row + 1);
+        lower->touchCell(stairs.row, stairs.col);
+        upper->board->markRows(stairs.upper_row, stairs.upper_row + 1);
+        upper->touchCell(stairs.upper_row, stairs.upper_col);
+    }
+    for (Sim* floor : this->floors) floor->board->touchDensities();
+}
+
+void Building::tick() {
+    uint threads = std::min<uint>(this->threads, this->floors.size());
+    if (threads > 1) {
+        if (!this->workers || this->workers->getSize() != threads) {
+            delete this->workers;
+            this->workers = nullptr;
+            this->workers = new WorkerPool(threads);
+        }
+        std::vector<std::exception_ptr> errors(threads);
+        this->workers->run([&](uint worker) {
+            size_t begin, end;
+            WorkerPool::getBand(worker, threads, this->floors.size(), 1,
+                                &begin, &end);
+            try {
+                for (size_t floor = begin; floor < end; floor++)
+                    this->floors[floor]->tick();
+            } catch (...) {
+                // Report the error on the calling thread
+                errors[worker] = std::current_exception();
+            }
+        });
+        for (auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    } else {
+        for (Sim* floor : this->floors) floor->tick();
+    }
+    this->climb();
+    this->ticks++;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file checkpoint.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checkpoint.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * @brief Write or read a list of buffers, resuming after short transfers.
+ * @return false on an error or on the end of the file.
+ */
+static bool transfer(int fd, std::vector<struct iovec>& buffers,
+                     bool writing) {
+    struct iovec* iov = buffers.data();
+    size_t count = buffers.size();
+    while (count > 0) {
+        int batch = (int)std::min(count, (size_t)IOV_MAX);
+        ssize_t done = writing ? writev(fd, iov, batch) : readv(fd, iov, batch);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        while (count > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+bool isCheckpoint(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) return false;
+    char magic[4];
+    bool is_checkpoint =
+        fread(magic, sizeof(magic), 1, fp) == 1 &&
+        std::memcmp(magic, checkpoint_magic, sizeof(magic)) == 0;
+    fclose(fp);
+    return is_checkpoint;
+}
+
+void writeCheckpoint(Sim& sim, const std::string& path) {
+    TraceScope trace(sim.tracer, "checkpoint");
+    if (sim.hasEmitterCurves())
+        throw std::runtime_error("Checkpoints cannot save emitter curves.");
+    if (sim.quiet_threshold > 0.f)
+        throw std::runtime_error("Checkpoints cannot save quiet tiles.");
+    if (sim.getBackend() != nullptr) sim.getBackend()->download(sim);
+    Board* board = sim.board;
+    CheckpointHeader header;
+    // Leaves no padding unwritten
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.width = board->getWidth();
+    header.height = board->getHeight();
+    header.storage = board->getStorage();
+    header.flags =
+        (sim.use_precalc_weights ? (uint32_t)Checkpoint::PrecalcWeights : 0) |
+        (sim.update_mode == Sim::Update::Synchronous
+             ? (uint32_t)Checkpoint::Synchronous
+             : 0) |
+        (sim.stencil == Sim::Stencil::Moore ? (uint32_t)Checkpoint::Moore
+                                            : 0) |
+        (sim.update_mode == Sim::Update::RedBlack
+             ? (uint32_t)Checkpoint::RedBlack
+             : 0) |
+        (sim.getArrivals() != nullptr ? (uint32_t)Checkpoint::Arrivals : 0) |
+        (sim.getDoses() != nullptr ? (uint32_t)Checkpoint::Doses : 0);
+    header.ticks = sim.getTicks();
+    header.rate_count = board->getRateCount();
+    header.emitter_rate = sim.emitter_rate;
+    header.escape_rate = sim.escape_rate;
+    header.elevation_bias = sim.elevation_bias;
+    header.tolerance = sim.tolerance;
+    header.wind_count = board->getWinds().size();
+    header.draft_noise = sim.draft_noise;
+    header.draft_seed = sim.draft_seed;
+    header.arrival_threshold = sim.getArrivalThreshold();
+    std::vector<struct iovec> buffers = {
+        {&header, sizeof(header)},
+        {(void*)board->getRates(), header.rate_count * sizeof(float)},
+        {(void*)board->getWinds().data(), header.wind_count * sizeof(Wind)}};
+    for (auto& array : board->getStateArrays())
+        buffers.push_back({array.first, array.second});
+    if (header.flags & Checkpoint::Arrivals) {
+        buffers.push_back({(void*)sim.getArrivals(),
+                           board->getPaddedSize() * sizeof(uint)});
+    }
+    if (header.flags & Checkpoint::Doses) {
+        buffers.push_back({(void*)sim.getDoses(),
+                           board->getPaddedSize() * sizeof(double)});
+    }
+    std::string partial = path + ".partial";
+    int fd = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    bool ok = transfer(fd, buffers, true);
+    if (close(fd) != 0 || !ok ||
+        rename(partial.c_str(), path.c_str()) != 0) {
+        unlink(partial.c_str());
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
+
+Sim* readCheckpoint(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    CheckpointHeader header;
+    struct stat st;
+    const char* error = nullptr;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+        read(fd, &header, sizeof(header)) != sizeof(header))
+        error = "Truncated checkpoint.";
+    else if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)))
+        error = "Not a checkpoint.";
+    else if (header.version != checkpoint_version)
+        error = "Unsupported checkpoint version.";
+    else if (header.width == 0 || header.height == 0)
+        error = "The board must not be empty.";
+    else if (header.storage > Board::Storage::Double)
+        error = "Unknown density storage.";
+    else if (header.rate_count == 0 || header.rate_count > 256)
+        error = "Invalid table of rates.";
+    else if (header.wind_count > (size_t)st.st_size / sizeof(Wind))
+        error = "Truncated checkpoint.";
+    if (error != nullptr) {
+        close(fd);
+        throw std::runtime_error(error);
+    }
+    Board* board = nullptr;
+    std::vector<uint> arrivals;
+    std::vector<double> doses;
+    try {
+        board = new Board(header.width, header.height,
+                          (Board::Storage)header.storage);
+        float rates[256];
+        std::vector<Wind> winds(header.wind_count);
+        std::vector<struct iovec> buffers = {
+            {rates, header.rate_count * sizeof(float)},
+            {winds.data(), header.wind_count * sizeof(Wind)}};
+        size_t expected =
+            sizeof(header) + buffers[0].iov_len + buffers[1].iov_len;
+        for (auto& array : board->getStateArrays()) {
+            buffers.push_back({array.first, array.second});
+            expected += array.second;
+        }
+        if (header.flags & Checkpoint::Arrivals) {
+            arrivals.resize(board->getPaddedSize());
+            buffers.push_back(
+                {arrivals.data(), arrivals.size() * sizeof(uint)});
+            expected += buffers.back().iov_len;
+        }
+        if (header.flags & Checkpoint::Doses) {
+            doses.resize(board->getPaddedSize());
+            buffers.push_back({doses.data(), doses.size() * sizeof(double)});
+            expected += buffers.back().iov_len;
+        }
+        if ((size_t)st.st_size != expected || !transfer(fd, buffers, false))
+            throw std::runtime_error("Truncated checkpoint.");
+        board->setRates(rates, header.rate_count);
+        for (auto& wind : winds) {
+            if ((uint)wind.dir > Dir::East)
+                throw std::runtime_error("Invalid wind.");
+            board->addWind(wind);
+        }
+        board->touchDensities();
+    } catch (std::runtime_error& e) {
+        delete board;
+        close(fd);
+        throw;
+    }
+    close(fd);
+    Sim* sim = new Sim(board);
+    sim->setTicks(header.ticks);
+    if (!arrivals.empty()) {
+        sim->setArrivals(std::move(arrivals), header.arrival_threshold);
+        sim->arrival_threshold = header.arrival_threshold;
+    }
+    if (!doses.empty()) {
+        sim->setDoses(std::move(doses));
+        sim->track_dose = true;
+    }
+    sim->use_precalc_weights = header.flags & Checkpoint::PrecalcWeights;
+    sim->update_mode = (header.flags & Checkpoint::Synchronous)
+                           ? Sim::Update::Synchronous
+                           : Sim::Update::InPlace;
+    if (header.flags & Checkpoint::RedBlack)
+        sim->update_mode = Sim::Update::RedBlack;
+    sim->stencil = (header.flags & Checkpoint::Moore)
+                       ? Sim::Stencil::Moore
+                       : Sim::Stencil::VonNeumann;
+    sim->emitter_rate = header.emitter_rate;
+    sim->escape_rate = header.escape_rate;
+    sim->elevation_bias = header.elevation_bias;
+    sim->tolerance = header.tolerance;
+    sim->draft_noise = header.draft_noise;
+    sim->draft_seed = header.draft_seed;
+    return sim;
+}
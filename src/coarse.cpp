@@ -0,0 +1,169 @@
+/**
+ * @file coarse.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "coarse.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+Board* coarsenBoard(Board* board, uint factor) {
+    if (factor < 2) {
+        throw std::runtime_error(
+            "Boards are coarsened by a factor of at least 2.");
+    }
+    uint width = board->getWidth(), height = board->getHeight();
+    uint coarse_width = (width + factor - 1) / factor;
+    uint coarse_height = (height + factor - 1) / factor;
+    const Cell::Type* type = board->getTypes();
+    const char* cost = board->getCosts();
+    const float* density = board->getDensities();
+    // Layout characters of the blocks, see the layout files
+    std::string layout((size_t)coarse_width * coarse_height, '/');
+    struct Source {
+        uint row, col;
+        float rate;
+    };
+    std::vector<Source> emitters, escapes;
+    std::vector<float> means(layout.size(), 0.f);
+    for (uint row = 0; row < coarse_height; row++) {
+        for (uint col = 0; col < coarse_width; col++) {
+            uint cells = 0, open = 0, floors = 0, heights = 0;
+            float emitter = -1.f, escape = -1.f;
+            double sum = 0.;
+            for (uint r = row * factor;
+                 r < std::min((row + 1) * factor, height); r++) {
+                for (uint c = col * factor;
+                     c < std::min((col + 1) * factor, width); c++) {
+                    size_t idx = board->indexOf(r, c);
+                    cells++;
+                    switch (type[idx]) {
+                        case Cell::Type::Floor:
+                            floors++;
+                            sum += density[idx];
+                            open++;
+                            heights += cost[idx];
+                            break;
+                        case Cell::Type::Emitter:
+                            emitter = std::max(emitter, board->getRate(idx));
+                            open++;
+                            heights += cost[idx];
+                            break;
+                        case Cell::Type::Escape:
+                            escape = std::max(escape, board->getRate(idx));
+                            break;
+                        default:
+                            break;
+                    }
+                }
+            }
+            size_t block = (size_t)row * coarse_width + col;
+            if (emitter >= 0.f || (escape < 0.f && 2 * open >= cells)) {
+                layout[block] = '0' + std::lround((float)heights / open);
+            } else if (escape >= 0.f) {
+                layout[block] = ':';
+            }
+            if (emitter >= 0.f) {
+                emitters.push_back({row, col, emitter});
+            } else if (escape >= 0.f) {
+                escapes.push_back({row, col, escape});
+            }
+            if (floors > 0) means[block] = sum / floors;
+        }
+    }
+    Board* coarse = new Board(coarse_width, coarse_height, layout.c_str());
+    try {
+        for (auto& emitter : emitters) {
+            coarse->placeEmitter(emitter.row, emitter.col, emitter.rate);
+            coarse->computeWeightsAround(emitter.row, emitter.col);
+        }
+        for (auto& escape : escapes) {
+            if (escape.rate != 1.f)
+                coarse->setEscapeRate(escape.row, escape.col, escape.rate);
+        }
+        for (const Wind& wind : board->getWinds()) {
+            Wind block = wind;
+            block.row = wind.row / factor;
+            block.col = wind.col / factor;
+            block.rows = (wind.row + wind.rows + factor - 1) / factor -
+                         block.row;
+            block.cols = (wind.col + wind.cols + factor - 1) / factor -
+                         block.col;
+            coarse->addWind(block);
+        }
+        const Cell::Type* coarse_type = coarse->getTypes();
+        float* coarse_density = coarse->getDensities();
+        for (uint row = 0; row < coarse_height; row++) {
+            for (uint col = 0; col < coarse_width; col++) {
+                size_t idx = coarse->indexOf(row, col);
+                if (coarse_type[idx] == Cell::Type::Floor)
+                    coarse_density[idx] = means[(size_t)row * coarse_width +
+                                                col];
+            }
+        }
+        coarse->setStorage(board->getStorage());
+    } catch (...) {
+        delete coarse;
+        throw;
+    }
+    return coarse;
+}
+
+void prolongDensities(Board* coarse, Board* fine, uint factor) {
+    uint width = fine->getWidth(), height = fine->getHeight();
+    if (factor < 2 || coarse->getWidth() != (width + factor - 1) / factor ||
+        coarse->getHeight() != (height + factor - 1) / factor) {
+        throw std::runtime_error(
+            "The coarse board was not made from this one by this factor.");
+    }
+    // Densities are written in float storage, and converted back
+    Board::Storage storage = fine->getStorage();
+    fine->setStorage(Board::Storage::Float);
+    fine->ownDensities();
+    const Cell::Type* coarse_type = coarse->getTypes();
+    const float* coarse_density = coarse->getDensities();
+    const Cell::Type* type = fine->getTypes();
+    float* density = fine->getDensities();
+    for (uint row = 0; row < height; row++) {
+        for (uint col = 0; col < width; col++) {
+            size_t idx = fine->indexOf(row, col);
+            if (type[idx] != Cell::Type::Floor) continue;
+            size_t block = coarse->indexOf(row / factor, col / factor);
+            if (coarse_type[block] == Cell::Type::Floor) {
+                density[idx] = coarse_density[block];
+                continue;
+            }
+            float sum = 0.f;
+            uint floors = 0;
+            for (auto dir : directions) {
+                size_t adj = coarse->neighbourOf(dir, block);
+                if (coarse_type[adj] != Cell::Type::Floor) continue;
+                sum += coarse_density[adj];
+                floors++;
+            }
+            density[idx] = floors > 0 ? sum / floors : 0.f;
+        }
+    }
+    fine->markRows(0, height);
+    fine->setStorage(storage);
+}
@@ -0,0 +1,131 @@
+/**
+ * @file colormap.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "colormap.hpp"
+
+#include <algorithm>
+
+const char* const palette_names[PaletteCount] = {"Grey", "Smoke", "Heat"};
+
+/**
+ * @brief Interpolate linearly between colour stops spread evenly over the
+ * levels.
+ */
+static void interpolate(const uint32_t* stops, uint count,
+                        uint32_t colors[palette_levels]) {
+    for (uint level = 0; level < palette_levels; level++) {
+        float pos = (float)level * (count - 1) / (palette_levels - 1);
+        uint stop = std::min((uint)pos, count - 2);
+        float t = pos - stop;
+        uchar channels[3];
+        for (int channel = 0; channel < 3; channel++) {
+            int shift = 24 - 8 * channel;
+            float from = (stops[stop] >> shift) & 0xFF;
+            float to = (stops[stop + 1] >> shift) & 0xFF;
+            channels[channel] = from + t * (to - from) + .5f;
+        }
+        colors[level] = packRGBA(channels[0], channels[1], channels[2]);
+    }
+}
+
+void buildPalette(Palette palette, uint32_t colors[palette_levels]) {
+    switch (palette) {
+        case Palette::Smoke: {
+            // The floor shades of the layout palette, darkening with smoke
+            uint32_t stops[11] = {floor_color};
+            std::copy(::palette + 1, ::palette + 11, stops + 1);
+            interpolate(stops, 11, colors);
+            break;
+        }
+        case Palette::Heat: {
+            const uint32_t stops[] = {floor_color, 0xFFFF00FF, 0xFF0000FF,
+                                      0x400000FF};
+            interpolate(stops, 4, colors);
+            break;
+        }
+        default:
+            for (uint level = 0; level < palette_levels; level++) {
+                uchar l = 255 - level;
+                colors[level] = packRGBA(l, l, l);
+            }
+    }
+}
+
+uint32_t getCellColor(Cell::Type type, float rate) {
+    if (type != Cell::Type::Emitter && type != Cell::Type::Escape)
+        return wall_color;
+    uchar l = 255.f * std::min(rate, 1.f);
+    return type == Cell::Type::Emitter ? packRGBA(l, 255 - l, 255 - l)
+                                       : packRGBA(255 - l, 255 - l, l);
+}
+
+void toDensityLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                     const float* densities, uint begin, uint end) {
+    Board* board = sim.board;
+    const float* density =
+        densities != nullptr ? densities : board->getDensities();
+    end = std::min(end, view.getHeight());
+    for (uint row = begin; row < end; row++) {
+        size_t idx = board->indexOf(view.row + row * view.step, view.col);
+        for (uint col = 0; col < view.getWidth(); col++, idx += view.step) {
+            float value = std::min(std::max(density[idx], 0.f), 1.f);
+            *levels++ = (palette_levels - 1) * value;
+        }
+    }
+}
+
+void toArrivalLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                     const uint* arrivals) {
+    Board* board = sim.board;
+    // Scale to the latest arrival so far
+    uint first = Sim::not_arrived, last = 0;
+    for (uint row = 0; row < board->getHeight(); row++) {
+        size_t idx = board->indexOf(row, 0);
+        for (uint col = 0; col < board->getWidth(); col++, idx++) {
+            if (arrivals[idx] == Sim::not_arrived) continue;
+            first = std::min(first, arrivals[idx]);
+            last = std::max(last, arrivals[idx]);
+        }
+    }
+    float scale = last > first ? (float)(not_arrived_level - 1) / (last - first)
+                               : 0.f;
+    for (uint row = 0; row < view.getHeight(); row++) {
+        size_t idx = board->indexOf(view.row + row * view.step, view.col);
+        for (uint col = 0; col < view.getWidth(); col++, idx += view.step) {
+            *levels++ = arrivals[idx] == Sim::not_arrived
+                            ? not_arrived_level
+                            : (uint8_t)(scale * (arrivals[idx] - first));
+        }
+    }
+}
+
+void toDoseLevels(Sim& sim, const BoardView& view, uint8_t* levels,
+                  const double* doses, float limit, uint begin, uint end) {
+    Board* board = sim.board;
+    double scale = limit > 0.f ? 1. / limit : 0.;
+    end = std::min(end, view.getHeight());
+    for (uint row = begin; row < end; row++) {
+        size_t idx = board->indexOf(view.row + row * view.step, view.col);
+        for (uint col = 0; col < view.getWidth(); col++, idx += view.step) {
+            double fed = std::min(doses[idx] * scale, 1.);
+            *levels++ = (palette_levels - 1) * fed;
+        }
+    }
+}
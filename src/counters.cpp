@@ -0,0 +1,103 @@
+/**
+ * @file counters.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "counters.hpp"
+
+#include <stdexcept>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+PerfCounters::PerfCounters() {
+    static const uint64_t configs[EventCount] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    bool any = false;
+    for (int event = 0; event < EventCount; event++) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[event];
+        attr.disabled = 1;
+        // Threads started from now on are counted along
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        this->fds[event] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        any |= this->fds[event] >= 0;
+    }
+    if (!any) {
+        throw std::runtime_error(
+            "Hardware performance counters are not available.");
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : this->fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void PerfCounters::start() {
+    if (this->depth++ > 0) return;
+    for (int fd : this->fds) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::stop() {
+    if (this->depth == 0 || --this->depth > 0) return;
+    for (int fd : this->fds) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+uint64_t PerfCounters::read(Event event) {
+    if (this->fds[event] < 0) return 0;
+    // The count, then the time the event was enabled and ran for
+    uint64_t values[3];
+    if (::read(this->fds[event], values, sizeof(values)) != sizeof(values) ||
+        values[2] == 0)
+        return 0;
+    if (values[2] == values[1]) return values[0];
+    return (uint64_t)((double)values[0] * values[1] / values[2]);
+}
+#else
+PerfCounters::PerfCounters() {
+    throw std::runtime_error(
+        "Hardware performance counters are only supported on Linux.");
+}
+
+PerfCounters::~PerfCounters() {}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop() {}
+
+uint64_t PerfCounters::read(Event) { return 0; }
+#endif
@@ -0,0 +1,351 @@
+/**
+ * @file crowd.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "crowd.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "philox.hpp"
+
+void CellHash::clear(size_t count) {
+    size_t capacity = 64;
+    while (capacity < 2 * count) capacity *= 2;
+    if (capacity > this->keys.size()) {
+        std::vector<std::atomic<size_t>>(capacity).swap(this->keys);
+        std::vector<std::atomic<uint>>(capacity).swap(this->values);
+        this->mask = capacity - 1;
+    }
+    for (auto& key : this->keys) key.store(empty, std::memory_order_relaxed);
+    for (auto& value : this->values)
+        value.store(none, std::memory_order_relaxed);
+}
+
+void CellHash::insert(size_t key, uint value) {
+    for (size_t slot = this->slotOf(key);; slot = (slot + 1) & this->mask) {
+        size_t held = this->keys[slot].load(std::memory_order_relaxed);
+        if (held == empty &&
+            this->keys[slot].compare_exchange_strong(held, key))
+            held = key;
+        if (held != key) continue;
+        uint lowest = this->values[slot].load(std::memory_order_relaxed);
+        while (value < lowest &&
+               !this->values[slot].compare_exchange_weak(lowest, value)) {
+        }
+        return;
+    }
+}
+
+uint CellHash::find(size_t key) const {
+    for (size_t slot = this->slotOf(key);; slot = (slot + 1) & this->mask) {
+        size_t held = this->keys[slot].load(std::memory_order_relaxed);
+        if (held == key)
+            return this->values[slot].load(std::memory_order_relaxed);
+        if (held == empty) return none;
+    }
+}
+
+Crowd::Crowd(Sim* sim) : sim(sim) {
+    this->computeDistances();
+    this->occupied.clear(0);
+}
+
+Crowd::~Crowd() { delete this->workers; }
+
+bool Crowd::isWalkable(size_t idx) {
+    Cell::Type type = this->sim->board->getTypes()[idx];
+    return type == Cell::Floor || type == Cell::Escape;
+}
+
+/* Breadth-first search from the queued cells, which must be in order of
+ * distance, through the floor cells they bring nearer to an escape. Cells
+ * nearer through another cell than through the queue are searched from
+ * once more, which costs little, as only the cells of a closed door do. */
+void Crowd::relax(std::vector<size_t>& queue) {
+    Board* board = this->sim->board;
+    const Cell::Type* type = board->getTypes();
+    ptrdiff_t stride = board->getStride();
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    // Cells found by the search are in order of distance too, merge them
+    std::vector<size_t> found;
+    size_t next = 0, next_found = 0;
+    while (next < queue.size() || next_found < found.size()) {
+        size_t cur;
+        if (next_found == found.size() ||
+            (next < queue.size() && this->distances[queue[next]] <=
+                                        this->distances[found[next_found]])) {
+            cur = queue[next++];
+        } else {
+            cur = found[next_found++];
+        }
+        uint distance = this->distances[cur] + 1;
+        for (ptrdiff_t offset : offsets) {
+            size_t idx = cur + offset;
+            if (type[idx] != Cell::Floor || this->distances[idx] <= distance)
+                continue;
+            this->distances[idx] = distance;
+            found.push_back(idx);
+        }
+    }
+}
+
+void Crowd::computeDistances() {
+    Board* board = this->sim->board;
+    const Cell::Type* type = board->getTypes();
+    this->distances.assign(board->getPaddedSize(), unreachable);
+    std::vector<size_t> escapes;
+    for (uint row = 0; row < board->getHeight(); row++) {
+        size_t idx = board->indexOf(row, 0);
+        for (uint col = 0; col < board->getWidth(); col++, idx++) {
+            if (type[idx] != Cell::Escape) continue;
+            this->distances[idx] = 0;
+            escapes.push_back(idx);
+        }
+    }
+    this->relax(escapes);
+}
+
+void Crowd::updateCell(uint row, uint col) {
+    Board* board = this->sim->board;
+    if (!board->contains(row, col))
+        throw std::runtime_error("Cell coordinates out of bounds.");
+    const Cell::Type* type = board->getTypes();
+    ptrdiff_t stride = board->getStride();
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    auto nearest = [&](size_t idx) {
+        uint distance = unreachable;
+        for (ptrdiff_t offset : offsets)
+            distance = std::min(distance, this->distances[idx + offset]);
+        return distance;
+    };
+    size_t idx = board->indexOf(row, col);
+    uint current = this->distances[idx], distance = unreachable;
+    if (type[idx] == Cell::Escape) {
+        distance = 0;
+    } else if (type[idx] == Cell::Floor) {
+        uint neighbour = nearest(idx);
+        if (neighbour != unreachable) distance = neighbour + 1;
+    }
+    if (distance == current) return;
+    std::vector<size_t> queue;
+    if (distance < current) {
+        this->distances[idx] = distance;
+        queue.push_back(idx);
+        this->relax(queue);
+        return;
+    }
+    /* Lose the distance of the cell, then of every cell whose neighbours
+     * nearer to an escape have all lost theirs. Cells are lost in order of
+     * distance, so all those at one distance are lost before the cells one
+     * step farther are checked. */
+    std::vector<size_t> lost = {idx};
+    std::vector<uint> lost_distances = {current};
+    this->distances[idx] = unreachable;
+    for (size_t next = 0; next < lost.size(); next++) {
+        uint farther = lost_distances[next] + 1;
+        for (ptrdiff_t offset : offsets) {
+            size_t cur = lost[next] + offset;
+            if (type[cur] != Cell::Floor || this->distances[cur] != farther ||
+                nearest(cur) == farther - 1)
+                continue;
+            this->distances[cur] = unreachable;
+            lost.push_back(cur);
+            lost_distances.push_back(farther);
+        }
+    }
+    // Search again from the cells that kept a neighbour nearer to an escape
+    for (size_t cur : lost) {
+        uint neighbour = nearest(cur);
+        if (type[cur] != Cell::Floor || neighbour == unreachable) continue;
+        this->distances[cur] = neighbour + 1;
+        queue.push_back(cur);
+    }
+    std::sort(queue.begin(), queue.end(), [&](size_t a, size_t b) {
+        return this->distances[a] < this->distances[b];
+    });
+    this->relax(queue);
+}
+
+void Crowd::setCellType(uint row, uint col, Cell::Type type) {
+    this->sim->setCellType(row, col, type);
+    this->updateCell(row, col);
+}
+
+uint Crowd::add(uint row, uint col) {
+    Board* board = this->sim->board;
+    if (!board->contains(row, col))
+        throw std::runtime_error("Cell coordinates out of bounds.");
+    size_t idx = board->indexOf(row, col);
+    if (board->getTypes()[idx] != Cell::Floor)
+        throw std::runtime_error("Occupants must stand on floor cells.");
+    if (this->occupied.find(idx) != CellHash::none)
+        throw std::runtime_error("The cell is already occupied.");
+    uint number = this->occupants.size();
+    Occupant occupant;
+    occupant.row = row;
+    occupant.col = col;
+    this->occupants.push_back(occupant);
+    this->targets.push_back(idx);
+    if (2 * this->occupants.size() > this->occupied.getCapacity()) {
+        this->fillOccupied(1);
+    } else {
+        this->occupied.insert(idx, number);
+    }
+    return number;
+}
+
+void Crowd::scatter(uint count, uint64_t seed) {
+    Board* board = this->sim->board;
+    const Cell::Type* type = board->getTypes();
+    size_t free = 0;
+    for (uint row = 0; row < board->getHeight(); row++) {
+        size_t idx = board->indexOf(row, 0);
+        for (uint col = 0; col < board->getWidth(); col++, idx++) {
+            free += type[idx] == Cell::Floor &&
+                    this->distances[idx] != unreachable &&
+                    this->occupied.find(idx) == CellHash::none;
+        }
+    }
+    if (free < count) {
+        throw std::runtime_error(
+            "Not enough free floor cells to place the occupants on.");
+    }
+    Philox::Key key = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    for (uint32_t draw = 0; count > 0; draw++) {
+        Philox::Counter words = Philox::scramble({draw, 0, 0, 0}, key);
+        uint row = words[0] % board->getHeight();
+        uint col = words[1] % board->getWidth();
+        size_t idx = board->indexOf(row, col);
+        if (type[idx] != Cell::Floor || this->distances[idx] == unreachable ||
+            this->occupied.find(idx) != CellHash::none)
+            continue;
+        this->add(row, col);
+        count--;
+    }
+}
+
+template <typename Job>
+void Crowd::forEachOccupant(uint threads, const Job& job) {
+    size_t count = this->occupants.size();
+    if (threads <= 1) {
+        job(0, 0, count);
+        return;
+    }
+    this->workers->run([&](uint worker) {
+        size_t begin, end;
+        WorkerPool::getBand(worker, threads, count, 64, &begin, &end);
+        job(worker, begin, end);
+    });
+}
+
+void Crowd::fillOccupied(uint threads) {
+    Board* board = this->sim->board;
+    this->occupied.clear(this->occupants.size());
+    this->forEachOccupant(threads, [&](uint, size_t begin, size_t end) {
+        for (size_t number = begin; number < end; number++) {
+            const Occupant& occupant = this->occupants[number];
+            if (occupant.status == Occupant::Evacuated) continue;
+            this->occupied.insert(
+                board->indexOf(occupant.row, occupant.col), number);
+        }
+    });
+}
+
+void Crowd::move() {
+    Board* board = this->sim->board;
+    const Cell::Type* type = board->getTypes();
+    const float* density = board->getDensities();
+    ptrdiff_t stride = board->getStride();
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    unsigned int ticks = this->sim->getTicks();
+    uint threads = std::max(1u, this->threads);
+    if (threads > 1 && (!this->workers || this->pool_threads != threads)) {
+        delete this->workers;
+        this->workers = nullptr;
+        this->workers = new WorkerPool(threads);
+        this->pool_threads = threads;
+    }
+    // Claim the cell nearest to an escape that no one stands on
+    this->claims.clear(this->occupants.size());
+    this->forEachOccupant(threads, [&](uint, size_t begin, size_t end) {
+        for (size_t number = begin; number < end; number++) {
+            Occupant& occupant = this->occupants[number];
+            size_t idx = board->indexOf(occupant.row, occupant.col);
+            this->targets[number] = idx;
+            if (occupant.status != Occupant::Moving) continue;
+            occupant.progress += this->speed;
+            if (occupant.progress < 1.f) continue;
+            uint nearest = this->distances[idx];
+            for (ptrdiff_t offset : offsets) {
+                size_t cur = idx + offset;
+                if (!this->isWalkable(cur) ||
+                    this->distances[cur] >= nearest ||
+                    this->occupied.find(cur) != CellHash::none)
+                    continue;
+                nearest = this->distances[cur];
+                this->targets[number] = cur;
+            }
+            if (this->targets[number] != idx)
+                this->claims.insert(this->targets[number], number);
+        }
+    });
+    // Step to the cells claimed first, then breathe
+    std::vector<uint> evacuated(threads), incapacitated(threads);
+    this->forEachOccupant(threads, [&](uint worker, size_t begin,
+                                       size_t end) {
+        for (size_t number = begin; number < end; number++) {
+            Occupant& occupant = this->occupants[number];
+            if (occupant.status == Occupant::Evacuated) continue;
+            size_t idx = board->indexOf(occupant.row, occupant.col);
+            size_t target = this->targets[number];
+            if (target != idx && this->claims.find(target) == number) {
+                idx = target;
+                occupant.row = idx / stride - 1;
+                occupant.col = idx % stride - 1;
+                occupant.progress -= 1.f;
+            } else {
+                occupant.progress = std::min(occupant.progress, 1.f);
+            }
+            if (type[idx] == Cell::Escape) {
+                occupant.status = Occupant::Evacuated;
+                occupant.end_tick = ticks;
+                evacuated[worker]++;
+                continue;
+            }
+            occupant.dose += density[idx];
+            if (occupant.status == Occupant::Moving &&
+                this->dose_limit > 0.f && occupant.dose >= this->dose_limit) {
+                occupant.status = Occupant::Incapacitated;
+                occupant.end_tick = ticks;
+                incapacitated[worker]++;
+            }
+        }
+    });
+    for (uint worker = 0; worker < threads; worker++) {
+        this->evacuated += evacuated[worker];
+        this->incapacitated += incapacitated[worker];
+    }
+    this->fillOccupied(threads);
+}
+
+void Crowd::tick() {
+    this->sim->tick();
+    this->move();
+}
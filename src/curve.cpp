@@ -0,0 +1,124 @@
+/**
+ * @file curve.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "curve.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Longest curve sampled, a table of 64 MiB
+static constexpr unsigned long max_curve_ticks = 1ul << 24;
+
+GrowthCurve GrowthCurve::fromPoints(
+    const std::vector<std::pair<unsigned long, float>>& points) {
+    if (points.empty())
+        throw std::runtime_error("Growth curves need at least one point.");
+    for (size_t point = 0; point < points.size(); point++) {
+        if (!(points[point].second >= 0.f)) {
+            throw std::runtime_error(
+                "Growth curves must not go below zero.");
+        }
+        if (point > 0 && points[point].first <= points[point - 1].first) {
+            throw std::runtime_error(
+                "The points of a growth curve must be in order of tick.");
+        }
+    }
+    if (points.back().first >= max_curve_ticks)
+        throw std::runtime_error("The growth curve is too long.");
+    GrowthCurve curve;
+    curve.table.resize(points.back().first + 1);
+    size_t next = 0;
+    for (unsigned long tick = 0; tick < curve.table.size(); tick++) {
+        while (points[next].first < tick) next++;
+        if (next == 0 || points[next].first == tick) {
+            curve.table[tick] = points[next].second;
+            continue;
+        }
+        auto& from = points[next - 1];
+        auto& to = points[next];
+        double t = (double)(tick - from.first) / (to.first - from.first);
+        curve.table[tick] = from.second + t * (to.second - from.second);
+    }
+    return curve;
+}
+
+bool GrowthCurve::isShape(const std::string& spec) {
+    return spec.compare(0, 3, "t2:") == 0 || spec.compare(0, 5, "ramp:") == 0 ||
+           spec.compare(0, 5, "step:") == 0;
+}
+
+GrowthCurve GrowthCurve::parse(const std::string& spec) {
+    unsigned long begin, end;
+    char rest;
+    if (spec.compare(0, 3, "t2:") == 0) {
+        if (sscanf(spec.c_str() + 3, "%lu%c", &end, &rest) != 1 || end == 0)
+            throw std::runtime_error("Invalid t-squared growth time.");
+        if (end >= max_curve_ticks)
+            throw std::runtime_error("The growth curve is too long.");
+        GrowthCurve curve;
+        curve.table.resize(end + 1);
+        for (unsigned long tick = 0; tick <= end; tick++) {
+            double t = (double)tick / end;
+            curve.table[tick] = t * t;
+        }
+        return curve;
+    }
+    if (spec.compare(0, 5, "ramp:") == 0) {
+        if (sscanf(spec.c_str() + 5, "%lu:%lu%c", &begin, &end, &rest) != 2 ||
+            end <= begin)
+            throw std::runtime_error("Ramps are given as ramp:BEGIN:END.");
+        return fromPoints({{begin, 0.f}, {end, 1.f}});
+    }
+    if (spec.compare(0, 5, "step:") == 0) {
+        if (sscanf(spec.c_str() + 5, "%lu%c", &end, &rest) != 1)
+            throw std::runtime_error("Steps are given as step:TICK.");
+        if (end == 0) return fromPoints({{0, 1.f}});
+        return fromPoints({{end - 1, 0.f}, {end, 1.f}});
+    }
+    std::ifstream file(spec);
+    if (!file) {
+        throw std::runtime_error(
+            "Growth curves are t2:GROWTH, ramp:BEGIN:END, step:TICK or a CSV "
+            "file.");
+    }
+    std::vector<std::pair<unsigned long, float>> points;
+    std::string text;
+    for (unsigned int number = 1; std::getline(file, text); number++) {
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) text.erase(comment);
+        if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+        unsigned long tick;
+        float share;
+        if (sscanf(text.c_str(), " %lu , %f %c", &tick, &share, &rest) != 2) {
+            std::stringstream ss;
+            ss << "Invalid point at line " << number
+               << " of the growth curve.";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        points.emplace_back(tick, share);
+    }
+    if (file.bad()) {
+        throw std::runtime_error(
+            "An I/O error occurred while reading the file.");
+    }
+    return fromPoints(points);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file difference.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "difference.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void DensityDifference::compareRows(const float* densities, uint begin,
+                                    uint end) {
+    const Cell::Type* type = this->board->getTypes();
+    const float* other = this->reference->getDensities();
+    for (uint row = begin; row < end; row++) {
+        Row sums;
+        size_t idx = this->board->indexOf(row, 0);
+        for (uint col = 0; col < this->board->getWidth(); col++, idx++) {
+            if (type[idx] != Cell::Type::Floor) continue;
+            float diff = densities[idx] - other[idx];
+            sums.l1 += std::fabs(diff);
+            sums.l2 += (double)diff * diff;
+            sums.mass += diff;
+            sums.linf = std::max(sums.linf, std::fabs(diff));
+            sums.cells++;
+        }
+        this->rows[row] = sums;
+    }
+}
+
+const DifferenceNorms& DensityDifference::compare(Board* board,
+                                                  Board* reference,
+                                                  const float* densities) {
+    if (reference->getWidth() != board->getWidth() ||
+        reference->getHeight() != board->getHeight())
+        throw std::runtime_error("The reference does not match the board.");
+    uint height = board->getHeight();
+    if (board != this->board || reference != this->reference) {
+        this->board = board;
+        this->reference = reference;
+        this->rows.assign(height, Row());
+        this->generation = this->reference_generation = 0;
+    }
+    // Only the rows either board changed are compared again
+    uint begin = 0, end = height;
+    if (densities == nullptr && this->generation != 0)
+        board->getChangedRows(this->generation, &begin, &end);
+    if (this->reference_generation != 0) {
+        uint first, last;
+        reference->getChangedRows(this->reference_generation, &first, &last);
+        if (begin == end) {
+            begin = first;
+            end = last;
+        } else if (first < last) {
+            begin = std::min(begin, first);
+            end = std::max(end, last);
+        }
+    } else {
+        begin = 0;
+        end = height;
+    }
+    if (begin < end) {
+        this->compareRows(
+            densities != nullptr ? densities : board->getDensities(), begin,
+            end);
+    }
+    this->generation = densities == nullptr ? board->getGeneration() : 0;
+    this->reference_generation = reference->getGeneration();
+    DifferenceNorms norms;
+    for (const Row& row : this->rows) {
+        norms.l1 += row.l1;
+        norms.l2 += row.l2;
+        norms.mass += row.mass;
+        norms.linf = std::max(norms.linf, (double)row.linf);
+        norms.cells += row.cells;
+    }
+    norms.l2 = std::sqrt(norms.l2);
+    this->norms = norms;
+    return this->norms;
+}
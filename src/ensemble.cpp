@@ -0,0 +1,258 @@
+/**
+ * @file ensemble.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ensemble.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "kernel.hpp"
+
+// Members advanced by each vector of the shared sweep
+static constexpr uint vector_lanes = 8;
+/* The cell of a member changes the types and coefficients of the cells
+ * next to it, and with them the updates of the cells up to two away. Patches
+ * update the cells up to three away, reading the coefficients of their
+ * neighbours too. */
+static constexpr int update_radius = 3;
+static constexpr int patch_radius = update_radius + 1;
+static constexpr int patch_size = 2 * patch_radius + 1;
+
+Ensemble::Ensemble(Board* layout,
+                   const std::vector<std::pair<uint, uint>>& emitters,
+                   Cell::Type type) {
+    if (emitters.empty()) {
+        throw std::runtime_error("An ensemble needs at least one member.");
+    }
+    if (layout->getStorage() != Board::Storage::Float) {
+        throw std::runtime_error("Ensembles only support float storage.");
+    }
+    if (type != Cell::Emitter && type != Cell::Escape) {
+        throw std::runtime_error(
+            "Ensemble members differ in an emitter or an escape.");
+    }
+    for (auto& emitter : emitters) {
+        if (!layout->contains(emitter.first, emitter.second)) {
+            throw std::runtime_error(type == Cell::Emitter
+                                         ? "Emitter coordinates out of bounds."
+                                         : "Escape coordinates out of bounds.");
+        }
+        Cell::Type old =
+            layout->getTypes()[layout->indexOf(emitter.first, emitter.second)];
+        if (type == Cell::Emitter && old != Cell::Floor)
+            throw std::runtime_error("Emitter not on floor tile.");
+        if (type == Cell::Escape && old != Cell::Floor && old != Cell::Wall)
+            throw std::runtime_error("Escape not on a floor or wall tile.");
+    }
+    this->layout = layout->fork();
+    this->emitters = emitters;
+    this->member_type = type;
+    this->lanes = (emitters.size() + vector_lanes - 1) / vector_lanes *
+                  vector_lanes;
+    size_t size = this->layout->getPaddedSize();
+    const float* density = this->layout->getDensities();
+    this->density.resize(size * this->lanes);
+    for (size_t idx = 0; idx < size; idx++) {
+        std::fill_n(this->density.begin() + idx * this->lanes, this->lanes,
+                    density[idx]);
+    }
+    // Emitters are placed full and escapes empty, like Board does
+    for (uint member = 0; member < this->getSize(); member++) {
+        auto& emitter = emitters[member];
+        size_t idx = this->layout->indexOf(emitter.first, emitter.second);
+        this->density[idx * this->lanes + member] =
+            type == Cell::Emitter ? 1.f : 0.f;
+    }
+    this->density_next = this->density;
+    this->max_change.assign(this->lanes, 0.f);
+}
+
+void Ensemble::prepare() {
+    bool precalc = this->use_precalc_weights;
+    float bias = this->elevation_bias;
+    if (!this->layout->hasFlowCoefficients(precalc, bias))
+        this->layout->computeFlowCoefficients(precalc, bias);
+    this->patches.clear();
+    for (auto& emitter : this->emitters) {
+        // Build the board of the member as a Sim would, and keep its window
+        Board* board = this->layout->fork();
+        if (this->member_type == Cell::Emitter) {
+            board->placeEmitter(emitter.first, emitter.second);
+            board->computeWeightsAround(emitter.first, emitter.second);
+        } else {
+            board->setCellType(emitter.first, emitter.second, Cell::Escape);
+        }
+        board->computeFlowCoefficients(precalc, bias);
+        Patch patch;
+        patch.row = emitter.first;
+        patch.col = emitter.second;
+        size_t cells = patch_size * patch_size;
+        patch.type.assign(cells, Cell::Wall);
+        patch.rate_index.assign(cells, 0);
+        patch.flow_in.assign(cells, 0.f);
+        for (auto dir : directions) patch.flow_out[dir].assign(cells, 0.f);
+        patch.rates.assign(board->getRates(),
+                           board->getRates() + board->getRateCount());
+        // Cells past the border of the board are left as walls
+        long stride = board->getStride();
+        long rows = board->getPaddedSize() / stride;
+        size_t centre = board->indexOf(emitter.first, emitter.second);
+        for (int row = -patch_radius; row <= patch_radius; row++) {
+            for (int col = -patch_radius; col <= patch_radius; col++) {
+                long padded_row = (long)(centre / stride) + row;
+                long padded_col = (long)(centre % stride) + col;
+                if (padded_row < 0 || padded_row >= rows || padded_col < 0 ||
+                    padded_col >= stride)
+                    continue;
+                size_t idx = padded_row * stride + padded_col;
+                size_t cell = (row + patch_radius) * patch_size +
+                              (col + patch_radius);
+                patch.type[cell] = board->getTypes()[idx];
+                patch.rate_index[cell] = board->getRateIndices()[idx];
+                patch.flow_in[cell] = board->getInflowCoefficients()[idx];
+                for (auto dir : directions) {
+                    patch.flow_out[dir][cell] =
+                        board->getOutflowCoefficients()[dir][idx];
+                }
+            }
+        }
+        delete board;
+        this->patches.push_back(std::move(patch));
+    }
+    this->prepared = true;
+    this->prepared_precalc = precalc;
+    this->prepared_bias = bias;
+}
+
+void Ensemble::updateShared() {
+    bool uniform = this->layout->hasUniformRates();
+    KernelArgs args = {};
+    args.type = this->layout->getTypes();
+    args.links = this->layout->getLinks();
+    args.flow_in = this->layout->getInflowCoefficients();
+    args.flow_out = this->layout->getOutflowCoefficients();
+    args.src = this->density.data();
+    args.dst = this->density_next.data();
+    args.rate_index = uniform ? nullptr : this->layout->getRateIndices();
+    args.rates = uniform ? nullptr : this->layout->getRates();
+    args.stride = this->layout->getStride();
+    args.emitter_rate = this->emitter_rate;
+    args.escape_rate = this->escape_rate;
+    const ptrdiff_t offsets[4] = {-(ptrdiff_t)args.stride,
+                                  (ptrdiff_t)args.stride, -1, 1};
+    const size_t lanes = this->lanes;
+    for (uint row = 0; row < this->layout->getHeight(); row++) {
+        size_t begin = this->layout->indexOf(row, 0);
+        size_t end = begin + this->layout->getWidth();
+        if (updateCellsSimd(args, lanes, begin, end)) continue;
+        for (size_t cur = begin; cur < end; cur++) {
+            const float* density = args.src + cur * lanes;
+            if (args.links[cur] == 0) {
+                std::copy_n(density, lanes, args.dst + cur * lanes);
+                continue;
+            }
+            CellFlows flows;
+            const float* adj_density[4];
+            gatherFlows(args, cur, &flows);
+            for (int dir = 0; dir < 4; dir++)
+                adj_density[dir] = args.src + (cur + offsets[dir]) * lanes;
+            updateLanes(flows, density, adj_density, args.dst + cur * lanes,
+                        lanes);
+        }
+    }
+}
+
+void Ensemble::updatePatch(uint member) {
+    const Patch& patch = this->patches[member];
+    const float* src = this->density.data();
+    float* dst = this->density_next.data();
+    const ptrdiff_t stride = this->layout->getStride();
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const int patch_offsets[4] = {-patch_size, patch_size, -1, 1};
+    const size_t lanes = this->lanes;
+    // The vector of lanes the member is in is advanced, and only it kept
+    size_t first = member / vector_lanes * vector_lanes;
+    float next[vector_lanes];
+    for (int row = -update_radius; row <= update_radius; row++) {
+        for (int col = -update_radius; col <= update_radius; col++) {
+            // Rows and columns before the first one wrap around and are skipped
+            uint board_row = patch.row + row, board_col = patch.col + col;
+            if (!this->layout->contains(board_row, board_col)) continue;
+            size_t cur = this->layout->indexOf(board_row, board_col);
+            int cell = (row + patch_radius) * patch_size + (col + patch_radius);
+            if (patch.type[cell] != Cell::Floor) {
+                dst[cur * lanes + member] = src[cur * lanes + member];
+                continue;
+            }
+            CellFlows flows;
+            const float* adj_density[4];
+            flows.flow_in = patch.flow_in[cell];
+            for (int dir = 0; dir < 4; dir++) {
+                int adj = cell + patch_offsets[dir];
+                adj_density[dir] = src + (cur + offsets[dir]) * lanes + first;
+                flows.flow_out[dir] = patch.flow_out[dir][cell];
+                flows.adj_type[dir] = patch.type[adj];
+                flows.adj_flow_in[dir] = patch.flow_in[adj];
+                flows.adj_flow_out[dir] = patch.flow_out[dir ^ 1][adj];
+                flows.adj_rate[dir] = (patch.type[adj] == Cell::Emitter
+                                           ? this->emitter_rate
+                                           : this->escape_rate) *
+                                      patch.rates[patch.rate_index[adj]];
+            }
+            updateLanes(flows, src + cur * lanes + first, adj_density, next,
+                        vector_lanes);
+            dst[cur * lanes + member] = next[member - first];
+        }
+    }
+}
+
+void Ensemble::measureChange() {
+    const Cell::Type* type = this->layout->getTypes();
+    const size_t lanes = this->lanes;
+    std::fill(this->max_change.begin(), this->max_change.end(), 0.f);
+    for (uint row = 0; row < this->layout->getHeight(); row++) {
+        size_t cur = this->layout->indexOf(row, 0);
+        for (uint col = 0; col < this->layout->getWidth(); col++, cur++) {
+            // The cell of a member is left as it is, like walls
+            if (type[cur] != Cell::Floor) continue;
+            const float* density = this->density.data() + cur * lanes;
+            const float* next = this->density_next.data() + cur * lanes;
+            for (size_t lane = 0; lane < lanes; lane++) {
+                this->max_change[lane] =
+                    std::max(this->max_change[lane],
+                             std::fabs(next[lane] - density[lane]));
+            }
+        }
+    }
+}
+
+void Ensemble::tick() {
+    if (!this->prepared ||
+        this->prepared_precalc != this->use_precalc_weights ||
+        this->prepared_bias != this->elevation_bias)
+        this->prepare();
+    this->updateShared();
+    for (uint member = 0; member < this->getSize(); member++)
+        this->updatePatch(member);
+    if (this->measure_change) this->measureChange();
+    std::swap(this->density, this->density_next);
+    this->ticks++;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file footprint.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "footprint.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+void Footprint::add(const std::string& name, size_t bytes) {
+    for (auto& part : this->parts) {
+        if (part.name == name) {
+            part.bytes += bytes;
+            return;
+        }
+    }
+    this->parts.push_back({name, bytes});
+}
+
+void Footprint::add(const Footprint& other) {
+    for (auto& part : other.parts) this->add(part.name, part.bytes);
+}
+
+size_t Footprint::get(const std::string& name) const {
+    for (auto& part : this->parts) {
+        if (part.name == name) return part.bytes;
+    }
+    return 0;
+}
+
+size_t Footprint::getTotal() const {
+    size_t total = 0;
+    for (auto& part : this->parts) total += part.bytes;
+    return total;
+}
+
+size_t MemoryBudget::getAvailable() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->limit - this->used;
+}
+
+bool MemoryBudget::reserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (bytes > this->limit - this->used) return false;
+    this->used += bytes;
+    return true;
+}
+
+void MemoryBudget::release(size_t bytes) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->used -= std::min(bytes, this->used);
+}
+
+size_t parseBytes(const std::string& text) {
+    const char* begin = text.c_str();
+    char* end;
+    errno = 0;
+    unsigned long long count = std::strtoull(begin, &end, 10);
+    bool valid = end != begin && errno == 0 && text[0] != '-';
+    unsigned int shift = 0;
+    if (valid && *end != '\0') {
+        switch (*end++) {
+            case 'K':
+            case 'k':
+                shift = 10;
+                break;
+            case 'M':
+            case 'm':
+                shift = 20;
+                break;
+            case 'G':
+            case 'g':
+                shift = 30;
+                break;
+            default:
+                valid = false;
+        }
+        valid = valid && *end == '\0';
+    }
+    if (!valid || count > (SIZE_MAX >> shift)) {
+        throw std::runtime_error(
+            "Byte counts must be whole numbers, optionally followed by K, M "
+            "or G.");
+    }
+    return (size_t)count << shift;
+}
+
+std::string formatBytes(size_t bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024. && unit < 3) {
+        value /= 1024.;
+        unit++;
+    }
+    char text[32];
+    if (unit == 0) {
+        snprintf(text, sizeof(text), "%zu B", bytes);
+    } else {
+        snprintf(text, sizeof(text), "%.1f %s", value, units[unit]);
+    }
+    return text;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file frames.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Project Includes
+#include "recording.hpp"
+
+struct Options {
+    std::string recording_path;
+    // Write out the frame recorded at this tick, instead of listing frames
+    long tick = -1;
+    std::string output_path;
+};
+
+static void usage(const char* argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options] RECORDING\n"
+        << "Lists the frames of a density recording, with the mass and peak\n"
+        << "density of each, or extracts one of them.\n"
+        << "  -t, --tick N           Write the frame recorded at tick N as\n"
+        << "                         CSV instead\n"
+        << "  -o, --output PATH      Write to a file instead of stdout\n"
+        << "  -h, --help             Show this message\n";
+}
+
+static Options parseOptions(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"tick", required_argument, nullptr, 't'},
+        {"output", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    Options opts;
+    int c;
+    while ((c = getopt_long(argc, argv, "t:o:h", long_options, nullptr)) !=
+           -1) {
+        switch (c) {
+            case 't':
+                opts.tick = std::stol(optarg);
+                if (opts.tick < 0)
+                    throw std::runtime_error("The tick must not be negative.");
+                break;
+            case 'o':
+                opts.output_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    opts.recording_path = argv[optind];
+    return opts;
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opts = parseOptions(argc, argv);
+        Playback playback(opts.recording_path);
+        FILE* fp = stdout;
+        if (!opts.output_path.empty()) {
+            fp = fopen(opts.output_path.c_str(), "w");
+            if (fp == nullptr) {
+                throw std::runtime_error(
+                    "An I/O error occurred while opening the file for "
+                    "writing.");
+            }
+        }
+        uint cols = playback.getWidth();
+        if (opts.tick < 0) {
+            fprintf(fp, "tick,mass,peak\n");
+            unsigned int tick;
+            std::vector<float> densities;
+            while (playback.next(&tick, densities)) {
+                double mass = 0.;
+                float peak = 0.f;
+                for (float density : densities) {
+                    mass += density;
+                    if (density > peak) peak = density;
+                }
+                fprintf(fp, "%u,%.9g,%.9g\n", tick, mass, peak);
+            }
+        } else {
+            // Decodes the key frame before the tick and the frames after it
+            size_t frame = playback.findFrame(opts.tick);
+            if (frame == playback.getFrameCount() ||
+                (long)playback.getTick(frame) != opts.tick) {
+                if (fp != stdout) fclose(fp);
+                throw std::runtime_error(
+                    "No frame was recorded at that tick.");
+            }
+            const std::vector<float>& densities = playback.seek(frame);
+            for (size_t idx = 0; idx < densities.size(); idx++) {
+                fprintf(fp, idx % cols == 0 ? "%.9g" : ",%.9g", densities[idx]);
+                if (idx % cols == cols - 1) fputc('\n', fp);
+            }
+        }
+        if (fp != stdout) fclose(fp);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file gl_util.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gl_util.hpp"
+
+#include <GL/glext.h>
+
+#include <stdexcept>
+
+const char* const fullscreen_vertex_shader = R"(#version 130
+void main() {
+    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// Same colours as colormap.hpp
+const char* const cell_colour_shader = R"(#version 130
+uniform sampler2D palette;
+uniform float emitter_rate;
+uniform float escape_rate;
+const float FLOOR = 1.0, EMITTER = 2.0, ESCAPE = 3.0;
+vec4 cellColour(float type, float rate, int level) {
+    if (type == FLOOR) {
+        return texelFetch(palette, ivec2(level, 0), 0);
+    } else if (type == EMITTER) {
+        float l = floor(255.0 * min(emitter_rate * rate, 1.0)) / 255.0;
+        return vec4(l, 1.0 - l, 1.0 - l, 1.0);
+    } else if (type == ESCAPE) {
+        float l = floor(255.0 * min(escape_rate * rate, 1.0)) / 255.0;
+        return vec4(1.0 - l, 1.0 - l, l, 1.0);
+    }
+    return vec4(0x4D, 0x5D, 0x53, 0xFF) / 255.0;
+}
+)";
+
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint ok;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        glDeleteShader(shader);
+        throw std::runtime_error(std::string("Shader error: ") + log);
+    }
+    return shader;
+}
+
+GLuint linkProgram(const std::string& fragment_source) {
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, fullscreen_vertex_shader);
+    GLuint fragment;
+    try {
+        fragment = compileShader(GL_FRAGMENT_SHADER, fragment_source.c_str());
+    } catch (std::runtime_error& e) {
+        glDeleteShader(vertex);
+        throw;
+    }
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    GLint ok;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        glDeleteProgram(program);
+        throw std::runtime_error(std::string("Shader link error: ") + log);
+    }
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "density"), 0);
+    glUniform1i(glGetUniformLocation(program, "cells"), 1);
+    glUniform1i(glGetUniformLocation(program, "palette"), 2);
+    glUseProgram(0);
+    return program;
+}
+
+GLuint createTexture(GLint format, GLsizei width, GLsizei height,
+                     GLenum data_format, GLenum data_type, const void* data) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, data_format,
+                 data_type, data);
+    return texture;
+}
+
+GLuint createFramebuffer(GLuint texture) {
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, texture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        glDeleteFramebuffers(1, &framebuffer);
+        throw std::runtime_error("Incomplete framebuffer.");
+    }
+    return framebuffer;
+}
+
+GLuint createPaletteTexture(Palette palette) {
+    uint32_t colors[palette_levels];
+    buildPalette(palette, colors);
+    return createTexture(GL_RGBA8, palette_levels, 1, GL_RGBA,
+                         GL_UNSIGNED_INT_8_8_8_8, colors);
+}
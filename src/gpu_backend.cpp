@@ -0,0 +1,219 @@
+/**
+ * @file gpu_backend.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "gpu_backend.hpp"
+
+#include <GL/glext.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gl_util.hpp"
+
+/* Same rule as the synchronous CPU kernel. Textures are halo-padded like the
+ * board, and border cells are walls, so interior cells never read outside. */
+static const char* step_shader = R"(#version 130
+uniform sampler2D density;
+uniform sampler2D cells;
+uniform float emitter_rate;
+uniform float escape_rate;
+uniform bool use_precalc_weights;
+out float next;
+const float FLOOR = 1.0, EMITTER = 2.0, ESCAPE = 3.0;
+const ivec2 offsets[4] = ivec2[4](ivec2(0, -1), ivec2(0, 1), ivec2(-1, 0),
+                                  ivec2(1, 0));
+void main() {
+    ivec2 cur = ivec2(gl_FragCoord.xy);
+    vec4 cell = texelFetch(cells, cur, 0);
+    float d = texelFetch(density, cur, 0).r;
+    if (cell.r != FLOOR) {
+        next = d;
+        return;
+    }
+    float omega_in = use_precalc_weights ? cell.g : 0.25;
+    float omega_out = use_precalc_weights ? cell.b : 0.25;
+    float intake = 0.0, outtake = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 adj = cur + offsets[i];
+        vec4 adj_cell = texelFetch(cells, adj, 0);
+        float adj_d = texelFetch(density, adj, 0).r;
+        float adj_omega_in = use_precalc_weights ? adj_cell.g : 0.25;
+        float adj_omega_out = use_precalc_weights ? adj_cell.b : 0.25;
+        if (adj_cell.r == FLOOR) {
+            outtake += min(omega_out * d, adj_omega_in * (1.0 - adj_d));
+            intake += min(adj_omega_out * adj_d, omega_in * (1.0 - d));
+        } else if (adj_cell.r == EMITTER) {
+            intake += emitter_rate * adj_cell.a *
+                      min(adj_omega_out * adj_d, omega_in * (1.0 - d));
+        } else if (adj_cell.r == ESCAPE) {
+            outtake += escape_rate * adj_cell.a * omega_out * d;
+        }
+    }
+    next = d + (intake - outtake);
+}
+)";
+
+// Halo-padded like the densities, the display texture has no border
+static const std::string display_shader = std::string(cell_colour_shader) + R"(
+uniform sampler2D density;
+uniform sampler2D cells;
+out vec4 color;
+void main() {
+    ivec2 cur = ivec2(gl_FragCoord.xy) + ivec2(1, 1);
+    vec4 cell = texelFetch(cells, cur, 0);
+    float d = clamp(texelFetch(density, cur, 0).r, 0.0, 1.0);
+    color = cellColour(cell.r, cell.a, int(d * 255.0));
+}
+)";
+
+GpuBackend::GpuBackend(Sim& sim) {
+    Board* board = sim.board;
+    if (board->getStorage() != Board::Storage::Float)
+        throw std::runtime_error("The GPU backend needs float densities.");
+    this->width = board->getWidth();
+    this->height = board->getHeight();
+    this->stride = board->getStride();
+    this->rows = (size_t)this->height + 2;
+    GLint max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (this->stride > (size_t)max_size || this->rows > (size_t)max_size)
+        throw std::runtime_error("The board is too large for the GPU.");
+    size_t size = board->getPaddedSize();
+    const Cell::Type* type = board->getTypes();
+    const float* omega_in = board->getOmegaIn();
+    const float* omega_out = board->getOmegaOut();
+    std::vector<float> cells(size * 4);
+    for (size_t idx = 0; idx < size; idx++) {
+        cells[idx * 4 + 0] = type[idx];
+        cells[idx * 4 + 1] = omega_in[idx];
+        cells[idx * 4 + 2] = omega_out[idx];
+        cells[idx * 4 + 3] = board->getRate(idx);
+    }
+    try {
+        this->step_program = linkProgram(step_shader);
+        this->display_program = linkProgram(display_shader);
+        this->cells = createTexture(GL_RGBA32F, this->stride, this->rows,
+                                    GL_RGBA, GL_FLOAT, cells.data());
+        for (uint i = 0; i < 2; i++) {
+            this->densities[i] =
+                createTexture(GL_R32F, this->stride, this->rows, GL_RED,
+                              GL_FLOAT, board->getDensities());
+            this->framebuffers[i] = createFramebuffer(this->densities[i]);
+        }
+        this->display = createTexture(GL_RGBA8, this->width, this->height,
+                                      GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        this->display_framebuffer = createFramebuffer(this->display);
+    } catch (std::runtime_error& e) {
+        this->release();
+        throw;
+    }
+    glGenVertexArrays(1, &this->vertex_array);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GpuBackend::~GpuBackend() { this->release(); }
+
+void GpuBackend::release() {
+    glDeleteVertexArrays(1, &this->vertex_array);
+    glDeleteFramebuffers(1, &this->display_framebuffer);
+    glDeleteFramebuffers(2, this->framebuffers);
+    glDeleteTextures(1, &this->display);
+    glDeleteTextures(1, &this->palette);
+    glDeleteTextures(2, this->densities);
+    glDeleteTextures(1, &this->cells);
+    glDeleteProgram(this->display_program);
+    glDeleteProgram(this->step_program);
+}
+
+void GpuBackend::draw(GLuint framebuffer, GLsizei width, GLsizei height) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->cells);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, this->densities[this->current]);
+    glBindVertexArray(this->vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void GpuBackend::tick(Sim& sim, float emitter_rate, float escape_rate,
+                      bool use_precalc_weights) {
+    if (sim.elevation_bias != 0.f) {
+        throw std::runtime_error(
+            "The GPU backend does not model floor heights.");
+    }
+    if (!sim.board->getWinds().empty())
+        throw std::runtime_error("The GPU backend does not model winds.");
+    if (sim.draft_noise != 0.f)
+        throw std::runtime_error("The GPU backend does not model drafts.");
+    glUseProgram(this->step_program);
+    glUniform1f(glGetUniformLocation(this->step_program, "emitter_rate"),
+                emitter_rate);
+    glUniform1f(glGetUniformLocation(this->step_program, "escape_rate"),
+                escape_rate);
+    glUniform1i(
+        glGetUniformLocation(this->step_program, "use_precalc_weights"),
+        use_precalc_weights);
+    this->draw(this->framebuffers[this->current ^ 1], this->stride,
+               this->rows);
+    glUseProgram(0);
+    this->current ^= 1;
+}
+
+void GpuBackend::download(Sim& sim) {
+    Board* board = sim.board;
+    board->ownDensities();
+    glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffers[this->current]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, this->stride, this->rows, GL_RED, GL_FLOAT,
+                 board->getDensities());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GpuBackend::render(Sim& sim, Palette palette) {
+    if (this->palette == 0 || palette != this->palette_shown) {
+        glDeleteTextures(1, &this->palette);
+        this->palette = createPaletteTexture(palette);
+        this->palette_shown = palette;
+    }
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, this->palette);
+    glActiveTexture(GL_TEXTURE0);
+    glUseProgram(this->display_program);
+    glUniform1f(glGetUniformLocation(this->display_program, "emitter_rate"),
+                sim.emitter_rate);
+    glUniform1f(glGetUniformLocation(this->display_program, "escape_rate"),
+                sim.escape_rate);
+    this->draw(this->display_framebuffer, this->width, this->height);
+    glUseProgram(0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,434 @@
+/**
+ * @file graph.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "graph.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * @brief Parse the cell or the edge of one line of a graph file, into the
+ * position and the rate of a cell or the ends and the weights of an edge.
+ * @return false if the line is neither.
+ */
+static bool parseLine(std::istringstream& line, bool* is_cell,
+                      float* values, Cell::Type* type, uint* ends) {
+    // Optional numbers keep their defaults when the line ends before them
+    auto optional = [&](float* value) {
+        if (line >> *value) return true;
+        line.clear();
+        return false;
+    };
+    std::string kind;
+    if (!(line >> kind)) return false;
+    if (kind == "cell") {
+        *is_cell = true;
+        std::string name;
+        if (!(line >> values[0] >> values[1] >> name)) return false;
+        if (name == "floor") {
+            *type = Cell::Floor;
+        } else if (name == "emitter") {
+            *type = Cell::Emitter;
+        } else if (name == "escape") {
+            *type = Cell::Escape;
+        } else {
+            return false;
+        }
+        if (!optional(&values[2])) values[2] = 1.f;
+        if (!(std::isfinite(values[0]) && std::isfinite(values[1]) &&
+              values[2] >= 0.f))
+            return false;
+    } else if (kind == "edge") {
+        *is_cell = false;
+        if (!(line >> ends[0] >> ends[1])) return false;
+        if (!optional(&values[0])) values[0] = 1.f;
+        if (!optional(&values[1])) values[1] = values[0];
+        if (!(values[0] > 0.f && values[1] > 0.f)) return false;
+    } else {
+        return false;
+    }
+    std::string rest;
+    return !(line >> rest);
+}
+
+Graph::Graph(const std::string& path, bool use_precalc_weights) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct Link {
+        uint from, to;
+        float weight;
+    };
+    std::vector<Link> links;
+    std::string text;
+    for (uint number = 1; std::getline(file, text); number++) {
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) text.erase(comment);
+        std::istringstream line(text);
+        // Lines without anything but blanks are skipped
+        if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+        bool is_cell;
+        float values[3];
+        Cell::Type type;
+        uint ends[2];
+        if (!parseLine(line, &is_cell, values, &type, ends)) {
+            std::stringstream ss;
+            ss << "Invalid cell or edge at line " << number
+               << " of the graph.";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        if (is_cell) {
+            this->type.push_back(type);
+            this->x.push_back(values[0]);
+            this->y.push_back(values[1]);
+            this->rate.push_back(values[2]);
+        } else {
+            links.push_back({ends[0], ends[1], values[0]});
+            links.push_back({ends[1], ends[0], values[1]});
+        }
+    }
+    if (file.bad()) {
+        throw std::runtime_error(
+            "An I/O error occurred while reading the file.");
+    }
+    uint cells = this->type.size();
+    if (cells == 0) throw std::runtime_error("The graph has no cells.");
+    this->edge_begin.assign(cells + 1, 0);
+    for (auto& link : links) {
+        if (link.from >= cells || link.to >= cells || link.from == link.to) {
+            throw std::runtime_error(
+                "Edges must link two distinct cells of the graph.");
+        }
+        this->edge_begin[link.from + 1]++;
+    }
+    std::partial_sum(this->edge_begin.begin(), this->edge_begin.end(),
+                     this->edge_begin.begin());
+    // Each cell keeps its edges in the order of the file
+    this->edges.resize(links.size());
+    std::vector<size_t> next(this->edge_begin.begin(),
+                             this->edge_begin.end() - 1);
+    for (auto& link : links)
+        this->edges[next[link.from]++] = {link.to, link.weight, 0.f, 0.f};
+    this->id.resize(cells);
+    std::iota(this->id.begin(), this->id.end(), 0);
+    this->slot = this->id;
+    this->density.assign(cells, 0.f);
+    for (uint cell = 0; cell < cells; cell++) {
+        // Emitters are placed full, like Board::placeEmitter() does
+        if (this->type[cell] == Cell::Emitter) this->density[cell] = 1.f;
+    }
+    this->density_next = this->density;
+    this->computeFlows(use_precalc_weights);
+}
+
+Graph::Graph(Board* board, bool use_precalc_weights, float elevation_bias) {
+    if (board->getStorage() != Board::Storage::Float) {
+        throw std::runtime_error("Graphs only support float storage.");
+    }
+    if (!board->hasFlowCoefficients(use_precalc_weights, elevation_bias))
+        board->computeFlowCoefficients(use_precalc_weights, elevation_bias);
+    const Cell::Type* type = board->getTypes();
+    const uchar* rate_index = board->getRateIndices();
+    const float* rates = board->getRates();
+    const float* density = board->getDensities();
+    const float* flow_in = board->getInflowCoefficients();
+    float* const* flow_out = board->getOutflowCoefficients();
+    // Cell numbers of the padded board, walls having none
+    std::vector<uint> cell_of(board->getPaddedSize(), UINT_MAX);
+    for (uint row = 0; row < board->getHeight(); row++) {
+        for (uint col = 0; col < board->getWidth(); col++) {
+            size_t idx = board->indexOf(row, col);
+            if (type[idx] == Cell::Wall) continue;
+            cell_of[idx] = this->type.size();
+            this->type.push_back(type[idx]);
+            this->x.push_back(col);
+            this->y.push_back(row);
+            this->rate.push_back(rates[rate_index[idx]]);
+            this->density.push_back(density[idx]);
+            this->flow_in.push_back(flow_in[idx]);
+        }
+    }
+    uint cells = this->type.size();
+    if (cells == 0) throw std::runtime_error("The graph has no cells.");
+    this->edge_begin.push_back(0);
+    for (uint row = 0; row < board->getHeight(); row++) {
+        for (uint col = 0; col < board->getWidth(); col++) {
+            size_t idx = board->indexOf(row, col);
+            if (type[idx] == Cell::Wall) continue;
+            // In the order the transition function visits the neighbours
+            for (auto dir : directions) {
+                size_t adj = board->neighbourOf(dir, idx);
+                if (type[adj] == Cell::Wall) continue;
+                float out = flow_out[dir][idx];
+                this->edges.push_back({cell_of[adj], out > 0.f ? out : 1.f,
+                                       out, flow_out[dir ^ 1][adj]});
+            }
+            this->edge_begin.push_back(this->edges.size());
+        }
+    }
+    this->id.resize(cells);
+    std::iota(this->id.begin(), this->id.end(), 0);
+    this->slot = this->id;
+    this->density_next = this->density;
+}
+
+void Graph::computeFlows(bool use_precalc_weights) {
+    uint cells = this->getSize();
+    size_t most = 4;
+    for (uint cell = 0; cell < cells; cell++) {
+        most = std::max(most,
+                        this->edge_begin[cell + 1] - this->edge_begin[cell]);
+    }
+    this->flow_in.assign(cells, 1.f / most);
+    for (uint cell = 0; cell < cells; cell++) {
+        size_t begin = this->edge_begin[cell], end = this->edge_begin[cell + 1];
+        // Counted like Board::countNeighbours() does
+        uint ins = 0, outs = 0;
+        float total = 0.f;
+        for (size_t edge = begin; edge < end; edge++) {
+            Cell::Type adj = this->type[this->edges[edge].cell];
+            ins += adj == Cell::Floor || adj == Cell::Emitter;
+            if (adj == Cell::Floor || adj == Cell::Escape) {
+                outs++;
+                total += this->edges[edge].weight;
+            }
+        }
+        float omega_out = 1.f / most;
+        if (use_precalc_weights) {
+            this->flow_in[cell] = ins == 0 ? 0.f : 1.f / (float)ins;
+            omega_out = outs == 0 ? 0.f : 1.f / (float)outs;
+        }
+        bool split = this->type[cell] == Cell::Floor ||
+                     this->type[cell] == Cell::Emitter;
+        for (size_t edge = begin; edge < end; edge++) {
+            Cell::Type adj = this->type[this->edges[edge].cell];
+            float lift = 1.f;
+            if (split && (adj == Cell::Floor || adj == Cell::Escape))
+                lift = outs * this->edges[edge].weight / total;
+            this->edges[edge].flow_out = omega_out * lift;
+        }
+    }
+    this->linkBack();
+}
+
+void Graph::linkBack() {
+    for (uint cell = 0; cell < this->getSize(); cell++) {
+        for (size_t edge = this->edge_begin[cell];
+             edge < this->edge_begin[cell + 1]; edge++) {
+            uint adj = this->edges[edge].cell;
+            for (size_t back = this->edge_begin[adj];
+                 back < this->edge_begin[adj + 1]; back++) {
+                if (this->edges[back].cell != cell) continue;
+                this->edges[edge].flow_back = this->edges[back].flow_out;
+                break;
+            }
+        }
+    }
+}
+
+void Graph::save(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    static const char* names[] = {"wall", "floor", "emitter", "escape"};
+    for (uint cell = 0; cell < this->getSize(); cell++) {
+        uint at = this->slot[cell];
+        fprintf(fp, "cell %g %g %s", this->x[at], this->y[at],
+                names[this->type[at]]);
+        if (this->rate[at] != 1.f) fprintf(fp, " %.9g", this->rate[at]);
+        fputc('\n', fp);
+    }
+    // Each pair of cells once, from the one numbered first
+    for (uint cell = 0; cell < this->getSize(); cell++) {
+        uint at = this->slot[cell];
+        for (size_t edge = this->edge_begin[at];
+             edge < this->edge_begin[at + 1]; edge++) {
+            uint adj = this->edges[edge].cell;
+            if (this->id[adj] < cell) continue;
+            float back = 1.f;
+            for (size_t other = this->edge_begin[adj];
+                 other < this->edge_begin[adj + 1]; other++) {
+                if (this->edges[other].cell == at)
+                    back = this->edges[other].weight;
+            }
+            fprintf(fp, "edge %u %u %.9g %.9g\n", cell, this->id[adj],
+                    this->edges[edge].weight, back);
+        }
+    }
+    bool failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
+
+/**
+ * @brief Spread the 16 bits of v over the even bits of the result.
+ */
+static uint32_t spreadBits(uint32_t v) {
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static uint64_t mortonKey(uint32_t x, uint32_t y) {
+    return spreadBits(x) | (uint64_t)spreadBits(y) << 1;
+}
+
+/**
+ * @brief Get the distance along the Hilbert curve through a 65536 by 65536
+ * square of a point in it.
+ */
+static uint64_t hilbertKey(uint32_t x, uint32_t y) {
+    const uint32_t side = 1u << 16;
+    uint64_t key = 0;
+    for (uint32_t half = side / 2; half > 0; half /= 2) {
+        uint32_t rx = (x & half) != 0, ry = (y & half) != 0;
+        key += (uint64_t)half * half * ((3 * rx) ^ ry);
+        // Turn the quadrant so that the curve enters it the same way
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return key;
+}
+
+void Graph::reorder(Graph::Order order) {
+    uint cells = this->getSize();
+    auto [min_x, max_x] = std::minmax_element(this->x.begin(), this->x.end());
+    auto [min_y, max_y] = std::minmax_element(this->y.begin(), this->y.end());
+    // The same scale on both axes, so that the curve keeps its shape
+    float extent = std::max(*max_x - *min_x, *max_y - *min_y);
+    float scale = extent > 0.f ? 65535.f / extent : 0.f;
+    std::vector<uint64_t> keys(cells);
+    for (uint cell = 0; cell < cells; cell++) {
+        uint32_t qx = (this->x[cell] - *min_x) * scale;
+        uint32_t qy = (this->y[cell] - *min_y) * scale;
+        switch (order) {
+            case Graph::Order::File:
+                keys[cell] = this->id[cell];
+                break;
+            case Graph::Order::Morton:
+                keys[cell] = mortonKey(qx, qy);
+                break;
+            case Graph::Order::Hilbert:
+                keys[cell] = hilbertKey(qx, qy);
+                break;
+        }
+    }
+    // Cells at the same point keep their relative order
+    std::vector<uint> old(cells);
+    std::iota(old.begin(), old.end(), 0);
+    std::stable_sort(old.begin(), old.end(), [&](uint a, uint b) {
+        return keys[a] < keys[b];
+    });
+    std::vector<uint> moved(cells);
+    for (uint cell = 0; cell < cells; cell++) moved[old[cell]] = cell;
+    auto permute = [&](auto& values) {
+        auto copy = values;
+        for (uint cell = 0; cell < cells; cell++)
+            values[cell] = copy[old[cell]];
+    };
+    permute(this->type);
+    permute(this->x);
+    permute(this->y);
+    permute(this->rate);
+    permute(this->id);
+    permute(this->density);
+    permute(this->density_next);
+    permute(this->flow_in);
+    for (uint cell = 0; cell < cells; cell++) this->slot[this->id[cell]] = cell;
+    std::vector<size_t> edge_begin(1, 0);
+    std::vector<Edge> edges;
+    edges.reserve(this->edges.size());
+    for (uint cell = 0; cell < cells; cell++) {
+        for (size_t edge = this->edge_begin[old[cell]];
+             edge < this->edge_begin[old[cell] + 1]; edge++) {
+            Edge moved_edge = this->edges[edge];
+            moved_edge.cell = moved[moved_edge.cell];
+            edges.push_back(moved_edge);
+        }
+        edge_begin.push_back(edges.size());
+    }
+    this->edge_begin = std::move(edge_begin);
+    this->edges = std::move(edges);
+}
+
+void Graph::tick() {
+    const float* src = this->density.data();
+    float* dst = this->density_next.data();
+    const Edge* edges = this->edges.data();
+    for (uint cur = 0; cur < this->getSize(); cur++) {
+        float density = src[cur];
+        if (this->type[cur] != Cell::Floor) {
+            dst[cur] = density;
+            continue;
+        }
+        // The transition function of the grid, see cellFlux()
+        float cur_flow_in = this->flow_in[cur];
+        float intake = .0f, outtake = .0f;
+        for (size_t edge = this->edge_begin[cur];
+             edge < this->edge_begin[cur + 1]; edge++) {
+            uint adj = edges[edge].cell;
+            float adj_density = src[adj];
+            if (this->type[adj] == Cell::Floor) {
+                outtake += std::min(edges[edge].flow_out * density,
+                                    this->flow_in[adj] * (1 - adj_density));
+                intake += std::min(edges[edge].flow_back * adj_density,
+                                   cur_flow_in * (1 - density));
+            } else if (this->type[adj] == Cell::Emitter) {
+                float rate = this->emitter_rate * this->rate[adj];
+                intake += rate * std::min(edges[edge].flow_back * adj_density,
+                                          cur_flow_in * (1 - density));
+            } else {
+                float rate = this->escape_rate * this->rate[adj];
+                outtake += rate * edges[edge].flow_out * density;
+            }
+        }
+        dst[cur] = density + (intake - outtake);
+    }
+    std::swap(this->density, this->density_next);
+    this->ticks++;
+}
+
+double Graph::getMass() {
+    double mass = 0.;
+    for (uint cell = 0; cell < this->getSize(); cell++) {
+        if (this->type[cell] == Cell::Floor) mass += this->density[cell];
+    }
+    return mass;
+}
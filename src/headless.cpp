@@ -0,0 +1,2116 @@
+/**
+ * @file headless.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project Includes
+#include "board_file.hpp"
+#include "building.hpp"
+#include "checkpoint.hpp"
+#include "crowd.hpp"
+#include "footprint.hpp"
+#include "graph.hpp"
+#include "job_server.hpp"
+#include "live.hpp"
+#include "probe.hpp"
+#ifdef SMOKEY_RECORDING
+#include "recording.hpp"
+#include "stream.hpp"
+#endif
+#include "scenario.hpp"
+#include "sim.hpp"
+#include "sweep.hpp"
+#include "synthetic.hpp"
+#include "video.hpp"
+
+struct Source {
+    uint row, col;
+    float rate;
+};
+
+// Options without a short form
+enum {
+    StreamRateOption = 256,
+    ServeOption,
+    ServeJobsOption,
+    DoseMapOption,
+    DoseLimitOption,
+    OccupantsOption,
+    OccupantSpeedOption,
+    OccupantReportOption,
+    CurveOption,
+    VideoOption,
+    VideoEveryOption,
+    VideoWidthOption,
+    VideoFpsOption,
+    VideoPaletteOption,
+    MemoryBudgetOption,
+    ServeAddressOption
+};
+
+class LayoutCache;
+
+struct Options {
+    std::string layout_path = "../layouts/default.txt";
+    std::vector<Source> emitters;
+    std::vector<Source> escapes;
+    std::vector<Wind> winds;
+    std::shared_ptr<const GrowthCurve> curve;
+    unsigned long ticks = 100;
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    Sim::Update update_mode = Sim::Update::InPlace;
+    uint threads = 1;
+    bool pin_threads = false;
+    uint time_block = 1;
+    Sim::Kernel kernel = Sim::Kernel::Simd;
+    Sim::Stencil stencil = Sim::Stencil::VonNeumann;
+    bool track_activity = true;
+    bool track_mass = false;
+    float arrival_threshold = 0.f;
+    std::string arrival_path;
+    std::string dose_path;
+    float dose_limit = 0.f;
+    uint occupants = 0;
+    uint64_t occupant_seed = 0;
+    float occupant_speed = 1.f;
+    std::string occupant_path;
+    Board::Storage storage = Board::Storage::Float;
+    float elevation_bias = 0.f;
+    float draft_noise = 0.f;
+    uint64_t draft_seed = 0;
+    float tolerance = 0.f;
+    float quiet_threshold = 0.f;
+    uint quiet_period = 4;
+    bool solve = false;
+    float relaxation = 1.9f;
+    uint coarse = 1;
+    std::string density_path;
+    std::string stats_path;
+    std::string outflow_path;
+    std::vector<Probe> probes;
+    std::string probe_path;
+    std::string summary_path;
+    std::string board_path;
+    std::string trace_path;
+    std::string record_path;
+    uint record_every = 1;
+    std::string video_path;
+    uint video_every = 1;
+    // Of the board if 0
+    uint video_width = 0;
+    float video_fps = 30.f;
+    Palette video_palette = Palette::Grey;
+    std::string share_name;
+    uint share_every = 1;
+    uint stream_port = 0;
+    float stream_rate = 10.f;
+    std::string checkpoint_path;
+    unsigned long checkpoint_every = 0;
+    std::string resume_path;
+    std::string scenario_path;
+    std::string graph_path;
+    Graph::Order graph_order = Graph::Order::Hilbert;
+    std::string graph_out_path;
+    std::string building_path;
+    float rise_rate = .25f;
+    float sink_rate = .05f;
+    std::vector<std::vector<BranchChange>> branches;
+    unsigned long branch_ticks = 100;
+    uint serve_port = 0;
+    std::string serve_address = "127.0.0.1";
+    uint serve_jobs = std::max(1u, std::thread::hardware_concurrency());
+    // Bytes the run may take at most, or 0 for no limit
+    size_t memory_budget = 0;
+    // Of the server the run is a job of, if not null: the layouts it has
+    // loaded, and the bytes its jobs share
+    LayoutCache* layouts = nullptr;
+    MemoryBudget* shared_budget = nullptr;
+    // Where the run of a job returns its summary, if not null
+    std::string* reply = nullptr;
+    // Short names of the options given, which override a checkpoint
+    std::string given;
+    bool isGiven(char option) const {
+        return this->given.find(option) != std::string::npos;
+    }
+};
+
+static void usage(const char* argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options]\n"
+        << "  -l, --layout PATH      Layout file (default: "
+           "../layouts/default.txt)\n"
+        << "  -e, --emitter ROW,COL[,RATE]\n"
+        << "                         Place an emitter, optionally scaling\n"
+        << "                         the emission rate for it; may be\n"
+        << "                         repeated (default: 0,0 for text\n"
+        << "                         layouts, none for binary layouts\n"
+        << "                         and images)\n"
+        << "      --curve CURVE      Grow every emitter along a curve,\n"
+        << "                         t2:GROWTH, ramp:BEGIN:END, step:TICK\n"
+        << "                         or a CSV file of TICK,SHARE lines\n"
+        << "  -g, --escape ROW,COL,RATE\n"
+        << "                         Scale the escape rate for one escape;\n"
+        << "                         may be repeated\n"
+        << "  -Y, --wind ROW,COL,ROWS,COLS,DIR,STRENGTH\n"
+        << "                         Make smoke drift towards DIR (n, s, w\n"
+        << "                         or e) over a rectangle of cells; may\n"
+        << "                         be repeated\n"
+        << "  -n, --ticks N          Number of ticks to run (default: 100)\n"
+        << "  -r, --emitter-rate R   Emission rate in [0, 1] (default: 1)\n"
+        << "  -x, --escape-rate R    Escape rate in [0, 1] (default: 1)\n"
+        << "  -w, --precalc-weights  Use precalculated weights\n"
+        << "  -u, --update MODE      Update mode, inplace (also called\n"
+        << "                         gauss-seidel), synchronous or\n"
+        << "                         redblack (default: inplace)\n"
+        << "  -j, --threads N        Worker threads for synchronous and\n"
+        << "                         red-black updates (default: 1)\n"
+        << "  -J, --pin-threads      Pin each worker thread to a core, so\n"
+        << "                         that its memory stays on its NUMA node\n"
+        << "  -X, --time-block T     Run up to T synchronous ticks over each\n"
+        << "                         block of the board while it is in\n"
+        << "                         cache, when no tick has to be measured\n"
+        << "                         or written (default: 1, at most 32)\n"
+        << "  -k, --kernel KERNEL    Synchronous kernel, scalar or simd\n"
+        << "                         (default: simd)\n"
+        << "  -M, --stencil STENCIL  Neighbours smoke flows to, neumann (4)\n"
+        << "                         or moore (8, synchronous updates\n"
+        << "                         with uniform weights only)\n"
+        << "                         (default: neumann)\n"
+        << "  -q, --storage STORAGE  Density storage, float, fixed16 or\n"
+        << "                         double (default: float, fixed16 needs\n"
+        << "                         synchronous updates)\n"
+        << "  -z, --elevation BIAS   Make smoke prefer rising to higher\n"
+        << "                         floors when positive, sinking when\n"
+        << "                         negative (default: 0, level)\n"
+        << "  -d, --draft NOISE      Let random drafts hold back up to this\n"
+        << "                         share of each flow on every tick\n"
+        << "                         (default: 0, deterministic)\n"
+        << "  -D, --seed SEED        Seed of the drafts (default: 0)\n"
+        << "  -t, --tolerance T      Stop early once no density changes by\n"
+        << "                         T or more over a tick (default: 0,\n"
+        << "                         never)\n"
+        << "  -Q, --quiet T[,PERIOD] Update the tiles that changed by less\n"
+        << "                         than T over a tick once every PERIOD\n"
+        << "                         ticks only, synchronous von Neumann\n"
+        << "                         updates only (default: 0, every tick;\n"
+        << "                         period: 4)\n"
+        << "  -S, --solve            Compute the steady state directly, in\n"
+        << "                         at most N sweeps (default tolerance:\n"
+        << "                         1e-6)\n"
+        << "  -W, --relaxation W     Over-relaxation factor of the solver in\n"
+        << "                         (0, 2) (default: 1.9)\n"
+        << "  -Z, --coarse FACTOR    Preview the run on a board coarsened by\n"
+        << "                         FACTOR, a tick of it standing for\n"
+        << "                         FACTOR^2 ticks, then write the output\n"
+        << "                         and checkpoint at full resolution; with\n"
+        << "                         -S, solve it first to warm-start the\n"
+        << "                         solver\n"
+        << "  -f, --full-board       Update every cell, instead of only the\n"
+        << "                         tiles smoke has reached\n"
+        << "  -m, --track-mass       Add the floor densities up during each\n"
+        << "                         tick, for the stats and the summary\n"
+        << "  -A, --arrival T        Map the first tick each cell holds\n"
+        << "                         more than T (default: 0.3 with -a)\n"
+        << "  -a, --arrival-map PATH Write the arrival map (CSV, -1 where\n"
+        << "                         the density never exceeded T)\n"
+        << "      --dose-map PATH    Write the density of each cell added\n"
+        << "                         up over every tick (CSV)\n"
+        << "      --dose-limit L     Divide the doses by the dose\n"
+        << "                         occupants tolerate, giving their\n"
+        << "                         fractional effective dose, and\n"
+        << "                         overcome occupants at it\n"
+        << "      --occupants N[,SEED]\n"
+        << "                         Evacuate N occupants from random\n"
+        << "                         floor cells to the nearest escapes\n"
+        << "      --occupant-speed S Cells occupants walk per tick, up to\n"
+        << "                         1 (default: 1)\n"
+        << "      --occupant-report PATH\n"
+        << "                         Write where each occupant ended up,\n"
+        << "                         when, and its dose (CSV)\n"
+        << "  -o, --output PATH      Write the final density field (CSV)\n"
+        << "  -s, --stats PATH       Write per-tick statistics (CSV)\n"
+        << "  -O, --outflow PATH     Write the smoke that leaves through\n"
+        << "                         each escape on every tick (CSV)\n"
+        << "  -P, --probe ROW,COL,ROWS,COLS[,NAME]\n"
+        << "                         Sample the floor of a rectangle on\n"
+        << "                         every tick; may be repeated\n"
+        << "  -p, --probes PATH      Write the mean and highest density of\n"
+        << "                         each probe on every tick (CSV)\n"
+        << "  -b, --save-board PATH  Write the board, its emitters and its\n"
+        << "                         topology as a binary layout\n"
+        << "  -L, --save-graph PATH  Write the board as a cell graph, walls\n"
+        << "                         left out\n"
+        << "  -G, --graph PATH       Run synchronous ticks on a cell graph\n"
+        << "                         instead of a layout, with -n, -r, -x,\n"
+        << "                         -w, -m and -o (CSV of each cell)\n"
+        << "  -H, --order ORDER      Order of the cells of a graph in\n"
+        << "                         memory, file, morton or hilbert\n"
+        << "                         (default: hilbert)\n"
+        << "  -U, --building PATH    Run a building file, its storeys linked\n"
+        << "                         by stairwells, instead of a layout,\n"
+        << "                         with -n, -r, -x, -w, -u, -z, -k, -M,\n"
+        << "                         -f, -m, -j (storeys at once) and -o\n"
+        << "                         (CSV of each storey, PATH.floorN)\n"
+        << "  -V, --stairs UP,DOWN   Share of the smoke that rises and that\n"
+        << "                         sinks through a stairwell on every\n"
+        << "                         tick (default: 0.25,0.05)\n"
+        << "  -y, --summary PATH     Write a summary of the run: layout\n"
+        << "                         hash, size, settings, ticks, speed,\n"
+        << "                         peak memory, the bytes of each part\n"
+        << "                         of the run, mass and escaped smoke;\n"
+        << "                         JSON if PATH ends in .json, or else a\n"
+        << "                         CSV row appended to PATH\n"
+        << "  -T, --trace PATH       Write a Chrome trace of the last ticks\n"
+#ifdef SMOKEY_RECORDING
+        << "  -R, --record PATH      Record the density field, compressed\n"
+        << "  -K, --record-every K   Ticks between recorded frames\n"
+        << "                         (default: 1)\n"
+#endif
+        << "      --video PATH       Encode a video of the densities with\n"
+        << "                         ffmpeg, coloured like the GUI shows\n"
+        << "                         them\n"
+        << "      --video-every K    Ticks between video frames (default: 1)\n"
+        << "      --video-width W    Pixels across the video at most\n"
+        << "                         (default: the width of the board)\n"
+        << "      --video-fps FPS    Frames per second of the video\n"
+        << "                         (default: 30)\n"
+        << "      --video-palette grey|smoke|heat\n"
+        << "                         Colours of the densities (default:\n"
+        << "                         grey)\n"
+        << "  -F, --share NAME       Publish the densities to the POSIX\n"
+        << "                         shared memory segment NAME for live\n"
+        << "                         viewers\n"
+        << "  -I, --share-every K    Ticks between published densities\n"
+        << "                         (default: 1)\n"
+#ifdef SMOKEY_RECORDING
+        << "  -v, --stream PORT      Serve the densities to remote viewers\n"
+        << "                         over WebSocket, and a page showing\n"
+        << "                         them over HTTP, on PORT\n"
+        << "      --stream-rate FPS  Frames sent per second at most\n"
+        << "                         (default: 10)\n"
+#endif
+        << "  -c, --checkpoint PATH  Save the state of the simulation when\n"
+        << "                         done\n"
+        << "  -C, --checkpoint-every N\n"
+        << "                         Also save it every N ticks\n"
+        << "  -i, --resume PATH      Resume from a checkpoint instead of a\n"
+        << "                         layout, with its settings unless they\n"
+        << "                         are given; emitters and escape rates\n"
+        << "                         are added to its own\n"
+        << "  -E, --scenario PATH    Replay the timed events of a scenario\n"
+        << "                         file between ticks: emitter and\n"
+        << "                         escape rates, cell changes,\n"
+        << "                         checkpoints and stops\n"
+        << "  -B, --branch CHANGES   Fork the simulation once done and run\n"
+        << "                         another continuation of it, all at\n"
+        << "                         the same time; CHANGES is a list of\n"
+        << "                         ROW,COL,RATE separated by ';', setting\n"
+        << "                         the rate of an escape (0 closes it) or\n"
+        << "                         placing an emitter, or '-' to change\n"
+        << "                         nothing; may be repeated\n"
+        << "  -N, --branch-ticks N   Ticks each branch runs (default: 100)\n"
+        << "      --serve PORT       Run as a server instead, taking jobs\n"
+        << "                         on PORT, each a line of these options\n"
+        << "                         or an HTTP POST of them, and replying\n"
+        << "                         with the summary of the run as JSON;\n"
+        << "                         jobs only name files under the\n"
+        << "                         directory of the server\n"
+        << "      --serve-address ADDR\n"
+        << "                         IPv4 address to take jobs on, 0.0.0.0\n"
+        << "                         for every interface (default:\n"
+        << "                         127.0.0.1, this machine only)\n"
+        << "      --serve-jobs N     Jobs run at the same time (default:\n"
+        << "                         one per core)\n"
+        << "      --memory-budget BYTES\n"
+        << "                         Plan the memory the run takes before\n"
+        << "                         it starts, and fit it in BYTES (with\n"
+        << "                         an optional K, M or G suffix) by\n"
+        << "                         running without time blocks and in\n"
+        << "                         fixed16 storage unless -q is given, or\n"
+        << "                         fail; with --serve, shared by the jobs\n"
+        << "                         and the layouts the server caches\n"
+        << "  -h, --help             Show this message\n";
+}
+
+/**
+ * @brief Check that a job only names a file under the directory of the
+ * server: neither an absolute path nor one going up through "..".
+ */
+static void checkJobPath(const std::string& path) {
+    bool outside = !path.empty() && path[0] == '/';
+    for (size_t begin = 0; !outside && begin <= path.size();) {
+        size_t end = std::min(path.find('/', begin), path.size());
+        outside = path.compare(begin, end - begin, "..") == 0;
+        begin = end + 1;
+    }
+    if (outside) {
+        throw std::runtime_error(
+            "Jobs can only name files under the directory of the server.");
+    }
+}
+
+static std::vector<BranchChange> parseChanges(const char* list) {
+    std::vector<BranchChange> changes;
+    if (strcmp(list, "-") == 0) return changes;
+    std::string remaining = list;
+    while (!remaining.empty()) {
+        size_t end = remaining.find(';');
+        BranchChange change;
+        if (sscanf(remaining.substr(0, end).c_str(), "%u,%u,%f", &change.row,
+                   &change.col, &change.rate) != 3) {
+            throw std::runtime_error(
+                "Branch changes must be given as ROW,COL,RATE.");
+        }
+        changes.push_back(change);
+        remaining =
+            end == std::string::npos ? "" : remaining.substr(end + 1);
+    }
+    return changes;
+}
+
+/**
+ * @brief Parse the options of a run.
+ * @param job Parse the options of a job of a server, which throws on
+ * invalid options instead of exiting.
+ */
+static Options parseOptions(int argc, char** argv, bool job = false) {
+    static const struct option long_options[] = {
+        {"layout", required_argument, nullptr, 'l'},
+        {"emitter", required_argument, nullptr, 'e'},
+        {"escape", required_argument, nullptr, 'g'},
+        {"wind", required_argument, nullptr, 'Y'},
+        {"ticks", required_argument, nullptr, 'n'},
+        {"emitter-rate", required_argument, nullptr, 'r'},
+        {"escape-rate", required_argument, nullptr, 'x'},
+        {"precalc-weights", no_argument, nullptr, 'w'},
+        {"update", required_argument, nullptr, 'u'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"pin-threads", no_argument, nullptr, 'J'},
+        {"time-block", required_argument, nullptr, 'X'},
+        {"kernel", required_argument, nullptr, 'k'},
+        {"stencil", required_argument, nullptr, 'M'},
+        {"storage", required_argument, nullptr, 'q'},
+        {"elevation", required_argument, nullptr, 'z'},
+        {"draft", required_argument, nullptr, 'd'},
+        {"seed", required_argument, nullptr, 'D'},
+        {"tolerance", required_argument, nullptr, 't'},
+        {"quiet", required_argument, nullptr, 'Q'},
+        {"solve", no_argument, nullptr, 'S'},
+        {"relaxation", required_argument, nullptr, 'W'},
+        {"coarse", required_argument, nullptr, 'Z'},
+        {"full-board", no_argument, nullptr, 'f'},
+        {"track-mass", no_argument, nullptr, 'm'},
+        {"arrival", required_argument, nullptr, 'A'},
+        {"arrival-map", required_argument, nullptr, 'a'},
+        {"dose-map", required_argument, nullptr, DoseMapOption},
+        {"dose-limit", required_argument, nullptr, DoseLimitOption},
+        {"occupants", required_argument, nullptr, OccupantsOption},
+        {"occupant-speed", required_argument, nullptr, OccupantSpeedOption},
+        {"occupant-report", required_argument, nullptr, OccupantReportOption},
+        {"curve", required_argument, nullptr, CurveOption},
+        {"output", required_argument, nullptr, 'o'},
+        {"stats", required_argument, nullptr, 's'},
+        {"outflow", required_argument, nullptr, 'O'},
+        {"probe", required_argument, nullptr, 'P'},
+        {"probes", required_argument, nullptr, 'p'},
+        {"save-board", required_argument, nullptr, 'b'},
+        {"save-graph", required_argument, nullptr, 'L'},
+        {"graph", required_argument, nullptr, 'G'},
+        {"order", required_argument, nullptr, 'H'},
+        {"building", required_argument, nullptr, 'U'},
+        {"stairs", required_argument, nullptr, 'V'},
+        {"summary", required_argument, nullptr, 'y'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"record", required_argument, nullptr, 'R'},
+        {"record-every", required_argument, nullptr, 'K'},
+        {"video", required_argument, nullptr, VideoOption},
+        {"video-every", required_argument, nullptr, VideoEveryOption},
+        {"video-width", required_argument, nullptr, VideoWidthOption},
+        {"video-fps", required_argument, nullptr, VideoFpsOption},
+        {"video-palette", required_argument, nullptr, VideoPaletteOption},
+        {"share", required_argument, nullptr, 'F'},
+        {"share-every", required_argument, nullptr, 'I'},
+        {"stream", required_argument, nullptr, 'v'},
+        {"stream-rate", required_argument, nullptr, StreamRateOption},
+        {"checkpoint", required_argument, nullptr, 'c'},
+        {"checkpoint-every", required_argument, nullptr, 'C'},
+        {"resume", required_argument, nullptr, 'i'},
+        {"scenario", required_argument, nullptr, 'E'},
+        {"branch", required_argument, nullptr, 'B'},
+        {"branch-ticks", required_argument, nullptr, 'N'},
+        {"serve", required_argument, nullptr, ServeOption},
+        {"serve-jobs", required_argument, nullptr, ServeJobsOption},
+        {"serve-address", required_argument, nullptr, ServeAddressOption},
+        {"memory-budget", required_argument, nullptr, MemoryBudgetOption},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    Options opts;
+    int c;
+    if (job) {
+        // Start over, and leave the errors to the job
+        optind = 0;
+        opterr = 0;
+    }
+    const char* short_options =
+        "l:e:g:Y:n:r:x:wu:j:JX:k:M:q:z:d:D:t:Q:SW:Z:fmA:a:o:s:O:P:p:b:L:G:"
+        "H:U:V:y:T:R:K:F:I:v:c:C:i:B:E:N:h";
+    while ((c = getopt_long(argc, argv, short_options, long_options,
+                            nullptr)) != -1) {
+        if (c < StreamRateOption) opts.given += (char)c;
+        switch (c) {
+            case 'l':
+                opts.layout_path = optarg;
+                break;
+            case 'e': {
+                Source emitter = {0, 0, 1.f};
+                if (sscanf(optarg, "%u,%u,%f", &emitter.row, &emitter.col,
+                           &emitter.rate) < 2) {
+                    throw std::runtime_error(
+                        "Emitters must be given as ROW,COL[,RATE].");
+                }
+                opts.emitters.push_back(emitter);
+                break;
+            }
+            case 'g': {
+                Source escape;
+                if (sscanf(optarg, "%u,%u,%f", &escape.row, &escape.col,
+                           &escape.rate) != 3) {
+                    throw std::runtime_error(
+                        "Escapes must be given as ROW,COL,RATE.");
+                }
+                opts.escapes.push_back(escape);
+                break;
+            }
+            case 'Y': {
+                Wind wind;
+                char dir;
+                if (sscanf(optarg, "%u,%u,%u,%u,%c,%f", &wind.row, &wind.col,
+                           &wind.rows, &wind.cols, &dir,
+                           &wind.strength) != 6 ||
+                    strchr("nswe", dir) == nullptr) {
+                    throw std::runtime_error(
+                        "Winds must be given as "
+                        "ROW,COL,ROWS,COLS,n|s|w|e,STRENGTH.");
+                }
+                wind.dir = (Dir)(strchr("nswe", dir) - "nswe");
+                opts.winds.push_back(wind);
+                break;
+            }
+            case 'n':
+                opts.ticks = std::stoul(optarg);
+                break;
+            case 'r':
+                opts.emitter_rate = std::stof(optarg);
+                if (!(opts.emitter_rate >= 0.f && opts.emitter_rate <= 1.f)) {
+                    throw std::runtime_error(
+                        "The emission rate must be in [0, 1].");
+                }
+                break;
+            case 'x':
+                opts.escape_rate = std::stof(optarg);
+                if (!(opts.escape_rate >= 0.f && opts.escape_rate <= 1.f)) {
+                    throw std::runtime_error(
+                        "The escape rate must be in [0, 1].");
+                }
+                break;
+            case 'w':
+                opts.use_precalc_weights = true;
+                break;
+            case 'u':
+                if (strcmp(optarg, "inplace") == 0 ||
+                    strcmp(optarg, "gauss-seidel") == 0) {
+                    opts.update_mode = Sim::Update::InPlace;
+                } else if (strcmp(optarg, "synchronous") == 0) {
+                    opts.update_mode = Sim::Update::Synchronous;
+                } else if (strcmp(optarg, "redblack") == 0) {
+                    opts.update_mode = Sim::Update::RedBlack;
+                } else {
+                    throw std::runtime_error(
+                        "The update mode must be inplace (gauss-seidel), "
+                        "synchronous or redblack.");
+                }
+                break;
+            case 'j':
+                opts.threads = std::stoul(optarg);
+                if (opts.threads == 0) {
+                    throw std::runtime_error(
+                        "At least one thread is required.");
+                }
+                break;
+            case 'J':
+                opts.pin_threads = true;
+                break;
+            case 'X':
+                opts.time_block = std::stoul(optarg);
+                if (opts.time_block == 0 || opts.time_block > Sim::tile_size) {
+                    throw std::runtime_error(
+                        "Time blocks must be 1 to 32 ticks long.");
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "scalar") == 0) {
+                    opts.kernel = Sim::Kernel::Scalar;
+                } else if (strcmp(optarg, "simd") == 0) {
+                    opts.kernel = Sim::Kernel::Simd;
+                } else {
+                    throw std::runtime_error(
+                        "The kernel must be scalar or simd.");
+                }
+                break;
+            case 'M':
+                if (strcmp(optarg, "neumann") == 0) {
+                    opts.stencil = Sim::Stencil::VonNeumann;
+                } else if (strcmp(optarg, "moore") == 0) {
+                    opts.stencil = Sim::Stencil::Moore;
+                } else {
+                    throw std::runtime_error(
+                        "The stencil must be neumann or moore.");
+                }
+                break;
+            case 'q':
+                if (strcmp(optarg, "float") == 0) {
+                    opts.storage = Board::Storage::Float;
+                } else if (strcmp(optarg, "fixed16") == 0) {
+                    opts.storage = Board::Storage::Fixed;
+                } else if (strcmp(optarg, "double") == 0) {
+                    opts.storage = Board::Storage::Double;
+                } else {
+                    throw std::runtime_error(
+                        "The storage must be float, fixed16 or double.");
+                }
+                break;
+            case 'z':
+                opts.elevation_bias = std::stof(optarg);
+                break;
+            case 'd':
+                opts.draft_noise = std::stof(optarg);
+                if (!(opts.draft_noise >= 0.f && opts.draft_noise <= 1.f)) {
+                    throw std::runtime_error(
+                        "The draft noise must be in [0, 1].");
+                }
+                break;
+            case 'D':
+                opts.draft_seed = std::stoull(optarg);
+                break;
+            case 't':
+                opts.tolerance = std::stof(optarg);
+                break;
+            case 'Q':
+                if (sscanf(optarg, "%f,%u", &opts.quiet_threshold,
+                           &opts.quiet_period) < 1 ||
+                    !(opts.quiet_threshold >= 0.f) || opts.quiet_period == 0) {
+                    throw std::runtime_error(
+                        "Quiet tiles need a threshold of at least 0 and a "
+                        "period of at least a tick.");
+                }
+                break;
+            case 'S':
+                opts.solve = true;
+                break;
+            case 'W':
+                opts.relaxation = std::stof(optarg);
+                if (!(opts.relaxation > 0.f && opts.relaxation < 2.f)) {
+                    throw std::runtime_error(
+                        "The relaxation factor must be in (0, 2).");
+                }
+                break;
+            case 'Z':
+                opts.coarse = std::stoul(optarg);
+                if (opts.coarse < 2) {
+                    throw std::runtime_error(
+                        "The coarsening factor must be at least 2.");
+                }
+                break;
+            case 'f':
+                opts.track_activity = false;
+                break;
+            case 'm':
+                opts.track_mass = true;
+                break;
+            case 'A':
+                opts.arrival_threshold = std::stof(optarg);
+                if (!(opts.arrival_threshold > 0.f)) {
+                    throw std::runtime_error(
+                        "The arrival threshold must be positive.");
+                }
+                break;
+            case 'a':
+                opts.arrival_path = optarg;
+                break;
+            case DoseMapOption:
+                opts.dose_path = optarg;
+                break;
+            case DoseLimitOption:
+                opts.dose_limit = std::stof(optarg);
+                if (!(opts.dose_limit > 0.f)) {
+                    throw std::runtime_error(
+                        "The dose limit must be positive.");
+                }
+                break;
+            case OccupantsOption: {
+                unsigned long long seed = 0;
+                if (sscanf(optarg, "%u,%llu", &opts.occupants, &seed) < 1) {
+                    throw std::runtime_error(
+                        "Occupants must be given as N[,SEED].");
+                }
+                opts.occupant_seed = seed;
+                break;
+            }
+            case OccupantSpeedOption:
+                opts.occupant_speed = std::stof(optarg);
+                if (!(opts.occupant_speed > 0.f &&
+                      opts.occupant_speed <= 1.f)) {
+                    throw std::runtime_error(
+                        "Occupants walk more than 0 and up to 1 cell per "
+                        "tick.");
+                }
+                break;
+            case OccupantReportOption:
+                opts.occupant_path = optarg;
+                break;
+            case CurveOption:
+                // Curves can be read from a file
+                if (job) checkJobPath(optarg);
+                opts.curve = std::make_shared<const GrowthCurve>(
+                    GrowthCurve::parse(optarg));
+                break;
+            case 'o':
+                opts.density_path = optarg;
+                break;
+            case 's':
+                opts.stats_path = optarg;
+                break;
+            case 'O':
+                opts.outflow_path = optarg;
+                break;
+            case 'P': {
+                Probe probe;
+                int length = 0;
+                if (sscanf(optarg, "%u,%u,%u,%u%n", &probe.row, &probe.col,
+                           &probe.rows, &probe.cols, &length) != 4 ||
+                    (optarg[length] != '\0' && optarg[length] != ',')) {
+                    throw std::runtime_error(
+                        "Probes must be given as ROW,COL,ROWS,COLS[,NAME].");
+                }
+                probe.name = optarg[length] == ','
+                                 ? std::string(optarg + length + 1)
+                                 : std::to_string(probe.row) + ":" +
+                                       std::to_string(probe.col);
+                opts.probes.push_back(probe);
+                break;
+            }
+            case 'p':
+                opts.probe_path = optarg;
+                break;
+            case 'b':
+                opts.board_path = optarg;
+                break;
+            case 'L':
+                opts.graph_out_path = optarg;
+                break;
+            case 'G':
+                opts.graph_path = optarg;
+                break;
+            case 'H':
+                if (strcmp(optarg, "file") == 0) {
+                    opts.graph_order = Graph::Order::File;
+                } else if (strcmp(optarg, "morton") == 0) {
+                    opts.graph_order = Graph::Order::Morton;
+                } else if (strcmp(optarg, "hilbert") == 0) {
+                    opts.graph_order = Graph::Order::Hilbert;
+                } else {
+                    throw std::runtime_error(
+                        "The order must be file, morton or hilbert.");
+                }
+                break;
+            case 'U':
+                opts.building_path = optarg;
+                break;
+            case 'V':
+                if (sscanf(optarg, "%f,%f", &opts.rise_rate,
+                           &opts.sink_rate) != 2 ||
+                    !(opts.rise_rate >= 0.f && opts.rise_rate <= 1.f &&
+                      opts.sink_rate >= 0.f && opts.sink_rate <= 1.f)) {
+                    throw std::runtime_error(
+                        "Stairwell rates must be two numbers in [0, 1].");
+                }
+                break;
+            case 'y':
+                opts.summary_path = optarg;
+                break;
+            case 'T':
+                opts.trace_path = optarg;
+                break;
+            case 'R':
+#ifndef SMOKEY_RECORDING
+                throw std::runtime_error(
+                    "This build cannot record densities, it lacks zlib.");
+#endif
+                opts.record_path = optarg;
+                break;
+            case 'K':
+                opts.record_every = std::stoul(optarg);
+                if (opts.record_every == 0) {
+                    throw std::runtime_error(
+                        "Frames must be at least a tick apart.");
+                }
+                break;
+            case VideoOption:
+                opts.video_path = optarg;
+                break;
+            case VideoEveryOption:
+                opts.video_every = std::stoul(optarg);
+                if (opts.video_every == 0) {
+                    throw std::runtime_error(
+                        "Frames must be at least a tick apart.");
+                }
+                break;
+            case VideoWidthOption:
+                opts.video_width = std::stoul(optarg);
+                if (opts.video_width == 0) {
+                    throw std::runtime_error(
+                        "Videos must be at least a pixel wide.");
+                }
+                break;
+            case VideoFpsOption:
+                opts.video_fps = std::stof(optarg);
+                if (!(opts.video_fps > 0.f)) {
+                    throw std::runtime_error(
+                        "Videos need a positive frame rate.");
+                }
+                break;
+            case VideoPaletteOption:
+                if (strcmp(optarg, "grey") == 0) {
+                    opts.video_palette = Palette::Grey;
+                } else if (strcmp(optarg, "smoke") == 0) {
+                    opts.video_palette = Palette::Smoke;
+                } else if (strcmp(optarg, "heat") == 0) {
+                    opts.video_palette = Palette::Heat;
+                } else {
+                    throw std::runtime_error(
+                        "The palette must be grey, smoke or heat.");
+                }
+                break;
+            case 'F':
+                // Segment names are a single component starting with '/'
+                opts.share_name = optarg[0] == '/' ? optarg
+                                                   : std::string("/") + optarg;
+                break;
+            case 'I':
+                opts.share_every = std::stoul(optarg);
+                if (opts.share_every == 0) {
+                    throw std::runtime_error(
+                        "Densities must be published at least a tick apart.");
+                }
+                break;
+            case 'v':
+#ifndef SMOKEY_RECORDING
+                throw std::runtime_error(
+                    "This build cannot stream densities, it lacks zlib.");
+#endif
+                opts.stream_port = std::stoul(optarg);
+                if (opts.stream_port == 0 || opts.stream_port > 65535)
+                    throw std::runtime_error("Invalid port to stream on.");
+                break;
+            case StreamRateOption:
+                opts.stream_rate = std::stof(optarg);
+                if (!(opts.stream_rate > 0.f)) {
+                    throw std::runtime_error(
+                        "Streams need a positive frame rate.");
+                }
+                break;
+            case 'c':
+                opts.checkpoint_path = optarg;
+                break;
+            case 'C':
+                opts.checkpoint_every = std::stoul(optarg);
+                break;
+            case 'i':
+                opts.resume_path = optarg;
+                break;
+            case 'E':
+                opts.scenario_path = optarg;
+                break;
+            case 'B':
+                opts.branches.push_back(parseChanges(optarg));
+                break;
+            case 'N':
+                opts.branch_ticks = std::stoul(optarg);
+                break;
+            case ServeOption:
+                opts.serve_port = std::stoul(optarg);
+                if (opts.serve_port == 0 || opts.serve_port > 65535)
+                    throw std::runtime_error("Invalid port to serve on.");
+                break;
+            case ServeAddressOption:
+                opts.serve_address = optarg;
+                break;
+            case ServeJobsOption:
+                opts.serve_jobs = std::stoul(optarg);
+                if (opts.serve_jobs == 0)
+                    throw std::runtime_error("Servers need a job thread.");
+                break;
+            case MemoryBudgetOption:
+                opts.memory_budget = parseBytes(optarg);
+                if (opts.memory_budget == 0)
+                    throw std::runtime_error("Memory budgets cannot be 0.");
+                break;
+            case 'h':
+                if (job) throw std::runtime_error("Jobs cannot ask for help.");
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                if (job) throw std::runtime_error("Invalid option in the job.");
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (job && optind < argc)
+        throw std::runtime_error("Jobs only take options.");
+    if (job) {
+        // The default layout is found from the build directory
+        if (opts.isGiven('l')) checkJobPath(opts.layout_path);
+        for (const std::string* path :
+             {&opts.arrival_path, &opts.dose_path, &opts.occupant_path,
+              &opts.density_path, &opts.stats_path, &opts.outflow_path,
+              &opts.probe_path, &opts.summary_path, &opts.board_path,
+              &opts.trace_path, &opts.record_path, &opts.video_path,
+              &opts.checkpoint_path, &opts.resume_path, &opts.scenario_path,
+              &opts.graph_path, &opts.graph_out_path, &opts.building_path})
+            checkJobPath(*path);
+    }
+    if (!opts.arrival_path.empty() && opts.arrival_threshold == 0.f)
+        opts.arrival_threshold = .3f;
+    if (!opts.probes.empty() && opts.probe_path.empty())
+        throw std::runtime_error("Probes need a path to be written to.");
+    if (!opts.occupant_path.empty() && opts.occupants == 0)
+        throw std::runtime_error("Occupant reports need occupants.");
+    if (opts.checkpoint_every > 0 && opts.checkpoint_path.empty()) {
+        throw std::runtime_error(
+            "Periodic checkpoints need a path to be saved to.");
+    }
+    if (opts.curve && !opts.checkpoint_path.empty())
+        throw std::runtime_error("Checkpoints cannot save emitter curves.");
+    if (opts.quiet_threshold > 0.f && !opts.checkpoint_path.empty())
+        throw std::runtime_error("Checkpoints cannot save quiet tiles.");
+    // A resumed crowd would start over from where it was scattered
+    if (opts.occupants > 0 &&
+        (!opts.checkpoint_path.empty() || !opts.resume_path.empty()))
+        throw std::runtime_error("Checkpoints cannot save occupants.");
+    return opts;
+}
+
+static void writeDensity(Sim& sim, const std::string& path) {
+    TraceScope trace(sim.tracer, "write density");
+    uint rows = sim.board->getHeight(), cols = sim.board->getWidth();
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    for (uint row = 0; row < rows; row++) {
+        for (uint col = 0; col < cols; col++) {
+            fprintf(fp, col == 0 ? "%.9g" : ",%.9g", sim.getDensity(row, col));
+        }
+        fputc('\n', fp);
+    }
+    fclose(fp);
+}
+
+static void writeArrivals(Sim& sim, const std::string& path) {
+    TraceScope trace(sim.tracer, "write arrivals");
+    uint rows = sim.board->getHeight(), cols = sim.board->getWidth();
+    const uint* arrivals = sim.getArrivals();
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    for (uint row = 0; row < rows; row++) {
+        size_t idx = sim.board->indexOf(row, 0);
+        for (uint col = 0; col < cols; col++, idx++) {
+            long tick = -1;
+            if (arrivals != nullptr && arrivals[idx] != Sim::not_arrived)
+                tick = arrivals[idx];
+            fprintf(fp, col == 0 ? "%ld" : ",%ld", tick);
+        }
+        fputc('\n', fp);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Write the dose of each cell, or its fractional effective dose if
+ * a limit was given.
+ */
+static void writeDoses(Sim& sim, const std::string& path, float limit) {
+    TraceScope trace(sim.tracer, "write doses");
+    uint rows = sim.board->getHeight(), cols = sim.board->getWidth();
+    const double* doses = sim.getDoses();
+    double scale = limit > 0.f ? 1. / limit : 1.;
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    for (uint row = 0; row < rows; row++) {
+        size_t idx = sim.board->indexOf(row, 0);
+        for (uint col = 0; col < cols; col++, idx++) {
+            double dose = doses != nullptr ? doses[idx] * scale : 0.;
+            fprintf(fp, col == 0 ? "%.9g" : ",%.9g", dose);
+        }
+        fputc('\n', fp);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Write the status of each occupant of a crowd, the tick it escaped
+ * or was overcome on, and its dose.
+ */
+static void writeOccupants(Crowd& crowd, const std::string& path) {
+    TraceScope trace(crowd.getSim()->tracer, "write occupants");
+    static const char* const statuses[] = {"moving", "evacuated",
+                                           "overcome"};
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    fprintf(fp, "occupant,row,col,status,tick,dose\n");
+    uint number = 0;
+    for (const Occupant& occupant : crowd.getOccupants()) {
+        fprintf(fp, "%u,%u,%u,%s,%u,%.9g\n", number++, occupant.row,
+                occupant.col, statuses[occupant.status], occupant.end_tick,
+                occupant.dose);
+    }
+    if (fclose(fp) != 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
+
+/**
+ * @brief Tag a path, before its extension if it has one.
+ */
+static std::string tagPath(const std::string& path, const std::string& tag) {
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = path.size();
+    return path.substr(0, dot) + "." + tag + path.substr(dot);
+}
+
+/**
+ * @brief Number a path for one branch, before its extension if it has one.
+ */
+static std::string branchPath(const std::string& path, size_t branch) {
+    return tagPath(path, std::to_string(branch + 1));
+}
+
+static void writeStats(Sim& sim, FILE* fp) {
+    TraceScope trace(sim.tracer, "write stats");
+    uint rows = sim.board->getHeight(), cols = sim.board->getWidth();
+    double mass = 0.;
+    float peak = 0.f;
+    for (uint row = 0; row < rows; row++) {
+        for (uint col = 0; col < cols; col++) {
+            float density = sim.getDensity(row, col);
+            mass += density;
+            if (density > peak) peak = density;
+        }
+    }
+    // The tracked mass leaves the emitters out
+    if (sim.track_mass) mass = sim.getMass();
+    fprintf(fp, "%u,%.9g,%.9g\n", sim.getTicks(), mass, peak);
+}
+
+static void writeOutflow(Sim& sim, FILE* fp) {
+    TraceScope trace(sim.tracer, "write outflow");
+    // The escapes are only listed once the simulation has ticked
+    if (ftell(fp) == 0) {
+        fprintf(fp, "tick,total");
+        for (size_t escape : sim.getEscapeCells()) {
+            fprintf(fp, ",%u:%u", sim.board->rowOf(escape),
+                    sim.board->colOf(escape));
+        }
+        fputc('\n', fp);
+    }
+    fprintf(fp, "%u,%.9g", sim.getTicks(), sim.getOutflow());
+    for (double outflow : sim.getEscapeOutflows())
+        fprintf(fp, ",%.9g", outflow);
+    fputc('\n', fp);
+}
+
+static void writeProbes(Sim& sim, ProbeSet& probes, FILE* fp) {
+    TraceScope trace(sim.tracer, "sample probes");
+    probes.sample(*sim.board);
+    fprintf(fp, "%u", sim.getTicks());
+    for (auto& sample : probes.getSamples())
+        fprintf(fp, ",%.9g,%.9g", sample.mean, sample.max);
+    fputc('\n', fp);
+}
+
+/**
+ * @brief The layouts a server has loaded, their weights computed, which its
+ * jobs fork instead of loading them again.
+ *
+ * A layout is loaded again once its file has changed.
+ */
+class LayoutCache {
+   private:
+    struct Entry {
+        Board* board;
+        bool has_emitters;
+        struct timespec modified;
+    };
+    std::map<std::string, Entry> entries;
+    std::mutex mutex;
+
+   public:
+    LayoutCache() = default;
+    ~LayoutCache() {
+        for (auto& entry : this->entries) delete entry.second.board;
+    }
+    LayoutCache(const LayoutCache&) = delete;
+    LayoutCache& operator=(const LayoutCache&) = delete;
+    /**
+     * @brief Fork a layout, loading it unless it is cached.
+     */
+    Board* fork(const std::string& path, bool* has_emitters) {
+        // Synthetic layouts never change
+        struct stat status = {};
+        if (!isSyntheticLayout(path) && stat(path.c_str(), &status) != 0) {
+            throw std::runtime_error(
+                "An I/O error occurred while opening the file for reading.");
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->entries.find(path);
+        if (found == this->entries.end() ||
+            found->second.modified.tv_sec != status.st_mtim.tv_sec ||
+            found->second.modified.tv_nsec != status.st_mtim.tv_nsec) {
+            Entry entry = {nullptr, hasOwnEmitters(path), status.st_mtim};
+            bool has_weights;
+            entry.board = loadBoard(path, &has_weights);
+            if (!has_weights) entry.board->computeWeights();
+            if (found != this->entries.end()) {
+                delete found->second.board;
+                found->second = entry;
+            } else {
+                found = this->entries.emplace(path, entry).first;
+            }
+        }
+        *has_emitters = found->second.has_emitters;
+        return found->second.board->fork();
+    }
+    /**
+     * @brief Forget every layout, which jobs that forked them keep their
+     * arrays of.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (auto& entry : this->entries) delete entry.second.board;
+        this->entries.clear();
+    }
+    /**
+     * @brief Add the bytes of the cached layouts to a footprint, as
+     * "caches", less the arrays the forks of the jobs still share.
+     */
+    void addFootprint(Footprint* footprint) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Footprint boards;
+        for (auto& entry : this->entries)
+            entry.second.board->addFootprint(&boards);
+        footprint->add("caches", boards.getTotal());
+    }
+};
+
+/**
+ * @brief Check whether a run reads the float copy of the densities of fixed
+ * and double storage, as its videos, recordings, live views, occupants,
+ * scenarios and graphs do.
+ */
+static bool decodesDensities(const Options& opts) {
+    return !opts.video_path.empty() || !opts.record_path.empty() ||
+           !opts.share_name.empty() || opts.stream_port != 0 ||
+           opts.occupants > 0 || !opts.scenario_path.empty() ||
+           !opts.graph_out_path.empty() || opts.coarse > 1;
+}
+
+/**
+ * @brief Plan the footprint of a run with its board in a storage: that of
+ * its simulation once it has ticked, see Sim::planFootprint(), and the most
+ * its recording and its video take.
+ */
+static Footprint planRun(Sim& sim, const Options& opts,
+                         Board::Storage storage) {
+    Footprint footprint;
+    sim.planFootprint(&footprint, storage, decodesDensities(opts));
+    uint width = sim.board->getWidth(), height = sim.board->getHeight();
+#ifdef SMOKEY_RECORDING
+    if (!opts.record_path.empty())
+        Recorder::planFootprint(&footprint, width, height);
+#endif
+    if (!opts.video_path.empty()) {
+        VideoExporter::planFootprint(
+            &footprint, width, height,
+            opts.video_width != 0 ? opts.video_width : width);
+    }
+    return footprint;
+}
+
+/**
+ * @brief Get the bytes a run may take: at most its own budget, and at most
+ * what is left of that of its server, the layouts it caches included.
+ */
+static size_t budgetOf(const Options& opts) {
+    size_t budget = opts.memory_budget > 0 ? opts.memory_budget : SIZE_MAX;
+    if (opts.shared_budget != nullptr) {
+        Footprint cached;
+        if (opts.layouts != nullptr) opts.layouts->addFootprint(&cached);
+        size_t available = opts.shared_budget->getAvailable();
+        available -= std::min(available, cached.getTotal());
+        budget = std::min(budget, available);
+    }
+    return budget;
+}
+
+// Of Board::Storage, as -q takes them
+static const char* const storage_names[] = {"float", "fixed16", "double"};
+
+/**
+ * @brief Fit a run in a memory budget before it starts: with the settings it
+ * was given, or else without time blocks, then in cheaper storages unless a
+ * storage was given, float for double and fixed16 for synchronous updates,
+ * with and without time blocks.
+ */
+static void fitBudget(Sim& sim, const Options& opts, size_t budget) {
+    Board::Storage storage = sim.board->getStorage();
+    std::vector<Board::Storage> storages = {storage};
+    if (!opts.isGiven('q')) {
+        if (storage == Board::Storage::Double)
+            storages.push_back(Board::Storage::Float);
+        if (storage != Board::Storage::Fixed &&
+            sim.update_mode == Sim::Update::Synchronous)
+            storages.push_back(Board::Storage::Fixed);
+    }
+    uint time_block = sim.time_block;
+    std::vector<uint> blocks = {time_block};
+    if (time_block > 1) blocks.push_back(1);
+    size_t least = SIZE_MAX;
+    for (Board::Storage candidate : storages) {
+        for (uint block : blocks) {
+            sim.time_block = block;
+            size_t planned = planRun(sim, opts, candidate).getTotal();
+            least = std::min(least, planned);
+            if (planned > budget) continue;
+            if (candidate != storage) {
+                fprintf(stderr,
+                        "Storing the densities in %s to fit the memory "
+                        "budget.\n",
+                        storage_names[candidate]);
+                sim.board->setStorage(candidate);
+            }
+            if (block != time_block) {
+                fprintf(stderr, "Running without time blocks to fit the "
+                                "memory budget.\n");
+            }
+            return;
+        }
+    }
+    sim.time_block = time_block;
+    throw std::runtime_error("The run needs " + formatBytes(least) +
+                             ", over its memory budget of " +
+                             formatBytes(budget) + ".");
+}
+
+/**
+ * @brief Set a simulation up from a layout or from a checkpoint, forking
+ * the layouts of the server the run is a job of, and fit it in its memory
+ * budget.
+ *
+ * The settings saved with a checkpoint are only changed when given.
+ */
+static Sim* makeSim(Options& opts) {
+    bool resumed = !opts.resume_path.empty();
+    bool has_weights = true;
+    Sim* sim;
+    if (resumed) {
+        sim = readCheckpoint(opts.resume_path);
+    } else if (opts.layouts != nullptr) {
+        bool has_emitters;
+        sim = new Sim(opts.layouts->fork(opts.layout_path, &has_emitters));
+        if (opts.emitters.empty() && !has_emitters)
+            opts.emitters.push_back({0, 0, 1.f});
+    } else {
+        bool has_emitters = hasOwnEmitters(opts.layout_path);
+        sim = new Sim(loadBoard(opts.layout_path, &has_weights));
+        // Text layouts have no emitters of their own
+        if (opts.emitters.empty() && !has_emitters)
+            opts.emitters.push_back({0, 0, 1.f});
+    }
+    Board* board = sim->board;
+    try {
+        for (auto& emitter : opts.emitters) {
+            board->placeEmitter(emitter.row, emitter.col, emitter.rate);
+            board->computeWeightsAround(emitter.row, emitter.col);
+        }
+        for (auto& escape : opts.escapes)
+            board->setEscapeRate(escape.row, escape.col, escape.rate);
+        // Winds given replace the saved ones, which would add up with them
+        if (resumed && opts.isGiven('Y')) board->clearWinds();
+        for (auto& wind : opts.winds) board->addWind(wind);
+        if (!has_weights) board->computeWeights();
+        if (opts.curve) sim->setEmitterCurves(opts.curve);
+    } catch (std::runtime_error& e) {
+        delete sim;
+        throw;
+    }
+    if (!resumed || opts.isGiven('q')) board->setStorage(opts.storage);
+    if (!resumed || opts.isGiven('r')) sim->emitter_rate = opts.emitter_rate;
+    if (!resumed || opts.isGiven('x')) sim->escape_rate = opts.escape_rate;
+    if (!resumed || opts.isGiven('w'))
+        sim->use_precalc_weights = opts.use_precalc_weights;
+    if (!resumed || opts.isGiven('u')) sim->update_mode = opts.update_mode;
+    if (!resumed || opts.isGiven('M')) sim->stencil = opts.stencil;
+    if (!resumed || opts.isGiven('z'))
+        sim->elevation_bias = opts.elevation_bias;
+    if (!resumed || opts.isGiven('d')) sim->draft_noise = opts.draft_noise;
+    if (!resumed || opts.isGiven('D')) sim->draft_seed = opts.draft_seed;
+    if (!resumed || opts.isGiven('t')) sim->tolerance = opts.tolerance;
+    sim->quiet_threshold = opts.quiet_threshold;
+    sim->quiet_period = opts.quiet_period;
+    sim->threads = opts.threads;
+    sim->pin_threads = opts.pin_threads;
+    sim->time_block = opts.time_block;
+    sim->kernel = opts.kernel;
+    sim->track_activity = opts.track_activity;
+    sim->track_mass = opts.track_mass;
+    sim->arrival_threshold = opts.arrival_threshold;
+    sim->track_dose = !opts.dose_path.empty();
+    // The summary measures the outflow too, unless that would stop ticks
+    // from running in time blocks
+    sim->track_outflow = !opts.outflow_path.empty() ||
+                         (!opts.summary_path.empty() && opts.time_block <= 1);
+    size_t budget = budgetOf(opts);
+    if (budget < SIZE_MAX) {
+        try {
+            fitBudget(*sim, opts, budget);
+        } catch (std::runtime_error& e) {
+            delete sim;
+            throw;
+        }
+    }
+    return sim;
+}
+
+static int runGraph(Options& opts) {
+    for (char option : opts.given) {
+        if (strchr("GHnrxwmo", option) == nullptr) {
+            std::string message = "Option -";
+            message += option;
+            throw std::runtime_error(message + " does not apply to graphs.");
+        }
+    }
+    Graph graph(opts.graph_path, opts.use_precalc_weights);
+    graph.reorder(opts.graph_order);
+    graph.emitter_rate = opts.emitter_rate;
+    graph.escape_rate = opts.escape_rate;
+    auto begin = std::chrono::steady_clock::now();
+    for (unsigned long tick = 0; tick < opts.ticks; tick++) graph.tick();
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - begin).count();
+    fprintf(stderr, "%lu ticks in %.3f s (%.1f ticks/s)\n", opts.ticks,
+            elapsed, elapsed > 0. ? opts.ticks / elapsed : 0.);
+    if (opts.track_mass)
+        fprintf(stderr, "Floor mass %.9f.\n", graph.getMass());
+    if (!opts.density_path.empty()) {
+        FILE* fp = fopen(opts.density_path.c_str(), "w");
+        if (fp == nullptr) {
+            throw std::runtime_error(
+                "An I/O error occurred while opening the file for writing.");
+        }
+        fprintf(fp, "cell,x,y,density\n");
+        for (uint cell = 0; cell < graph.getSize(); cell++) {
+            fprintf(fp, "%u,%g,%g,%.9g\n", cell, graph.getX(cell),
+                    graph.getY(cell), graph.getDensity(cell));
+        }
+        fclose(fp);
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Add up the floor densities of a simulation that did not track its
+ * mass while it ran.
+ */
+static double floorMass(Sim& sim) {
+    Board* board = sim.board;
+    double mass = 0.;
+    for (uint row = 0; row < board->getHeight(); row++) {
+        for (uint col = 0; col < board->getWidth(); col++) {
+            if (board->getTypes()[board->indexOf(row, col)] ==
+                Cell::Type::Floor)
+                mass += sim.getDensity(row, col);
+        }
+    }
+    return mass;
+}
+
+/**
+ * @brief Hash a file with 64-bit FNV-1a, so that summaries of runs of the
+ * same layout can be told apart from those of a changed one of the same
+ * name.
+ */
+static uint64_t hashFile(const std::string& path) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    // Synthetic layouts are hashed by their settings
+    if (isSyntheticLayout(path)) {
+        for (unsigned char c : path) {
+            hash ^= c;
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    unsigned char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            hash ^= buffer[i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+    bool failed = ferror(fp);
+    fclose(fp);
+    if (failed) {
+        throw std::runtime_error(
+            "An I/O error occurred while reading the file.");
+    }
+    return hash;
+}
+
+/* One value of a run summary, text being quoted and an empty value that is
+ * not text standing for one that was not measured. */
+struct SummaryField {
+    const char* name;
+    std::string value;
+    bool text;
+};
+
+static std::string quoted(const std::string& text, char escape) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == escape) out += escape;
+        out += c;
+    }
+    return out + '"';
+}
+
+/**
+ * @brief Gather the summary of a run, see writeSummary().
+ * @param mode What the ticks were: "run", "solve" or "coarse".
+ * @param cells Cells of the board the ticks were run on.
+ * @param escaped Smoke that left through the escapes, or a negative value
+ * if the outflow was not measured.
+ */
+static std::vector<SummaryField> summaryOf(Sim& sim, const Options& opts,
+                                           const char* mode,
+                                           unsigned long ticks, double cells,
+                                           double elapsed, double escaped) {
+    static const char* const update_names[] = {"inplace", "synchronous",
+                                               "redblack"};
+    static const char* const stencil_names[] = {"neumann", "moore"};
+    static const char* const kernel_names[] = {"scalar", "simd"};
+    Board* board = sim.board;
+    std::string source =
+        opts.resume_path.empty() ? opts.layout_path : opts.resume_path;
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             (unsigned long long)hashFile(source));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // What the simulation holds once done, and the most its outputs took
+    Footprint footprint;
+    sim.addFootprint(&footprint);
+    Footprint planned = planRun(sim, opts, board->getStorage());
+    if (planned.get("recorder buffers") > 0)
+        footprint.add("recorder buffers", planned.get("recorder buffers"));
+    if (opts.layouts != nullptr) opts.layouts->addFootprint(&footprint);
+    std::string parts;
+    for (auto& part : footprint.getParts()) {
+        if (!parts.empty()) parts += ';';
+        parts += part.name + '=' + std::to_string(part.bytes);
+    }
+    size_t budget = opts.memory_budget;
+    if (opts.shared_budget != nullptr) {
+        size_t limit = opts.shared_budget->getLimit();
+        budget = budget > 0 ? std::min(budget, limit) : limit;
+    }
+    auto number = [](double value) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.9g", value);
+        return std::string(text);
+    };
+    std::vector<SummaryField> fields = {
+        {"layout", source, true},
+        {"layout_hash", hash, true},
+        {"width", std::to_string(board->getWidth()), false},
+        {"height", std::to_string(board->getHeight()), false},
+        {"storage", storage_names[board->getStorage()], true},
+        {"update", update_names[sim.update_mode], true},
+        {"stencil", stencil_names[sim.stencil], true},
+        {"kernel", kernel_names[sim.kernel], true},
+        {"threads", std::to_string(sim.threads), false},
+        {"time_block", std::to_string(sim.time_block), false},
+        {"emitter_rate", number(sim.emitter_rate), false},
+        {"escape_rate", number(sim.escape_rate), false},
+        {"precalc_weights", sim.use_precalc_weights ? "1" : "0", false},
+        {"mode", mode, true},
+        {"ticks", std::to_string(ticks), false},
+        {"final_tick", std::to_string(sim.getTicks()), false},
+        {"converged", sim.hasConverged() ? "1" : "0", false},
+        {"wall_time", number(elapsed), false},
+        {"ticks_per_s", number(elapsed > 0. ? ticks / elapsed : 0.), false},
+        {"cells_per_s", number(elapsed > 0. ? cells * ticks / elapsed : 0.),
+         false},
+        // Kilobytes on Linux
+        {"peak_rss_kb", std::to_string(usage.ru_maxrss), false},
+        {"memory_bytes", std::to_string(footprint.getTotal()), false},
+        {"memory_planned", std::to_string(planned.getTotal()), false},
+        {"memory_budget", budget > 0 ? std::to_string(budget) : "", false},
+        {"memory_parts", parts, true},
+        {"mass", number(floorMass(sim)), false},
+        {"escaped", escaped < 0. ? "" : number(escaped), false}};
+    return fields;
+}
+
+/**
+ * @brief Format a summary as a JSON object, on a line of its own.
+ */
+static std::string summaryJson(const std::vector<SummaryField>& fields) {
+    std::string json = "{";
+    for (size_t i = 0; i < fields.size(); i++) {
+        auto& field = fields[i];
+        std::string value = field.value;
+        if (field.text) {
+            value = quoted(value, '\\');
+        } else if (value.empty()) {
+            value = "null";
+        }
+        json += std::string(i == 0 ? "" : ", ") + "\"" + field.name +
+                "\": " + value;
+    }
+    return json + "}\n";
+}
+
+/**
+ * @brief Write the summary of a run: a JSON object if the path ends in
+ * .json, or else a row appended to a CSV file, its header written first if
+ * the file is empty, so that many runs can be gathered in one table.
+ *
+ * When the run is a job of a server, the summary is also returned to it as
+ * JSON, see Options::reply.
+ */
+static void writeSummary(Sim& sim, const Options& opts, const char* mode,
+                         unsigned long ticks, double cells, double elapsed,
+                         double escaped, const std::string& path) {
+    std::vector<SummaryField> fields =
+        summaryOf(sim, opts, mode, ticks, cells, elapsed, escaped);
+    if (opts.reply != nullptr) *opts.reply = summaryJson(fields);
+    if (path.empty()) return;
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5,
+                                                 ".json") == 0;
+    FILE* fp = fopen(path.c_str(), json ? "w" : "a");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    // Appending may not start at the end of the file until the first write
+    fseek(fp, 0, SEEK_END);
+    if (json) {
+        fputs(summaryJson(fields).c_str(), fp);
+    } else {
+        if (ftell(fp) == 0) {
+            for (size_t i = 0; i < fields.size(); i++)
+                fprintf(fp, i == 0 ? "%s" : ",%s", fields[i].name);
+            fputc('\n', fp);
+        }
+        for (size_t i = 0; i < fields.size(); i++) {
+            auto& field = fields[i];
+            std::string value =
+                field.text ? quoted(field.value, '"') : field.value;
+            fprintf(fp, i == 0 ? "%s" : ",%s", value.c_str());
+        }
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
+
+static int runBuilding(Options& opts) {
+    for (char option : opts.given) {
+        if (strchr("UVnrxwuzkMfmjo", option) == nullptr) {
+            std::string message = "Option -";
+            message += option;
+            throw std::runtime_error(message +
+                                     " does not apply to buildings.");
+        }
+    }
+    Building building(opts.building_path);
+    building.rise_rate = opts.rise_rate;
+    building.sink_rate = opts.sink_rate;
+    building.threads = opts.threads;
+    for (uint floor = 0; floor < building.getFloorCount(); floor++) {
+        Sim& sim = building.getFloor(floor);
+        sim.emitter_rate = opts.emitter_rate;
+        sim.escape_rate = opts.escape_rate;
+        sim.use_precalc_weights = opts.use_precalc_weights;
+        sim.update_mode = opts.update_mode;
+        sim.elevation_bias = opts.elevation_bias;
+        sim.kernel = opts.kernel;
+        sim.stencil = opts.stencil;
+        sim.track_activity = opts.track_activity;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    for (unsigned long tick = 0; tick < opts.ticks; tick++) building.tick();
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(end - begin).count();
+    fprintf(stderr, "%lu ticks in %.3f s (%.1f ticks/s)\n", opts.ticks,
+            elapsed, elapsed > 0. ? opts.ticks / elapsed : 0.);
+    for (uint floor = 0; floor < building.getFloorCount(); floor++) {
+        Sim& sim = building.getFloor(floor);
+        if (opts.track_mass) {
+            // Added up once done, as stairwells move smoke after each tick
+            fprintf(stderr, "Floor mass of storey %u %.9f.\n", floor,
+                    floorMass(sim));
+        }
+        if (!opts.density_path.empty()) {
+            writeDensity(sim, tagPath(opts.density_path,
+                                      "floor" + std::to_string(floor)));
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static int runCoarse(Options& opts) {
+    for (char option : opts.given) {
+        if (strchr("ZlegYnrxwujJXkMqzdDtQfmociy", option) == nullptr) {
+            std::string message = "Option -";
+            message += option;
+            throw std::runtime_error(message +
+                                     " does not apply to coarse previews.");
+        }
+    }
+    Sim* sim = makeSim(opts);
+    Sim* coarse = nullptr;
+    try {
+        coarse = sim->coarsen(opts.coarse);
+        unsigned long scale = (unsigned long)opts.coarse * opts.coarse;
+        unsigned long due = (opts.ticks + scale - 1) / scale, ticks = 0;
+        auto begin = std::chrono::steady_clock::now();
+        while (ticks < due && !coarse->hasConverged())
+            ticks += coarse->advance(due - ticks);
+        auto end = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(end - begin).count();
+        fprintf(stderr, "%lu ticks of %ux%u cells in %.3f s (%.1f ticks/s)\n",
+                ticks, coarse->board->getWidth(), coarse->board->getHeight(),
+                elapsed, elapsed > 0. ? ticks / elapsed : 0.);
+        if (coarse->hasConverged()) {
+            fprintf(stderr, "Steady state reached, largest change %g.\n",
+                    coarse->getMaxChange());
+        }
+        sim->prolong(*coarse, opts.coarse);
+        if (opts.track_mass)
+            fprintf(stderr, "Floor mass %.9f.\n", floorMass(*sim));
+        if (!opts.density_path.empty())
+            writeDensity(*sim, opts.density_path);
+        if (!opts.checkpoint_path.empty())
+            writeCheckpoint(*sim, opts.checkpoint_path);
+        if (!opts.summary_path.empty()) {
+            double cells = (double)coarse->board->getWidth() *
+                           coarse->board->getHeight();
+            writeSummary(*sim, opts, "coarse", ticks, cells, elapsed, -1.,
+                         opts.summary_path);
+        }
+    } catch (std::exception& e) {
+        delete coarse;
+        delete sim;
+        throw;
+    }
+    delete coarse;
+    delete sim;
+    return EXIT_SUCCESS;
+}
+
+static int run(Sim& sim, Options& opts) {
+    if (!opts.board_path.empty()) writeBoardFile(*sim.board, opts.board_path);
+    if (!opts.graph_out_path.empty()) {
+        Graph(sim.board, sim.use_precalc_weights, sim.elevation_bias)
+            .save(opts.graph_out_path);
+    }
+    Tracer tracer;
+    if (!opts.trace_path.empty()) sim.tracer = &tracer;
+
+    // Indexed before any file is opened, as probes may be out of bounds
+    ProbeSet probes(*sim.board, opts.probes);
+    Scenario scenario;
+    if (!opts.scenario_path.empty()) {
+        if (opts.solve) {
+            throw std::runtime_error(
+                "Scenarios cannot be replayed by the solver.");
+        }
+        // Jobs keep the files of their scenario under the server too
+        scenario = Scenario(opts.scenario_path, opts.reply != nullptr
+                                                    ? checkJobPath
+                                                    : nullptr);
+        scenario.seek(sim.getTicks());
+    }
+    std::unique_ptr<Crowd> crowd;
+    if (opts.occupants > 0) {
+        for (auto& event : scenario.getEvents()) {
+            if (event.kind == ScenarioEvent::Checkpoint)
+                throw std::runtime_error("Checkpoints cannot save occupants.");
+        }
+        crowd.reset(new Crowd(&sim));
+        crowd->speed = opts.occupant_speed;
+        crowd->dose_limit = opts.dose_limit;
+        crowd->threads = opts.threads;
+        crowd->scatter(opts.occupants, opts.occupant_seed);
+    }
+    FILE* stats = nullptr;
+    if (!opts.stats_path.empty()) {
+        stats = fopen(opts.stats_path.c_str(), "w");
+        if (stats == nullptr) {
+            throw std::runtime_error(
+                "An I/O error occurred while opening the file for "
+                "writing.");
+        }
+        fprintf(stats, "tick,mass,peak\n");
+    }
+    FILE* probe_file = nullptr;
+    if (!opts.probe_path.empty()) {
+        probe_file = fopen(opts.probe_path.c_str(), "w");
+        if (probe_file == nullptr) {
+            if (stats != nullptr) fclose(stats);
+            throw std::runtime_error(
+                "An I/O error occurred while opening the file for "
+                "writing.");
+        }
+        fprintf(probe_file, "tick");
+        for (auto& probe : probes.getProbes()) {
+            fprintf(probe_file, ",%s.mean,%s.max", probe.name.c_str(),
+                    probe.name.c_str());
+        }
+        fputc('\n', probe_file);
+    }
+    FILE* outflow = nullptr;
+    if (!opts.outflow_path.empty()) {
+        outflow = fopen(opts.outflow_path.c_str(), "w");
+        if (outflow == nullptr) {
+            if (stats != nullptr) fclose(stats);
+            if (probe_file != nullptr) fclose(probe_file);
+            throw std::runtime_error(
+                "An I/O error occurred while opening the file for "
+                "writing.");
+        }
+    }
+
+    if (opts.solve) {
+        if (stats != nullptr) fclose(stats);
+        if (outflow != nullptr) fclose(outflow);
+        if (probe_file != nullptr) fclose(probe_file);
+        float tolerance = opts.tolerance > 0.f ? opts.tolerance : 1e-6f;
+        auto begin = std::chrono::steady_clock::now();
+        if (opts.coarse > 1) {
+            Sim* coarse = sim.coarsen(opts.coarse);
+            unsigned long sweeps;
+            try {
+                sweeps = coarse->solve(tolerance, opts.ticks, opts.relaxation);
+                sim.prolong(*coarse, opts.coarse);
+            } catch (std::exception& e) {
+                delete coarse;
+                throw;
+            }
+            delete coarse;
+            double elapsed = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - begin)
+                                 .count();
+            fprintf(stderr, "%lu coarse sweeps in %.3f s\n", sweeps, elapsed);
+            begin = std::chrono::steady_clock::now();
+        }
+        unsigned long sweeps =
+            sim.solve(tolerance, opts.ticks, opts.relaxation);
+        auto end = std::chrono::steady_clock::now();
+        double elapsed =
+            std::chrono::duration<double>(end - begin).count();
+        fprintf(stderr, "%lu sweeps in %.3f s, largest change %g%s\n",
+                sweeps, elapsed, sim.getMaxChange(),
+                sim.hasConverged() ? "" : " (not converged)");
+        if (!opts.density_path.empty())
+            writeDensity(sim, opts.density_path);
+        if (!opts.checkpoint_path.empty())
+            writeCheckpoint(sim, opts.checkpoint_path);
+        if (!opts.summary_path.empty() || opts.reply != nullptr) {
+            double cells =
+                (double)sim.board->getWidth() * sim.board->getHeight();
+            writeSummary(sim, opts, "solve", sweeps, cells, elapsed, -1.,
+                         opts.summary_path);
+        }
+        return sim.hasConverged() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+#ifdef SMOKEY_RECORDING
+    Recorder* recorder = nullptr;
+    if (!opts.record_path.empty()) {
+        recorder = new Recorder(opts.record_path, sim.board->getWidth(),
+                                sim.board->getHeight(), opts.record_every);
+        recorder->capture(sim);
+    }
+    std::unique_ptr<FrameStream> stream;
+    if (opts.stream_port != 0) {
+        stream.reset(new FrameStream(opts.stream_port, sim.board->getWidth(),
+                                     sim.board->getHeight(),
+                                     opts.stream_rate));
+        stream->offer(sim);
+    }
+#endif
+
+    std::unique_ptr<VideoExporter> video;
+    if (!opts.video_path.empty()) {
+        uint width = opts.video_width != 0 ? opts.video_width
+                                           : sim.board->getWidth();
+        video.reset(new VideoExporter(
+            opts.video_path, sim.board->getWidth(), sim.board->getHeight(),
+            width, opts.video_every, opts.video_fps, opts.video_palette));
+        video->capture(sim);
+    }
+    std::unique_ptr<LiveExport> live;
+    if (!opts.share_name.empty()) {
+        live.reset(new LiveExport(opts.share_name, sim.board->getWidth(),
+                                  sim.board->getHeight()));
+        live->publish(sim);
+    }
+    // Observers that are off are never due
+    auto share = Sim::every(live ? opts.share_every : UINT_MAX,
+                            [&](Sim& observed) {
+                                if (live) live->publish(observed);
+                            });
+    auto film = Sim::every(video ? opts.video_every : UINT_MAX,
+                           [&](Sim& observed) {
+                               if (video) video->capture(observed);
+                           });
+#ifdef SMOKEY_RECORDING
+    auto record = Sim::every(
+        recorder != nullptr ? opts.record_every : UINT_MAX,
+        [&](Sim& observed) {
+            if (recorder != nullptr) recorder->capture(observed);
+        });
+    // Streams see every tick, and only take those due at their rate
+    auto watch = Sim::every(stream ? 1 : UINT_MAX, [&](Sim& observed) {
+        if (stream) stream->offer(observed);
+    });
+#endif
+
+    auto begin = std::chrono::steady_clock::now();
+    unsigned long ticks = 0;
+    double escaped = 0.;
+    // Ticks nobody looks at are left to run in time blocks
+    bool every_tick = stats != nullptr || sim.track_outflow ||
+                      probe_file != nullptr || crowd;
+    // Events are applied between the ticks they fall between
+    auto replay = [&]() {
+        bool cells_changed;
+        std::vector<size_t> escapes = sim.getEscapeCells();
+        bool running = scenario.apply(sim, &cells_changed, crowd.get());
+        if (!cells_changed) return running;
+        if (!opts.probes.empty()) probes = ProbeSet(*sim.board, opts.probes);
+        if (outflow != nullptr && ftell(outflow) > 0 &&
+            sim.getEscapeCells() != escapes) {
+            throw std::runtime_error(
+                "The escapes cannot change while their outflow is written.");
+        }
+        return running;
+    };
+    bool running = replay();
+    while (running && ticks < opts.ticks) {
+        unsigned long due = every_tick ? 1 : opts.ticks - ticks;
+        if (opts.checkpoint_every > 0) {
+            due = std::min(due, opts.checkpoint_every -
+                                    sim.getTicks() % opts.checkpoint_every);
+        }
+        due = std::min(due, scenario.nextTick() - sim.getTicks());
+        // Frames and densities go out as they fall due, between time blocks
+#ifdef SMOKEY_RECORDING
+        unsigned long ran = sim.advance(due, share, film, record, watch);
+#else
+        unsigned long ran = sim.advance(due, share, film);
+#endif
+        ticks += ran;
+        if (crowd && ran > 0) crowd->move();
+        escaped += sim.getOutflow();
+        if (stats != nullptr) writeStats(sim, stats);
+        if (outflow != nullptr) writeOutflow(sim, outflow);
+        if (probe_file != nullptr) writeProbes(sim, probes, probe_file);
+        // Counted in ticks of the simulation, so resuming keeps the schedule
+        if (opts.checkpoint_every > 0 &&
+            sim.getTicks() % opts.checkpoint_every == 0)
+            writeCheckpoint(sim, opts.checkpoint_path);
+        running = replay();
+        // Events still to come can stir a steady state up again
+        if (sim.hasConverged() && scenario.isDone()) break;
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (stats != nullptr) fclose(stats);
+    if (outflow != nullptr) fclose(outflow);
+    if (probe_file != nullptr) fclose(probe_file);
+#ifdef SMOKEY_RECORDING
+    if (recorder != nullptr) {
+        // Pending frames are still written after the clock stops
+        recorder->close();
+        if (recorder->getStalls() > 0) {
+            fprintf(stderr, "The recorder held up %lu ticks.\n",
+                    recorder->getStalls());
+        }
+        delete recorder;
+    }
+    if (stream && stream->getDropped() > 0) {
+        fprintf(stderr, "The stream dropped %lu stale frames.\n",
+                stream->getDropped());
+    }
+#endif
+    if (video) {
+        video->close();
+        if (video->getStalls() > 0) {
+            fprintf(stderr, "The video held up %lu ticks.\n",
+                    video->getStalls());
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(end - begin).count();
+    fprintf(stderr, "%lu ticks in %.3f s (%.1f ticks/s)\n", ticks, elapsed,
+            elapsed > 0. ? ticks / elapsed : 0.);
+    if (sim.hasConverged()) {
+        fprintf(stderr, "Steady state reached, largest change %g.\n",
+                sim.getMaxChange());
+    }
+    if (opts.track_mass)
+        fprintf(stderr, "Floor mass %.9f.\n", sim.getMass());
+    if (sim.track_outflow)
+        fprintf(stderr, "Smoke escaped %.9f.\n", escaped);
+    if (crowd) {
+        fprintf(stderr, "Occupants evacuated %u, overcome %u, of %u.\n",
+                crowd->getEvacuated(), crowd->getIncapacitated(),
+                crowd->getSize());
+    }
+
+    if (!opts.density_path.empty())
+        writeDensity(sim, opts.density_path);
+    if (!opts.arrival_path.empty()) writeArrivals(sim, opts.arrival_path);
+    if (!opts.occupant_path.empty())
+        writeOccupants(*crowd, opts.occupant_path);
+    if (!opts.dose_path.empty())
+        writeDoses(sim, opts.dose_path, opts.dose_limit);
+    if (!opts.checkpoint_path.empty())
+        writeCheckpoint(sim, opts.checkpoint_path);
+    if (!opts.summary_path.empty() || opts.reply != nullptr) {
+        double cells = (double)sim.board->getWidth() * sim.board->getHeight();
+        writeSummary(sim, opts, "run", ticks, cells, elapsed,
+                     sim.track_outflow ? escaped : -1., opts.summary_path);
+    }
+
+    if (!opts.branches.empty()) {
+        uint jobs = std::max(1u, std::thread::hardware_concurrency());
+        begin = std::chrono::steady_clock::now();
+        std::vector<SweepResult> results = runBranches(
+            sim, opts.branches, opts.branch_ticks, jobs,
+            [&](size_t branch, Sim& fork) {
+                if (!opts.density_path.empty())
+                    writeDensity(fork, branchPath(opts.density_path, branch));
+                if (!opts.arrival_path.empty())
+                    writeArrivals(fork, branchPath(opts.arrival_path, branch));
+                if (!opts.dose_path.empty()) {
+                    writeDoses(fork, branchPath(opts.dose_path, branch),
+                               opts.dose_limit);
+                }
+            });
+        end = std::chrono::steady_clock::now();
+        elapsed = std::chrono::duration<double>(end - begin).count();
+        fprintf(stderr, "%zu branches in %.3f s\n", results.size(), elapsed);
+        for (size_t branch = 0; branch < results.size(); branch++) {
+            fprintf(stderr, "Branch %zu: tick %u, mass %f, peak %f.\n",
+                    branch + 1, results[branch].ticks, results[branch].mass,
+                    results[branch].peak);
+        }
+    }
+    if (!opts.trace_path.empty()) tracer.write(opts.trace_path);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Split a job into its options, at whitespace outside of double
+ * quotes.
+ */
+static std::vector<std::string> splitJob(const std::string& job) {
+    std::vector<std::string> words;
+    std::string word;
+    bool quoted = false, started = false;
+    for (char c : job) {
+        if (c == '"') {
+            quoted = !quoted;
+            started = true;
+        } else if (!quoted && std::isspace((unsigned char)c)) {
+            if (started) words.push_back(word);
+            word.clear();
+            started = false;
+        } else {
+            word += c;
+            started = true;
+        }
+    }
+    if (quoted) throw std::runtime_error("Unterminated quote in the job.");
+    if (started) words.push_back(word);
+    return words;
+}
+
+/**
+ * @brief Serve runs, see JobServer, with the layouts they load cached.
+ */
+static int serve(const Options& opts) {
+    // Each job gives its own options
+    if (!opts.given.empty()) {
+        std::string message = "Option -";
+        message += opts.given[0];
+        throw std::runtime_error(message + " does not apply to servers.");
+    }
+    LayoutCache layouts;
+    // Reserved by each job for what it plans to take, as long as it runs
+    std::unique_ptr<MemoryBudget> budget;
+    if (opts.memory_budget > 0)
+        budget.reset(new MemoryBudget(opts.memory_budget));
+    std::mutex parsing;
+    JobServer server(
+        opts.serve_address, opts.serve_port, opts.serve_jobs,
+        [&](const std::string& request) {
+            std::vector<std::string> words = splitJob(request);
+            std::vector<char*> argv = {(char*)"job"};
+            for (auto& word : words) argv.push_back(&word[0]);
+            argv.push_back(nullptr);
+            Options job;
+            {
+                // getopt keeps its state in globals
+                std::lock_guard<std::mutex> lock(parsing);
+                job = parseOptions(argv.size() - 1, argv.data(), true);
+            }
+            if (!job.graph_path.empty() || !job.building_path.empty() ||
+                (job.coarse > 1 && !job.solve) || job.stream_port != 0 ||
+                !job.share_name.empty() || job.serve_port != 0) {
+                throw std::runtime_error(
+                    "Jobs only run simulations of layouts.");
+            }
+            std::string reply;
+            job.reply = &reply;
+            job.layouts = &layouts;
+            job.shared_budget = budget.get();
+            Sim* sim;
+            try {
+                sim = makeSim(job);
+            } catch (std::runtime_error& e) {
+                // Layouts no job runs do not hold the budget of the next
+                if (budget) layouts.clear();
+                throw;
+            }
+            size_t reserved = 0;
+            if (budget) {
+                reserved =
+                    planRun(*sim, job, sim->board->getStorage()).getTotal();
+                // Other jobs may have reserved the bytes since it was fitted
+                if (!budget->reserve(reserved)) {
+                    delete sim;
+                    throw std::runtime_error(
+                        "The memory budget of the server is taken by other "
+                        "jobs.");
+                }
+            }
+            try {
+                run(*sim, job);
+            } catch (std::exception& e) {
+                delete sim;
+                if (budget) budget->release(reserved);
+                throw;
+            }
+            delete sim;
+            if (budget) budget->release(reserved);
+            return reply;
+        });
+    fprintf(stderr, "Serving jobs on %s port %u, %u at a time.\n",
+            opts.serve_address.c_str(), opts.serve_port, opts.serve_jobs);
+    server.serve();
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opts = parseOptions(argc, argv);
+        if (opts.serve_port != 0) return serve(opts);
+        if (!opts.graph_path.empty()) return runGraph(opts);
+        if (!opts.building_path.empty()) return runBuilding(opts);
+        if (opts.coarse > 1 && !opts.solve) return runCoarse(opts);
+        Sim* sim = makeSim(opts);
+        int status;
+        try {
+            status = run(*sim, opts);
+        } catch (std::exception& e) {
+            delete sim;
+            throw;
+        }
+        delete sim;
+        return status;
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,492 @@
+/**
+ * @file headless_mpi.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+#include <mpi.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Project Includes
+#include "layout.hpp"
+#include "sim.hpp"
+#include "workers.hpp"
+
+/* Each rank simulates a band of rows of the board, with a halo of the rows
+ * of its neighbours above and below it. Cells near the edges of a band see
+ * walls where the board goes on, and the updates that are wrong because of
+ * it move inward by a row per tick: the flow coefficients of a cell depend
+ * on the cells up to two rows away, so after T ticks the rows more than
+ * T + 1 rows from an edge are still right. Bands exchange halos of T + 1
+ * rows every T ticks, which keeps their own rows exact. */
+
+struct Source {
+    uint row, col;
+    float rate;
+};
+
+struct Options {
+    std::string layout_path = "../layouts/default.txt";
+    std::vector<Source> emitters;
+    std::vector<Source> escapes;
+    unsigned long ticks = 100;
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    uint threads = 1;
+    bool pin_threads = false;
+    uint time_block = 8;
+    Sim::Kernel kernel = Sim::Kernel::Simd;
+    Board::Storage storage = Board::Storage::Float;
+    float elevation_bias = 0.f;
+    bool track_activity = true;
+    std::string density_path;
+};
+
+static void usage(const char* argv0) {
+    std::cerr
+        << "Usage: mpirun -n RANKS " << argv0 << " [options]\n"
+        << "Runs synchronous ticks on a text layout split in bands of rows,\n"
+        << "one for each rank.\n"
+        << "  -l, --layout PATH      Layout file (default: "
+           "../layouts/default.txt)\n"
+        << "  -e, --emitter ROW,COL[,RATE]\n"
+        << "                         Place an emitter, optionally scaling\n"
+        << "                         the emission rate for it; may be\n"
+        << "                         repeated (default: 0,0)\n"
+        << "  -g, --escape ROW,COL,RATE\n"
+        << "                         Scale the escape rate for one escape;\n"
+        << "                         may be repeated\n"
+        << "  -n, --ticks N          Number of ticks to run (default: 100)\n"
+        << "  -r, --emitter-rate R   Emission rate in [0, 1] (default: 1)\n"
+        << "  -x, --escape-rate R    Escape rate in [0, 1] (default: 1)\n"
+        << "  -w, --precalc-weights  Use precalculated weights\n"
+        << "  -j, --threads N        Worker threads of each rank (default: 1)\n"
+        << "  -J, --pin-threads      Pin each worker thread to a core\n"
+        << "  -X, --time-block T     Ticks between halo exchanges, run over\n"
+        << "                         each block of a band while it is in\n"
+        << "                         cache (default: 8, at most 32)\n"
+        << "  -k, --kernel KERNEL    Kernel, scalar or simd (default: simd)\n"
+        << "  -q, --storage STORAGE  Density storage, float, fixed16 or\n"
+        << "                         double (default: float)\n"
+        << "  -z, --elevation BIAS   Make smoke prefer rising to higher\n"
+        << "                         floors when positive, sinking when\n"
+        << "                         negative (default: 0, level)\n"
+        << "  -f, --full-board       Update every cell, instead of only the\n"
+        << "                         tiles smoke has reached\n"
+        << "  -o, --output PATH      Write the final density field (CSV),\n"
+        << "                         gathered on the first rank\n"
+        << "  -h, --help             Show this message\n";
+}
+
+static Options parseOptions(int argc, char** argv) {
+    static struct option long_options[] = {
+        {"layout", required_argument, nullptr, 'l'},
+        {"emitter", required_argument, nullptr, 'e'},
+        {"escape", required_argument, nullptr, 'g'},
+        {"ticks", required_argument, nullptr, 'n'},
+        {"emitter-rate", required_argument, nullptr, 'r'},
+        {"escape-rate", required_argument, nullptr, 'x'},
+        {"precalc-weights", no_argument, nullptr, 'w'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"pin-threads", no_argument, nullptr, 'J'},
+        {"time-block", required_argument, nullptr, 'X'},
+        {"kernel", required_argument, nullptr, 'k'},
+        {"storage", required_argument, nullptr, 'q'},
+        {"elevation", required_argument, nullptr, 'z'},
+        {"full-board", no_argument, nullptr, 'f'},
+        {"output", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    Options opts;
+    int c;
+    while ((c = getopt_long(argc, argv, "l:e:g:n:r:x:wj:JX:k:q:z:fo:h",
+                            long_options, nullptr)) != -1) {
+        switch (c) {
+            case 'l':
+                opts.layout_path = optarg;
+                break;
+            case 'e': {
+                Source emitter = {0, 0, 1.f};
+                if (sscanf(optarg, "%u,%u,%f", &emitter.row, &emitter.col,
+                           &emitter.rate) < 2) {
+                    throw std::runtime_error(
+                        "Emitters must be given as ROW,COL[,RATE].");
+                }
+                opts.emitters.push_back(emitter);
+                break;
+            }
+            case 'g': {
+                Source escape;
+                if (sscanf(optarg, "%u,%u,%f", &escape.row, &escape.col,
+                           &escape.rate) != 3) {
+                    throw std::runtime_error(
+                        "Escapes must be given as ROW,COL,RATE.");
+                }
+                opts.escapes.push_back(escape);
+                break;
+            }
+            case 'n':
+                opts.ticks = std::stoul(optarg);
+                break;
+            case 'r':
+                opts.emitter_rate = std::stof(optarg);
+                break;
+            case 'x':
+                opts.escape_rate = std::stof(optarg);
+                break;
+            case 'w':
+                opts.use_precalc_weights = true;
+                break;
+            case 'j':
+                opts.threads = std::stoul(optarg);
+                if (opts.threads == 0) {
+                    throw std::runtime_error(
+                        "At least one thread is required.");
+                }
+                break;
+            case 'J':
+                opts.pin_threads = true;
+                break;
+            case 'X':
+                opts.time_block = std::stoul(optarg);
+                if (opts.time_block == 0 || opts.time_block > Sim::tile_size) {
+                    throw std::runtime_error(
+                        "Time blocks must be 1 to 32 ticks long.");
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "scalar") == 0) {
+                    opts.kernel = Sim::Kernel::Scalar;
+                } else if (strcmp(optarg, "simd") == 0) {
+                    opts.kernel = Sim::Kernel::Simd;
+                } else {
+                    throw std::runtime_error(
+                        "The kernel must be scalar or simd.");
+                }
+                break;
+            case 'q':
+                if (strcmp(optarg, "float") == 0) {
+                    opts.storage = Board::Storage::Float;
+                } else if (strcmp(optarg, "fixed16") == 0) {
+                    opts.storage = Board::Storage::Fixed;
+                } else if (strcmp(optarg, "double") == 0) {
+                    opts.storage = Board::Storage::Double;
+                } else {
+                    throw std::runtime_error(
+                        "The storage must be float, fixed16 or double.");
+                }
+                break;
+            case 'z':
+                opts.elevation_bias = std::stof(optarg);
+                break;
+            case 'f':
+                opts.track_activity = false;
+                break;
+            case 'o':
+                opts.density_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                MPI_Finalize();
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                MPI_Finalize();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (opts.emitters.empty()) opts.emitters.push_back({0, 0, 1.f});
+    return opts;
+}
+
+/**
+ * @brief Set a simulation up on rows [first, last) of a layout, with the
+ * emitters and escape rates that fall within them.
+ */
+static Sim* makeBand(const Layout& layout, const Options& opts, uint first,
+                     uint last) {
+    Sim* sim = new Sim(new Board(layout.cols, last - first,
+                                 layout.data + first * layout.stride,
+                                 layout.stride));
+    Board* board = sim->board;
+    try {
+        for (auto& emitter : opts.emitters) {
+            if (emitter.row < first || emitter.row >= last) continue;
+            board->placeEmitter(emitter.row - first, emitter.col,
+                                emitter.rate);
+            board->computeWeightsAround(emitter.row - first, emitter.col);
+        }
+        for (auto& escape : opts.escapes) {
+            if (escape.row < first || escape.row >= last) continue;
+            board->setEscapeRate(escape.row - first, escape.col,
+                                 escape.rate);
+        }
+    } catch (std::runtime_error& e) {
+        delete sim;
+        throw;
+    }
+    board->setStorage(opts.storage);
+    sim->emitter_rate = opts.emitter_rate;
+    sim->escape_rate = opts.escape_rate;
+    sim->use_precalc_weights = opts.use_precalc_weights;
+    sim->update_mode = Sim::Update::Synchronous;
+    sim->elevation_bias = opts.elevation_bias;
+    sim->threads = opts.threads;
+    sim->pin_threads = opts.pin_threads;
+    sim->time_block = opts.time_block;
+    sim->kernel = opts.kernel;
+    sim->track_activity = opts.track_activity;
+    return sim;
+}
+
+/**
+ * @brief Get the current densities of a board in their storage, and the
+ * size of each.
+ */
+static char* densityBytes(Board& board, size_t* size) {
+    switch (board.getStorage()) {
+        case Board::Storage::Fixed:
+            *size = sizeof(Fixed16);
+            return (char*)board.getFixedDensities();
+        case Board::Storage::Double:
+            *size = sizeof(double);
+            return (char*)board.getDoubleDensities();
+        default:
+            *size = sizeof(float);
+            return (char*)board.getDensities();
+    }
+}
+
+/**
+ * @brief Get the densities of a row of a board in their storage, padding
+ * included, and the size of a row.
+ */
+static char* rowBytes(Board& board, uint row, size_t* row_size) {
+    size_t size;
+    char* density = densityBytes(board, &size);
+    *row_size = board.getStride() * size;
+    return density + (board.indexOf(row, 0) - 1) * size;
+}
+
+/**
+ * @brief Overwrite rows of the densities of a simulation, between ticks.
+ */
+static void writeRows(Sim& sim, uint row, uint rows, const char* data) {
+    size_t row_size;
+    sim.board->ownDensities();
+    char* density = rowBytes(*sim.board, row, &row_size);
+    std::memcpy(density, data, rows * row_size);
+    sim.board->touchDensities();
+    sim.board->markRows(row, row + rows);
+    sim.touchRows(row, row + rows);
+}
+
+/**
+ * @brief A band of the board next to that of another rank, advanced on its
+ * own so that the rows the other rank needs can be sent before the rest of
+ * the band is done.
+ */
+struct Edge {
+    int rank;
+    // Rows of the band the edge simulates, and the rows it sends
+    uint first, last;
+    uint send_first, send_last;
+    // Rows of the halo of the band the other rank sends
+    uint recv_first, recv_last;
+    Sim* sim = nullptr;
+    std::vector<char> send, recv;
+    MPI_Request requests[2];
+};
+
+/**
+ * @brief Write the densities of the rows of every rank, in order, from the
+ * first rank.
+ *
+ * @param first,last Rows of the band the rank owns.
+ */
+static void writeDensity(Sim& sim, uint first, uint last,
+                         const std::string& path, int rank, int ranks) {
+    uint cols = sim.board->getWidth();
+    std::vector<float> rows((size_t)(last - first) * cols);
+    for (uint row = first; row < last; row++) {
+        for (uint col = 0; col < cols; col++)
+            rows[(size_t)(row - first) * cols + col] = sim.getDensity(row, col);
+    }
+    if (rank != 0) {
+        MPI_Send(rows.data(), (int)rows.size(), MPI_FLOAT, 0, 0,
+                 MPI_COMM_WORLD);
+        return;
+    }
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    for (int other = 0; other < ranks; other++) {
+        if (other > 0) {
+            MPI_Status status;
+            MPI_Probe(other, 0, MPI_COMM_WORLD, &status);
+            int count;
+            MPI_Get_count(&status, MPI_FLOAT, &count);
+            rows.resize(count);
+            MPI_Recv(rows.data(), count, MPI_FLOAT, other, 0,
+                     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        for (size_t idx = 0; idx < rows.size(); idx++) {
+            fprintf(fp, idx % cols == 0 ? "%.9g" : ",%.9g", rows[idx]);
+            if (idx % cols == cols - 1) fputc('\n', fp);
+        }
+    }
+    fclose(fp);
+}
+
+static int run(const Options& opts, int rank, int ranks) {
+    Layout layout(opts.layout_path);
+    uint height = layout.rows;
+    for (auto& emitter : opts.emitters) {
+        if (emitter.row >= height || emitter.col >= layout.cols)
+            throw std::runtime_error("Cell coordinates out of bounds.");
+    }
+    uint halo = opts.time_block + 1;
+    if (ranks > 1 && height / ranks < halo) {
+        throw std::runtime_error("The board is too short for " +
+                                 std::to_string(ranks) +
+                                 " ranks, each needs at least " +
+                                 std::to_string(halo) + " rows.");
+    }
+    // Rows the rank owns, and the rows it simulates with their halos
+    size_t begin, end;
+    WorkerPool::getBand(rank, ranks, height, 1, &begin, &end);
+    uint own_first = begin, own_last = end;
+    uint first = own_first > halo ? own_first - halo : 0;
+    uint last = std::min(own_last + halo, height);
+    Sim* sim = makeBand(layout, opts, first, last);
+    /* The rows the neighbours need are advanced first, with enough of the
+     * band around them, so that they are on their way while the rest of
+     * the band is. */
+    std::vector<Edge> edges;
+    if (rank > 0) {
+        Edge edge;
+        edge.rank = rank - 1;
+        edge.first = first;
+        edge.last = std::min(own_first + 2 * halo, last);
+        edge.send_first = own_first;
+        edge.send_last = own_first + halo;
+        edge.recv_first = first;
+        edge.recv_last = own_first;
+        edges.push_back(edge);
+    }
+    if (rank + 1 < ranks) {
+        Edge edge;
+        edge.rank = rank + 1;
+        edge.first = std::max(own_last, first + 2 * halo) - 2 * halo;
+        edge.last = last;
+        edge.send_first = own_last - halo;
+        edge.send_last = own_last;
+        edge.recv_first = own_last;
+        edge.recv_last = last;
+        edges.push_back(edge);
+    }
+    size_t row_size;
+    rowBytes(*sim->board, 0, &row_size);
+    for (auto& edge : edges) {
+        edge.sim = makeBand(layout, opts, edge.first, edge.last);
+        edge.send.resize((edge.send_last - edge.send_first) * row_size);
+        edge.recv.resize((edge.recv_last - edge.recv_first) * row_size);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = std::chrono::steady_clock::now();
+    unsigned long ticks = 0;
+    while (ticks < opts.ticks) {
+        uint depth = std::min((unsigned long)opts.time_block,
+                              opts.ticks - ticks);
+        for (auto& edge : edges) {
+            MPI_Irecv(edge.recv.data(), (int)edge.recv.size(), MPI_BYTE,
+                      edge.rank, 0, MPI_COMM_WORLD, &edge.requests[0]);
+        }
+        for (auto& edge : edges) {
+            writeRows(*edge.sim, 0, edge.last - edge.first,
+                      rowBytes(*sim->board, edge.first - first, &row_size));
+            edge.sim->advance(depth);
+            std::memcpy(edge.send.data(),
+                        rowBytes(*edge.sim->board,
+                                 edge.send_first - edge.first, &row_size),
+                        edge.send.size());
+            MPI_Isend(edge.send.data(), (int)edge.send.size(), MPI_BYTE,
+                      edge.rank, 0, MPI_COMM_WORLD, &edge.requests[1]);
+        }
+        sim->advance(depth);
+        for (auto& edge : edges) {
+            MPI_Waitall(2, edge.requests, MPI_STATUSES_IGNORE);
+            writeRows(*sim, edge.recv_first - first,
+                      edge.recv_last - edge.recv_first, edge.recv.data());
+        }
+        ticks += depth;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto stop = std::chrono::steady_clock::now();
+
+    double mass = 0., total = 0.;
+    for (uint row = own_first; row < own_last; row++) {
+        for (uint col = 0; col < layout.cols; col++)
+            mass += sim->getDensity(row - first, col);
+    }
+    MPI_Reduce(&mass, &total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        double elapsed = std::chrono::duration<double>(stop - start).count();
+        fprintf(stderr, "%lu ticks in %.3f s (%.1f ticks/s) on %d ranks\n",
+                ticks, elapsed, elapsed > 0. ? ticks / elapsed : 0., ranks);
+        fprintf(stderr, "Mass %.6f.\n", total);
+    }
+    if (!opts.density_path.empty()) {
+        writeDensity(*sim, own_first - first, own_last - first,
+                     opts.density_path, rank, ranks);
+    }
+    for (auto& edge : edges) delete edge.sim;
+    delete sim;
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    try {
+        Options opts = parseOptions(argc, argv);
+        int status = run(opts, rank, ranks);
+        MPI_Finalize();
+        return status;
+    } catch (std::exception& e) {
+        // The other ranks may be waiting for this one
+        std::cerr << e.what() << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,483 @@
+/**
+ * @file headless_sweep.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project Includes
+#include "board_file.hpp"
+#include "sweep.hpp"
+
+struct Options {
+    std::string layout_path = "../layouts/default.txt";
+    std::vector<std::pair<uint, uint>> emitters;
+    std::vector<float> emitter_rates = {1.f};
+    std::vector<float> escape_rates = {1.f};
+    std::vector<bool> weight_modes = {false};
+    std::vector<Board::Storage> storages = {Board::Storage::Float};
+    // Each curve with the spec it was given as
+    std::vector<std::pair<std::string, std::shared_ptr<const GrowthCurve>>>
+        curves = {{"none", nullptr}};
+    unsigned long ticks = 100;
+    float tolerance = 0.f;
+    Sim::Update update_mode = Sim::Update::InPlace;
+    Sim::Kernel kernel = Sim::Kernel::Simd;
+    uint jobs = std::max(1u, std::thread::hardware_concurrency());
+    // 0 for the default of the mode, 1 for a sweep and 8 for a search
+    uint ensemble_size = 0;
+    std::string output_path;
+    bool search = false;
+    std::vector<std::pair<uint, uint>> candidates;
+    uint candidate_step = 1;
+    EscapeSearch::Metric metric = EscapeSearch::Metric::Dose;
+    float threshold = .3f;
+};
+
+static void usage(const char* argv0) {
+    std::cerr
+        << "Usage: " << argv0 << " [options]\n"
+        << "Runs every combination of the given parameters on one layout,\n"
+        << "or searches where one more escape clears its smoke best.\n"
+        << "  -l, --layout PATH        Layout file (default: "
+           "../layouts/default.txt)\n"
+        << "  -e, --emitter ROW,COL    Emitter coordinates, may be repeated\n"
+        << "                           (default: 0,0 for text layouts, none\n"
+        << "                           for binary layouts and images)\n"
+        << "  -n, --ticks N            Number of ticks per run (default: 100)\n"
+        << "  -t, --tolerance T        Stop runs early once no density\n"
+        << "                           changes by T or more over a tick\n"
+        << "                           (default: 0, never)\n"
+        << "  -r, --emitter-rates LIST Emission rates (default: 1)\n"
+        << "  -x, --escape-rates LIST  Escape rates (default: 1)\n"
+        << "  -w, --weights LIST       Weight modes, uniform and/or precalc\n"
+        << "                           (default: uniform)\n"
+        << "  -q, --storage LIST       Density storage, float, fixed16 and/or\n"
+        << "                           double (default: float, fixed16 needs\n"
+        << "                           synchronous updates)\n"
+        << "  -c, --curves LIST        Growth curves of the emitters, none,\n"
+        << "                           t2:GROWTH, ramp:BEGIN:END, step:TICK\n"
+        << "                           or a CSV file of TICK,SHARE lines\n"
+        << "                           (default: none)\n"
+        << "  -u, --update MODE        Update mode, inplace (also called\n"
+        << "                           gauss-seidel), synchronous or\n"
+        << "                           redblack (default: inplace)\n"
+        << "  -k, --kernel KERNEL      Synchronous kernel, scalar or simd\n"
+        << "                           (default: simd)\n"
+        << "  -j, --jobs N             Concurrent runs (default: one per "
+           "core)\n"
+        << "  -E, --ensemble N         Advance runs that only differ in\n"
+        << "                           their emitter N at a time, sharing\n"
+        << "                           one sweep of the layout (default: 1,\n"
+        << "                           each on its own, needs synchronous\n"
+        << "                           updates; 8 for searches)\n"
+        << "  -p, --place-escape       Search for the cell to open one more\n"
+        << "                           escape at, with the first of each\n"
+        << "                           list, synchronous updates and float\n"
+        << "                           storage, instead of sweeping\n"
+        << "  -g, --candidate ROW,COL  Cell to try an escape at, a floor or\n"
+        << "                           a wall; may be repeated (default:\n"
+        << "                           the floor cells along the walls)\n"
+        << "  -S, --candidate-step N   Try every Nth of the default\n"
+        << "                           candidates only (default: 1)\n"
+        << "  -m, --metric METRIC      What the search minimises per floor\n"
+        << "                           cell, dose (density ticks) or\n"
+        << "                           exposure (ticks above -A, default:\n"
+        << "                           dose)\n"
+        << "  -A, --threshold T        Exposure threshold (default: 0.3)\n"
+        << "  -o, --output PATH        Write the results table to a file\n"
+        << "                           (CSV, default: standard output)\n"
+        << "  -h, --help               Show this message\n"
+        << "Lists are comma separated, e.g. -r 0.25,0.5,1.\n";
+}
+
+static std::vector<std::string> splitList(const char* list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) items.push_back(item);
+    if (items.empty()) throw std::runtime_error("Empty parameter list.");
+    return items;
+}
+
+static std::vector<float> parseRates(const char* list) {
+    std::vector<float> rates;
+    for (auto& item : splitList(list)) {
+        float rate = std::stof(item);
+        if (!(rate >= 0.f && rate <= 1.f))
+            throw std::runtime_error("Rates must be in [0, 1].");
+        rates.push_back(rate);
+    }
+    return rates;
+}
+
+static Options parseOptions(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"layout", required_argument, nullptr, 'l'},
+        {"emitter", required_argument, nullptr, 'e'},
+        {"ticks", required_argument, nullptr, 'n'},
+        {"tolerance", required_argument, nullptr, 't'},
+        {"emitter-rates", required_argument, nullptr, 'r'},
+        {"escape-rates", required_argument, nullptr, 'x'},
+        {"weights", required_argument, nullptr, 'w'},
+        {"storage", required_argument, nullptr, 'q'},
+        {"curves", required_argument, nullptr, 'c'},
+        {"update", required_argument, nullptr, 'u'},
+        {"kernel", required_argument, nullptr, 'k'},
+        {"jobs", required_argument, nullptr, 'j'},
+        {"ensemble", required_argument, nullptr, 'E'},
+        {"place-escape", no_argument, nullptr, 'p'},
+        {"candidate", required_argument, nullptr, 'g'},
+        {"candidate-step", required_argument, nullptr, 'S'},
+        {"metric", required_argument, nullptr, 'm'},
+        {"threshold", required_argument, nullptr, 'A'},
+        {"output", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    Options opts;
+    int c;
+    while ((c = getopt_long(argc, argv,
+                            "l:e:n:t:r:x:w:q:c:u:k:j:E:pg:S:m:A:o:h",
+                            long_options, nullptr)) != -1) {
+        switch (c) {
+            case 'l':
+                opts.layout_path = optarg;
+                break;
+            case 'e': {
+                uint row, col;
+                if (sscanf(optarg, "%u,%u", &row, &col) != 2) {
+                    throw std::runtime_error(
+                        "Emitter coordinates must be given as ROW,COL.");
+                }
+                opts.emitters.emplace_back(row, col);
+                break;
+            }
+            case 'n':
+                opts.ticks = std::stoul(optarg);
+                break;
+            case 't':
+                opts.tolerance = std::stof(optarg);
+                break;
+            case 'r':
+                opts.emitter_rates = parseRates(optarg);
+                break;
+            case 'x':
+                opts.escape_rates = parseRates(optarg);
+                break;
+            case 'w':
+                opts.weight_modes.clear();
+                for (auto& item : splitList(optarg)) {
+                    if (item == "uniform") {
+                        opts.weight_modes.push_back(false);
+                    } else if (item == "precalc") {
+                        opts.weight_modes.push_back(true);
+                    } else {
+                        throw std::runtime_error(
+                            "The weight modes must be uniform or precalc.");
+                    }
+                }
+                break;
+            case 'q':
+                opts.storages.clear();
+                for (auto& item : splitList(optarg)) {
+                    if (item == "float") {
+                        opts.storages.push_back(Board::Storage::Float);
+                    } else if (item == "fixed16") {
+                        opts.storages.push_back(Board::Storage::Fixed);
+                    } else if (item == "double") {
+                        opts.storages.push_back(Board::Storage::Double);
+                    } else {
+                        throw std::runtime_error(
+                            "The storages must be float, fixed16 or double.");
+                    }
+                }
+                break;
+            case 'c':
+                opts.curves.clear();
+                for (auto& item : splitList(optarg)) {
+                    std::shared_ptr<const GrowthCurve> curve;
+                    if (item != "none") {
+                        curve = std::make_shared<const GrowthCurve>(
+                            GrowthCurve::parse(item));
+                    }
+                    opts.curves.emplace_back(item, curve);
+                }
+                break;
+            case 'u':
+                if (strcmp(optarg, "inplace") == 0 ||
+                    strcmp(optarg, "gauss-seidel") == 0) {
+                    opts.update_mode = Sim::Update::InPlace;
+                } else if (strcmp(optarg, "synchronous") == 0) {
+                    opts.update_mode = Sim::Update::Synchronous;
+                } else if (strcmp(optarg, "redblack") == 0) {
+                    opts.update_mode = Sim::Update::RedBlack;
+                } else {
+                    throw std::runtime_error(
+                        "The update mode must be inplace (gauss-seidel), "
+                        "synchronous or redblack.");
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "scalar") == 0) {
+                    opts.kernel = Sim::Kernel::Scalar;
+                } else if (strcmp(optarg, "simd") == 0) {
+                    opts.kernel = Sim::Kernel::Simd;
+                } else {
+                    throw std::runtime_error(
+                        "The kernel must be scalar or simd.");
+                }
+                break;
+            case 'j':
+                opts.jobs = std::stoul(optarg);
+                if (opts.jobs == 0) {
+                    throw std::runtime_error("At least one job is required.");
+                }
+                break;
+            case 'E':
+                opts.ensemble_size = std::stoul(optarg);
+                if (opts.ensemble_size == 0) {
+                    throw std::runtime_error(
+                        "Ensembles need at least one member.");
+                }
+                break;
+            case 'p':
+                opts.search = true;
+                break;
+            case 'g': {
+                uint row, col;
+                if (sscanf(optarg, "%u,%u", &row, &col) != 2) {
+                    throw std::runtime_error(
+                        "Candidate coordinates must be given as ROW,COL.");
+                }
+                opts.candidates.emplace_back(row, col);
+                break;
+            }
+            case 'S':
+                opts.candidate_step = std::stoul(optarg);
+                if (opts.candidate_step == 0) {
+                    throw std::runtime_error(
+                        "The candidate step must be at least 1.");
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "dose") == 0) {
+                    opts.metric = EscapeSearch::Metric::Dose;
+                } else if (strcmp(optarg, "exposure") == 0) {
+                    opts.metric = EscapeSearch::Metric::Exposure;
+                } else {
+                    throw std::runtime_error(
+                        "The metric must be dose or exposure.");
+                }
+                break;
+            case 'A':
+                opts.threshold = std::stof(optarg);
+                break;
+            case 'o':
+                opts.output_path = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    return opts;
+}
+
+static FILE* openOutput(const std::string& path) {
+    if (path.empty()) return stdout;
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    return fp;
+}
+
+/**
+ * @brief Search where one more escape clears the smoke of the layout best,
+ * with its emitters placed, see EscapeSearch.
+ */
+static void searchEscapes(Options& opts, Board* layout) {
+    EscapeSearch search(layout);
+    if (opts.emitter_rates.size() > 1 || opts.escape_rates.size() > 1 ||
+        opts.weight_modes.size() > 1 || opts.storages.size() > 1 ||
+        opts.curves.size() > 1) {
+        throw std::runtime_error(
+            "Escape searches take one value of each parameter.");
+    }
+    if (opts.storages[0] != Board::Storage::Float || opts.curves[0].second) {
+        throw std::runtime_error(
+            "Escape searches run float storage without curves.");
+    }
+    if (opts.update_mode != Sim::Update::Synchronous) {
+        throw std::runtime_error("Ensembles need synchronous updates.");
+    }
+    for (auto& emitter : opts.emitters) {
+        layout->placeEmitter(emitter.first, emitter.second);
+        layout->computeWeightsAround(emitter.first, emitter.second);
+    }
+    if (opts.candidates.empty())
+        opts.candidates = EscapeSearch::findCandidates(layout,
+                                                       opts.candidate_step);
+    if (opts.candidates.empty())
+        throw std::runtime_error("There are no candidates to search.");
+    search.metric = opts.metric;
+    search.threshold = opts.threshold;
+    search.ticks = opts.ticks;
+    search.emitter_rate = opts.emitter_rates[0];
+    search.escape_rate = opts.escape_rates[0];
+    search.use_precalc_weights = opts.weight_modes[0];
+    if (opts.ensemble_size != 0) search.ensemble_size = opts.ensemble_size;
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<EscapeCandidate> candidates =
+        search.run(opts.candidates, opts.jobs);
+    auto end = std::chrono::steady_clock::now();
+
+    FILE* fp = openOutput(opts.output_path);
+    const char* metric =
+        opts.metric == EscapeSearch::Metric::Dose ? "dose" : "exposure";
+    fprintf(fp, "row,col,%s,ticks,pruned\n", metric);
+    const EscapeCandidate* best = nullptr;
+    size_t pruned = 0;
+    for (const EscapeCandidate& candidate : candidates) {
+        fprintf(fp, "%u,%u,%f,%u,%d\n", candidate.row, candidate.col,
+                candidate.score, candidate.ticks, candidate.pruned);
+        if (candidate.pruned) {
+            pruned++;
+        } else if (best == nullptr || candidate.score < best->score) {
+            best = &candidate;
+        }
+    }
+    if (fp != stdout) fclose(fp);
+
+    double elapsed = std::chrono::duration<double>(end - begin).count();
+    fprintf(stderr,
+            "%zu candidates, %zu pruned, in %.3f s (%.1f candidates/s)\n",
+            candidates.size(), pruned, elapsed,
+            elapsed > 0. ? candidates.size() / elapsed : 0.);
+    fprintf(stderr, "Best escape at %u,%u, %s %f.\n", best->row, best->col,
+            metric, best->score);
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options opts = parseOptions(argc, argv);
+        bool has_weights;
+        bool has_emitters = hasOwnEmitters(opts.layout_path);
+        Board* layout = loadBoard(opts.layout_path, &has_weights);
+        if (!has_weights) layout->computeWeights();
+        // Text layouts have no emitters of their own
+        if (opts.emitters.empty() && !has_emitters)
+            opts.emitters.emplace_back();
+        if (opts.search) {
+            searchEscapes(opts, layout);
+            return EXIT_SUCCESS;
+        }
+        Sweep sweep(layout);
+        sweep.ticks = opts.ticks;
+        sweep.tolerance = opts.tolerance;
+        sweep.update_mode = opts.update_mode;
+        sweep.kernel = opts.kernel;
+        sweep.ensemble_size = std::max(opts.ensemble_size, 1u);
+
+        std::vector<SweepPoint> points;
+        // The spec of the curve of each point
+        std::vector<const std::string*> names;
+        size_t emitters = std::max<size_t>(opts.emitters.size(), 1);
+        for (size_t emitter = 0; emitter < emitters; emitter++) {
+            for (float emitter_rate : opts.emitter_rates) {
+                for (float escape_rate : opts.escape_rates) {
+                    for (bool use_precalc_weights : opts.weight_modes) {
+                        for (Board::Storage storage : opts.storages) {
+                            for (auto& curve : opts.curves) {
+                                SweepPoint point;
+                                if (!opts.emitters.empty()) {
+                                    point.place_emitter = true;
+                                    point.emitter_row =
+                                        opts.emitters[emitter].first;
+                                    point.emitter_col =
+                                        opts.emitters[emitter].second;
+                                }
+                                point.emitter_rate = emitter_rate;
+                                point.escape_rate = escape_rate;
+                                point.use_precalc_weights =
+                                    use_precalc_weights;
+                                point.storage = storage;
+                                point.curve = curve.second;
+                                points.push_back(point);
+                                names.push_back(&curve.first);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<SweepResult> results = sweep.run(points, opts.jobs);
+        auto end = std::chrono::steady_clock::now();
+
+        FILE* fp = openOutput(opts.output_path);
+        fprintf(fp,
+                "emitter_row,emitter_col,emitter_rate,escape_rate,weights,"
+                "storage,curve,ticks,mass,peak\n");
+        for (size_t idx = 0; idx < points.size(); idx++) {
+            const SweepPoint& point = points[idx];
+            if (point.place_emitter) {
+                fprintf(fp, "%u,%u,", point.emitter_row, point.emitter_col);
+            } else {
+                fprintf(fp, ",,");
+            }
+            const char* storage = "float";
+            if (point.storage == Board::Storage::Fixed) storage = "fixed16";
+            if (point.storage == Board::Storage::Double) storage = "double";
+            fprintf(fp, "%f,%f,%s,%s,%s,%u,%f,%f\n", point.emitter_rate,
+                    point.escape_rate,
+                    point.use_precalc_weights ? "precalc" : "uniform", storage,
+                    names[idx]->c_str(), results[idx].ticks,
+                    results[idx].mass, results[idx].peak);
+        }
+        if (fp != stdout) fclose(fp);
+
+        double elapsed = std::chrono::duration<double>(end - begin).count();
+        fprintf(stderr, "%zu runs of %lu ticks in %.3f s (%.1f runs/s)\n",
+                points.size(), opts.ticks, elapsed,
+                elapsed > 0. ? points.size() / elapsed : 0.);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file image.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "image.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef SMOKEY_PNG
+#include <png.h>
+#endif
+
+#include "workers.hpp"
+
+constexpr unsigned char png_magic[8] = {0x89, 'P',  'N',  'G',
+                                        '\r', '\n', 0x1A, '\n'};
+
+/**
+ * @brief Pixels of an image, row by row, with 1 (grey), 3 (RGB) or 4 (RGBA)
+ * channels of at most maxval each.
+ */
+struct Pixels {
+    const uchar* data;
+    size_t row_bytes;
+    uint channels;
+    uint maxval;
+};
+
+/**
+ * @brief Turn a pixel into the layout character of its cell, see image.hpp.
+ */
+static char classify(uint r, uint g, uint b, uint a, bool* emitter) {
+    *emitter = false;
+    if (a < 128) return '/';
+    if (r > 191 && g < 64 && b < 64) {
+        *emitter = true;
+        return '0';
+    }
+    if (g > 191 && r < 64 && b < 64) return ':';
+    uint grey = (r * 77 + g * 150 + b * 29) >> 8;
+    if (grey < image_wall_grey) return '/';
+    return '0' + std::min(9u, (255 - grey) * 10 / (256 - image_wall_grey));
+}
+
+/**
+ * @brief Classify the pixels of an image in bands of rows, one per thread,
+ * then build the board of the layout they make and place its emitters.
+ */
+static Board* buildBoard(uint width, uint height, const Pixels& pixels,
+                         uint threads) {
+    if (width == 0 || height == 0)
+        throw std::runtime_error("The layout must not be empty.");
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, height);
+    std::vector<char> layout((size_t)width * height);
+    // Rows and columns of the emitters of each band
+    std::vector<std::vector<uint>> emitters(threads);
+    WorkerPool workers(threads);
+    workers.run([&](uint worker) {
+        size_t begin, end;
+        WorkerPool::getBand(worker, threads, height, 1, &begin, &end);
+        uint channels = pixels.channels, maxval = pixels.maxval;
+        for (size_t row = begin; row < end; row++) {
+            const uchar* pixel = pixels.data + row * pixels.row_bytes;
+            char* line = layout.data() + row * width;
+            for (uint col = 0; col < width; col++, pixel += channels) {
+                uint r = pixel[0], g = r, b = r, a = 255;
+                if (channels >= 3) {
+                    g = pixel[1];
+                    b = pixel[2];
+                }
+                if (channels == 4) a = pixel[3];
+                if (maxval != 255) {
+                    r = r * 255 / maxval;
+                    g = g * 255 / maxval;
+                    b = b * 255 / maxval;
+                }
+                bool emitter;
+                line[col] = classify(r, g, b, a, &emitter);
+                if (emitter) {
+                    emitters[worker].push_back(row);
+                    emitters[worker].push_back(col);
+                }
+            }
+        }
+    });
+    Board* board = new Board(width, height, layout.data());
+    try {
+        for (auto& band : emitters) {
+            for (size_t i = 0; i < band.size(); i += 2) {
+                board->placeEmitter(band[i], band[i + 1]);
+                board->computeWeightsAround(band[i], band[i + 1]);
+            }
+        }
+    } catch (std::runtime_error& e) {
+        delete board;
+        throw;
+    }
+    return board;
+}
+
+/**
+ * @brief Read the next number of the header of a PGM or PPM image, skipping
+ * whitespace and comments.
+ * @return Whether a number was found before the end of the image.
+ */
+static bool readNumber(const char* data, size_t length, size_t* offset,
+                       uint* number) {
+    size_t i = *offset;
+    while (i < length && (isspace((uchar)data[i]) || data[i] == '#')) {
+        if (data[i] == '#') {
+            while (i < length && data[i] != '\n') i++;
+        } else {
+            i++;
+        }
+    }
+    if (i == length || !isdigit((uchar)data[i])) return false;
+    unsigned long value = 0;
+    for (; i < length && isdigit((uchar)data[i]); i++) {
+        value = value * 10 + (data[i] - '0');
+        if (value > 0xFFFFFFFFul) return false;
+    }
+    *number = value;
+    *offset = i;
+    return true;
+}
+
+/**
+ * @brief Load a binary PGM or PPM image, classifying its rows straight from
+ * a mapping of the file.
+ */
+static Board* loadNetpbm(const std::string& path, uint threads) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Invalid PGM or PPM image.");
+    }
+    size_t length = st.st_size;
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the file.");
+    }
+    const char* data = (const char*)mapping;
+    uint width = 0, height = 0, maxval = 0;
+    size_t offset = 2;
+    uint channels = data[1] == '6' ? 3 : 1;
+    const char* error = nullptr;
+    if (!readNumber(data, length, &offset, &width) ||
+        !readNumber(data, length, &offset, &height) ||
+        !readNumber(data, length, &offset, &maxval) || offset == length ||
+        !isspace((uchar)data[offset]))
+        error = "Invalid PGM or PPM image.";
+    else if (maxval == 0 || maxval > 255)
+        error = "Only PGM and PPM images of up to 8 bits are supported.";
+    // The raster starts after a single whitespace character
+    else if ((length - offset - 1) / channels / std::max(width, 1u) <
+             height)
+        error = "Truncated PGM or PPM image.";
+    if (error != nullptr) {
+        munmap(mapping, length);
+        throw std::runtime_error(error);
+    }
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    Pixels pixels = {(const uchar*)data + offset + 1,
+                     (size_t)width * channels, channels, maxval};
+    Board* board;
+    try {
+        board = buildBoard(width, height, pixels, threads);
+    } catch (std::exception& e) {
+        munmap(mapping, length);
+        throw;
+    }
+    munmap(mapping, length);
+    return board;
+}
+
+#ifdef SMOKEY_PNG
+/**
+ * @brief Report libpng errors through the message of decodePng() rather than
+ * on stderr, and drop its warnings.
+ */
+static void onPngError(png_structp png, png_const_charp) {
+    png_longjmp(png, 1);
+}
+
+static void onPngWarning(png_structp, png_const_charp) {}
+
+/**
+ * @brief Inflate a PNG image into 8-bit RGBA pixels.
+ *
+ * libpng reports errors by jumping back here, so nothing that needs
+ * destroying is made after setjmp().
+ * @return An error message, or null if the image was read.
+ */
+static const char* decodePng(FILE* fp, std::vector<uchar>* pixels,
+                             uint* width, uint* height) {
+    png_structp png = png_create_read_struct(
+        PNG_LIBPNG_VER_STRING, nullptr, onPngError, onPngWarning);
+    if (png == nullptr) return "Out of memory.";
+    png_infop info = png_create_info_struct(png);
+    if (info == nullptr) {
+        png_destroy_read_struct(&png, nullptr, nullptr);
+        return "Out of memory.";
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return "Invalid PNG image.";
+    }
+    png_init_io(png, fp);
+    png_read_info(png, info);
+    // Palettes, grey levels, low bit depths and tRNS chunks all become RGBA
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    *width = png_get_image_width(png, info);
+    *height = png_get_image_height(png, info);
+    pixels->resize((size_t)*width * *height * 4);
+    for (int pass = 0; pass < passes; pass++) {
+        for (uint row = 0; row < *height; row++) {
+            png_read_row(png, pixels->data() + (size_t)row * *width * 4,
+                         nullptr);
+        }
+    }
+    png_read_end(png, nullptr);
+    png_destroy_read_struct(&png, &info, nullptr);
+    return nullptr;
+}
+
+/**
+ * @brief Load a PNG image, inflated by the calling thread and classified in
+ * bands.
+ */
+static Board* loadPng(const std::string& path, uint threads) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    std::vector<uchar> data;
+    uint width = 0, height = 0;
+    const char* error = decodePng(fp, &data, &width, &height);
+    fclose(fp);
+    if (error != nullptr) throw std::runtime_error(error);
+    Pixels pixels = {data.data(), (size_t)width * 4, 4, 255};
+    return buildBoard(width, height, pixels, threads);
+}
+#endif
+
+bool isImageFile(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) return false;
+    unsigned char magic[sizeof(png_magic)];
+    size_t count = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    if (count == sizeof(magic) &&
+        std::memcmp(magic, png_magic, sizeof(magic)) == 0)
+        return true;
+    return count >= 3 && magic[0] == 'P' &&
+           (magic[1] == '5' || magic[1] == '6') && isspace(magic[2]);
+}
+
+Board* loadImage(const std::string& path, uint threads) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    unsigned char magic[sizeof(png_magic)] = {};
+    size_t count = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    if (count == sizeof(magic) &&
+        std::memcmp(magic, png_magic, sizeof(magic)) == 0) {
+#ifdef SMOKEY_PNG
+        return loadPng(path, threads);
+#else
+        throw std::runtime_error("PNG images need a build with libpng.");
+#endif
+    }
+    if (count < 3 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+        throw std::runtime_error("Not a PNG, PGM or PPM image.");
+    return loadNetpbm(path, threads);
+}
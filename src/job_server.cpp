@@ -0,0 +1,196 @@
+/**
+ * @file job_server.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "job_server.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Escape a message for a JSON string.
+ */
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c < ' ') {
+            quoted += ' ';
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t size = send(fd, data.data() + sent, data.size() - sent,
+                            MSG_NOSIGNAL);
+        if (size < 0 && errno == EINTR) continue;
+        if (size <= 0) return false;
+        sent += size;
+    }
+    return true;
+}
+
+JobServer::JobServer(const std::string& address_text, uint port, uint jobs,
+                     Handler handler) {
+    if (jobs == 0) throw std::runtime_error("Servers need a job thread.");
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    if (inet_pton(AF_INET, address_text.c_str(), &address.sin_addr) != 1)
+        throw std::runtime_error("Invalid address to serve on.");
+    address.sin_port = htons(port);
+    this->handler = handler;
+    this->listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (this->listener == -1 ||
+        setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                   sizeof(reuse)) != 0 ||
+        bind(this->listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(this->listener, 64) != 0) {
+        if (this->listener != -1) close(this->listener);
+        throw std::runtime_error(
+            "An I/O error occurred while listening for jobs.");
+    }
+    for (uint job = 0; job < jobs; job++)
+        this->threads.emplace_back(&JobServer::loop, this);
+}
+
+JobServer::~JobServer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->quit = true;
+    }
+    this->wake.notify_all();
+    for (auto& thread : this->threads) thread.join();
+    for (int fd : this->queue) close(fd);
+    close(this->listener);
+}
+
+void JobServer::serve() {
+    for (;;) {
+        int fd = accept4(this->listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            throw std::runtime_error(
+                "An I/O error occurred while accepting a job.");
+        }
+        // A client that stops sending its job only holds up its own
+        timeval timeout = {10, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->queue.push_back(fd);
+        }
+        this->wake.notify_one();
+    }
+}
+
+void JobServer::loop() {
+    for (;;) {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(
+                lock, [&] { return this->quit || !this->queue.empty(); });
+            if (this->quit) return;
+            fd = this->queue.front();
+            this->queue.pop_front();
+        }
+        this->answer(fd);
+        close(fd);
+    }
+}
+
+void JobServer::answer(int fd) {
+    // Read up to the end of the line, or of the headers of a request
+    std::string request;
+    char bytes[4096];
+    size_t end;
+    bool http = false;
+    for (;;) {
+        end = request.find('\n');
+        if (end != std::string::npos) {
+            http = request.compare(0, 5, "POST ") == 0;
+            if (!http) break;
+            end = request.find("\r\n\r\n");
+            if (end != std::string::npos) break;
+        }
+        if (request.size() > 65536) return;
+        ssize_t size = recv(fd, bytes, sizeof(bytes), 0);
+        if (size < 0 && errno == EINTR) continue;
+        // A line may end with the connection
+        if (size <= 0 && !request.empty() && !http) {
+            end = request.size();
+            break;
+        }
+        if (size <= 0) return;
+        request.append(bytes, size);
+    }
+    std::string job;
+    if (http) {
+        std::string headers = request.substr(0, end);
+        for (char& c : headers) c = std::tolower((unsigned char)c);
+        size_t at = headers.find("\r\ncontent-length:");
+        size_t length = at == std::string::npos
+                            ? 0
+                            : std::strtoul(&headers[at + 17], nullptr, 10);
+        job = request.substr(end + 4);
+        while (job.size() < length && job.size() <= 65536) {
+            ssize_t size = recv(fd, bytes, sizeof(bytes), 0);
+            if (size < 0 && errno == EINTR) continue;
+            if (size <= 0) return;
+            job.append(bytes, size);
+        }
+        job.resize(std::min(job.size(), length));
+    } else {
+        job = request.substr(0, end);
+    }
+    if (!job.empty() && job.back() == '\r') job.pop_back();
+    std::string reply;
+    bool failed = false;
+    try {
+        reply = this->handler(job);
+    } catch (std::exception& e) {
+        reply = "{\"error\": " + jsonString(e.what()) + "}\n";
+        failed = true;
+    }
+    if (http) {
+        reply = std::string("HTTP/1.1 ") +
+                (failed ? "400 Bad Request" : "200 OK") +
+                "\r\nContent-Type: application/json\r\n"
+                "Content-Length: " +
+                std::to_string(reply.size()) +
+                "\r\nConnection: close\r\n\r\n" + reply;
+    }
+    sendAll(fd, reply);
+}
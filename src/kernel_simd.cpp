@@ -0,0 +1,876 @@
+/**
+ * @file kernel_simd.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "kernel.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SMOKEY_SIMD_AVX2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SMOKEY_SIMD_NEON
+#endif
+
+/* Every neighbour contributes, in N/S/W/E order:
+ *
+ *   intake  += floor ? A : emitter ? emitter_rate * rate * A : 0
+ *   outtake += floor ? B : escape ? escape_rate * rate * flow_out * d : 0
+ *
+ * with d the density, A = min(adj_flow_out * adj_density, flow_in * (1 - d))
+ * and B = min(flow_out * d, adj_flow_in * (1 - adj_density)), which is the
+ * scalar switch rewritten with masks. The flow coefficients out of the cell
+ * and out of the neighbour are those of the direction of the flow. The rate
+ * of the neighbour is gathered from the rate table, unless all of them are 1.
+ * The types of the neighbours are unpacked from the links of the cell, and
+ * cells without any link, walls and sources among them, add nothing to their
+ * density, so they keep it without being told apart. Vectors of such cells,
+ * in the interiors of walls, are copied without computing any flow.
+ *
+ * Each kernel is specialised on how the densities are stored, on whether the
+ * weights are uniform, so the coefficients are constants, on whether the span
+ * borders any emitter or escape, and on whether there is a rate table to
+ * gather from. Fixed-point densities are decoded on load and rounded back to
+ * the nearest step on store, the arithmetic being the same as for floats. */
+
+#ifdef SMOKEY_SIMD_AVX2
+__attribute__((target("avx2"))) static inline __m256i loadBytes(
+    const uchar* bytes) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)bytes));
+}
+
+__attribute__((target("avx2"))) static inline __m256 loadDensities(
+    const float* density) {
+    return _mm256_loadu_ps(density);
+}
+
+__attribute__((target("avx2"))) static inline __m256 loadDensities(
+    const Fixed16* density) {
+    __m256i fixed =
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)density));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(fixed),
+                         _mm256_set1_ps(1.f / 65535.f));
+}
+
+__attribute__((target("avx2"))) static inline void storeDensities(
+    float* density, __m256 value) {
+    _mm256_storeu_ps(density, value);
+}
+
+__attribute__((target("avx2"))) static inline void storeDensities(
+    Fixed16* density, __m256 value) {
+    value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()),
+                          _mm256_set1_ps(1.f));
+    __m256i fixed =
+        _mm256_cvtps_epi32(_mm256_mul_ps(value, _mm256_set1_ps(65535.f)));
+    _mm_storeu_si128((__m128i*)density,
+                     _mm_packus_epi32(_mm256_castsi256_si128(fixed),
+                                      _mm256_extracti128_si256(fixed, 1)));
+}
+
+template <typename T, bool Uniform, bool Sources, bool Rated>
+__attribute__((target("avx2"))) static size_t updateSpanAvx2(
+    const KernelArgs& args, size_t begin, size_t end) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 quarter = _mm256_set1_ps(.25f);
+    const __m256 emitter_rate = _mm256_set1_ps(args.emitter_rate);
+    const __m256 escape_rate = _mm256_set1_ps(args.escape_rate);
+    const __m256i floor_type = _mm256_set1_epi32(Cell::Floor);
+    const __m256i emitter_type = _mm256_set1_epi32(Cell::Emitter);
+    const __m256i escape_type = _mm256_set1_epi32(Cell::Escape);
+    const __m256i type_mask = _mm256_set1_epi32(3);
+    size_t idx = begin;
+    for (; idx + 8 <= end; idx += 8) {
+        uint64_t packed;
+        std::memcpy(&packed, args.links + idx, sizeof(packed));
+        if (packed == 0) {
+            std::memcpy(dst + idx, src + idx, 8 * sizeof(T));
+            continue;
+        }
+        __m256i links = loadBytes(args.links + idx);
+        __m256 density = loadDensities(src + idx);
+        __m256 flow_in =
+            Uniform ? quarter : _mm256_loadu_ps(args.flow_in + idx);
+        __m256 in_room = _mm256_mul_ps(flow_in, _mm256_sub_ps(one, density));
+        __m256 intake = _mm256_setzero_ps(), outtake = _mm256_setzero_ps();
+        for (int dir = 0; dir < 4; dir++) {
+            size_t adj = idx + offsets[dir];
+            __m256i adj_type = _mm256_and_si256(
+                _mm256_srl_epi32(links, _mm_cvtsi32_si128(2 * dir)),
+                type_mask);
+            __m256 adj_density = loadDensities(src + adj);
+            __m256 flow_out = quarter, adj_flow_out = quarter,
+                   adj_flow_in = quarter;
+            if (!Uniform) {
+                flow_out = _mm256_loadu_ps(args.flow_out[dir] + idx);
+                adj_flow_out = _mm256_loadu_ps(args.flow_out[dir ^ 1] + adj);
+                adj_flow_in = _mm256_loadu_ps(args.flow_in + adj);
+            }
+            __m256 a = _mm256_min_ps(_mm256_mul_ps(adj_flow_out, adj_density),
+                                     in_room);
+            __m256 b = _mm256_min_ps(
+                _mm256_mul_ps(flow_out, density),
+                _mm256_mul_ps(adj_flow_in, _mm256_sub_ps(one, adj_density)));
+            __m256 adj_floor = _mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(adj_type, floor_type));
+            __m256 in = _mm256_and_ps(adj_floor, a);
+            __m256 out = _mm256_and_ps(adj_floor, b);
+            if (Sources) {
+                __m256 adj_emitter = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, emitter_type));
+                __m256 adj_escape = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, escape_type));
+                __m256 adj_emitter_rate = emitter_rate;
+                __m256 adj_escape_rate = escape_rate;
+                if (Rated) {
+                    __m256 rate = _mm256_i32gather_ps(
+                        args.rates, loadBytes(args.rate_index + adj), 4);
+                    adj_emitter_rate = _mm256_mul_ps(emitter_rate, rate);
+                    adj_escape_rate = _mm256_mul_ps(escape_rate, rate);
+                }
+                __m256 adj_escape_flow = _mm256_mul_ps(
+                    _mm256_mul_ps(adj_escape_rate, flow_out), density);
+                in = _mm256_or_ps(
+                    in, _mm256_and_ps(adj_emitter,
+                                      _mm256_mul_ps(adj_emitter_rate, a)));
+                out = _mm256_or_ps(out,
+                                   _mm256_and_ps(adj_escape, adj_escape_flow));
+            }
+            intake = _mm256_add_ps(intake, in);
+            outtake = _mm256_add_ps(outtake, out);
+        }
+        storeDensities(dst + idx,
+                       _mm256_add_ps(density, _mm256_sub_ps(intake, outtake)));
+    }
+    return idx - begin;
+}
+/* The Moore kernels run the same terms over the side neighbours, then over
+ * the corner neighbours, with the constant weights of each, see
+ * Sim::Stencil. The types of the corners are loaded from the cell types, and
+ * read as walls where either side between the cell and the corner is one,
+ * so that smoke does not cut corners. */
+template <typename T, bool Sources, bool Rated>
+__attribute__((target("avx2"))) static size_t updateMooreAvx2(
+    const KernelArgs& args, size_t begin, size_t end) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 side = _mm256_set1_ps(moore_side);
+    const __m256 corner = _mm256_set1_ps(moore_corner);
+    const __m256 emitter_rate = _mm256_set1_ps(args.emitter_rate);
+    const __m256 escape_rate = _mm256_set1_ps(args.escape_rate);
+    const __m256i wall_type = _mm256_set1_epi32(Cell::Wall);
+    const __m256i floor_type = _mm256_set1_epi32(Cell::Floor);
+    const __m256i emitter_type = _mm256_set1_epi32(Cell::Emitter);
+    const __m256i escape_type = _mm256_set1_epi32(Cell::Escape);
+    const __m256i type_mask = _mm256_set1_epi32(3);
+    size_t idx = begin;
+    for (; idx + 8 <= end; idx += 8) {
+        uint64_t packed;
+        std::memcpy(&packed, args.links + idx, sizeof(packed));
+        if (packed == 0) {
+            std::memcpy(dst + idx, src + idx, 8 * sizeof(T));
+            continue;
+        }
+        __m256i links = loadBytes(args.links + idx);
+        __m256 density = loadDensities(src + idx);
+        __m256 room = _mm256_sub_ps(one, density);
+        __m256 intake = _mm256_setzero_ps(), outtake = _mm256_setzero_ps();
+        __m256i walls[4];
+        for (int dir = 0; dir < 8; dir++) {
+            size_t adj;
+            __m256i adj_type;
+            __m256 weight;
+            if (dir < 4) {
+                adj = idx + offsets[dir];
+                adj_type = _mm256_and_si256(
+                    _mm256_srl_epi32(links, _mm_cvtsi32_si128(2 * dir)),
+                    type_mask);
+                walls[dir] = _mm256_cmpeq_epi32(adj_type, wall_type);
+                weight = side;
+            } else {
+                int vertical = (dir - 4) >> 1, horizontal = 2 + (dir & 1);
+                adj = idx + offsets[vertical] + offsets[horizontal];
+                adj_type = _mm256_andnot_si256(
+                    _mm256_or_si256(walls[vertical], walls[horizontal]),
+                    loadBytes((const uchar*)args.type + adj));
+                weight = corner;
+            }
+            __m256 adj_density = loadDensities(src + adj);
+            __m256 a = _mm256_min_ps(_mm256_mul_ps(weight, adj_density),
+                                     _mm256_mul_ps(weight, room));
+            __m256 b = _mm256_min_ps(
+                _mm256_mul_ps(weight, density),
+                _mm256_mul_ps(weight, _mm256_sub_ps(one, adj_density)));
+            __m256 adj_floor = _mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(adj_type, floor_type));
+            __m256 in = _mm256_and_ps(adj_floor, a);
+            __m256 out = _mm256_and_ps(adj_floor, b);
+            if (Sources) {
+                __m256 adj_emitter = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, emitter_type));
+                __m256 adj_escape = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, escape_type));
+                __m256 adj_emitter_rate = emitter_rate;
+                __m256 adj_escape_rate = escape_rate;
+                if (Rated) {
+                    __m256 rate = _mm256_i32gather_ps(
+                        args.rates, loadBytes(args.rate_index + adj), 4);
+                    adj_emitter_rate = _mm256_mul_ps(emitter_rate, rate);
+                    adj_escape_rate = _mm256_mul_ps(escape_rate, rate);
+                }
+                __m256 adj_escape_flow = _mm256_mul_ps(
+                    _mm256_mul_ps(adj_escape_rate, weight), density);
+                in = _mm256_or_ps(
+                    in, _mm256_and_ps(adj_emitter,
+                                      _mm256_mul_ps(adj_emitter_rate, a)));
+                out = _mm256_or_ps(out,
+                                   _mm256_and_ps(adj_escape, adj_escape_flow));
+            }
+            intake = _mm256_add_ps(intake, in);
+            outtake = _mm256_add_ps(outtake, out);
+        }
+        storeDensities(dst + idx,
+                       _mm256_add_ps(density, _mm256_sub_ps(intake, outtake)));
+    }
+    return idx - begin;
+}
+
+/**
+ * @brief Run the transition function on the last four lanes of a cell, when
+ * there are not eight left, with the operations of updateLanesAvx2() on
+ * halves of its vectors.
+ */
+__attribute__((target("avx2"))) static inline void updateQuadAvx2(
+    const CellFlows& flows, const float* density,
+    const float* const* adj_density, float* next, size_t lane) {
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 d = _mm_loadu_ps(density + lane);
+    __m128 in_room =
+        _mm_mul_ps(_mm_set1_ps(flows.flow_in), _mm_sub_ps(one, d));
+    __m128 intake = _mm_setzero_ps(), outtake = _mm_setzero_ps();
+    for (int dir = 0; dir < 4; dir++) {
+        Cell::Type type = flows.adj_type[dir];
+        if (type == Cell::Wall) continue;
+        __m128 adj = _mm_loadu_ps(adj_density[dir] + lane);
+        __m128 flow_out = _mm_set1_ps(flows.flow_out[dir]);
+        __m128 a = _mm_min_ps(
+            _mm_mul_ps(_mm_set1_ps(flows.adj_flow_out[dir]), adj), in_room);
+        if (type == Cell::Floor) {
+            __m128 b = _mm_min_ps(
+                _mm_mul_ps(flow_out, d),
+                _mm_mul_ps(_mm_set1_ps(flows.adj_flow_in[dir]),
+                           _mm_sub_ps(one, adj)));
+            intake = _mm_add_ps(intake, a);
+            outtake = _mm_add_ps(outtake, b);
+            continue;
+        }
+        __m128 rate = _mm_set1_ps(flows.adj_rate[dir]);
+        __m128 emitter =
+            _mm_castsi128_ps(_mm_set1_epi32(-(type == Cell::Emitter)));
+        __m128 escape =
+            _mm_castsi128_ps(_mm_set1_epi32(-(type == Cell::Escape)));
+        intake = _mm_add_ps(intake, _mm_and_ps(emitter, _mm_mul_ps(rate, a)));
+        outtake = _mm_add_ps(
+            outtake,
+            _mm_and_ps(escape, _mm_mul_ps(_mm_mul_ps(rate, flow_out), d)));
+    }
+    _mm_storeu_ps(next + lane, _mm_add_ps(d, _mm_sub_ps(intake, outtake)));
+}
+
+__attribute__((target("avx2"))) static inline void updateLanesAvx2(
+    const CellFlows& flows, const float* density,
+    const float* const* adj_density, float* next, size_t lanes) {
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 flow_in = _mm256_set1_ps(flows.flow_in);
+    if (lanes % 8 != 0) {
+        updateQuadAvx2(flows, density, adj_density, next, lanes - 4);
+        lanes -= 4;
+    }
+    for (size_t lane = 0; lane < lanes; lane += 8) {
+        __m256 d = _mm256_loadu_ps(density + lane);
+        __m256 in_room = _mm256_mul_ps(flow_in, _mm256_sub_ps(one, d));
+        __m256 intake = _mm256_setzero_ps(), outtake = _mm256_setzero_ps();
+        for (int dir = 0; dir < 4; dir++) {
+            // Every board has the same neighbours, walls add nothing
+            Cell::Type type = flows.adj_type[dir];
+            if (type == Cell::Wall) continue;
+            __m256 adj = _mm256_loadu_ps(adj_density[dir] + lane);
+            __m256 flow_out = _mm256_set1_ps(flows.flow_out[dir]);
+            __m256 a = _mm256_min_ps(
+                _mm256_mul_ps(_mm256_set1_ps(flows.adj_flow_out[dir]), adj),
+                in_room);
+            if (type == Cell::Floor) {
+                __m256 b = _mm256_min_ps(
+                    _mm256_mul_ps(flow_out, d),
+                    _mm256_mul_ps(_mm256_set1_ps(flows.adj_flow_in[dir]),
+                                  _mm256_sub_ps(one, adj)));
+                intake = _mm256_add_ps(intake, a);
+                outtake = _mm256_add_ps(outtake, b);
+                continue;
+            }
+            /* The source terms are masked like in updateSpanAvx2(), so that
+             * they are rounded the same, never fused into the sums. */
+            __m256 rate = _mm256_set1_ps(flows.adj_rate[dir]);
+            __m256 emitter = _mm256_castsi256_ps(
+                _mm256_set1_epi32(-(type == Cell::Emitter)));
+            __m256 escape = _mm256_castsi256_ps(
+                _mm256_set1_epi32(-(type == Cell::Escape)));
+            intake = _mm256_add_ps(
+                intake, _mm256_and_ps(emitter, _mm256_mul_ps(rate, a)));
+            outtake = _mm256_add_ps(
+                outtake,
+                _mm256_and_ps(escape,
+                              _mm256_mul_ps(_mm256_mul_ps(rate, flow_out), d)));
+        }
+        _mm256_storeu_ps(next + lane,
+                         _mm256_add_ps(d, _mm256_sub_ps(intake, outtake)));
+    }
+}
+
+/**
+ * @brief Load the values of two cells, each broadcast to the four lanes of
+ * its half of a vector.
+ */
+__attribute__((target("avx2"))) static inline __m256 loadPair(
+    const float* values) {
+    __m128 pair = _mm_castpd_ps(_mm_load_sd((const double*)values));
+    return _mm256_permutevar8x32_ps(_mm256_castps128_ps256(pair),
+                                    _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1));
+}
+
+/**
+ * @brief Run the transition function on pairs of cells of four lanes each,
+ * a pair to a vector, with the masked terms of updateSpanAvx2() and the
+ * coefficients of each cell broadcast to its half.
+ *
+ * Cells without links see walls all around, so they keep their densities
+ * without being told apart.
+ * @return The number of cells processed, a multiple of 2.
+ */
+__attribute__((target("avx2"))) static size_t updatePairsAvx2(
+    const KernelArgs& args, size_t begin, size_t end) {
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256i floor_type = _mm256_set1_epi32(Cell::Floor);
+    const __m256i emitter_type = _mm256_set1_epi32(Cell::Emitter);
+    const __m256i escape_type = _mm256_set1_epi32(Cell::Escape);
+    const __m256i type_mask = _mm256_set1_epi32(3);
+    size_t cur = begin;
+    for (; cur + 2 <= end; cur += 2) {
+        uint l0 = args.links[cur], l1 = args.links[cur + 1];
+        const float* src = args.src + cur * 4;
+        float* dst = args.dst + cur * 4;
+        if ((l0 | l1) == 0) {
+            _mm256_storeu_ps(dst, _mm256_loadu_ps(src));
+            continue;
+        }
+        // Emitters and escapes are the types with the high bit set
+        bool sources = ((l0 | l1) & 0xAA) != 0;
+        __m256i links = _mm256_setr_epi32(l0, l0, l0, l0, l1, l1, l1, l1);
+        __m256 density = _mm256_loadu_ps(src);
+        __m256 in_room = _mm256_mul_ps(loadPair(args.flow_in + cur),
+                                       _mm256_sub_ps(one, density));
+        __m256 intake = _mm256_setzero_ps(), outtake = _mm256_setzero_ps();
+        for (int dir = 0; dir < 4; dir++) {
+            size_t adj = cur + offsets[dir];
+            __m256i adj_type = _mm256_and_si256(
+                _mm256_srl_epi32(links, _mm_cvtsi32_si128(2 * dir)),
+                type_mask);
+            __m256 adj_density = _mm256_loadu_ps(args.src + adj * 4);
+            __m256 flow_out = loadPair(args.flow_out[dir] + cur);
+            __m256 a = _mm256_min_ps(
+                _mm256_mul_ps(loadPair(args.flow_out[dir ^ 1] + adj),
+                              adj_density),
+                in_room);
+            __m256 b = _mm256_min_ps(
+                _mm256_mul_ps(flow_out, density),
+                _mm256_mul_ps(loadPair(args.flow_in + adj),
+                              _mm256_sub_ps(one, adj_density)));
+            __m256 adj_floor = _mm256_castsi256_ps(
+                _mm256_cmpeq_epi32(adj_type, floor_type));
+            __m256 in = _mm256_and_ps(adj_floor, a);
+            __m256 out = _mm256_and_ps(adj_floor, b);
+            if (sources) {
+                __m256 adj_emitter = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, emitter_type));
+                __m256 adj_escape = _mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(adj_type, escape_type));
+                float rates[2] = {1.f, 1.f};
+                if (args.rates != nullptr) {
+                    rates[0] = args.rates[args.rate_index[adj]];
+                    rates[1] = args.rates[args.rate_index[adj + 1]];
+                }
+                __m256 rate = loadPair(rates);
+                __m256 adj_emitter_rate =
+                    _mm256_mul_ps(_mm256_set1_ps(args.emitter_rate), rate);
+                __m256 adj_escape_rate =
+                    _mm256_mul_ps(_mm256_set1_ps(args.escape_rate), rate);
+                __m256 adj_escape_flow = _mm256_mul_ps(
+                    _mm256_mul_ps(adj_escape_rate, flow_out), density);
+                in = _mm256_or_ps(
+                    in, _mm256_and_ps(adj_emitter,
+                                      _mm256_mul_ps(adj_emitter_rate, a)));
+                out = _mm256_or_ps(out,
+                                   _mm256_and_ps(adj_escape, adj_escape_flow));
+            }
+            intake = _mm256_add_ps(intake, in);
+            outtake = _mm256_add_ps(outtake, out);
+        }
+        _mm256_storeu_ps(
+            dst, _mm256_add_ps(density, _mm256_sub_ps(intake, outtake)));
+    }
+    return cur - begin;
+}
+
+__attribute__((target("avx2"))) static void updateCellsAvx2(
+    const KernelArgs& args, size_t lanes, size_t begin, size_t end) {
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    // Four lanes only fill half a vector, so cells go in pairs
+    if (lanes == 4 && !args.uniform_flow)
+        begin += updatePairsAvx2(args, begin, end);
+    for (size_t cur = begin; cur < end; cur++) {
+        const float* density = args.src + cur * lanes;
+        float* next = args.dst + cur * lanes;
+        if (args.links[cur] == 0) {
+            std::memcpy(next, density, lanes * sizeof(float));
+            continue;
+        }
+        CellFlows flows;
+        const float* adj_density[4];
+        gatherFlows(args, cur, &flows);
+        for (int dir = 0; dir < 4; dir++)
+            adj_density[dir] = args.src + (cur + offsets[dir]) * lanes;
+        updateLanesAvx2(flows, density, adj_density, next, lanes);
+    }
+}
+#endif
+
+#ifdef SMOKEY_SIMD_NEON
+static inline uint32x4_t loadBytes(const uchar* bytes4) {
+    uint32_t packed;
+    std::memcpy(&packed, bytes4, sizeof(packed));
+    uint8x8_t bytes = vreinterpret_u8_u32(vdup_n_u32(packed));
+    return vmovl_u16(vget_low_u16(vmovl_u8(bytes)));
+}
+
+static inline float32x4_t select(uint32x4_t mask, float32x4_t value) {
+    return vreinterpretq_f32_u32(
+        vandq_u32(mask, vreinterpretq_u32_f32(value)));
+}
+
+static inline float32x4_t loadDensities(const float* density) {
+    return vld1q_f32(density);
+}
+
+static inline float32x4_t loadDensities(const Fixed16* density) {
+    return vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(density))),
+                       1.f / 65535.f);
+}
+
+static inline void storeDensities(float* density, float32x4_t value) {
+    vst1q_f32(density, value);
+}
+
+static inline void storeDensities(Fixed16* density, float32x4_t value) {
+    value = vminq_f32(vmaxq_f32(value, vdupq_n_f32(0.f)), vdupq_n_f32(1.f));
+    vst1_u16(density, vmovn_u32(vcvtnq_u32_f32(vmulq_n_f32(value, 65535.f))));
+}
+
+template <typename T, bool Uniform, bool Sources, bool Rated>
+static size_t updateSpanNeon(const KernelArgs& args, size_t begin,
+                             size_t end) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t quarter = vdupq_n_f32(.25f);
+    const float32x4_t emitter_rate = vdupq_n_f32(args.emitter_rate);
+    const float32x4_t escape_rate = vdupq_n_f32(args.escape_rate);
+    const uint32x4_t floor_type = vdupq_n_u32(Cell::Floor);
+    const uint32x4_t emitter_type = vdupq_n_u32(Cell::Emitter);
+    const uint32x4_t escape_type = vdupq_n_u32(Cell::Escape);
+    const uint32x4_t type_mask = vdupq_n_u32(3);
+    size_t idx = begin;
+    for (; idx + 4 <= end; idx += 4) {
+        uint32_t packed;
+        std::memcpy(&packed, args.links + idx, sizeof(packed));
+        if (packed == 0) {
+            std::memcpy(dst + idx, src + idx, 4 * sizeof(T));
+            continue;
+        }
+        uint32x4_t links = loadBytes(args.links + idx);
+        float32x4_t density = loadDensities(src + idx);
+        float32x4_t flow_in = Uniform ? quarter : vld1q_f32(args.flow_in + idx);
+        float32x4_t in_room = vmulq_f32(flow_in, vsubq_f32(one, density));
+        float32x4_t intake = vdupq_n_f32(0.f), outtake = vdupq_n_f32(0.f);
+        for (int dir = 0; dir < 4; dir++) {
+            size_t adj = idx + offsets[dir];
+            // Shifting by a negative count shifts right
+            uint32x4_t adj_type = vandq_u32(
+                vshlq_u32(links, vdupq_n_s32(-2 * dir)), type_mask);
+            float32x4_t adj_density = loadDensities(src + adj);
+            float32x4_t flow_out = quarter, adj_flow_out = quarter,
+                        adj_flow_in = quarter;
+            if (!Uniform) {
+                flow_out = vld1q_f32(args.flow_out[dir] + idx);
+                adj_flow_out = vld1q_f32(args.flow_out[dir ^ 1] + adj);
+                adj_flow_in = vld1q_f32(args.flow_in + adj);
+            }
+            float32x4_t a =
+                vminq_f32(vmulq_f32(adj_flow_out, adj_density), in_room);
+            float32x4_t b =
+                vminq_f32(vmulq_f32(flow_out, density),
+                          vmulq_f32(adj_flow_in, vsubq_f32(one, adj_density)));
+            uint32x4_t adj_floor = vceqq_u32(adj_type, floor_type);
+            float32x4_t in = select(adj_floor, a);
+            float32x4_t out = select(adj_floor, b);
+            if (Sources) {
+                uint32x4_t adj_emitter = vceqq_u32(adj_type, emitter_type);
+                uint32x4_t adj_escape = vceqq_u32(adj_type, escape_type);
+                float32x4_t adj_emitter_rate = emitter_rate;
+                float32x4_t adj_escape_rate = escape_rate;
+                if (Rated) {
+                    float lanes[4];
+                    for (int lane = 0; lane < 4; lane++)
+                        lanes[lane] = args.rates[args.rate_index[adj + lane]];
+                    float32x4_t rate = vld1q_f32(lanes);
+                    adj_emitter_rate = vmulq_f32(emitter_rate, rate);
+                    adj_escape_rate = vmulq_f32(escape_rate, rate);
+                }
+                float32x4_t adj_escape_flow =
+                    vmulq_f32(vmulq_f32(adj_escape_rate, flow_out), density);
+                in = vaddq_f32(
+                    in, select(adj_emitter, vmulq_f32(adj_emitter_rate, a)));
+                out = vaddq_f32(out, select(adj_escape, adj_escape_flow));
+            }
+            intake = vaddq_f32(intake, in);
+            outtake = vaddq_f32(outtake, out);
+        }
+        storeDensities(dst + idx,
+                       vaddq_f32(density, vsubq_f32(intake, outtake)));
+    }
+    return idx - begin;
+}
+
+template <typename T, bool Sources, bool Rated>
+static size_t updateMooreNeon(const KernelArgs& args, size_t begin,
+                              size_t end) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t side = vdupq_n_f32(moore_side);
+    const float32x4_t corner = vdupq_n_f32(moore_corner);
+    const float32x4_t emitter_rate = vdupq_n_f32(args.emitter_rate);
+    const float32x4_t escape_rate = vdupq_n_f32(args.escape_rate);
+    const uint32x4_t wall_type = vdupq_n_u32(Cell::Wall);
+    const uint32x4_t floor_type = vdupq_n_u32(Cell::Floor);
+    const uint32x4_t emitter_type = vdupq_n_u32(Cell::Emitter);
+    const uint32x4_t escape_type = vdupq_n_u32(Cell::Escape);
+    const uint32x4_t type_mask = vdupq_n_u32(3);
+    size_t idx = begin;
+    for (; idx + 4 <= end; idx += 4) {
+        uint32_t packed;
+        std::memcpy(&packed, args.links + idx, sizeof(packed));
+        if (packed == 0) {
+            std::memcpy(dst + idx, src + idx, 4 * sizeof(T));
+            continue;
+        }
+        uint32x4_t links = loadBytes(args.links + idx);
+        float32x4_t density = loadDensities(src + idx);
+        float32x4_t room = vsubq_f32(one, density);
+        float32x4_t intake = vdupq_n_f32(0.f), outtake = vdupq_n_f32(0.f);
+        uint32x4_t walls[4];
+        for (int dir = 0; dir < 8; dir++) {
+            size_t adj;
+            uint32x4_t adj_type;
+            float32x4_t weight;
+            if (dir < 4) {
+                adj = idx + offsets[dir];
+                // Shifting by a negative count shifts right
+                adj_type = vandq_u32(vshlq_u32(links, vdupq_n_s32(-2 * dir)),
+                                     type_mask);
+                walls[dir] = vceqq_u32(adj_type, wall_type);
+                weight = side;
+            } else {
+                int vertical = (dir - 4) >> 1, horizontal = 2 + (dir & 1);
+                adj = idx + offsets[vertical] + offsets[horizontal];
+                adj_type =
+                    vbicq_u32(loadBytes((const uchar*)args.type + adj),
+                              vorrq_u32(walls[vertical], walls[horizontal]));
+                weight = corner;
+            }
+            float32x4_t adj_density = loadDensities(src + adj);
+            float32x4_t a = vminq_f32(vmulq_f32(weight, adj_density),
+                                      vmulq_f32(weight, room));
+            float32x4_t b =
+                vminq_f32(vmulq_f32(weight, density),
+                          vmulq_f32(weight, vsubq_f32(one, adj_density)));
+            uint32x4_t adj_floor = vceqq_u32(adj_type, floor_type);
+            float32x4_t in = select(adj_floor, a);
+            float32x4_t out = select(adj_floor, b);
+            if (Sources) {
+                uint32x4_t adj_emitter = vceqq_u32(adj_type, emitter_type);
+                uint32x4_t adj_escape = vceqq_u32(adj_type, escape_type);
+                float32x4_t adj_emitter_rate = emitter_rate;
+                float32x4_t adj_escape_rate = escape_rate;
+                if (Rated) {
+                    float lanes[4];
+                    for (int lane = 0; lane < 4; lane++)
+                        lanes[lane] = args.rates[args.rate_index[adj + lane]];
+                    float32x4_t rate = vld1q_f32(lanes);
+                    adj_emitter_rate = vmulq_f32(emitter_rate, rate);
+                    adj_escape_rate = vmulq_f32(escape_rate, rate);
+                }
+                float32x4_t adj_escape_flow =
+                    vmulq_f32(vmulq_f32(adj_escape_rate, weight), density);
+                in = vaddq_f32(
+                    in, select(adj_emitter, vmulq_f32(adj_emitter_rate, a)));
+                out = vaddq_f32(out, select(adj_escape, adj_escape_flow));
+            }
+            intake = vaddq_f32(intake, in);
+            outtake = vaddq_f32(outtake, out);
+        }
+        storeDensities(dst + idx,
+                       vaddq_f32(density, vsubq_f32(intake, outtake)));
+    }
+    return idx - begin;
+}
+
+static inline void updateLanesNeon(const CellFlows& flows,
+                                   const float* density,
+                                   const float* const* adj_density,
+                                   float* next, size_t lanes) {
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t flow_in = vdupq_n_f32(flows.flow_in);
+    for (size_t lane = 0; lane < lanes; lane += 4) {
+        float32x4_t d = vld1q_f32(density + lane);
+        float32x4_t in_room = vmulq_f32(flow_in, vsubq_f32(one, d));
+        float32x4_t intake = vdupq_n_f32(0.f), outtake = vdupq_n_f32(0.f);
+        for (int dir = 0; dir < 4; dir++) {
+            Cell::Type type = flows.adj_type[dir];
+            if (type == Cell::Wall) continue;
+            float32x4_t adj = vld1q_f32(adj_density[dir] + lane);
+            float32x4_t flow_out = vdupq_n_f32(flows.flow_out[dir]);
+            float32x4_t a = vminq_f32(
+                vmulq_f32(vdupq_n_f32(flows.adj_flow_out[dir]), adj), in_room);
+            if (type == Cell::Floor) {
+                float32x4_t b = vminq_f32(
+                    vmulq_f32(flow_out, d),
+                    vmulq_f32(vdupq_n_f32(flows.adj_flow_in[dir]),
+                              vsubq_f32(one, adj)));
+                intake = vaddq_f32(intake, a);
+                outtake = vaddq_f32(outtake, b);
+                continue;
+            }
+            float32x4_t rate = vdupq_n_f32(flows.adj_rate[dir]);
+            uint32x4_t emitter =
+                vdupq_n_u32(-(uint32_t)(type == Cell::Emitter));
+            uint32x4_t escape =
+                vdupq_n_u32(-(uint32_t)(type == Cell::Escape));
+            intake = vaddq_f32(intake, select(emitter, vmulq_f32(rate, a)));
+            outtake = vaddq_f32(
+                outtake,
+                select(escape, vmulq_f32(vmulq_f32(rate, flow_out), d)));
+        }
+        vst1q_f32(next + lane, vaddq_f32(d, vsubq_f32(intake, outtake)));
+    }
+}
+
+static void updateCellsNeon(const KernelArgs& args, size_t lanes,
+                            size_t begin, size_t end) {
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    for (size_t cur = begin; cur < end; cur++) {
+        const float* density = args.src + cur * lanes;
+        float* next = args.dst + cur * lanes;
+        if (args.links[cur] == 0) {
+            for (size_t lane = 0; lane < lanes; lane += 4)
+                vst1q_f32(next + lane, vld1q_f32(density + lane));
+            continue;
+        }
+        CellFlows flows;
+        const float* adj_density[4];
+        gatherFlows(args, cur, &flows);
+        for (int dir = 0; dir < 4; dir++)
+            adj_density[dir] = args.src + (cur + offsets[dir]) * lanes;
+        updateLanesNeon(flows, density, adj_density, next, lanes);
+    }
+}
+#endif
+
+bool hasSimdKernel() {
+#if defined(SMOKEY_SIMD_AVX2)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+#elif defined(SMOKEY_SIMD_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+typedef size_t (*SpanKernel)(const KernelArgs& args, size_t begin,
+                             size_t end);
+
+/* Kernels by fixed storage, uniform weights, sources and rate table, in
+ * binary order. */
+#if defined(SMOKEY_SIMD_AVX2)
+static const SpanKernel span_kernels[16] = {
+    updateSpanAvx2<float, false, false, false>,
+    updateSpanAvx2<float, false, false, true>,
+    updateSpanAvx2<float, false, true, false>,
+    updateSpanAvx2<float, false, true, true>,
+    updateSpanAvx2<float, true, false, false>,
+    updateSpanAvx2<float, true, false, true>,
+    updateSpanAvx2<float, true, true, false>,
+    updateSpanAvx2<float, true, true, true>,
+    updateSpanAvx2<Fixed16, false, false, false>,
+    updateSpanAvx2<Fixed16, false, false, true>,
+    updateSpanAvx2<Fixed16, false, true, false>,
+    updateSpanAvx2<Fixed16, false, true, true>,
+    updateSpanAvx2<Fixed16, true, false, false>,
+    updateSpanAvx2<Fixed16, true, false, true>,
+    updateSpanAvx2<Fixed16, true, true, false>,
+    updateSpanAvx2<Fixed16, true, true, true>};
+#elif defined(SMOKEY_SIMD_NEON)
+static const SpanKernel span_kernels[16] = {
+    updateSpanNeon<float, false, false, false>,
+    updateSpanNeon<float, false, false, true>,
+    updateSpanNeon<float, false, true, false>,
+    updateSpanNeon<float, false, true, true>,
+    updateSpanNeon<float, true, false, false>,
+    updateSpanNeon<float, true, false, true>,
+    updateSpanNeon<float, true, true, false>,
+    updateSpanNeon<float, true, true, true>,
+    updateSpanNeon<Fixed16, false, false, false>,
+    updateSpanNeon<Fixed16, false, false, true>,
+    updateSpanNeon<Fixed16, false, true, false>,
+    updateSpanNeon<Fixed16, false, true, true>,
+    updateSpanNeon<Fixed16, true, false, false>,
+    updateSpanNeon<Fixed16, true, false, true>,
+    updateSpanNeon<Fixed16, true, true, false>,
+    updateSpanNeon<Fixed16, true, true, true>};
+#endif
+
+/* Moore kernels by fixed storage, sources and rate table, in binary order. */
+#if defined(SMOKEY_SIMD_AVX2)
+static const SpanKernel moore_kernels[8] = {
+    updateMooreAvx2<float, false, false>,
+    updateMooreAvx2<float, false, true>,
+    updateMooreAvx2<float, true, false>,
+    updateMooreAvx2<float, true, true>,
+    updateMooreAvx2<Fixed16, false, false>,
+    updateMooreAvx2<Fixed16, false, true>,
+    updateMooreAvx2<Fixed16, true, false>,
+    updateMooreAvx2<Fixed16, true, true>};
+#elif defined(SMOKEY_SIMD_NEON)
+static const SpanKernel moore_kernels[8] = {
+    updateMooreNeon<float, false, false>,
+    updateMooreNeon<float, false, true>,
+    updateMooreNeon<float, true, false>,
+    updateMooreNeon<float, true, true>,
+    updateMooreNeon<Fixed16, false, false>,
+    updateMooreNeon<Fixed16, false, true>,
+    updateMooreNeon<Fixed16, true, false>,
+    updateMooreNeon<Fixed16, true, true>};
+#endif
+
+size_t updateSpanSimd(const KernelArgs& args, size_t begin, size_t end,
+                      bool sources) {
+    if (!hasSimdKernel() || args.src_double != nullptr) return 0;
+#if defined(SMOKEY_SIMD_AVX2) || defined(SMOKEY_SIMD_NEON)
+    return span_kernels[(args.src_fixed != nullptr) << 3 |
+                        args.uniform_flow << 2 | sources << 1 |
+                        (args.rates != nullptr)](args, begin, end);
+#else
+    (void)args;
+    (void)begin;
+    (void)end;
+    (void)sources;
+    return 0;
+#endif
+}
+
+size_t updateMooreSimd(const KernelArgs& args, size_t begin, size_t end,
+                       bool sources) {
+    if (!hasSimdKernel() || args.src_double != nullptr) return 0;
+#if defined(SMOKEY_SIMD_AVX2) || defined(SMOKEY_SIMD_NEON)
+    return moore_kernels[(args.src_fixed != nullptr) << 2 | sources << 1 |
+                         (args.rates != nullptr)](args, begin, end);
+#else
+    (void)args;
+    (void)begin;
+    (void)end;
+    (void)sources;
+    return 0;
+#endif
+}
+
+bool updateLanesSimd(const CellFlows& flows, const float* density,
+                     const float* const* adj_density, float* next,
+                     size_t lanes) {
+    if (!hasSimdKernel()) return false;
+#if defined(SMOKEY_SIMD_AVX2)
+    updateLanesAvx2(flows, density, adj_density, next, lanes);
+    return true;
+#elif defined(SMOKEY_SIMD_NEON)
+    updateLanesNeon(flows, density, adj_density, next, lanes);
+    return true;
+#else
+    (void)flows;
+    (void)density;
+    (void)adj_density;
+    (void)next;
+    (void)lanes;
+    return false;
+#endif
+}
+
+bool updateCellsSimd(const KernelArgs& args, size_t lanes, size_t begin,
+                     size_t end) {
+    if (!hasSimdKernel()) return false;
+#if defined(SMOKEY_SIMD_AVX2)
+    updateCellsAvx2(args, lanes, begin, end);
+    return true;
+#elif defined(SMOKEY_SIMD_NEON)
+    updateCellsNeon(args, lanes, begin, end);
+    return true;
+#else
+    (void)args;
+    (void)lanes;
+    (void)begin;
+    (void)end;
+    return false;
+#endif
+}
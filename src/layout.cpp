@@ -0,0 +1,121 @@
+/**
+ * @file layout.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "layout.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Check that a row only contains valid layout characters.
+ * @return The offset of the first invalid character, or len if there is none.
+ */
+static size_t validateRow(const char* row, size_t len) {
+    size_t col = 0;
+#if defined(__SSE2__)
+    /* Valid characters are in ['/', ':']: subtracting '/' maps them to
+     * [0, 11] and everything else, wrapping around, to [12, 255]. */
+    const __m128i base = _mm_set1_epi8('/');
+    const __m128i limit = _mm_set1_epi8(':' - '/');
+    for (; col + 16 <= len; col += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(row + col));
+        __m128i offset = _mm_sub_epi8(chunk, base);
+        __m128i valid =
+            _mm_cmpeq_epi8(_mm_max_epu8(offset, limit), limit);
+        if (_mm_movemask_epi8(valid) != 0xFFFF) break;
+    }
+#endif
+    for (; col < len; col++) {
+        if (row[col] < '/' || row[col] > ':') return col;
+    }
+    return len;
+}
+
+Layout::Layout(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    this->length = st.st_size;
+    if (this->length == 0) {
+        close(fd);
+        throw std::runtime_error("The layout must not be empty.");
+    }
+    this->mapping = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (this->mapping == MAP_FAILED) {
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the file.");
+    }
+    madvise(this->mapping, this->length, MADV_SEQUENTIAL);
+    const char* begin = (const char*)this->mapping;
+    const char* end = begin + this->length;
+    this->data = begin;
+    this->rows = 0;
+    this->cols = 0;
+    /* Every row is expected to have the same length, so all of them but the
+     * last must be followed by a newline at the same offset. */
+    for (const char* row = begin; row < end; this->rows++) {
+        const char* eol = (const char*)memchr(row, '\n', end - row);
+        if (eol == nullptr) eol = end;
+        size_t cols = eol - row;
+        size_t bad = validateRow(row, cols);
+        if (bad != cols) {
+            std::stringstream ss;
+            ss << "Invalid character \'" << row[bad] << "\' ("
+               << (int)row[bad] << ") detected at " << this->rows + 1 << ", "
+               << bad << ".";
+            munmap(this->mapping, this->length);
+            throw std::runtime_error(ss.str().c_str());
+        }
+        if (this->rows == 0) {
+            this->cols = cols;
+            this->stride = cols + 1;
+        } else if (cols != this->cols) {
+            munmap(this->mapping, this->length);
+            throw std::runtime_error(
+                "Each row must have the same number of columns.");
+        }
+        row = eol + 1;
+    }
+    if (this->rows == 0 || this->cols == 0) {
+        munmap(this->mapping, this->length);
+        throw std::runtime_error("The layout must not be empty.");
+    }
+}
+
+Layout::~Layout() { munmap(this->mapping, this->length); }
@@ -0,0 +1,157 @@
+/**
+ * @file live.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "live.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+/**
+ * @brief Get the size of a segment, the densities starting on a cache line
+ * of their own.
+ */
+static size_t segmentSize(uint width, uint height, uint32_t* offset) {
+    *offset = (sizeof(LiveHeader) + 63) / 64 * 64;
+    return *offset + (size_t)width * height * sizeof(float);
+}
+
+LiveExport::LiveExport(const std::string& name, uint width, uint height) {
+    uint32_t offset;
+    this->size = segmentSize(width, height, &offset);
+    this->name = name;
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error(
+            "An I/O error occurred while creating the shared memory "
+            "segment.");
+    }
+    void* segment = MAP_FAILED;
+    if (ftruncate(fd, this->size) == 0) {
+        segment = mmap(nullptr, this->size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (segment == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the shared memory segment.");
+    }
+    this->header = new (segment) LiveHeader();
+    this->header->version = live_version;
+    this->header->width = width;
+    this->header->height = height;
+    this->header->densities_offset = offset;
+    this->header->sequence.store(0, std::memory_order_relaxed);
+    this->header->tick = 0;
+    this->densities = (float*)((char*)segment + offset);
+    // Readers only trust the segment once the magic is there
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(this->header->magic, live_magic, sizeof(live_magic));
+}
+
+LiveExport::~LiveExport() {
+    munmap(this->header, this->size);
+    shm_unlink(this->name.c_str());
+}
+
+void LiveExport::publish(Sim& sim) {
+    TraceScope trace(sim.tracer, "publish");
+    Board* board = sim.board;
+    if (board->getWidth() != this->header->width ||
+        board->getHeight() != this->header->height) {
+        throw std::runtime_error(
+            "The board does not match the shared memory segment.");
+    }
+    uint64_t sequence = this->header->sequence.load(std::memory_order_relaxed);
+    this->header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    const float* density = board->getDensities();
+    uint width = board->getWidth();
+    for (uint row = 0; row < board->getHeight(); row++) {
+        const float* first = density + board->indexOf(row, 0);
+        std::copy(first, first + width, this->densities + (size_t)row * width);
+    }
+    this->header->tick = sim.getTicks();
+    this->header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+LiveView::LiveView(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the shared memory segment.");
+    }
+    struct stat status;
+    void* segment = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(LiveHeader))
+        segment = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        throw std::runtime_error(
+            "An I/O error occurred while mapping the shared memory segment.");
+    }
+    this->size = status.st_size;
+    this->header = (const LiveHeader*)segment;
+    uint32_t offset;
+    if (std::memcmp(this->header->magic, live_magic, sizeof(live_magic)) ||
+        this->header->version != live_version ||
+        segmentSize(this->header->width, this->header->height, &offset) >
+            this->size ||
+        this->header->densities_offset != offset) {
+        munmap(segment, this->size);
+        throw std::runtime_error("The segment is not a live export.");
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    this->densities = (const float*)((const char*)segment + offset);
+}
+
+LiveView::~LiveView() { munmap((void*)this->header, this->size); }
+
+bool LiveView::read(std::vector<float>* densities, uint64_t* tick) {
+    size_t cells = (size_t)this->header->width * this->header->height;
+    densities->resize(cells);
+    while (true) {
+        uint64_t before =
+            this->header->sequence.load(std::memory_order_acquire);
+        if (before == this->last) return false;
+        // The writer is halfway through, it will be done shortly
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::copy(this->densities, this->densities + cells,
+                  densities->begin());
+        uint64_t published = this->header->tick;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->header->sequence.load(std::memory_order_relaxed) != before)
+            continue;
+        this->last = before;
+        if (tick != nullptr) *tick = published;
+        return true;
+    }
+}
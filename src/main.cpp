@@ -20,74 +20,327 @@
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include <getopt.h>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "backends/imgui_impl_opengl3.h"
 #include "backends/imgui_impl_sdl2.h"
 #include "imgui.h"
 
 // Project Includes
+#include "board_file.hpp"
+#include "checkpoint.hpp"
+#include "counters.hpp"
+#include "difference.hpp"
+#include "footprint.hpp"
+#include "gpu_backend.hpp"
+#ifdef SMOKEY_RECORDING
+#include "recording.hpp"
+#endif
 #include "sim.hpp"
+#include "sim_loader.hpp"
+#include "sim_thread.hpp"
+#include "texture.hpp"
+#include "timing.hpp"
 
-struct Layout {
-    uint rows, cols;
-    char* data;
-    Layout(const std::string& path) {
-        std::ifstream ifs;
-        ifs.open(path, std::ifstream::in);
-        if (!ifs.is_open()) {
-            throw std::runtime_error(
-                "An I/O error occurred while opening the file for reading.");
-        }
-        std::string tmp, line;
-        uint rows = 0, cols = 0, cols_prev = 0;
-        while (std::getline(ifs, line)) {
-            rows++;
-            cols = 0;
-            for (auto c : line) {
-                if (c < '/' || c > ':') {
-                    ifs.close();
-                    std::stringstream ss;
-                    ss << "Invalid character \'" << c << "\' (" << (int)c
-                       << ") detected at " << rows << ", " << cols << ".";
-                    throw std::runtime_error(ss.str().c_str());
+constexpr ImVec4 __ui_clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+constexpr float __ui_board_zoom_default = 10.f;
+// Frames the timings of the Debug Information are rolled over
+constexpr size_t __ui_timing_window = 240;
+// Ticks the outflow plot is rolled over
+constexpr size_t __ui_outflow_window = 1000;
+// Fastest playback of a recording, in frames per second either way
+constexpr float __ui_playback_speed_max = 240.f;
+
+/* Phases of a frame that are timed separately. Colour-mapping on the GPU
+ * counts as building the pixmap. */
+enum UiPhase { Cycle, Pixmap, Upload, Render, Frame, PhaseCount };
+static const char* const __ui_phase_names[] = {
+    "Simulation", "Colour Map", "Upload", "ImGui Render", "Frame"};
+
+/* A run given on the command line, which the window starts straight into,
+ * or which is run without one. */
+struct LaunchEmitter {
+    uint row, col;
+    float rate;
+};
+struct LaunchOptions {
+    std::string layout_path = "../layouts/default.txt";
+    std::string resume_path;
+    std::vector<LaunchEmitter> emitters;
+    float emitter_rate = 1.f;
+    float escape_rate = 1.f;
+    bool use_precalc_weights = false;
+    Sim::Update update_mode = Sim::Update::InPlace;
+    uint threads = 1;
+    // 0 runs until stopped in the window, and for the default without one
+    unsigned long ticks = 0;
+    std::string density_path;
+    bool gui = true;
+    // Options that were given, by their short name
+    std::string given;
+    bool isGiven(char c) const {
+        return this->given.find(c) != std::string::npos;
+    }
+};
+// Long options without a short name
+enum { NoGuiOption = 256 };
+constexpr unsigned long __launch_ticks_default = 100;
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Options start the window straight into a run, or run without it:\n"
+            "  -l, --layout PATH      Layout file (default: "
+            "../layouts/default.txt)\n"
+            "  -e, --emitter ROW,COL[,RATE]\n"
+            "                         Place an emitter, optionally scaling\n"
+            "                         the emission rate for it; may be\n"
+            "                         repeated (default: 0,0 for text\n"
+            "                         layouts, none for binary layouts\n"
+            "                         and images)\n"
+            "  -i, --resume PATH      Start from a checkpoint instead of a\n"
+            "                         layout\n"
+            "  -r, --emitter-rate R   Global emission rate (default: 1)\n"
+            "  -x, --escape-rate R    Global escape rate (default: 1)\n"
+            "  -w, --precalc-weights  Use precalculated weights\n"
+            "  -u, --update MODE      inplace (also called gauss-seidel),\n"
+            "                         synchronous or redblack (default:\n"
+            "                         inplace)\n"
+            "  -j, --threads N        Threads for synchronous and red-black\n"
+            "                         ticks (default: 1)\n"
+            "  -n, --ticks N          Ticks to run before stopping (default:\n"
+            "                         until stopped, or %lu with --no-gui)\n"
+            "  -o, --output PATH      Write the densities as CSV once the\n"
+            "                         ticks are run\n"
+            "      --no-gui           Run without opening a window and print\n"
+            "                         the speed of the run\n"
+            "  -h, --help             Show this help\n",
+            argv0, __launch_ticks_default);
+}
+
+static LaunchOptions parseLaunchOptions(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"layout", required_argument, nullptr, 'l'},
+        {"emitter", required_argument, nullptr, 'e'},
+        {"resume", required_argument, nullptr, 'i'},
+        {"emitter-rate", required_argument, nullptr, 'r'},
+        {"escape-rate", required_argument, nullptr, 'x'},
+        {"precalc-weights", no_argument, nullptr, 'w'},
+        {"update", required_argument, nullptr, 'u'},
+        {"threads", required_argument, nullptr, 'j'},
+        {"ticks", required_argument, nullptr, 'n'},
+        {"output", required_argument, nullptr, 'o'},
+        {"no-gui", no_argument, nullptr, NoGuiOption},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    LaunchOptions opts;
+    int c;
+    while ((c = getopt_long(argc, argv, "l:e:i:r:x:wu:j:n:o:h", long_options,
+                            nullptr)) != -1) {
+        if (c < NoGuiOption) opts.given += (char)c;
+        switch (c) {
+            case 'l':
+                opts.layout_path = optarg;
+                break;
+            case 'e': {
+                LaunchEmitter emitter = {0, 0, 1.f};
+                if (sscanf(optarg, "%u,%u,%f", &emitter.row, &emitter.col,
+                           &emitter.rate) < 2) {
+                    throw std::runtime_error(
+                        "Emitters must be given as ROW,COL[,RATE].");
                 }
-                cols++;
-                tmp.push_back(c);
+                opts.emitters.push_back(emitter);
+                break;
             }
-            if (cols != cols_prev && rows > 1) {
-                ifs.close();
-                throw std::runtime_error(
-                    "Each row must have the same number of columns.");
-            }
-            cols_prev = cols;
+            case 'i':
+                opts.resume_path = optarg;
+                break;
+            case 'r':
+                opts.emitter_rate = std::stof(optarg);
+                break;
+            case 'x':
+                opts.escape_rate = std::stof(optarg);
+                break;
+            case 'w':
+                opts.use_precalc_weights = true;
+                break;
+            case 'u':
+                if (strcmp(optarg, "inplace") == 0 ||
+                    strcmp(optarg, "gauss-seidel") == 0) {
+                    opts.update_mode = Sim::Update::InPlace;
+                } else if (strcmp(optarg, "synchronous") == 0) {
+                    opts.update_mode = Sim::Update::Synchronous;
+                } else if (strcmp(optarg, "redblack") == 0) {
+                    opts.update_mode = Sim::Update::RedBlack;
+                } else {
+                    throw std::runtime_error(
+                        "The update mode must be inplace (gauss-seidel), "
+                        "synchronous or redblack.");
+                }
+                break;
+            case 'j':
+                opts.threads = std::stoul(optarg);
+                if (opts.threads == 0) {
+                    throw std::runtime_error(
+                        "At least one thread is needed.");
+                }
+                break;
+            case 'n':
+                opts.ticks = std::stoul(optarg);
+                break;
+            case 'o':
+                opts.density_path = optarg;
+                break;
+            case NoGuiOption:
+                opts.gui = false;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
         }
-        ifs.close();
-        if (rows <= 0 || cols <= 0) {
-            throw std::runtime_error("The layout must not be empty.");
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (opts.isGiven('l') && opts.isGiven('i')) {
+        throw std::runtime_error(
+            "A run starts from either a layout or a checkpoint.");
+    }
+    return opts;
+}
+
+/**
+ * @brief Start loading the simulation of a run given on the command line,
+ * the first emitter being placed by the loader on text layouts.
+ */
+static SimLoader* launchLoader(const LaunchOptions& opts) {
+    auto loader = new SimLoader();
+    if (!opts.resume_path.empty()) {
+        loader->loadCheckpoint(opts.resume_path);
+    } else if (opts.emitters.empty()) {
+        loader->loadLayout(opts.layout_path, 0, 0);
+    } else {
+        loader->loadLayout(opts.layout_path, opts.emitters[0].row,
+                           opts.emitters[0].col);
+    }
+    return loader;
+}
+
+/**
+ * @brief Apply the emitters and settings of a run given on the command line
+ * to its loaded simulation.
+ *
+ * The settings saved with a checkpoint are only changed when given.
+ */
+static void launchSetUp(Sim& sim, const LaunchOptions& opts) {
+    bool resumed = !opts.resume_path.empty();
+    Board* board = sim.board;
+    for (auto& emitter : opts.emitters) {
+        // The loader placed the first one already
+        if (board->contains(emitter.row, emitter.col) &&
+            board->getTypes()[board->indexOf(emitter.row, emitter.col)] ==
+                Cell::Type::Emitter) {
+            board->setEmitterRate(emitter.row, emitter.col, emitter.rate);
+        } else {
+            board->placeEmitter(emitter.row, emitter.col, emitter.rate);
+            board->computeWeightsAround(emitter.row, emitter.col);
         }
-        if (rows > 512 || cols > 512) {
-            throw std::runtime_error(
-                "The layout must not exceed a size of 512x512 cells.");
+    }
+    sim.touchBoard();
+    if (!resumed || opts.isGiven('r')) sim.emitter_rate = opts.emitter_rate;
+    if (!resumed || opts.isGiven('x')) sim.escape_rate = opts.escape_rate;
+    if (!resumed || opts.isGiven('w'))
+        sim.use_precalc_weights = opts.use_precalc_weights;
+    if (!resumed || opts.isGiven('u')) sim.update_mode = opts.update_mode;
+    sim.threads = opts.threads;
+}
+
+static void writeDensity(Sim& sim, const std::string& path) {
+    uint rows = sim.board->getHeight(), cols = sim.board->getWidth();
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    for (uint row = 0; row < rows; row++) {
+        for (uint col = 0; col < cols; col++) {
+            fprintf(fp, col == 0 ? "%.9g" : ",%.9g", sim.getDensity(row, col));
         }
-        this->rows = rows;
-        this->cols = cols;
-        this->data = (char*)malloc(rows * cols);
-        std::memcpy(this->data, tmp.c_str(), rows * cols);
+        fputc('\n', fp);
     }
-    ~Layout() { free(this->data); }
-};
+    fclose(fp);
+}
 
-constexpr ImVec4 __ui_clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-constexpr int __ui_board_zoom_default = 10;
+/**
+ * @brief Run the ticks of a run given on the command line without opening a
+ * window, for benchmarks and scripts.
+ */
+static int runWithoutGui(const LaunchOptions& opts) {
+    Sim* sim;
+    {
+        // Deleting the loader waits for it to finish
+        SimLoader* loader = launchLoader(opts);
+        while (!loader->isDone())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        try {
+            sim = loader->take();
+        } catch (...) {
+            delete loader;
+            throw;
+        }
+        delete loader;
+    }
+    try {
+        launchSetUp(*sim, opts);
+        unsigned long target =
+            opts.ticks > 0 ? opts.ticks : __launch_ticks_default;
+        unsigned long ticks = 0;
+        auto begin = std::chrono::steady_clock::now();
+        while (ticks < target && !sim->hasConverged())
+            ticks += sim->advance(target - ticks);
+        double elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - begin)
+                             .count();
+        double cells =
+            (double)sim->board->getWidth() * sim->board->getHeight();
+        printf("%lu ticks of %ux%u cells in %.3f s (%.1f ticks/s, %.3g "
+               "cells/s)\n",
+               ticks, sim->board->getWidth(), sim->board->getHeight(),
+               elapsed, ticks / elapsed, cells * ticks / elapsed);
+        if (!opts.density_path.empty()) writeDensity(*sim, opts.density_path);
+    } catch (...) {
+        delete sim;
+        throw;
+    }
+    delete sim;
+    return EXIT_SUCCESS;
+}
 
-int main(void) {
-    GLuint board_texture_id = 0;
+int main(int argc, char** argv) {
+    LaunchOptions launch;
+    try {
+        launch = parseLaunchOptions(argc, argv);
+        if (!launch.gui) return runWithoutGui(launch);
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
     SDL_GLContext main_gl_context;
     SDL_Window* main_window;
     SDL_WindowFlags main_window_flags;
@@ -95,9 +348,22 @@ int main(void) {
     bool ui_done = false;
     int ui_emitter_pos[2] = {0, 0};
     char ui_layout_path[512] = "../layouts/default.txt";
+    char ui_checkpoint_path[512] = "checkpoint.smkc";
     std::string ui_status_msg = "Ready.";
-    int ui_board_zoom = __ui_board_zoom_default;
+    float ui_board_zoom = __ui_board_zoom_default;
     int ui_breakpoint = 0;
+    int ui_ticks_per_frame = 1;
+    float ui_frame_budget = 0.f;
+    snprintf(ui_layout_path, sizeof(ui_layout_path), "%s",
+             launch.layout_path.c_str());
+    if (!launch.emitters.empty()) {
+        ui_emitter_pos[0] = launch.emitters[0].row;
+        ui_emitter_pos[1] = launch.emitters[0].col;
+    }
+    if (!launch.resume_path.empty()) {
+        snprintf(ui_checkpoint_path, sizeof(ui_checkpoint_path), "%s",
+                 launch.resume_path.c_str());
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) !=
         0) {
@@ -124,8 +390,135 @@ int main(void) {
     ImGui::CreateContext();
     ImGui_ImplSDL2_InitForOpenGL(main_window, main_gl_context);
     ImGui_ImplOpenGL3_Init();
+    // Must outlive the main loop but not the GL context
+    auto board_texture = new BoardTexture();
+    GpuBackend* gpu_backend = nullptr;
+    SimThread* sim_thread = nullptr;
+    SimLoader* sim_loader = nullptr;
+    bool ui_loading_checkpoint = false;
+    bool ui_thread_running = false;
+    double ui_target_rate = 0.;
+    // Latest tick taken from the simulation thread, owned by the thread
+    const Snapshot* ui_snapshot = nullptr;
+    // Overlays the arrival map of the simulation, once it has one
+    bool ui_show_arrivals = false;
+    // Overlays the doses instead, scaled to the fractional effective dose
+    bool ui_show_doses = false;
+    /* The frame of a recording shown over the board instead of its
+     * densities, padded like them, and empty when not playing one back. */
+    std::vector<float> ui_playback_densities;
+#ifdef SMOKEY_RECORDING
+    Playback* playback = nullptr;
+    char ui_recording_path[512] = "recording.smkr";
+    bool ui_playback_playing = false;
+    // Frames per second, backward if negative
+    float ui_playback_speed = 30.f;
+    // In frames, the one shown being the whole part
+    double ui_playback_position = 0.;
+    long ui_playback_shown = -1;
+#endif
+    /* A run the densities are compared with, shown as their difference:
+     * another simulation, which follows the ticks of this one, or the
+     * frames of a recording over a copy of the board. */
+    Sim* reference = nullptr;
+    char ui_reference_path[512] = "reference.smkc";
+    bool ui_show_difference = true;
+    bool ui_reference_follow = true;
+    DensityDifference ui_difference;
+#ifdef SMOKEY_RECORDING
+    Playback* reference_playback = nullptr;
+    long ui_reference_frame = -1;
+#endif
+    auto closeReference = [&]() {
+#ifdef SMOKEY_RECORDING
+        delete reference_playback;
+        reference_playback = nullptr;
+#endif
+        delete reference;
+        reference = nullptr;
+        board_texture->setReference(nullptr);
+    };
+    /* What the brush paints on the board, 0 being off and the rest a
+     * BrushDab::Paint after it, and the dabs painted since the last frame,
+     * applied together between two ticks. */
+    int ui_brush = 0;
+    int ui_brush_radius = 2;
+    float ui_brush_value = 1.f;
+    std::vector<BrushDab> ui_brush_dabs;
+    // The last cell dabbed by the stroke being painted
+    bool ui_brush_stroke = false;
+    int ui_brush_row = 0, ui_brush_col = 0;
+    std::vector<RollingStats> ui_phase_stats(UiPhase::PhaseCount,
+                                             RollingStats(__ui_timing_window));
+    RollingStats ui_tick_stats(__ui_timing_window);
+    // Sampled once per new tick count, when the simulation measures it
+    RollingStats ui_outflow_stats(__ui_outflow_window);
+    unsigned int ui_outflow_ticks = 0;
+    // Likewise, the occupied cells of the density histogram
+    RollingStats ui_occupied_stats(__ui_outflow_window);
+    unsigned int ui_occupied_ticks = 0;
+    int ui_histogram_bins = 32;
+    // The bins on a log scale, so the empty cells do not flatten the rest
+    std::vector<float> ui_histogram_plot;
+    unsigned int ui_last_ticks = 0;
+    double ui_cells = 0.;
+    // Shared by every simulation, and only recording while asked to
+    Tracer ui_tracer;
+    ui_tracer.enabled = false;
+    char ui_trace_path[512] = "trace.json";
+    /* Opened before any simulation starts a thread, so that its threads are
+     * counted too, and only counting the ticks while asked to. */
+    PerfCounters* ui_counters = nullptr;
+    std::string ui_counters_error;
+    try {
+        ui_counters = new PerfCounters();
+    } catch (std::runtime_error& e) {
+        ui_counters_error = e.what();
+    }
+    bool ui_count_events = false;
+    uint64_t ui_counts[PerfCounters::EventCount] = {};
+    RollingStats ui_ipc_stats(__ui_timing_window);
+    RollingStats ui_cache_miss_stats(__ui_timing_window);
+    RollingStats ui_branch_miss_stats(__ui_timing_window);
+    // Bytes of the simulation, taken while holding its lock
+    Footprint ui_footprint;
+    // A run given on the command line is loaded and started right away
+    bool ui_launching = !launch.given.empty();
+    if (ui_launching) {
+        sim_loader = launchLoader(launch);
+        ui_loading_checkpoint = !launch.resume_path.empty();
+        ui_status_msg = "Loading...";
+    }
+    // Written once the ticks of a run given on the command line are run
+    auto finishLaunch = [&]() {
+        if (launch.density_path.empty()) return;
+        try {
+            writeDensity(*simulation, launch.density_path);
+            ui_status_msg +=
+                " Densities written to " + launch.density_path + ".";
+        } catch (std::runtime_error& e) {
+            ui_status_msg = e.what();
+        }
+        launch.density_path.clear();
+    };
 
     while (!ui_done) {
+        double ui_phase_time[UiPhase::PhaseCount] = {};
+        unsigned int ui_frame_ticks = 0;
+        auto redraw = [&]() {
+            if (!ui_playback_densities.empty()) {
+                board_texture->update(*simulation,
+                                      ui_playback_densities.data());
+            } else if (gpu_backend != nullptr) {
+                ScopedTimer timer(&ui_phase_time[UiPhase::Pixmap]);
+                gpu_backend->render(*simulation, board_texture->palette);
+            } else {
+                board_texture->update(
+                    *simulation, nullptr,
+                    ui_show_arrivals ? simulation->getArrivals() : nullptr,
+                    ui_show_doses ? simulation->getDoses() : nullptr);
+            }
+        };
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
@@ -142,7 +535,7 @@ int main(void) {
         ImGui::NewFrame();
 
         {
-            ImGui::SetNextWindowSize(ImVec2(430, 240));
+            ImGui::SetNextWindowSize(ImVec2(430, 290));
             ImGui::Begin(
                 "Set-up Window", nullptr,
                 ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse);
@@ -150,22 +543,83 @@ int main(void) {
             ImGui::InputText("Layout File Path", ui_layout_path,
                              IM_ARRAYSIZE(ui_layout_path));
             ImGui::InputInt2("Emitter Coordinates", &ui_emitter_pos[0]);
+            ImGui::InputText("Checkpoint File Path", ui_checkpoint_path,
+                             IM_ARRAYSIZE(ui_checkpoint_path));
 
-            if (ImGui::Button("New Simulation")) {
-                delete simulation;
+            // Only one simulation is loaded at a time
+            ImGui::BeginDisabled(sim_loader != nullptr);
+            bool ui_new = ImGui::Button("New Simulation");
+            ImGui::SameLine();
+            bool ui_resume = ImGui::Button("Load Checkpoint");
+            ImGui::EndDisabled();
+            if (ui_new || ui_resume) {
+                /* The simulation is built on another thread and the current
+                 * one keeps running until it is swapped in. */
+                sim_loader = new SimLoader();
+                ui_loading_checkpoint = ui_resume;
+                if (ui_resume) {
+                    sim_loader->loadCheckpoint(ui_checkpoint_path);
+                } else {
+                    sim_loader->loadLayout(ui_layout_path, ui_emitter_pos[0],
+                                           ui_emitter_pos[1]);
+                }
+                ui_status_msg = "Loading...";
+            }
+            if (sim_loader != nullptr && sim_loader->isDone()) {
+                Sim* loaded = nullptr;
                 try {
-                    auto layout = new Layout(ui_layout_path);
-                    simulation =
-                        new Sim(layout->cols, layout->rows, layout->data,
-                                ui_emitter_pos[0], ui_emitter_pos[1]);
-                    delete layout;
+                    loaded = sim_loader->take();
+                } catch (std::runtime_error& e) {
+                    ui_status_msg = e.what();
+                }
+                delete sim_loader;
+                sim_loader = nullptr;
+                if (loaded != nullptr) {
+#ifdef SMOKEY_RECORDING
+                    // Recordings are played back over the board they match
+                    delete playback;
+                    playback = nullptr;
+                    ui_playback_densities.clear();
+#endif
+                    // And so are references
+                    closeReference();
+                    delete sim_thread;
+                    sim_thread = nullptr;
+                    ui_snapshot = nullptr;
+                    ui_thread_running = false;
+                    delete gpu_backend;
+                    gpu_backend = nullptr;
+                    delete simulation;
+                    simulation = loaded;
+                    simulation->tracer = &ui_tracer;
                     // Draw first frame regardless of simulation status
-                    simulation->board->toTexture(&board_texture_id);
+                    board_texture->update(*simulation);
                     ui_status_msg = "Simulation initialized.";
-                } catch (std::runtime_error e) {
-                    ui_status_msg = e.what();
-                    simulation = nullptr;
+                    if (ui_loading_checkpoint) {
+                        ui_status_msg =
+                            "Checkpoint loaded at tick " +
+                            std::to_string(simulation->getTicks()) + ".";
+                    }
+                    if (ui_launching) {
+                        try {
+                            launchSetUp(*simulation, launch);
+                            ui_breakpoint = (int)launch.ticks;
+                            simulation->start();
+                            ui_status_msg = "Simulation running.";
+                        } catch (std::runtime_error& e) {
+                            ui_status_msg = e.what();
+                        }
+                    }
                 }
+                ui_launching = false;
+            }
+            if (sim_loader != nullptr) {
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%s (%.0f%%)",
+                         sim_loader->getStage(),
+                         100.f * sim_loader->getProgress());
+                ImGui::ProgressBar(sim_loader->getProgress(),
+                                   ImVec2(-FLT_MIN, 0), overlay);
             }
 
             ImGui::Separator();
@@ -176,68 +630,887 @@ int main(void) {
                              ImGuiWindowFlags_NoCollapse |
                                  ImGuiWindowFlags_NoSavedSettings |
                                  ImGuiWindowFlags_HorizontalScrollbar);
+                /* With the simulation thread, the simulation can only be
+                 * touched while holding its lock: hold it until we have a
+                 * snapshot of the latest tick. */
+                std::unique_lock<std::mutex> sim_lock;
+                if (sim_thread != nullptr) {
+                    sim_lock = sim_thread->acquire();
+                    if (ui_thread_running && !sim_thread->isRunning()) {
+                        ui_thread_running = false;
+                        if (simulation->hasConverged()) {
+                            ui_status_msg = "Steady state reached.";
+                            finishLaunch();
+                        } else {
+                            ui_breakpoint = 0;
+                            ui_status_msg = "Breakpoint reached.";
+                            finishLaunch();
+                        }
+                    }
+                }
+                bool running = sim_thread != nullptr ? ui_thread_running
+                                                     : simulation->isRunning();
+                simulation->counters = ui_count_events ? ui_counters : nullptr;
+                bool brushing = ui_brush != 0 && gpu_backend == nullptr &&
+                                ui_playback_densities.empty();
+                if (!ui_brush_dabs.empty()) {
+                    // Only the cells painted and their neighbours are redone
+                    try {
+                        simulation->paint(ui_brush_dabs);
+                    } catch (std::runtime_error& e) {
+                        ui_status_msg = e.what();
+                    }
+                    ui_brush_dabs.clear();
+                    if (!running) redraw();
+                }
                 // Simulation Controls
-                if (simulation->isRunning()) {
+                if (running) {
                     if (ImGui::Button("Stop")) {
                         ui_status_msg = "Simulation stopped.";
-                        simulation->stop();
+                        if (sim_thread != nullptr) {
+                            sim_lock.unlock();
+                            sim_thread->stop();
+                            sim_lock.lock();
+                            ui_thread_running = false;
+                        } else {
+                            simulation->stop();
+                        }
                     }
                 } else {
+                    // A recording is played back instead
+                    ImGui::BeginDisabled(!ui_playback_densities.empty());
                     if (ImGui::Button("Start")) {
                         ui_status_msg = "Simulation running.";
-                        simulation->start();
+                        if (sim_thread != nullptr) {
+                            sim_thread->start(ui_breakpoint);
+                            ui_thread_running = true;
+                        } else {
+                            simulation->start();
+                        }
                     }
                     ImGui::SameLine();
                     if (ImGui::Button("Step")) {
-                        simulation->step();
+                        {
+                                    simulation->step();
+                        }
+                        redraw();
                     }
+                    ImGui::EndDisabled();
                 }
                 ImGui::SameLine();
                 ImGui::SliderInt("Tick Rate", &simulation->tick_rate, 1, 50);
+                ImGui::SliderInt("Ticks per Frame", &ui_ticks_per_frame, 1,
+                                 1000);
+                ImGui::InputFloat("Frame Budget (ms)", &ui_frame_budget, 1.f,
+                                  5.f, "%.1f");
+                ui_frame_budget = std::max(ui_frame_budget, 0.f);
+                ImGui::SameLine();
+                ImGui::TextDisabled("(0 = use ticks per frame)");
                 if (ImGui::CollapsingHeader("Advanced")) {
                     ImGui::InputInt("Breakpoint", &ui_breakpoint);
-                    ImGui::SliderFloat("Emission Rate",
-                                       &simulation->emitter_rate, .0f, 1.0f);
-                    ImGui::SliderFloat("Escape Rate", &simulation->escape_rate,
-                                       .0f, 1.0f);
+                    // Emitters and escapes are coloured by their rates
+                    bool recolour = ImGui::SliderFloat(
+                        "Emission Rate", &simulation->emitter_rate, .0f, 1.0f);
+                    recolour |= ImGui::SliderFloat(
+                        "Escape Rate", &simulation->escape_rate, .0f, 1.0f);
+                    if (recolour) redraw();
                     ImGui::Checkbox("Use Precalculated Weights",
                                     &simulation->use_precalc_weights);
+                    // Floor heights are only modelled on the CPU
+                    ImGui::BeginDisabled(gpu_backend != nullptr);
+                    ImGui::SliderFloat("Elevation Bias",
+                                       &simulation->elevation_bias, -1.f, 1.f);
+                    ImGui::EndDisabled();
+                    // The GPU backend needs the GL context of this thread
+                    ImGui::BeginDisabled(sim_thread != nullptr || running ||
+                                         simulation->elevation_bias != 0.f ||
+                                         !ui_playback_densities.empty() ||
+                                         reference != nullptr);
+                    bool use_gpu = gpu_backend != nullptr;
+                    if (ImGui::Checkbox("GPU Backend", &use_gpu)) {
+                        try {
+                            if (use_gpu) {
+                                gpu_backend = new GpuBackend(*simulation);
+                                simulation->setBackend(gpu_backend);
+                                gpu_backend->render(*simulation,
+                                                    board_texture->palette);
+                            } else {
+                                simulation->setBackend(nullptr);
+                                delete gpu_backend;
+                                gpu_backend = nullptr;
+                                board_texture->update(*simulation);
+                            }
+                        } catch (std::runtime_error& e) {
+                            ui_status_msg = e.what();
+                        }
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::BeginDisabled(gpu_backend != nullptr || running ||
+                                         !ui_playback_densities.empty());
+                    bool use_thread = sim_thread != nullptr;
+                    if (ImGui::Checkbox("Simulation Thread", &use_thread)) {
+                        if (use_thread) {
+                            sim_thread = new SimThread(simulation);
+                            sim_thread->target_rate = ui_target_rate;
+                            sim_lock = sim_thread->acquire();
+                        } else {
+                            sim_lock = std::unique_lock<std::mutex>();
+                            delete sim_thread;
+                            sim_thread = nullptr;
+                            ui_snapshot = nullptr;
+                        }
+                    }
+                    ImGui::EndDisabled();
+                    if (sim_thread != nullptr) {
+                        if (ImGui::InputDouble("Target Ticks/s",
+                                               &ui_target_rate, 100., 1000.,
+                                               "%.0f")) {
+                            ui_target_rate = std::max(ui_target_rate, 0.);
+                            sim_thread->target_rate = ui_target_rate;
+                        }
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("(0 = uncapped)");
+                    }
+                    ImGui::Combo("Update Mode",
+                                 (int*)&simulation->update_mode,
+                                 "In-place (Gauss-Seidel)\0Synchronous\0"
+                                 "Red-black\0");
+                    // The Moore stencil falls back where it cannot run
+                    bool moore_runs =
+                        simulation->update_mode ==
+                            Sim::Update::Synchronous &&
+                        gpu_backend == nullptr &&
+                        !simulation->use_precalc_weights &&
+                        simulation->elevation_bias == 0.f &&
+                        !simulation->track_outflow &&
+                        simulation->board->getWinds().empty();
+                    if (!moore_runs)
+                        simulation->stencil = Sim::Stencil::VonNeumann;
+                    if (simulation->update_mode != Sim::Update::InPlace) {
+                        int threads = simulation->threads;
+                        ImGui::SliderInt(
+                            "Threads", &threads, 1,
+                            std::max(1u, std::thread::hardware_concurrency()));
+                        simulation->threads = threads;
+                        ImGui::Checkbox("Pin Threads",
+                                        &simulation->pin_threads);
+                    }
+                    if (simulation->update_mode == Sim::Update::Synchronous) {
+                        bool use_simd =
+                            simulation->kernel == Sim::Kernel::Simd;
+                        ImGui::Checkbox("Vectorised Kernel", &use_simd);
+                        simulation->kernel = use_simd ? Sim::Kernel::Simd
+                                                      : Sim::Kernel::Scalar;
+                        ImGui::BeginDisabled(!moore_runs);
+                        bool moore =
+                            simulation->stencil == Sim::Stencil::Moore;
+                        ImGui::Checkbox("Moore Stencil", &moore);
+                        simulation->stencil = moore
+                                                  ? Sim::Stencil::Moore
+                                                  : Sim::Stencil::VonNeumann;
+                        ImGui::EndDisabled();
+                    }
+                    ImGui::Checkbox("Skip Untouched Tiles",
+                                    &simulation->track_activity);
+                    ImGui::InputFloat("Steady-State Tolerance",
+                                      &simulation->tolerance, 0.f, 0.f, "%g");
+                    simulation->tolerance =
+                        std::max(simulation->tolerance, 0.f);
+                    ImGui::InputFloat("Arrival Threshold",
+                                      &simulation->arrival_threshold, 0.f, 0.f,
+                                      "%g");
+                    simulation->arrival_threshold =
+                        std::min(std::max(simulation->arrival_threshold, 0.f),
+                                 1.f);
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("(0 = off)");
+                    // Arrivals are only mapped on the CPU
+                    ImGui::BeginDisabled(gpu_backend != nullptr);
+                    if (ImGui::Checkbox("Show Arrival Times",
+                                        &ui_show_arrivals)) {
+                        if (ui_show_arrivals) ui_show_doses = false;
+                        redraw();
+                    }
+                    ImGui::EndDisabled();
+                    // Doses are also only added up on the CPU
+                    ImGui::BeginDisabled(gpu_backend != nullptr);
+                    ImGui::Checkbox("Track Dose", &simulation->track_dose);
+                    ImGui::SameLine();
+                    if (ImGui::Button("Reset Dose")) {
+                        simulation->resetDoses();
+                        redraw();
+                    }
+                    if (ImGui::Checkbox("Show Dose", &ui_show_doses)) {
+                        if (ui_show_doses) ui_show_arrivals = false;
+                        redraw();
+                    }
+                    ImGui::EndDisabled();
+                    if (ImGui::InputFloat("Dose Limit",
+                                          &board_texture->dose_limit, 0.f,
+                                          0.f, "%g")) {
+                        board_texture->dose_limit =
+                            std::max(board_texture->dose_limit, 1.f);
+                        redraw();
+                    }
+                    if (ImGui::Combo("Palette", (int*)&board_texture->palette,
+                                     palette_names, Palette::PaletteCount))
+                        redraw();
+                    ImGui::BeginDisabled(gpu_backend != nullptr || running ||
+                                         !ui_playback_densities.empty());
+                    if (ImGui::Button("Solve Steady State")) {
+                        // Blocks the UI until the solver converges
+                        float tolerance = simulation->tolerance > 0.f
+                                              ? simulation->tolerance
+                                              : 1e-6f;
+                        unsigned long sweeps =
+                            simulation->solve(tolerance, 1000000);
+                        ui_status_msg =
+                            (simulation->hasConverged()
+                                 ? "Steady state solved in "
+                                 : "Solver gave up after ") +
+                            std::to_string(sweeps) + " sweeps.";
+                        board_texture->update(*simulation);
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::SameLine();
+                    if (ImGui::Button("Save Checkpoint")) {
+                        try {
+                            writeCheckpoint(*simulation, ui_checkpoint_path);
+                            ui_status_msg =
+                                "Checkpoint saved at tick " +
+                                std::to_string(simulation->getTicks()) + ".";
+                        } catch (std::runtime_error& e) {
+                            ui_status_msg = e.what();
+                        }
+                    }
                 }
-                ImGui::Separator();
-                // Simulation Cycle
-                try {
-                    simulation->cycle();
-                } catch (std::runtime_error e) {
-                    simulation->stop();
-                    ui_status_msg = e.what();
+                if (simulation->track_outflow &&
+                    simulation->getTicks() != ui_outflow_ticks) {
+                    // A new simulation starts the plot over
+                    if (simulation->getTicks() < ui_outflow_ticks)
+                        ui_outflow_stats.clear();
+                    ui_outflow_ticks = simulation->getTicks();
+                    ui_outflow_stats.add(simulation->getOutflow());
                 }
-
-                if (simulation->isRunning()) {
-                    // Update Display
-                    simulation->board->toTexture(&board_texture_id);
-                    // Check if we've reached a breakpoint
-                    if (ui_breakpoint > 0) {
-                        ui_breakpoint--;
-                        if (ui_breakpoint == 0) {
-                            ui_status_msg = "Breakpoint reached.";
+                ui_footprint = Footprint();
+                simulation->addFootprint(&ui_footprint);
+                const DensityHistogram& histogram = simulation->getHistogram();
+                if (!histogram.bins.empty() &&
+                    simulation->getTicks() != ui_occupied_ticks) {
+                    if (simulation->getTicks() < ui_occupied_ticks)
+                        ui_occupied_stats.clear();
+                    ui_occupied_ticks = simulation->getTicks();
+                    ui_occupied_stats.add(histogram.occupied);
+                }
+                if (ImGui::CollapsingHeader("Densities")) {
+                    // Measured as each tick writes the densities, on the CPU
+                    ImGui::BeginDisabled(gpu_backend != nullptr);
+                    bool measure_histogram = simulation->histogram_bins > 0;
+                    if (ImGui::Checkbox("Measure Histogram",
+                                        &measure_histogram))
+                        ui_occupied_stats.clear();
+                    if (ImGui::SliderInt("Bins", &ui_histogram_bins, 2, 128))
+                        ui_histogram_bins = std::max(ui_histogram_bins, 2);
+                    simulation->histogram_bins =
+                        measure_histogram ? ui_histogram_bins : 0;
+                    ImGui::SliderFloat("Occupied Density",
+                                       &simulation->occupied_density, 0.f,
+                                       1.f, "%.2g",
+                                       ImGuiSliderFlags_Logarithmic);
+                    ImGui::EndDisabled();
+                    if (!histogram.bins.empty()) {
+                        ui_histogram_plot.clear();
+                        for (size_t count : histogram.bins)
+                            ui_histogram_plot.push_back(std::log10(1. + count));
+                        ImGui::PlotHistogram(
+                            "Cells", ui_histogram_plot.data(),
+                            ui_histogram_plot.size(), 0, "log10(1 + cells)",
+                            0.f, FLT_MAX, ImVec2(0, 80));
+                        ImGui::Text("Mean: %.4g  Max: %.4g", histogram.mean,
+                                    histogram.max);
+                        char overlay[64];
+                        snprintf(overlay, sizeof(overlay), "%zu of %zu",
+                                 histogram.occupied, histogram.cells);
+                        ImGui::PlotLines("Occupied",
+                                         ui_occupied_stats.getSamples(),
+                                         ui_occupied_stats.getCount(),
+                                         ui_occupied_stats.getOffset(),
+                                         overlay, 0.f, FLT_MAX, ImVec2(0, 80));
+                    }
+                }
+                if (ImGui::CollapsingHeader("Outflow")) {
+                    // Outflow is only measured on the CPU, on four sides
+                    ImGui::BeginDisabled(gpu_backend != nullptr ||
+                                         simulation->stencil ==
+                                             Sim::Stencil::Moore);
+                    if (ImGui::Checkbox("Measure Outflow",
+                                        &simulation->track_outflow))
+                        ui_outflow_stats.clear();
+                    ImGui::EndDisabled();
+                    char overlay[64];
+                    snprintf(overlay, sizeof(overlay), "%.4g per tick",
+                             simulation->getOutflow());
+                    ImGui::PlotLines("Total", ui_outflow_stats.getSamples(),
+                                     ui_outflow_stats.getCount(),
+                                     ui_outflow_stats.getOffset(), overlay,
+                                     0.f, FLT_MAX, ImVec2(0, 80));
+                    const std::vector<size_t>& escapes =
+                        simulation->getEscapeCells();
+                    const std::vector<double>& outflows =
+                        simulation->getEscapeOutflows();
+                    if (!escapes.empty() &&
+                        ImGui::BeginTable("Escapes", 3,
+                                          ImGuiTableFlags_Borders |
+                                              ImGuiTableFlags_ScrollY,
+                                          ImVec2(0, 120))) {
+                        ImGui::TableSetupScrollFreeze(0, 1);
+                        ImGui::TableSetupColumn("Escape");
+                        ImGui::TableSetupColumn("Outflow");
+                        ImGui::TableSetupColumn("Share");
+                        ImGui::TableHeadersRow();
+                        double total = simulation->getOutflow();
+                        for (size_t escape = 0; escape < escapes.size();
+                             escape++) {
+                            double outflow = escape < outflows.size()
+                                                 ? outflows[escape]
+                                                 : 0.;
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn();
+                            ImGui::Text(
+                                "%u, %u",
+                                simulation->board->rowOf(escapes[escape]),
+                                simulation->board->colOf(escapes[escape]));
+                            ImGui::TableNextColumn();
+                            ImGui::Text("%.4g", outflow);
+                            ImGui::TableNextColumn();
+                            ImGui::ProgressBar(
+                                total > 0. ? (float)(outflow / total) : 0.f);
+                        }
+                        ImGui::EndTable();
+                    }
+                }
+                if (ImGui::CollapsingHeader("Brush")) {
+                    // Cells are only edited on the CPU, and over the board
+                    ImGui::BeginDisabled(gpu_backend != nullptr ||
+                                         !ui_playback_densities.empty());
+                    ImGui::Combo("Paint", &ui_brush,
+                                 "Off\0Wall\0Floor\0Emitter\0Escape\0"
+                                 "Smoke\0");
+                    ImGui::SliderInt("Radius", &ui_brush_radius, 0, 32);
+                    if (ui_brush == BrushDab::Smoke + 1) {
+                        ui_brush_value = std::min(ui_brush_value, 1.f);
+                        ImGui::SliderFloat("Density", &ui_brush_value, 0.f,
+                                           1.f);
+                    } else if (ui_brush == BrushDab::Emitter + 1 ||
+                               ui_brush == BrushDab::Escape + 1) {
+                        ImGui::SliderFloat("Rate", &ui_brush_value, 0.f, 4.f);
+                    }
+                    ImGui::EndDisabled();
+                    ImGui::TextDisabled("(drag over the board to paint)");
+                }
+#ifdef SMOKEY_RECORDING
+                /* Frames are decoded from the recording as they are shown,
+                 * the simulation being left as it is. */
+                auto closePlayback = [&]() {
+                    delete playback;
+                    playback = nullptr;
+                    ui_playback_densities.clear();
+                    redraw();
+                };
+                if (ImGui::CollapsingHeader("Playback")) {
+                    ImGui::InputText("Recording File Path", ui_recording_path,
+                                     IM_ARRAYSIZE(ui_recording_path));
+                    if (playback == nullptr) {
+                        ImGui::BeginDisabled(running || sim_thread != nullptr ||
+                                             gpu_backend != nullptr);
+                        if (ImGui::Button("Open Recording")) {
+                            try {
+                                playback = new Playback(ui_recording_path);
+                                if (playback->getWidth() !=
+                                        simulation->board->getWidth() ||
+                                    playback->getHeight() !=
+                                        simulation->board->getHeight()) {
+                                    throw std::runtime_error(
+                                        "The recording does not match the "
+                                        "board.");
+                                }
+                                if (playback->getFrameCount() == 0) {
+                                    throw std::runtime_error(
+                                        "The recording has no frames.");
+                                }
+                                ui_playback_densities.assign(
+                                    simulation->board->getPaddedSize(), 0.f);
+                                ui_playback_playing = false;
+                                ui_playback_position = 0.;
+                                ui_playback_shown = -1;
+                                ui_status_msg =
+                                    "Recording opened, " +
+                                    std::to_string(playback->getFrameCount()) +
+                                    " frames.";
+                            } catch (std::runtime_error& e) {
+                                delete playback;
+                                playback = nullptr;
+                                ui_status_msg = e.what();
+                            }
+                        }
+                        ImGui::EndDisabled();
+                    } else {
+                        if (ImGui::Button(ui_playback_playing ? "Pause"
+                                                              : "Play"))
+                            ui_playback_playing = !ui_playback_playing;
+                        ImGui::SameLine();
+                        bool close = ImGui::Button("Close Recording");
+                        int frame = (int)ui_playback_position;
+                        if (ImGui::SliderInt(
+                                "Frame", &frame, 0,
+                                (int)playback->getFrameCount() - 1))
+                            ui_playback_position = frame;
+                        ImGui::SliderFloat("Frames/s", &ui_playback_speed,
+                                           -__ui_playback_speed_max,
+                                           __ui_playback_speed_max, "%.1f");
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("(negative = backward)");
+                        ImGui::Text("Recorded Tick: %u",
+                                    playback->getTick(frame));
+                        if (close) {
+                            closePlayback();
+                            ui_status_msg = "Recording closed.";
+                        }
+                    }
+                }
+                if (playback != nullptr) {
+                    double last = playback->getFrameCount() - 1;
+                    if (ui_playback_playing) {
+                        ui_playback_position +=
+                            ui_playback_speed * ImGui::GetIO().DeltaTime;
+                        // Pause at either end
+                        if (ui_playback_position <= 0. ||
+                            ui_playback_position >= last)
+                            ui_playback_playing = false;
+                    }
+                    ui_playback_position =
+                        std::min(std::max(ui_playback_position, 0.), last);
+                    long frame = (long)ui_playback_position;
+                    if (frame != ui_playback_shown) {
+                        try {
+                            const std::vector<float>& densities =
+                                playback->seek(frame);
+                            Board* board = simulation->board;
+                            uint width = board->getWidth();
+                            for (uint row = 0; row < board->getHeight();
+                                 row++) {
+                                std::copy_n(densities.begin() +
+                                                (size_t)row * width,
+                                            width,
+                                            ui_playback_densities.begin() +
+                                                board->indexOf(row, 0));
+                            }
+                            ui_playback_shown = frame;
+                            redraw();
+                        } catch (std::runtime_error& e) {
+                            closePlayback();
+                            ui_status_msg = e.what();
+                        }
+                    }
+                }
+#endif
+                /* The reference is compared with whatever is shown: the
+                 * simulation, its latest snapshot or a recorded frame. */
+                bool recolour = false;
+                if (ImGui::CollapsingHeader("Compare")) {
+                    ImGui::InputText("Reference File Path", ui_reference_path,
+                                     IM_ARRAYSIZE(ui_reference_path));
+                    if (reference == nullptr) {
+                        ImGui::BeginDisabled(running || gpu_backend != nullptr);
+                        bool open = ImGui::Button("Open Reference");
+                        ImGui::SameLine();
+                        bool fork = ImGui::Button("Fork Current Run");
+                        ImGui::EndDisabled();
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("(checkpoint or recording)");
+                        if (open || fork) {
+                            try {
+                                if (fork) {
+                                    reference = simulation->fork();
+                                } else if (isCheckpoint(ui_reference_path)) {
+                                    reference =
+                                        readCheckpoint(ui_reference_path);
+                                } else {
+#ifdef SMOKEY_RECORDING
+                                    reference_playback =
+                                        new Playback(ui_reference_path);
+                                    if (reference_playback->getFrameCount() ==
+                                        0) {
+                                        throw std::runtime_error(
+                                            "The recording has no frames.");
+                                    }
+                                    // Frames are copied over its densities
+                                    reference = simulation->fork();
+                                    reference->board->setStorage(
+                                        Board::Storage::Float);
+                                    ui_reference_frame = -1;
+#else
+                                    throw std::runtime_error(
+                                        "This build cannot read recordings, "
+                                        "it lacks zlib.");
+#endif
+                                }
+                                uint width = reference->board->getWidth();
+                                uint height = reference->board->getHeight();
+#ifdef SMOKEY_RECORDING
+                                if (reference_playback != nullptr) {
+                                    width = reference_playback->getWidth();
+                                    height = reference_playback->getHeight();
+                                }
+#endif
+                                if (width != simulation->board->getWidth() ||
+                                    height != simulation->board->getHeight()) {
+                                    throw std::runtime_error(
+                                        "The reference does not match the "
+                                        "board.");
+                                }
+                                ui_difference.reset();
+                                recolour = true;
+                                ui_status_msg = "Reference opened.";
+                            } catch (std::runtime_error& e) {
+                                closeReference();
+                                ui_status_msg = e.what();
+                            }
+                        }
+                    } else {
+                        recolour = ImGui::Checkbox("Show Difference",
+                                                   &ui_show_difference);
+                        ImGui::SameLine();
+                        if (ImGui::Button("Close Reference")) {
+                            closeReference();
+                            recolour = true;
+                            ui_status_msg = "Reference closed.";
+                        }
+#ifdef SMOKEY_RECORDING
+                        ImGui::BeginDisabled(reference_playback != nullptr);
+#endif
+                        ImGui::Checkbox("Follow Ticks", &ui_reference_follow);
+#ifdef SMOKEY_RECORDING
+                        ImGui::EndDisabled();
+#endif
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("(advance with the run)");
+                        recolour |= ImGui::SliderFloat(
+                            "Difference Scale",
+                            &board_texture->difference_scale, 1e-4f, 1.f,
+                            "%.4g", ImGuiSliderFlags_Logarithmic);
+                        if (reference != nullptr) {
+                            unsigned int reference_ticks =
+                                reference->getTicks();
+#ifdef SMOKEY_RECORDING
+                            if (reference_playback != nullptr &&
+                                ui_reference_frame >= 0) {
+                                reference_ticks = reference_playback->getTick(
+                                    ui_reference_frame);
+                            }
+#endif
+                            const DifferenceNorms& norms =
+                                ui_difference.getNorms();
+                            ImGui::Text("Reference Tick: %u", reference_ticks);
+                            ImGui::Text("L1: %.4g  L2: %.4g  Max: %.4g",
+                                        norms.l1, norms.l2, norms.linf);
+                            ImGui::Text("Smoke Beyond Reference: %.4g",
+                                        norms.mass);
+                        }
+                    }
+                }
+                board_texture->setReference(
+                    reference != nullptr && ui_show_difference
+                        ? reference->board
+                        : nullptr);
+                if (recolour) redraw();
+                ImGui::Separator();
+                unsigned int ticks = simulation->getTicks();
+                bool measured = simulation->tolerance > 0.f;
+                float max_change = simulation->getMaxChange();
+                if (sim_thread != nullptr) {
+                    sim_lock.unlock();
+                    sim_thread->snapshot_arrivals = ui_show_arrivals;
+                    sim_thread->snapshot_doses = ui_show_doses;
+                    // Only redraw once the thread has published a new tick
+                    bool taken = false;
+                    if (ui_thread_running)
+                        ui_snapshot = sim_thread->latest(&taken);
+                    if (ui_snapshot != nullptr) ticks = ui_snapshot->ticks;
+                    if (taken) {
+                        board_texture->update(
+                            *simulation, ui_snapshot->densities.data(),
+                            ui_show_arrivals && !ui_snapshot->arrivals.empty()
+                                ? ui_snapshot->arrivals.data()
+                                : nullptr,
+                            ui_show_doses && !ui_snapshot->doses.empty()
+                                ? ui_snapshot->doses.data()
+                                : nullptr);
+                    }
+                } else {
+                    /* Simulation Cycle: run a batch of cycles, either a fixed
+                     * number or as many as fit in the frame budget, and only
+                     * redraw the board once at the end of it. */
+                    bool ticked = false;
+                    auto batch_begin = std::chrono::steady_clock::now();
+                    auto batch_end =
+                        batch_begin +
+                        std::chrono::duration_cast<
+                            std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double, std::milli>(
+                                ui_frame_budget));
+                    for (int cycle = 0; simulation->isRunning(); cycle++) {
+                        if (ui_frame_budget > 0.f) {
+                            if (cycle > 0 &&
+                                std::chrono::steady_clock::now() >= batch_end)
+                                break;
+                        } else if (cycle >= ui_ticks_per_frame) {
+                            break;
+                        }
+                        try {
+                            if (!simulation->cycle()) continue;
+                        } catch (std::runtime_error& e) {
                             simulation->stop();
+                            ui_status_msg = e.what();
+                            break;
+                        }
+                        ticked = true;
+                        if (simulation->hasConverged()) {
+                            ui_status_msg = "Steady state reached.";
+                            finishLaunch();
+                            break;
+                        }
+                        // Check if we've reached a breakpoint
+                        if (ui_breakpoint > 0) {
+                            ui_breakpoint--;
+                            if (ui_breakpoint == 0) {
+                                ui_status_msg = "Breakpoint reached.";
+                                simulation->stop();
+                                finishLaunch();
+                            }
+                        }
+                    }
+
+                    ui_phase_time[UiPhase::Cycle] +=
+                        std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - batch_begin)
+                            .count();
+                    if (ticked) {
+                        // Update Display
+                        redraw();
+                    }
+                    ticks = simulation->getTicks();
+                    max_change = simulation->getMaxChange();
+                }
+                if (sim_lock.owns_lock()) sim_lock.unlock();
+                if (reference != nullptr) {
+                    // Compared at the tick shown
+                    unsigned int shown = ticks;
+                    const float* densities =
+                        sim_thread != nullptr && ui_snapshot != nullptr
+                            ? ui_snapshot->densities.data()
+                            : nullptr;
+                    unsigned long generation =
+                        reference->board->getGeneration();
+                    try {
+                        bool recorded = false;
+#ifdef SMOKEY_RECORDING
+                        if (!ui_playback_densities.empty() &&
+                            ui_playback_shown >= 0) {
+                            shown = playback->getTick(ui_playback_shown);
+                            densities = ui_playback_densities.data();
+                        }
+                        recorded = reference_playback != nullptr;
+                        if (recorded) {
+                            long frame = reference_playback->findFrame(shown);
+                            if (frame != ui_reference_frame) {
+                                const std::vector<float>& frame_densities =
+                                    reference_playback->seek(frame);
+                                Board* board = reference->board;
+                                uint width = board->getWidth();
+                                board->ownDensities();
+                                for (uint row = 0; row < board->getHeight();
+                                     row++) {
+                                    std::copy_n(frame_densities.begin() +
+                                                    (size_t)row * width,
+                                                width,
+                                                board->getDensities() +
+                                                    board->indexOf(row, 0));
+                                }
+                                board->markRows(0, board->getHeight());
+                                ui_reference_frame = frame;
+                            }
+                        }
+#endif
+                        if (!recorded && ui_reference_follow &&
+                            reference->getTicks() < shown)
+                            reference->advance(shown - reference->getTicks());
+                        if (densities != nullptr || sim_thread == nullptr)
+                            ui_difference.compare(simulation->board,
+                                                  reference->board, densities);
+                    } catch (std::runtime_error& e) {
+                        closeReference();
+                        ui_status_msg = e.what();
+                        redraw();
+                    }
+                    // The reference changed after the board was last drawn
+                    if (reference != nullptr && ui_show_difference &&
+                        reference->board->getGeneration() != generation) {
+                        if (densities != nullptr && sim_thread != nullptr) {
+                            board_texture->update(*simulation, densities);
+                        } else {
+                            redraw();
                         }
                     }
                 }
+                // A new simulation starts counting from zero again
+                ui_frame_ticks =
+                    ticks >= ui_last_ticks ? ticks - ui_last_ticks : ticks;
+                ui_last_ticks = ticks;
+                ui_cells = (double)simulation->board->getWidth() *
+                           simulation->board->getHeight();
                 if (ui_breakpoint < 0) {
                     ui_breakpoint = 0;
                 }
 
-                ImGui::Image(
-                    (void*)(intptr_t)board_texture_id,
-                    ImVec2(simulation->board->getWidth() * ui_board_zoom,
-                           simulation->board->getHeight() * ui_board_zoom),
-                    ImVec2(0, 0), ImVec2(1, 1), ImVec4(1, 1, 1, 1),
-                    ImVec4(0.302, 0.365, 0.325, 1));
-                ImGui::Text("Ticks: %d", simulation->getTicks());
+                /* Only the cells on screen are displayed, at most one per
+                 * pixel, the rest of the board is only laid out. */
+                Board* board = simulation->board;
+                float zoom = ui_board_zoom;
+                ImVec2 board_size(board->getWidth() * zoom,
+                                  board->getHeight() * zoom);
+                // Leave room for the border, as ImGui::Image() does
+                ImVec2 origin = ImGui::GetCursorScreenPos();
+                origin.x += 1;
+                origin.y += 1;
+                ImDrawList* draw_list = ImGui::GetWindowDrawList();
+                ImVec2 clip_min = draw_list->GetClipRectMin();
+                ImVec2 clip_max = draw_list->GetClipRectMax();
+                float x0 = std::max(clip_min.x - origin.x, 0.f);
+                float y0 = std::max(clip_min.y - origin.y, 0.f);
+                float x1 = std::min(clip_max.x - origin.x, board_size.x);
+                float y1 = std::min(clip_max.y - origin.y, board_size.y);
+                if (x1 > x0 && y1 > y0) {
+                    BoardView view;
+                    view.step =
+                        zoom < 1.f ? (uint)std::ceil(1.f / zoom - 1e-4f) : 1;
+                    // Align the view to the step, so scrolling keeps texels
+                    view.col = (uint)(x0 / zoom) / view.step * view.step;
+                    view.row = (uint)(y0 / zoom) / view.step * view.step;
+                    view.cols = std::min((uint)std::ceil(x1 / zoom),
+                                         board->getWidth()) -
+                                view.col;
+                    view.rows = std::min((uint)std::ceil(y1 / zoom),
+                                         board->getHeight()) -
+                                view.row;
+                    GLuint texture;
+                    ImVec2 p_min, p_max, uv_min, uv_max;
+                    if (gpu_backend != nullptr) {
+                        // The whole board is already displayed on the GPU
+                        texture = gpu_backend->getTexture();
+                        p_min = ImVec2(origin.x + view.col * zoom,
+                                       origin.y + view.row * zoom);
+                        p_max = ImVec2(p_min.x + view.cols * zoom,
+                                       p_min.y + view.rows * zoom);
+                        uv_min = ImVec2((float)view.col / board->getWidth(),
+                                        (float)view.row / board->getHeight());
+                        uv_max = ImVec2((float)(view.col + view.cols) /
+                                            board->getWidth(),
+                                        (float)(view.row + view.rows) /
+                                            board->getHeight());
+                    } else {
+                        if (board_texture->setView(view)) {
+                            if (ui_thread_running && ui_snapshot != nullptr) {
+                                board_texture->update(
+                                    *simulation, ui_snapshot->densities.data(),
+                                    ui_show_arrivals &&
+                                            !ui_snapshot->arrivals.empty()
+                                        ? ui_snapshot->arrivals.data()
+                                        : nullptr,
+                                    ui_show_doses && !ui_snapshot->doses.empty()
+                                        ? ui_snapshot->doses.data()
+                                        : nullptr);
+                            } else {
+                                redraw();
+                            }
+                        }
+                        texture = board_texture->getTexture();
+                        const BoardView& shown = board_texture->getView();
+                        // The last texels may cover cells past the view
+                        float cell = shown.step * zoom;
+                        p_min = ImVec2(origin.x + shown.col * zoom,
+                                       origin.y + shown.row * zoom);
+                        p_max = ImVec2(p_min.x + shown.getWidth() * cell,
+                                       p_min.y + shown.getHeight() * cell);
+                        uv_min = ImVec2(0, 0);
+                        board_texture->getExtent(&uv_max.x, &uv_max.y);
+                    }
+                    draw_list->AddImage((void*)(intptr_t)texture, p_min,
+                                        p_max, uv_min, uv_max);
+                }
+                draw_list->AddRect(
+                    ImVec2(origin.x - 1, origin.y - 1),
+                    ImVec2(origin.x + board_size.x + 1,
+                           origin.y + board_size.y + 1),
+                    ImGui::GetColorU32(ImVec4(0.302, 0.365, 0.325, 1)));
+                if (!brushing) {
+                    ImGui::Dummy(ImVec2(board_size.x + 2, board_size.y + 2));
+                } else {
+                    ImGui::InvisibleButton(
+                        "##board", ImVec2(board_size.x + 2, board_size.y + 2));
+                    ImVec2 mouse = ImGui::GetIO().MousePos;
+                    float x = (mouse.x - origin.x) / zoom;
+                    float y = (mouse.y - origin.y) / zoom;
+                    bool inside = x >= 0.f && y >= 0.f &&
+                                  x < board->getWidth() &&
+                                  y < board->getHeight();
+                    if (ImGui::IsItemActive() && inside) {
+                        BrushDab dab;
+                        dab.radius = ui_brush_radius;
+                        dab.paint = (BrushDab::Paint)(ui_brush - 1);
+                        dab.value = ui_brush_value;
+                        int row = (int)y, col = (int)x;
+                        if (!ui_brush_stroke) {
+                            ui_brush_row = row;
+                            ui_brush_col = col;
+                        }
+                        // Fill the gaps a fast stroke leaves between frames
+                        int span = std::max(std::abs(row - ui_brush_row),
+                                            std::abs(col - ui_brush_col));
+                        int spacing = std::max(ui_brush_radius, 1);
+                        for (int step = spacing; step < span;
+                             step += spacing) {
+                            dab.row = ui_brush_row +
+                                      (row - ui_brush_row) * step / span;
+                            dab.col = ui_brush_col +
+                                      (col - ui_brush_col) * step / span;
+                            ui_brush_dabs.push_back(dab);
+                        }
+                        if (!ui_brush_stroke || span > 0) {
+                            dab.row = row;
+                            dab.col = col;
+                            ui_brush_dabs.push_back(dab);
+                        }
+                        ui_brush_stroke = true;
+                        ui_brush_row = row;
+                        ui_brush_col = col;
+                    }
+                    if (!ImGui::IsItemActive()) ui_brush_stroke = false;
+                    if (ImGui::IsItemHovered() && inside) {
+                        draw_list->AddCircle(
+                            mouse, (ui_brush_radius + .5f) * zoom,
+                            ImGui::GetColorU32(ImVec4(1, 1, 1, .8f)));
+                    }
+                }
+                ImGui::Text("Ticks: %u", ticks);
+                if (measured) {
+                    ImGui::SameLine();
+                    ImGui::Text("Change: %g", max_change);
+                }
                 ImGui::Separator();
                 // UI Controls
-                ImGui::SliderInt("##zoom", &ui_board_zoom, 1, 20);
+                ImGui::SliderFloat("##zoom", &ui_board_zoom, 1.f / 16, 20.f,
+                                   "%.3gx", ImGuiSliderFlags_Logarithmic);
                 ImGui::SameLine();
                 if (ImGui::Button("10x")) {
                     ui_board_zoom = __ui_board_zoom_default;
@@ -252,6 +1525,93 @@ int main(void) {
                 ImGui::Text("%.3f ms/frame (%.1f FPS)",
                             1000.0f / ImGui::GetIO().Framerate,
                             ImGui::GetIO().Framerate);
+                float seconds =
+                    ui_phase_stats[UiPhase::Frame].getSum() / 1000.f;
+                float tick_rate =
+                    seconds > 0.f ? ui_tick_stats.getSum() / seconds : 0.f;
+                ImGui::Text("%.1f ticks/s (%.3g cells/s)", tick_rate,
+                            tick_rate * ui_cells);
+                for (int phase = 0; phase < UiPhase::PhaseCount; phase++) {
+                    const RollingStats& stats = ui_phase_stats[phase];
+                    char overlay[64];
+                    snprintf(overlay, sizeof(overlay),
+                             "min %.2f avg %.2f p99 %.2f ms", stats.getMin(),
+                             stats.getAverage(), stats.getPercentile(.99f));
+                    ImGui::PlotLines(__ui_phase_names[phase],
+                                     stats.getSamples(), stats.getCount(),
+                                     stats.getOffset(), overlay, 0.f, FLT_MAX,
+                                     ImVec2(0, 40));
+                }
+                if (ui_counters != nullptr) {
+                    // Hardware events of the ticks, workers included
+                    if (ImGui::Checkbox("Hardware Counters",
+                                        &ui_count_events)) {
+                        ui_ipc_stats.clear();
+                        ui_cache_miss_stats.clear();
+                        ui_branch_miss_stats.clear();
+                    }
+                    const RollingStats* event_stats[] = {
+                        &ui_ipc_stats, &ui_cache_miss_stats,
+                        &ui_branch_miss_stats};
+                    const char* event_names[] = {
+                        "IPC", "Cache Misses/Cell", "Branch Misses/Cell"};
+                    bool event_counted[] = {
+                        ui_counters->has(PerfCounters::Cycles) &&
+                            ui_counters->has(PerfCounters::Instructions),
+                        ui_counters->has(PerfCounters::CacheMisses),
+                        ui_counters->has(PerfCounters::BranchMisses)};
+                    for (int event = 0; ui_count_events && event < 3;
+                         event++) {
+                        if (!event_counted[event]) {
+                            ImGui::TextDisabled("%s: not counted",
+                                                event_names[event]);
+                            continue;
+                        }
+                        const RollingStats& stats = *event_stats[event];
+                        char overlay[64];
+                        snprintf(overlay, sizeof(overlay),
+                                 "min %.3g avg %.3g max %.3g", stats.getMin(),
+                                 stats.getAverage(), stats.getMax());
+                        ImGui::PlotLines(event_names[event],
+                                         stats.getSamples(), stats.getCount(),
+                                         stats.getOffset(), overlay, 0.f,
+                                         FLT_MAX, ImVec2(0, 40));
+                    }
+                } else {
+                    ImGui::TextDisabled("(%s)", ui_counters_error.c_str());
+                }
+                if (ImGui::TreeNode("Memory")) {
+                    Footprint footprint = ui_footprint;
+                    if (reference != nullptr) {
+                        Footprint compared;
+                        reference->addFootprint(&compared);
+                        footprint.add("reference", compared.getTotal());
+                    }
+                    board_texture->addFootprint(&footprint);
+                    for (auto& part : footprint.getParts()) {
+                        ImGui::Text("%-18s %s", part.name.c_str(),
+                                    formatBytes(part.bytes).c_str());
+                    }
+                    ImGui::Text("%-18s %s", "total",
+                                formatBytes(footprint.getTotal()).c_str());
+                    ImGui::TreePop();
+                }
+                bool recording = ui_tracer.enabled;
+                if (ImGui::Checkbox("Record Trace", &recording))
+                    ui_tracer.enabled = recording;
+                ImGui::SameLine();
+                if (ImGui::Button("Save Trace")) {
+                    try {
+                        ui_tracer.write(ui_trace_path);
+                        ui_status_msg = "Trace saved.";
+                    } catch (std::runtime_error& e) {
+                        ui_status_msg = e.what();
+                    }
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Clear Trace")) ui_tracer.clear();
+                ImGui::InputText("Trace File Path", ui_trace_path,
+                                 IM_ARRAYSIZE(ui_trace_path));
             }
             if (ImGui::CollapsingHeader("About")) {
                 ImGui::TextWrapped(
@@ -266,18 +1626,61 @@ int main(void) {
         }
 
         // Rendering
-        ImGui::Render();
-        glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x,
-                   (int)ImGui::GetIO().DisplaySize.y);
-        glClearColor(__ui_clear_color.x * __ui_clear_color.w,
-                     __ui_clear_color.y * __ui_clear_color.w,
-                     __ui_clear_color.z * __ui_clear_color.w,
-                     __ui_clear_color.w);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            ScopedTimer timer(&ui_phase_time[UiPhase::Render]);
+            TraceScope trace(&ui_tracer, "render");
+            ImGui::Render();
+            glViewport(0, 0, (int)ImGui::GetIO().DisplaySize.x,
+                       (int)ImGui::GetIO().DisplaySize.y);
+            glClearColor(__ui_clear_color.x * __ui_clear_color.w,
+                         __ui_clear_color.y * __ui_clear_color.w,
+                         __ui_clear_color.z * __ui_clear_color.w,
+                         __ui_clear_color.w);
+            glClear(GL_COLOR_BUFFER_BIT);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        ui_phase_time[UiPhase::Pixmap] += board_texture->pixmap_time;
+        ui_phase_time[UiPhase::Upload] += board_texture->upload_time;
+        board_texture->pixmap_time = board_texture->upload_time = 0.;
+        ui_phase_time[UiPhase::Frame] = ImGui::GetIO().DeltaTime * 1000.;
+        for (int phase = 0; phase < UiPhase::PhaseCount; phase++)
+            ui_phase_stats[phase].add(ui_phase_time[phase]);
+        ui_tick_stats.add(ui_frame_ticks);
+        if (ui_counters != nullptr) {
+            /* Counts only grow while the ticks are counted, though scaling
+             * can take a multiplexed count back a little. */
+            double deltas[PerfCounters::EventCount];
+            for (int event = 0; event < PerfCounters::EventCount; event++) {
+                uint64_t count =
+                    ui_counters->read((PerfCounters::Event)event);
+                deltas[event] = (double)count - ui_counts[event];
+                ui_counts[event] = count;
+            }
+            double cells = ui_cells * ui_frame_ticks;
+            if (ui_count_events && cells > 0. &&
+                deltas[PerfCounters::Cycles] > 0.) {
+                ui_ipc_stats.add(deltas[PerfCounters::Instructions] /
+                                 deltas[PerfCounters::Cycles]);
+                ui_cache_miss_stats.add(deltas[PerfCounters::CacheMisses] /
+                                        cells);
+                ui_branch_miss_stats.add(deltas[PerfCounters::BranchMisses] /
+                                         cells);
+            }
+        }
         SDL_GL_SwapWindow(main_window);
     }
 
+#ifdef SMOKEY_RECORDING
+    delete playback;
+    delete reference_playback;
+#endif
+    delete reference;
+    delete sim_loader;
+    delete sim_thread;
+    delete gpu_backend;
+    delete simulation;
+    delete ui_counters;
+    delete board_texture;
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,88 @@
+/**
+ * @file probe.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+ProbeSet::ProbeSet(Board& board, const std::vector<Probe>& probes) {
+    const Cell::Type* type = board.getTypes();
+    for (auto& probe : probes) {
+        if (probe.rows == 0 || probe.cols == 0 ||
+            !board.contains(probe.row, probe.col) ||
+            probe.rows > board.getHeight() - probe.row ||
+            probe.cols > board.getWidth() - probe.col) {
+            throw std::runtime_error("Probes must lie within the board.");
+        }
+        this->first_run.push_back(this->runs.size());
+        size_t cells = 0;
+        for (uint row = probe.row; row < probe.row + probe.rows; row++) {
+            size_t idx = board.indexOf(row, probe.col);
+            size_t end = idx + probe.cols;
+            while (idx < end) {
+                // Skip to the next floor cell, then to the end of the run
+                while (idx < end && type[idx] != Cell::Floor) idx++;
+                size_t begin = idx;
+                while (idx < end && type[idx] == Cell::Floor) idx++;
+                if (idx > begin) this->runs.push_back({begin, idx});
+                cells += idx - begin;
+            }
+        }
+        this->floor_cells.push_back(cells);
+    }
+    this->first_run.push_back(this->runs.size());
+    this->probes = probes;
+    this->samples.resize(probes.size());
+}
+
+template <typename T>
+void ProbeSet::sample(const T* density) {
+    for (size_t probe = 0; probe < this->probes.size(); probe++) {
+        double sum = 0.;
+        float max = 0.f;
+        for (size_t run = this->first_run[probe];
+             run < this->first_run[probe + 1]; run++) {
+            for (size_t idx = this->runs[run].begin; idx < this->runs[run].end;
+                 idx++) {
+                double value = decodeDensity(density[idx]);
+                sum += value;
+                max = std::max(max, (float)value);
+            }
+        }
+        size_t cells = this->floor_cells[probe];
+        this->samples[probe].mean = cells > 0 ? sum / cells : 0.;
+        this->samples[probe].max = max;
+    }
+}
+
+void ProbeSet::sample(Board& board) {
+    switch (board.getStorage()) {
+        case Board::Storage::Float:
+            this->sample(board.getDensities());
+            break;
+        case Board::Storage::Fixed:
+            this->sample(board.getFixedDensities());
+            break;
+        case Board::Storage::Double:
+            this->sample(board.getDoubleDensities());
+            break;
+    }
+}
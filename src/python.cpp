@@ -0,0 +1,322 @@
+/**
+ * @file python.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Project Includes
+#include "board_file.hpp"
+#include "ensemble.hpp"
+#include "sim.hpp"
+#include "species.hpp"
+
+namespace py = pybind11;
+
+/**
+ * @brief Load a layout and compute its weights unless the file holds them.
+ */
+static Board* loadLayout(const std::string& path) {
+    bool has_weights;
+    Board* board = loadBoard(path, &has_weights);
+    if (!has_weights) board->computeWeights();
+    return board;
+}
+
+/**
+ * @brief View the cells of a padded array as a read-only height × width
+ * array, or height × width × lanes if its cells hold lanes values each,
+ * without copying it.
+ *
+ * The view keeps owner alive, and is only valid until the owner writes
+ * another buffer, typically on its next tick.
+ */
+template <typename T>
+static py::array viewOf(const T* data, Board* board, py::handle owner,
+                        uint lanes = 0) {
+    size_t step = std::max(lanes, 1u);
+    std::vector<py::ssize_t> shape = {board->getHeight(), board->getWidth()};
+    std::vector<py::ssize_t> strides = {
+        (py::ssize_t)(board->getStride() * step * sizeof(T)),
+        (py::ssize_t)(step * sizeof(T))};
+    if (lanes > 0) {
+        shape.push_back(lanes);
+        strides.push_back(sizeof(T));
+    }
+    py::array view(py::dtype::of<T>(), shape, strides,
+                   data + board->indexOf(0, 0) * step, owner);
+    view.attr("setflags")(py::arg("write") = false);
+    return view;
+}
+
+/**
+ * @brief View a vector of the simulation as a read-only array.
+ */
+template <typename T>
+static py::array viewOf(const std::vector<T>& data, py::handle owner) {
+    py::array view(py::dtype::of<T>(), {(py::ssize_t)data.size()},
+                   {(py::ssize_t)sizeof(T)}, data.data(), owner);
+    view.attr("setflags")(py::arg("write") = false);
+    return view;
+}
+
+static Sim* makeSim(const std::string& path,
+                    const std::vector<std::pair<uint, uint>>& emitters,
+                    Board::Storage storage) {
+    Board* board = loadLayout(path);
+    try {
+        for (auto& emitter : emitters) {
+            board->placeEmitter(emitter.first, emitter.second);
+            board->computeWeightsAround(emitter.first, emitter.second);
+        }
+        board->setStorage(storage);
+    } catch (...) {
+        delete board;
+        throw;
+    }
+    Sim* sim = new Sim(board);
+    sim->touchBoard();
+    return sim;
+}
+
+static py::array densitiesOf(Sim& sim, py::handle owner) {
+    Board* board = sim.board;
+    if (board->getStorage() == Board::Storage::Double)
+        return viewOf(board->getDoubleDensities(), board, owner);
+    // Fixed-point densities are decoded once per tick, into a float buffer
+    return viewOf(board->getDensities(), board, owner);
+}
+
+static py::object arrivalsOf(Sim& sim, py::handle owner) {
+    const uint* arrivals = sim.getArrivals();
+    if (arrivals == nullptr) return py::none();
+    return viewOf(arrivals, sim.board, owner);
+}
+
+static py::object dosesOf(Sim& sim, py::handle owner) {
+    const double* doses = sim.getDoses();
+    if (doses == nullptr) return py::none();
+    return viewOf(doses, sim.board, owner);
+}
+
+static Ensemble* makeEnsemble(
+    const std::string& path,
+    const std::vector<std::pair<uint, uint>>& emitters) {
+    std::unique_ptr<Board> layout(loadLayout(path));
+    // The ensemble works on a fork of the layout
+    return new Ensemble(layout.get(), emitters);
+}
+
+static Species* makeSpecies(
+    const std::string& path, uint count,
+    const std::vector<std::tuple<uint, uint, uint, float>>& sources) {
+    std::unique_ptr<Board> layout(loadLayout(path));
+    std::vector<SpeciesSource> emitters;
+    for (auto& source : sources) {
+        emitters.push_back({std::get<0>(source), std::get<1>(source),
+                            std::get<2>(source), std::get<3>(source)});
+    }
+    // The species work on a fork of the layout
+    return new Species(layout.get(), count, emitters);
+}
+
+PYBIND11_MODULE(smokey, m) {
+    m.doc() = "Smoke propagation on cellular automata.";
+
+    py::enum_<Board::Storage>(m, "Storage")
+        .value("Float", Board::Storage::Float)
+        .value("Fixed", Board::Storage::Fixed)
+        .value("Double", Board::Storage::Double);
+
+    py::class_<Sim> sim(m, "Sim");
+    py::enum_<Sim::Update>(sim, "Update")
+        .value("InPlace", Sim::Update::InPlace)
+        .value("Synchronous", Sim::Update::Synchronous)
+        .value("RedBlack", Sim::Update::RedBlack);
+    py::enum_<Sim::Kernel>(sim, "Kernel")
+        .value("Scalar", Sim::Kernel::Scalar)
+        .value("Simd", Sim::Kernel::Simd);
+    py::enum_<Sim::Stencil>(sim, "Stencil")
+        .value("VonNeumann", Sim::Stencil::VonNeumann)
+        .value("Moore", Sim::Stencil::Moore);
+    sim.def(py::init(&makeSim), py::arg("layout"),
+            py::arg("emitters") = std::vector<std::pair<uint, uint>>(),
+            py::arg("storage") = Board::Storage::Float,
+            "Load a layout and place emitters on it.")
+        .def_readwrite("emitter_rate", &Sim::emitter_rate)
+        .def_readwrite("escape_rate", &Sim::escape_rate)
+        .def_readwrite("use_precalc_weights", &Sim::use_precalc_weights)
+        .def_readwrite("update_mode", &Sim::update_mode)
+        .def_readwrite("threads", &Sim::threads)
+        .def_readwrite("kernel", &Sim::kernel)
+        .def_readwrite("stencil", &Sim::stencil)
+        .def_readwrite("track_activity", &Sim::track_activity)
+        .def_readwrite("time_block", &Sim::time_block)
+        .def_readwrite("elevation_bias", &Sim::elevation_bias)
+        .def_readwrite("tolerance", &Sim::tolerance)
+        .def_readwrite("track_mass", &Sim::track_mass)
+        .def_readwrite("arrival_threshold", &Sim::arrival_threshold)
+        .def_readwrite("track_outflow", &Sim::track_outflow)
+        .def_readwrite("track_dose", &Sim::track_dose)
+        .def(
+            "step",
+            [](Sim& sim, unsigned long ticks) { return sim.advance(ticks); },
+            py::arg("ticks") = 1, py::call_guard<py::gil_scoped_release>(),
+            "Run a number of ticks, or until the simulation converges, "
+            "without holding the GIL. Returns the number of ticks run.")
+        .def(
+            "place_emitter",
+            [](Sim& sim, uint row, uint col, float rate) {
+                sim.board->placeEmitter(row, col, rate);
+                sim.board->computeWeightsAround(row, col);
+                sim.touchBoard();
+            },
+            py::arg("row"), py::arg("col"), py::arg("rate") = 1.f)
+        .def(
+            "set_emitter_curve",
+            [](Sim& sim, uint row, uint col, const std::string& curve) {
+                std::shared_ptr<const GrowthCurve> table;
+                if (curve != "none") {
+                    table = std::make_shared<const GrowthCurve>(
+                        GrowthCurve::parse(curve));
+                }
+                sim.setEmitterCurve(row, col, table);
+            },
+            py::arg("row"), py::arg("col"), py::arg("curve"),
+            "Grow an emitter along a curve from the next step, or 'none'.")
+        .def("reset_doses", &Sim::resetDoses,
+             "Start the doses over from the next step.")
+        .def_property_readonly("width",
+                               [](Sim& sim) { return sim.board->getWidth(); })
+        .def_property_readonly("height",
+                               [](Sim& sim) { return sim.board->getHeight(); })
+        .def_property_readonly("ticks", &Sim::getTicks)
+        .def_property_readonly("max_change", &Sim::getMaxChange)
+        .def_property_readonly("change_norm", &Sim::getChangeNorm)
+        .def_property_readonly("converged", &Sim::hasConverged)
+        .def_property_readonly("mass", &Sim::getMass)
+        .def_property_readonly("outflow", &Sim::getOutflow)
+        .def_property_readonly(
+            "densities",
+            [](py::object self) {
+                return densitiesOf(self.cast<Sim&>(), self);
+            },
+            "Read-only view of the densities, valid until the next step.")
+        .def_property_readonly(
+            "types",
+            [](py::object self) {
+                Sim& sim = self.cast<Sim&>();
+                return viewOf((const uchar*)sim.board->getTypes(), sim.board,
+                              self);
+            },
+            "Read-only view of the cell types, see Cell.Type.")
+        .def_property_readonly(
+            "arrivals",
+            [](py::object self) {
+                return arrivalsOf(self.cast<Sim&>(), self);
+            },
+            "Read-only view of the arrival map, or None unless mapped.")
+        .def_property_readonly(
+            "doses",
+            [](py::object self) { return dosesOf(self.cast<Sim&>(), self); },
+            "Read-only view of the density of each cell added up over the "
+            "steps, or None unless tracked.")
+        .def_property_readonly(
+            "escape_outflows",
+            [](py::object self) {
+                return viewOf(self.cast<Sim&>().getEscapeOutflows(), self);
+            },
+            "Read-only view of the outflow through each escape over the "
+            "last tick.");
+
+    py::class_<Ensemble>(m, "Ensemble")
+        .def(py::init(&makeEnsemble), py::arg("layout"), py::arg("emitters"),
+             "Run one member per emitter on a layout.")
+        .def_readwrite("emitter_rate", &Ensemble::emitter_rate)
+        .def_readwrite("escape_rate", &Ensemble::escape_rate)
+        .def_readwrite("use_precalc_weights", &Ensemble::use_precalc_weights)
+        .def_readwrite("elevation_bias", &Ensemble::elevation_bias)
+        .def_readwrite("measure_change", &Ensemble::measure_change)
+        .def(
+            "step",
+            [](Ensemble& ensemble, unsigned long ticks) {
+                for (unsigned long tick = 0; tick < ticks; tick++)
+                    ensemble.tick();
+            },
+            py::arg("ticks") = 1, py::call_guard<py::gil_scoped_release>(),
+            "Run a number of ticks without holding the GIL.")
+        .def_property_readonly("size", &Ensemble::getSize)
+        .def_property_readonly("ticks", &Ensemble::getTicks)
+        .def("max_change", &Ensemble::getMaxChange, py::arg("member"))
+        .def_property_readonly(
+            "densities",
+            [](py::object self) {
+                Ensemble& ensemble = self.cast<Ensemble&>();
+                py::array lanes =
+                    viewOf(ensemble.getDensities(), ensemble.getLayout(), self,
+                           ensemble.getLanes());
+                // Lanes past the last member are padding
+                return py::object(lanes[py::make_tuple(
+                    py::ellipsis(), py::slice(0, ensemble.getSize(), 1))]);
+            },
+            "Read-only height × width × members view of the densities, "
+            "valid until the next step.");
+
+    py::class_<Species>(m, "Species")
+        .def(py::init(&makeSpecies), py::arg("layout"), py::arg("count"),
+             py::arg("sources"),
+             "Carry count species through a layout from emitters given as "
+             "(species, row, col, rate).")
+        .def_readwrite("emitter_rate", &Species::emitter_rate)
+        .def_readwrite("escape_rate", &Species::escape_rate)
+        .def_readwrite("use_precalc_weights", &Species::use_precalc_weights)
+        .def_readwrite("elevation_bias", &Species::elevation_bias)
+        .def(
+            "step",
+            [](Species& species, unsigned long ticks) {
+                for (unsigned long tick = 0; tick < ticks; tick++)
+                    species.tick();
+            },
+            py::arg("ticks") = 1, py::call_guard<py::gil_scoped_release>(),
+            "Run a number of ticks without holding the GIL.")
+        .def_property_readonly("size", &Species::getSize)
+        .def_property_readonly("ticks", &Species::getTicks)
+        .def("mass", &Species::getMass, py::arg("species"))
+        .def_property_readonly(
+            "densities",
+            [](py::object self) {
+                Species& species = self.cast<Species&>();
+                py::array lanes =
+                    viewOf(species.getDensities(), species.getBoard(), self,
+                           species.getLanes());
+                // Lanes past the last species are padding
+                return py::object(lanes[py::make_tuple(
+                    py::ellipsis(), py::slice(0, species.getSize(), 1))]);
+            },
+            "Read-only height × width × species view of the densities, "
+            "valid until the next step.");
+}
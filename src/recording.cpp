@@ -0,0 +1,320 @@
+/**
+ * @file recording.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "recording.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Split the densities into byte planes, as differences from the
+ * previous ones unless previous is null.
+ */
+static void encodeFrame(const float* densities, const float* previous,
+                        size_t cells, unsigned char* planes) {
+    for (size_t idx = 0; idx < cells; idx++) {
+        uint32_t bits, base = 0;
+        std::memcpy(&bits, densities + idx, sizeof(bits));
+        if (previous != nullptr)
+            std::memcpy(&base, previous + idx, sizeof(base));
+        bits -= base;
+        for (int plane = 0; plane < 4; plane++)
+            planes[plane * cells + idx] = bits >> (24 - 8 * plane);
+    }
+}
+
+/**
+ * @brief Undo encodeFrame() in place, previous being the densities of the
+ * last frame.
+ */
+static void decodeFrame(const unsigned char* planes, size_t cells, bool key,
+                        float* densities) {
+    for (size_t idx = 0; idx < cells; idx++) {
+        uint32_t bits = 0, base = 0;
+        for (int plane = 0; plane < 4; plane++)
+            bits |= (uint32_t)planes[plane * cells + idx] << (24 - 8 * plane);
+        if (!key) std::memcpy(&base, densities + idx, sizeof(base));
+        bits += base;
+        std::memcpy(densities + idx, &bits, sizeof(bits));
+    }
+}
+
+void Recorder::planFootprint(Footprint* footprint, uint width, uint height,
+                             size_t max_pending) {
+    size_t bytes = (size_t)width * height * sizeof(float);
+    // Besides those queued, one frame is filled and one written at a time
+    size_t frames = std::max(max_pending, (size_t)1) + 1;
+    footprint->add("recorder buffers",
+                   (frames + 2) * bytes + compressBound(bytes));
+}
+
+Recorder::Recorder(const std::string& path, uint width, uint height,
+                   uint every, size_t max_pending) {
+    if (every == 0)
+        throw std::runtime_error("Frames must be at least a tick apart.");
+    this->width = width;
+    this->height = height;
+    this->every = every;
+    this->max_pending = std::max(max_pending, (size_t)1);
+    this->fp = fopen(path.c_str(), "wb");
+    if (this->fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    RecordingHeader header;
+    std::memcpy(header.magic, recording_magic, sizeof(header.magic));
+    header.version = recording_version;
+    header.width = width;
+    header.height = height;
+    header.every = every;
+    if (fwrite(&header, sizeof(header), 1, this->fp) != 1) {
+        fclose(this->fp);
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+    this->thread = std::thread(&Recorder::loop, this);
+}
+
+Recorder::~Recorder() {
+    try {
+        this->close();
+    } catch (...) {
+    }
+}
+
+void Recorder::capture(Sim& sim) {
+    unsigned int tick = sim.getTicks();
+    if (tick % this->every != 0) return;
+    TraceScope trace(sim.tracer, "record", "tick", tick);
+    Board* board = sim.board;
+    if (board->getWidth() != this->width ||
+        board->getHeight() != this->height)
+        throw std::runtime_error("The board does not match the recording.");
+    std::vector<float> densities;
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto ready = [&] {
+            return this->error || this->pending.size() < this->max_pending;
+        };
+        if (!ready()) {
+            this->stalls++;
+            this->room.wait(lock, ready);
+        }
+        if (this->error) std::rethrow_exception(this->error);
+        if (!this->spare.empty()) {
+            densities = std::move(this->spare.back());
+            this->spare.pop_back();
+        }
+    }
+    // Copy without the halo, while the recorder thread gets on with its work
+    densities.resize((size_t)this->width * this->height);
+    const float* src = board->getDensities();
+    for (uint row = 0; row < this->height; row++) {
+        size_t idx = board->indexOf(row, 0);
+        std::copy(src + idx, src + idx + this->width,
+                  densities.begin() + (size_t)row * this->width);
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back({tick, std::move(densities)});
+    }
+    this->wake.notify_one();
+}
+
+void Recorder::close() {
+    if (this->thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->quit = true;
+        }
+        this->wake.notify_one();
+        this->thread.join();
+    }
+    if (this->fp != nullptr) {
+        bool ok = fclose(this->fp) == 0;
+        this->fp = nullptr;
+        if (!ok && !this->error) {
+            this->error = std::make_exception_ptr(std::runtime_error(
+                "An I/O error occurred while writing the file."));
+        }
+    }
+    if (this->error) std::rethrow_exception(this->error);
+}
+
+void Recorder::loop() {
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(
+                lock, [&] { return this->quit || !this->pending.empty(); });
+            // Pending frames are written before quitting
+            if (this->pending.empty()) return;
+            frame = std::move(this->pending.front());
+            this->pending.pop_front();
+        }
+        this->room.notify_one();
+        try {
+            this->write(frame);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->error = std::current_exception();
+            this->room.notify_all();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->spare.push_back(std::move(frame.densities));
+    }
+}
+
+void Recorder::write(Frame& frame) {
+    size_t cells = frame.densities.size();
+    bool key = this->frames % Recorder::key_interval == 0;
+    this->planes.resize(cells * sizeof(float));
+    encodeFrame(frame.densities.data(),
+                key ? nullptr : this->previous.data(), cells,
+                this->planes.data());
+    uLongf size = compressBound(this->planes.size());
+    this->compressed.resize(size);
+    if (compress2(this->compressed.data(), &size, this->planes.data(),
+                  this->planes.size(), Z_BEST_SPEED) != Z_OK)
+        throw std::runtime_error("Failed to compress a frame.");
+    RecordingChunk chunk = {frame.tick, key ? Recording::KeyFrame : 0u,
+                            (uint32_t)size};
+    if (fwrite(&chunk, sizeof(chunk), 1, this->fp) != 1 ||
+        fwrite(this->compressed.data(), 1, size, this->fp) != size) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+    // The frame becomes the base of the next one
+    std::swap(this->previous, frame.densities);
+    this->frames++;
+}
+
+Playback::Playback(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    struct stat status;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(header))
+        mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw std::runtime_error("Truncated recording.");
+    this->data = (const unsigned char*)mapped;
+    this->size = status.st_size;
+    std::memcpy(&this->header, this->data, sizeof(this->header));
+    const char* error = nullptr;
+    if (std::memcmp(this->header.magic, recording_magic,
+                    sizeof(this->header.magic)))
+        error = "Not a recording.";
+    else if (this->header.version != recording_version)
+        error = "Unsupported recording version.";
+    // Only the headers of the chunks are read, the frames are left as is
+    size_t offset = sizeof(this->header);
+    while (error == nullptr && offset < this->size) {
+        RecordingChunk chunk;
+        if (this->size - offset < sizeof(chunk)) {
+            error = "Truncated recording.";
+            break;
+        }
+        std::memcpy(&chunk, this->data + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if (this->size - offset < chunk.size) {
+            error = "Truncated recording.";
+            break;
+        }
+        this->frames.push_back({chunk.tick,
+                                (chunk.flags & Recording::KeyFrame) != 0,
+                                chunk.size, offset});
+        offset += chunk.size;
+    }
+    if (error != nullptr) {
+        munmap(mapped, this->size);
+        throw std::runtime_error(error);
+    }
+}
+
+Playback::~Playback() { munmap((void*)this->data, this->size); }
+
+void Playback::decode(size_t frame, std::vector<float>& densities) {
+    const Entry& entry = this->frames[frame];
+    size_t cells = (size_t)this->header.width * this->header.height;
+    this->planes.resize(cells * sizeof(float));
+    uLongf size = this->planes.size();
+    if (uncompress(this->planes.data(), &size, this->data + entry.offset,
+                   entry.size) != Z_OK ||
+        size != this->planes.size())
+        throw std::runtime_error("Corrupt frame in the recording.");
+    densities.resize(cells);
+    decodeFrame(this->planes.data(), cells, entry.key, densities.data());
+}
+
+size_t Playback::findFrame(unsigned int tick) {
+    auto after = std::upper_bound(
+        this->frames.begin(), this->frames.end(), tick,
+        [](unsigned int tick, const Entry& entry) {
+            return tick < entry.tick;
+        });
+    return after == this->frames.begin() ? 0
+                                         : after - this->frames.begin() - 1;
+}
+
+const std::vector<float>& Playback::seek(size_t frame) {
+    if (frame >= this->frames.size())
+        throw std::runtime_error("No such frame in the recording.");
+    if ((long)frame == this->current_frame) return this->current;
+    long key = frame;
+    while (key >= 0 && !this->frames[key].key) key--;
+    if (key < 0) throw std::runtime_error("The recording lacks a key frame.");
+    // Carry on from the frame last decoded if it is on the way
+    long from = this->current_frame;
+    if (from < key || from > (long)frame) {
+        if (this->key_frame != key) {
+            this->key_frame = -1;
+            this->decode(key, this->key);
+            this->key_frame = key;
+        }
+        this->current = this->key;
+        from = key;
+    }
+    this->current_frame = -1;
+    for (long next = from + 1; next <= (long)frame; next++)
+        this->decode(next, this->current);
+    this->current_frame = frame;
+    return this->current;
+}
+
+bool Playback::next(unsigned int* tick, std::vector<float>& densities) {
+    if (this->cursor == this->frames.size()) return false;
+    densities = this->seek(this->cursor);
+    *tick = this->frames[this->cursor].tick;
+    this->cursor++;
+    return true;
+}
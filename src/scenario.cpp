@@ -0,0 +1,183 @@
+/**
+ * @file scenario.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scenario.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "checkpoint.hpp"
+
+/**
+ * @brief Parse the event of one line of a scenario, after its tick.
+ * @return false if the line is not a valid event.
+ */
+static bool parseEvent(
+    std::istringstream& line, const std::string& dir,
+    const std::function<void(const std::string&)>& check_path,
+    ScenarioEvent* event) {
+    std::string kind;
+    if (!(line >> kind)) return false;
+    if (kind == "emitter" || kind == "escape") {
+        event->kind = kind == "emitter" ? ScenarioEvent::Emitter
+                                        : ScenarioEvent::Escape;
+        if (!(line >> event->row >> event->col >> event->rate)) return false;
+    } else if (kind == "emitter-rate" || kind == "escape-rate") {
+        event->kind = kind == "emitter-rate" ? ScenarioEvent::EmitterRate
+                                             : ScenarioEvent::EscapeRate;
+        if (!(line >> event->rate) ||
+            !(event->rate >= 0.f && event->rate <= 1.f))
+            return false;
+    } else if (kind == "curve") {
+        event->kind = ScenarioEvent::Curve;
+        std::string spec;
+        if (!(line >> event->row >> event->col >> spec)) return false;
+        if (spec != "none") {
+            // Files are found next to the scenario
+            if (!GrowthCurve::isShape(spec)) {
+                if (check_path) check_path(spec);
+                if (spec[0] != '/') spec = dir + spec;
+            }
+            event->curve = std::make_shared<const GrowthCurve>(
+                GrowthCurve::parse(spec));
+        }
+    } else if (kind == "cell") {
+        event->kind = ScenarioEvent::SetCell;
+        std::string type;
+        if (!(line >> event->row >> event->col >> type)) return false;
+        if (type == "wall") {
+            event->type = Cell::Wall;
+        } else if (type == "floor") {
+            event->type = Cell::Floor;
+        } else if (type == "escape") {
+            event->type = Cell::Escape;
+        } else {
+            return false;
+        }
+    } else if (kind == "checkpoint") {
+        event->kind = ScenarioEvent::Checkpoint;
+        if (!(line >> event->path)) return false;
+        if (check_path) check_path(event->path);
+        if (event->path[0] != '/') event->path = dir + event->path;
+    } else if (kind == "stop") {
+        event->kind = ScenarioEvent::Stop;
+    } else {
+        return false;
+    }
+    std::string rest;
+    return !(line >> rest);
+}
+
+Scenario::Scenario(const std::string& path,
+                   std::function<void(const std::string&)> check_path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for reading.");
+    }
+    size_t slash = path.find_last_of('/');
+    std::string dir =
+        slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::string text;
+    for (uint number = 1; std::getline(file, text); number++) {
+        size_t comment = text.find('#');
+        if (comment != std::string::npos) text.erase(comment);
+        std::istringstream line(text);
+        // Lines without anything but blanks are skipped
+        if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+        ScenarioEvent event;
+        if (!(line >> event.tick) ||
+            !parseEvent(line, dir, check_path, &event)) {
+            std::stringstream ss;
+            ss << "Invalid event at line " << number << " of the scenario.";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        this->events.push_back(event);
+    }
+    if (file.bad()) {
+        throw std::runtime_error(
+            "An I/O error occurred while reading the file.");
+    }
+    std::stable_sort(this->events.begin(), this->events.end(),
+                     [](const ScenarioEvent& a, const ScenarioEvent& b) {
+                         return a.tick < b.tick;
+                     });
+}
+
+void Scenario::seek(unsigned long tick) {
+    while (this->next < this->events.size() &&
+           this->events[this->next].tick < tick)
+        this->next++;
+}
+
+bool Scenario::apply(Sim& sim, bool* cells_changed, Crowd* crowd) {
+    if (cells_changed != nullptr) *cells_changed = false;
+    for (; this->nextTick() == sim.getTicks(); this->next++) {
+        const ScenarioEvent& event = this->events[this->next];
+        Board* board = sim.board;
+        switch (event.kind) {
+            case ScenarioEvent::Emitter:
+                if (board->contains(event.row, event.col) &&
+                    board->getTypes()[board->indexOf(event.row, event.col)] ==
+                        Cell::Floor) {
+                    // Emitters change the weights of their neighbours
+                    board->placeEmitter(event.row, event.col, event.rate);
+                    board->computeWeightsAround(event.row, event.col);
+                    sim.touchBoard();
+                    // Occupants walk around emitters
+                    if (crowd != nullptr)
+                        crowd->updateCell(event.row, event.col);
+                    if (cells_changed != nullptr) *cells_changed = true;
+                } else {
+                    board->setEmitterRate(event.row, event.col, event.rate);
+                }
+                break;
+            case ScenarioEvent::Escape:
+                board->setEscapeRate(event.row, event.col, event.rate);
+                break;
+            case ScenarioEvent::EmitterRate:
+                sim.emitter_rate = event.rate;
+                break;
+            case ScenarioEvent::EscapeRate:
+                sim.escape_rate = event.rate;
+                break;
+            case ScenarioEvent::Curve:
+                sim.setEmitterCurve(event.row, event.col, event.curve);
+                break;
+            case ScenarioEvent::SetCell:
+                if (crowd != nullptr) {
+                    crowd->setCellType(event.row, event.col, event.type);
+                } else {
+                    sim.setCellType(event.row, event.col, event.type);
+                }
+                if (cells_changed != nullptr) *cells_changed = true;
+                break;
+            case ScenarioEvent::Checkpoint:
+                writeCheckpoint(sim, event.path);
+                break;
+            case ScenarioEvent::Stop:
+                this->next++;
+                return false;
+        }
+    }
+    return true;
+}
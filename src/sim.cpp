@@ -0,0 +1,2175 @@
+/**
+ * @file sim.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <type_traits>
+
+#include "coarse.hpp"
+#include "kernel.hpp"
+#include "philox.hpp"
+
+/* Type the transition function computes in for each density storage. */
+template <typename T>
+using Real = decltype(decodeDensity(T()));
+
+Sim::Sim(uint board_width, uint board_height, const char* const layout,
+         uint emitter_row, uint emitter_col, size_t layout_stride) {
+    this->board =
+        new Board(board_width, board_height, layout, layout_stride);
+    try {
+        this->board->placeEmitter(emitter_row, emitter_col);
+    } catch (std::runtime_error& e) {
+        delete this->board;
+        throw;
+    }
+    this->board->computeWeightsAround(emitter_row, emitter_col);
+}
+
+Sim::Sim(Board* board) { this->board = board; }
+
+Sim* Sim::fork() {
+    if (this->backend != nullptr) this->backend->download(*this);
+    Sim* copy = new Sim(this->board->fork());
+    copy->ticks = this->ticks;
+    copy->tile_rows = this->tile_rows;
+    copy->tile_cols = this->tile_cols;
+    copy->tile_active = this->tile_active;
+    copy->tile_was_active = this->tile_was_active;
+    copy->tile_live = this->tile_live;
+    copy->tile_quiet = this->tile_quiet;
+    copy->tile_change = this->tile_change;
+    copy->tile_skipped = this->tile_skipped;
+    copy->activity_stale = this->activity_stale;
+    copy->activity_tracked = this->activity_tracked;
+    copy->activity_synchronous = this->activity_synchronous;
+    copy->activity_diagonal = this->activity_diagonal;
+    copy->tile_sources = this->tile_sources;
+    copy->runs = this->runs;
+    copy->run_rows = this->run_rows;
+    copy->runs_stale = this->runs_stale;
+    copy->unsynced_begin = this->unsynced_begin;
+    copy->unsynced_end = this->unsynced_end;
+    copy->outlets = this->outlets;
+    copy->escape_cells = this->escape_cells;
+    copy->escape_outflows = this->escape_outflows;
+    copy->outflow = this->outflow;
+    copy->max_change = this->max_change;
+    copy->change_norm = this->change_norm;
+    copy->converged = this->converged;
+    copy->mass = this->mass;
+    copy->histogram = this->histogram;
+    copy->arrivals = this->arrivals;
+    copy->arrivals_threshold = this->arrivals_threshold;
+    copy->doses = this->doses;
+    copy->curves = this->curves;
+    this->copySettings(copy);
+    return copy;
+}
+
+void Sim::copySettings(Sim* copy) {
+    copy->track_outflow = this->track_outflow;
+    copy->arrival_threshold = this->arrival_threshold;
+    copy->track_dose = this->track_dose;
+    copy->tick_rate = this->tick_rate;
+    copy->emitter_rate = this->emitter_rate;
+    copy->escape_rate = this->escape_rate;
+    copy->use_precalc_weights = this->use_precalc_weights;
+    copy->update_mode = this->update_mode;
+    copy->threads = this->threads;
+    copy->pin_threads = this->pin_threads;
+    copy->time_block = this->time_block;
+    copy->kernel = this->kernel;
+    copy->stencil = this->stencil;
+    copy->track_activity = this->track_activity;
+    copy->elevation_bias = this->elevation_bias;
+    copy->draft_noise = this->draft_noise;
+    copy->draft_seed = this->draft_seed;
+    copy->tolerance = this->tolerance;
+    copy->quiet_threshold = this->quiet_threshold;
+    copy->quiet_period = this->quiet_period;
+    copy->track_mass = this->track_mass;
+    copy->histogram_bins = this->histogram_bins;
+    copy->occupied_density = this->occupied_density;
+    copy->tracer = this->tracer;
+}
+
+Sim* Sim::coarsen(uint factor) {
+    if (this->backend != nullptr) this->backend->download(*this);
+    Sim* copy = new Sim(coarsenBoard(this->board, factor));
+    this->copySettings(copy);
+    copy->ticks = this->ticks / (factor * factor);
+    return copy;
+}
+
+void Sim::prolong(Sim& coarse, uint factor) {
+    if (this->backend != nullptr) {
+        throw std::runtime_error(
+            "Densities cannot be prolonged while a backend is attached.");
+    }
+    prolongDensities(coarse.board, this->board, factor);
+    this->touchBoard();
+    this->ticks = coarse.ticks * factor * factor;
+}
+
+KernelArgs Sim::kernelArgs(const float* src, float* dst, float emitter_rate,
+                           float escape_rate, bool use_precalc_weights,
+                           WorkerPool* workers) {
+    bool uniform = this->board->hasUniformRates();
+    if (!this->board->hasFlowCoefficients(use_precalc_weights,
+                                          this->elevation_bias)) {
+        this->board->computeFlowCoefficients(use_precalc_weights,
+                                             this->elevation_bias, workers,
+                                             tile_size);
+        // The coefficients are rebuilt whenever the cell types change
+        this->resetSources();
+    } else if (this->tile_sources.empty()) {
+        // The coefficients were computed before this simulation first ticked,
+        // such as by a Graph made of its board
+        this->resetSources();
+    }
+    return {this->board->getTypes(),
+            this->board->getLinks(),
+            this->board->getInflowCoefficients(),
+            this->board->getOutflowCoefficients(),
+            src,
+            dst,
+            this->board->getFixedDensities(),
+            this->board->getNextFixedDensities(),
+            this->board->getDoubleDensities(),
+            this->board->getNextDoubleDensities(),
+            uniform ? nullptr : this->board->getRateIndices(),
+            uniform ? nullptr : this->board->getRates(),
+            this->board->getStride(),
+            emitter_rate,
+            escape_rate,
+            !use_precalc_weights && this->elevation_bias == 0.f &&
+                this->board->getWinds().empty()};
+}
+
+bool Sim::cycle() {
+    /* Check if we're running: if so, decrement the Frame Skip Counter until
+     * we reach zero, then run the update cycle. We're assuming this is
+     * executed once per frame. */
+    if (this->state == Sim::State::Stop ||
+        (this->state == Sim::State::Run && (--this->frame_skip_counter) > 0))
+        return false;
+    this->tick();
+    if (this->converged) this->state = Sim::State::Stop;
+    // Avoid resetting the FSC if we're single-stepping.
+    if (this->state == Sim::State::Run)
+        this->frame_skip_counter = this->tick_rate;
+    return true;
+}
+
+/**
+ * @brief Add a value to a Kahan-compensated sum.
+ *
+ * The carry holds the rounding error of the sum so far, to be subtracted
+ * from it.
+ */
+static inline void addCompensated(double* sum, double* carry, double value) {
+    double next = value - *carry;
+    double total = *sum + next;
+    *carry = (total - *sum) - next;
+    *sum = total;
+}
+
+WorkerPool* Sim::workerPool(uint threads) {
+    if (threads <= 1) return nullptr;
+    if (this->workers == nullptr || this->workers->getSize() != threads ||
+        this->workers->isPinned() != this->pin_threads) {
+        delete this->workers;
+        this->workers = new WorkerPool(threads, this->pin_threads);
+    }
+    return this->workers;
+}
+
+/* Workers pick the blocks up one at a time, from their own band of tile rows
+ * first, the one whose coefficients and densities they touched first and
+ * that were placed on their NUMA node, then from the bands of the others, to
+ * keep them all busy. Blocks are numbered in row-major order, row_blocks to
+ * a row. */
+template <typename Job>
+void Sim::runBlocks(WorkerPool* workers, uint threads, size_t block_rows,
+                    size_t row_blocks, Job job) {
+    if (workers == nullptr) {
+        TraceScope trace(this->tracer, "band", "worker", 0);
+        for (size_t block = 0; block < block_rows * row_blocks; block++)
+            job(0, block);
+        return;
+    }
+    std::vector<std::atomic<size_t>> next(threads);
+    std::vector<size_t> band_ends(threads);
+    for (uint worker = 0; worker < threads; worker++) {
+        size_t begin, end;
+        WorkerPool::getBand(worker, threads, block_rows, 1, &begin, &end);
+        next[worker] = begin * row_blocks;
+        band_ends[worker] = end * row_blocks;
+    }
+    workers->run([&](uint worker) {
+        TraceScope trace(this->tracer, "band", "worker", worker);
+        for (uint i = 0; i < threads; i++) {
+            uint band = (worker + i) % threads;
+            for (size_t block = next[band]++; block < band_ends[band];
+                 block = next[band]++)
+                job(worker, block);
+        }
+    });
+}
+
+void Sim::tick() {
+    TraceScope trace(this->tracer, "tick", "tick", this->ticks);
+    CounterScope count(this->counters);
+    this->applyCurves();
+    // Parameters are latched for the whole tick
+    float emitter_rate = this->emitter_rate;
+    float escape_rate = this->escape_rate;
+    bool use_precalc_weights = this->use_precalc_weights;
+    bool synchronous = this->update_mode == Sim::Update::Synchronous;
+    bool red_black = this->update_mode == Sim::Update::RedBlack;
+    Board::Storage storage = this->board->getStorage();
+    if (storage == Board::Storage::Fixed && !synchronous) {
+        throw std::runtime_error(
+            "Fixed-point densities need synchronous updates.");
+    }
+    if (!(this->draft_noise >= 0.f && this->draft_noise <= 1.f))
+        throw std::runtime_error("The draft noise must be in [0, 1].");
+    bool moore = this->stencil == Sim::Stencil::Moore;
+    if (moore && (!synchronous || this->backend != nullptr ||
+                  this->draft_noise > 0.f || this->track_outflow)) {
+        throw std::runtime_error(
+            "The Moore stencil needs synchronous updates on the CPU, without "
+            "drafts or outflow measurement.");
+    }
+    if (moore && (use_precalc_weights || this->elevation_bias != 0.f ||
+                  !this->board->getWinds().empty())) {
+        throw std::runtime_error(
+            "The Moore stencil needs uniform weights, level floors and no "
+            "winds.");
+    }
+    if (red_black && (moore || this->draft_noise > 0.f)) {
+        throw std::runtime_error(
+            "Red-black updates run the von Neumann stencil without drafts.");
+    }
+    // Smoke can turn a corner within a red-black tick
+    bool diagonal = moore || red_black;
+    bool quiet = this->quiet_threshold > 0.f;
+    if (quiet && this->quiet_period == 0)
+        throw std::runtime_error("The quiet period must be at least a tick.");
+    if (quiet && (!synchronous || moore || this->draft_noise > 0.f)) {
+        throw std::runtime_error(
+            "Quiet tiles need synchronous von Neumann ticks without drafts.");
+    }
+    if (storage != Board::Storage::Float && this->backend != nullptr) {
+        throw std::runtime_error(
+            "Fixed-point and double densities can only be updated on the "
+            "CPU.");
+    }
+    if (!this->curves.empty() && this->backend != nullptr)
+        throw std::runtime_error("Emitter curves only drive the CPU kernels.");
+    // Forks of the board share its densities until they are written
+    if (this->backend == nullptr) this->board->ownDensities();
+    this->activity_tracked = this->track_activity && this->backend == nullptr;
+    if (!this->activity_tracked ||
+        this->activity_synchronous != synchronous ||
+        this->activity_diagonal != diagonal)
+        this->activity_stale = true;
+    if (this->activity_stale) this->resetActivity();
+    this->quiet_tracked = quiet && this->activity_tracked;
+    this->quiet_skips = 0;
+    for (size_t tile = 0; tile < this->tile_quiet.size(); tile++) {
+        // Quiet tiles take turns, one in every quiet_period in a row updated
+        bool skip = this->quiet_tracked && this->tile_active[tile] &&
+                    this->tile_quiet[tile] &&
+                    (this->ticks + tile) % this->quiet_period != 0;
+        this->tile_skipped[tile] = skip;
+        this->quiet_skips += skip;
+        if (!this->quiet_tracked) this->tile_quiet[tile] = 0;
+    }
+    bool measure = this->tolerance > 0.f && this->backend == nullptr;
+    std::vector<Change> changes(measure ? std::max(1u, this->threads) : 0);
+    bool census = this->histogram_bins > 0 && this->backend == nullptr;
+    // The mean of the histogram is that of the mass
+    bool weigh = (this->track_mass || census) && this->backend == nullptr;
+    std::vector<Mass> masses(weigh ? 1 : 0);
+    // Bins only count cells, so each worker fills its own in any order
+    std::vector<DensityHistogram> histograms(
+        census ? std::max(1u, this->threads) : 0);
+    for (auto& histogram : histograms)
+        histogram.bins.assign(this->histogram_bins, 0);
+    this->arrivals_tracked =
+        this->arrival_threshold > 0.f && this->backend == nullptr;
+    if (this->arrivals_tracked &&
+        (this->arrivals.empty() ||
+         this->arrivals_threshold != this->arrival_threshold)) {
+        this->arrivals.assign(this->board->getPaddedSize(), not_arrived);
+        this->arrivals_threshold = this->arrival_threshold;
+    }
+    this->doses_tracked = this->track_dose && this->backend == nullptr;
+    if (this->doses_tracked &&
+        this->doses.size() != this->board->getPaddedSize())
+        this->doses.assign(this->board->getPaddedSize(), 0.);
+    // Workers share the tiles of synchronous and red-black ticks
+    uint threads = (synchronous || red_black) && this->backend == nullptr
+                       ? std::max(1u, this->threads)
+                       : 1;
+    WorkerPool* workers = this->workerPool(threads);
+    if (this->track_outflow && this->backend == nullptr) {
+        KernelArgs args =
+            this->kernelArgs(nullptr, nullptr, emitter_rate, escape_rate,
+                             use_precalc_weights, workers);
+        switch (storage) {
+            case Board::Storage::Float:
+                this->measureOutflow(args, this->board->getDensities());
+                break;
+            case Board::Storage::Fixed:
+                this->measureOutflow(args, this->board->getFixedDensities());
+                break;
+            case Board::Storage::Double:
+                this->measureOutflow(args, this->board->getDoubleDensities());
+                break;
+        }
+    } else {
+        this->escape_outflows.assign(this->escape_cells.size(), 0.);
+        this->outflow = 0.;
+    }
+    if (this->backend != nullptr) {
+        this->backend->tick(*this, emitter_rate, escape_rate,
+                            use_precalc_weights);
+        // Downloads only write the current densities
+        this->unsync(0, UINT_MAX);
+    } else if (synchronous) {
+        // The float densities are not touched unless they are stored
+        KernelArgs args = this->kernelArgs(
+            storage == Board::Storage::Float ? this->board->getDensities()
+                                             : nullptr,
+            this->board->getNextDensities(), emitter_rate, escape_rate,
+            use_precalc_weights, workers);
+        if (this->runs_stale) this->resetRuns();
+        if (this->unsynced_begin < this->unsynced_end) {
+            this->board->syncDensities(
+                this->unsynced_begin,
+                std::min(this->unsynced_end, this->board->getHeight()));
+            this->unsynced_begin = this->unsynced_end = 0;
+        }
+        /* Blocks span whole rows of tiles, unless that leaves too few of
+         * them to keep every worker busy on a board that is only a few tiles
+         * tall. */
+        uint splits = 1;
+        if (threads > 1)
+            splits = (4 * threads + this->tile_rows - 1) / this->tile_rows;
+        splits = std::min(splits, this->tile_cols);
+        this->block_tiles = (this->tile_cols + splits - 1) / splits;
+        size_t blocks = (size_t)this->tile_rows *
+                        ((this->tile_cols + this->block_tiles - 1) /
+                         this->block_tiles);
+        // Blocks are weighed apart and added up in order, whoever ran them
+        if (weigh) masses.resize(blocks);
+        auto update = [&](size_t block, Change* change,
+                          DensityHistogram* histogram) {
+            Mass* mass = weigh ? &masses[block] : nullptr;
+            switch (storage) {
+                case Board::Storage::Float:
+                    this->updateBlock<float>(args, block, change, mass,
+                                             histogram);
+                    break;
+                case Board::Storage::Fixed:
+                    this->updateBlock<Fixed16>(args, block, change, mass,
+                                               histogram);
+                    break;
+                case Board::Storage::Double:
+                    this->updateBlock<double>(args, block, change, mass,
+                                              histogram);
+                    break;
+            }
+        };
+        this->runBlocks(workers, threads, this->tile_rows,
+                        blocks / this->tile_rows,
+                        [&](uint worker, size_t block) {
+                            update(block,
+                                   measure ? &changes[worker] : nullptr,
+                                   census ? &histograms[worker] : nullptr);
+                        });
+        this->board->swapDensities();
+    } else if (red_black) {
+        KernelArgs args =
+            this->kernelArgs(nullptr, nullptr, emitter_rate, escape_rate,
+                             use_precalc_weights, workers);
+        // Rows of tiles are weighed apart and added up in order
+        if (weigh) masses.resize(this->tile_rows);
+        if (storage == Board::Storage::Double) {
+            this->updateRedBlack<double>(args, workers, threads,
+                                         measure ? &changes : nullptr,
+                                         weigh ? &masses : nullptr,
+                                         census ? &histograms : nullptr);
+        } else {
+            this->updateRedBlack<float>(args, workers, threads,
+                                        measure ? &changes : nullptr,
+                                        weigh ? &masses : nullptr,
+                                        census ? &histograms : nullptr);
+        }
+    } else {
+        Change* change = measure ? &changes[0] : nullptr;
+        Mass* mass = weigh ? &masses[0] : nullptr;
+        DensityHistogram* histogram = census ? &histograms[0] : nullptr;
+        if (storage == Board::Storage::Double) {
+            this->updateInPlace<double>(emitter_rate, escape_rate,
+                                        use_precalc_weights, change, mass,
+                                        histogram);
+        } else {
+            this->updateInPlace<float>(emitter_rate, escape_rate,
+                                       use_precalc_weights, change, mass,
+                                       histogram);
+        }
+    }
+    Change total;
+    for (auto& change : changes) {
+        total.max = std::max(total.max, change.max);
+        total.squares += change.squares;
+    }
+    this->max_change = total.max;
+    this->change_norm = std::sqrt(total.squares);
+    this->converged = measure && this->max_change < this->tolerance &&
+                      !this->curves_growing;
+    Mass total_mass;
+    for (auto& mass : masses) {
+        addCompensated(&total_mass.sum, &total_mass.carry, mass.sum);
+        addCompensated(&total_mass.sum, &total_mass.carry, -mass.carry);
+    }
+    this->mass = total_mass.sum - total_mass.carry;
+    this->histogram = DensityHistogram();
+    if (census) {
+        this->histogram.bins.assign(this->histogram_bins, 0);
+        for (auto& histogram : histograms) {
+            for (uint bin = 0; bin < this->histogram_bins; bin++)
+                this->histogram.bins[bin] += histogram.bins[bin];
+            this->histogram.cells += histogram.cells;
+            this->histogram.occupied += histogram.occupied;
+            this->histogram.max = std::max(this->histogram.max, histogram.max);
+        }
+        // The cells that were not visited are empty
+        size_t cells = this->countFloorCells();
+        this->histogram.bins[0] += cells - this->histogram.cells;
+        this->histogram.cells = cells;
+        this->histogram.mean = cells > 0 ? this->mass / cells : 0.;
+    }
+    this->markUpdatedRows();
+    if (this->activity_tracked) this->updateActivity(diagonal);
+    this->activity_synchronous = synchronous;
+    this->activity_diagonal = diagonal;
+    this->ticks++;
+}
+
+size_t Sim::countFloorCells() {
+    if (this->floor_generation == this->board->getCellGeneration())
+        return this->floor_cells;
+    const Cell::Type* type = this->board->getTypes();
+    this->floor_cells = 0;
+    for (uint row = 0; row < this->board->getHeight(); row++) {
+        size_t idx = this->board->indexOf(row, 0);
+        this->floor_cells +=
+            std::count(type + idx, type + idx + this->board->getWidth(),
+                       Cell::Floor);
+    }
+    this->floor_generation = this->board->getCellGeneration();
+    return this->floor_cells;
+}
+
+// Only the rows of the tiles that were updated can have changed
+void Sim::markUpdatedRows() {
+    uint begin = 0, end = this->board->getHeight();
+    if (this->activity_tracked) {
+        uint first = this->tile_rows, last = 0;
+        for (size_t tile = 0; tile < this->tile_active.size(); tile++) {
+            if (!this->tile_active[tile]) continue;
+            uint tile_row = tile / this->tile_cols;
+            first = std::min(first, tile_row);
+            last = tile_row + 1;
+        }
+        begin = std::min(first * tile_size, end);
+        end = std::min(last * tile_size, end);
+    }
+    this->board->markRows(begin, end);
+}
+
+void Sim::resetActivity() {
+    this->tile_rows = (this->board->getHeight() + tile_size - 1) / tile_size;
+    this->tile_cols = (this->board->getWidth() + tile_size - 1) / tile_size;
+    size_t tiles = (size_t)this->tile_rows * this->tile_cols;
+    this->tile_active.assign(tiles, 1);
+    this->tile_was_active.assign(tiles, 1);
+    this->tile_live.assign(tiles, 0);
+    this->tile_quiet.assign(tiles, 0);
+    this->tile_change.assign(tiles, 0.f);
+    this->tile_skipped.assign(tiles, 0);
+    this->activity_stale = false;
+}
+
+void Sim::touchRows(uint begin, uint end) {
+    this->unsync(begin, end);
+    if (this->activity_stale || begin >= end) return;
+    uint first = begin / tile_size, last = (end - 1) / tile_size + 1;
+    first = first > 0 ? first - 1 : 0;
+    last = std::min(last + 1, this->tile_rows);
+    std::fill(this->tile_active.begin() + (size_t)first * this->tile_cols,
+              this->tile_active.begin() + (size_t)last * this->tile_cols, 1);
+    std::fill(this->tile_quiet.begin() + (size_t)first * this->tile_cols,
+              this->tile_quiet.begin() + (size_t)last * this->tile_cols, 0);
+}
+
+void Sim::resetSources() {
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    uint tile_cols = (width + tile_size - 1) / tile_size;
+    this->tile_sources.assign(
+        (size_t)((height + tile_size - 1) / tile_size) * tile_cols, 0);
+    const Cell::Type* type = this->board->getTypes();
+    this->escape_cells.clear();
+    for (uint row = 0; row < height; row++) {
+        for (uint col = 0; col < width; col++) {
+            size_t idx = this->board->indexOf(row, col);
+            Cell::Type cell = type[idx];
+            if (cell != Cell::Emitter && cell != Cell::Escape) continue;
+            if (cell == Cell::Escape) this->escape_cells.push_back(idx);
+            this->markSources(row, col);
+        }
+    }
+    this->resetOutlets();
+    // Cells can have been walled in, with densities the buffers disagree on
+    this->runs_stale = true;
+    this->unsync(0, UINT_MAX);
+}
+
+void Sim::markSources(uint row, uint col) {
+    uint tile_cols = (this->board->getWidth() + tile_size - 1) / tile_size;
+    /* Mark the tiles of the cells that have this one as a neighbour, on a
+     * corner too so that either stencil can run on them. */
+    for (uint r = row - 1; r != row + 2; r++) {
+        for (uint c = col - 1; c != col + 2; c++) {
+            if (!this->board->contains(r, c)) continue;
+            this->tile_sources[(size_t)(r / tile_size) * tile_cols +
+                               c / tile_size] = 1;
+        }
+    }
+}
+
+void Sim::resetOutlets() {
+    const Cell::Type* type = this->board->getTypes();
+    this->outlets.clear();
+    for (uint escape = 0; escape < this->escape_cells.size(); escape++) {
+        size_t idx = this->escape_cells[escape];
+        // Only floor cells flow out, emitters are never updated
+        for (auto dir : directions) {
+            size_t adj = this->board->neighbourOf(dir, idx);
+            if (type[adj] != Cell::Floor) continue;
+            // The direction from the floor cell to the escape
+            this->outlets.push_back({adj, (Dir)(dir ^ 1), escape});
+        }
+    }
+}
+
+void Sim::setCellType(uint row, uint col, Cell::Type type) {
+    if (this->backend != nullptr) {
+        throw std::runtime_error(
+            "Cells cannot be changed while a backend is attached.");
+    }
+    bool current = this->board->hasFlowCoefficients(this->use_precalc_weights,
+                                                    this->elevation_bias) &&
+                   !this->tile_sources.empty();
+    this->board->setCellType(row, col, type);
+    if (current) {
+        // Tiles that no longer border a source are left marked, which is safe
+        size_t idx = this->board->indexOf(row, col);
+        auto escape = std::lower_bound(this->escape_cells.begin(),
+                                       this->escape_cells.end(), idx);
+        bool listed = escape != this->escape_cells.end() && *escape == idx;
+        if (type == Cell::Escape && !listed) {
+            this->escape_cells.insert(escape, idx);
+            this->markSources(row, col);
+        } else if (type != Cell::Escape && listed) {
+            this->escape_cells.erase(escape);
+        }
+        this->escape_outflows.assign(this->escape_cells.size(), 0.);
+        this->resetOutlets();
+    }
+    // The cell was zeroed, but its neighbours can have been walled in
+    uint first = row > 0 ? row - 1 : 0;
+    uint last = std::min(row + 2, this->board->getHeight());
+    this->unsync(first, last);
+    if (!current) {
+        this->runs_stale = true;
+    } else if (!this->runs_stale) {
+        for (uint r = first; r < last; r++) this->resetRuns(r);
+    }
+    // The cell and its neighbours flow differently from the next tick on
+    this->touchCell(row, col);
+}
+
+size_t Sim::paintCells(const std::vector<size_t>& cells, Cell::Type type,
+                       float rate) {
+    bool current = this->board->hasFlowCoefficients(this->use_precalc_weights,
+                                                    this->elevation_bias) &&
+                   !this->tile_sources.empty();
+    std::vector<size_t> changed = this->board->paintCells(cells, type, rate);
+    if (changed.empty()) return 0;
+    uint first = this->board->getHeight(), last = 0;
+    for (size_t idx : changed) {
+        first = std::min(first, this->board->rowOf(idx));
+        last = std::max(last, this->board->rowOf(idx) + 1);
+    }
+    if (current) {
+        // Tiles that no longer border a source are left marked, which is safe
+        for (size_t idx : changed) {
+            auto escape = std::lower_bound(this->escape_cells.begin(),
+                                           this->escape_cells.end(), idx);
+            bool listed = escape != this->escape_cells.end() && *escape == idx;
+            if (type == Cell::Escape && !listed) {
+                this->escape_cells.insert(escape, idx);
+            } else if (type != Cell::Escape && listed) {
+                this->escape_cells.erase(escape);
+            }
+            if (type == Cell::Escape || type == Cell::Emitter)
+                this->markSources(this->board->rowOf(idx),
+                                  this->board->colOf(idx));
+        }
+        this->escape_outflows.assign(this->escape_cells.size(), 0.);
+        this->resetOutlets();
+    }
+    // The cells were written, but their neighbours can have been walled in
+    first = first > 0 ? first - 1 : 0;
+    last = std::min(last + 1, this->board->getHeight());
+    this->unsync(first, last);
+    if (!current) {
+        this->runs_stale = true;
+    } else if (!this->runs_stale) {
+        uint row = UINT_MAX;
+        for (size_t idx : changed) {
+            // Cells are in index order, so each row comes up in one stretch
+            if (this->board->rowOf(idx) == row) continue;
+            row = this->board->rowOf(idx);
+            for (uint r = row > 0 ? row - 1 : 0;
+                 r < std::min(row + 2, this->board->getHeight()); r++)
+                this->resetRuns(r);
+        }
+    }
+    for (size_t idx : changed)
+        this->touchCell(this->board->rowOf(idx), this->board->colOf(idx));
+    return changed.size();
+}
+
+size_t Sim::paint(const std::vector<BrushDab>& dabs) {
+    if (this->backend != nullptr) {
+        throw std::runtime_error(
+            "Cells cannot be changed while a backend is attached.");
+    }
+    Board* board = this->board;
+    size_t count = 0;
+    std::vector<size_t> cells;
+    for (size_t begin = 0, end; begin < dabs.size(); begin = end) {
+        const BrushDab& stroke = dabs[begin];
+        cells.clear();
+        for (end = begin; end < dabs.size() &&
+                          dabs[end].paint == stroke.paint &&
+                          dabs[end].value == stroke.value;
+             end++) {
+            const BrushDab& dab = dabs[end];
+            long r = dab.radius;
+            for (long dr = -r; dr <= r; dr++) {
+                for (long dc = -r; dc <= r; dc++) {
+                    // Rounder than a plain dr² + dc² <= r² for small discs
+                    if (dr * dr + dc * dc > r * (r + 1)) continue;
+                    long row = dab.row + dr, col = dab.col + dc;
+                    if (row < 0 || col < 0 ||
+                        !board->contains((uint)row, (uint)col))
+                        continue;
+                    cells.push_back(board->indexOf(row, col));
+                }
+            }
+        }
+        std::sort(cells.begin(), cells.end());
+        cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+        if (stroke.paint == BrushDab::Smoke) {
+            std::vector<size_t> changed =
+                board->paintSmoke(cells, stroke.value);
+            for (size_t idx : changed)
+                this->touchCell(board->rowOf(idx), board->colOf(idx));
+            count += changed.size();
+        } else {
+            count += this->paintCells(cells, (Cell::Type)stroke.paint,
+                                      stroke.value);
+        }
+    }
+    return count;
+}
+
+void Sim::setEmitterCurve(uint row, uint col,
+                          std::shared_ptr<const GrowthCurve> curve) {
+    Board* board = this->board;
+    if (!board->contains(row, col) ||
+        board->getTypes()[board->indexOf(row, col)] != Cell::Emitter)
+        throw std::runtime_error("Not an emitter tile.");
+    auto curved = std::find_if(
+        this->curves.begin(), this->curves.end(),
+        [&](const CurvedEmitter& emitter) {
+            return emitter.row == row && emitter.col == col;
+        });
+    bool listed = curved != this->curves.end() &&
+                  board->hasClaimedRate(row, col);
+    if (curve == nullptr) {
+        if (listed) {
+            board->setClaimedRate(row, col, curved->rate);
+            board->releaseRate(row, col);
+        }
+        if (curved != this->curves.end()) this->curves.erase(curved);
+        return;
+    }
+    if (!listed) {
+        if (curved != this->curves.end()) this->curves.erase(curved);
+        board->claimRate(row, col);
+        this->curves.push_back(
+            {row, col, board->getRate(board->indexOf(row, col)), 0, nullptr});
+        curved = this->curves.end() - 1;
+    }
+    curved->start = this->ticks;
+    curved->curve = std::move(curve);
+}
+
+void Sim::setEmitterCurves(std::shared_ptr<const GrowthCurve> curve) {
+    const Cell::Type* type = this->board->getTypes();
+    for (uint row = 0; row < this->board->getHeight(); row++) {
+        size_t idx = this->board->indexOf(row, 0);
+        for (uint col = 0; col < this->board->getWidth(); col++) {
+            if (type[idx + col] == Cell::Emitter)
+                this->setEmitterCurve(row, col, curve);
+        }
+    }
+}
+
+bool Sim::hasEmitterCurves() {
+    // Emitters whose rate was set on the board are only dropped on the next
+    // tick
+    return std::any_of(this->curves.begin(), this->curves.end(),
+                       [&](const CurvedEmitter& emitter) {
+                           return this->board->contains(emitter.row,
+                                                        emitter.col) &&
+                                  this->board->hasClaimedRate(emitter.row,
+                                                              emitter.col);
+                       });
+}
+
+void Sim::applyCurves() {
+    // Emitters whose rate was set on the board since are off their curve
+    this->curves.erase(
+        std::remove_if(this->curves.begin(), this->curves.end(),
+                       [&](const CurvedEmitter& emitter) {
+                           return !this->board->contains(emitter.row,
+                                                         emitter.col) ||
+                                  !this->board->hasClaimedRate(emitter.row,
+                                                               emitter.col);
+                       }),
+        this->curves.end());
+    this->curves_growing = false;
+    for (const CurvedEmitter& emitter : this->curves) {
+        unsigned long tick = this->ticks - emitter.start;
+        if (tick + 1 < emitter.curve->getLength()) this->curves_growing = true;
+        float share = emitter.curve->at(tick);
+        this->board->setClaimedRate(emitter.row, emitter.col,
+                                    emitter.rate * share);
+    }
+}
+
+void Sim::touchCell(uint row, uint col) {
+    this->unsync(row, row + 1);
+    if (this->activity_stale) return;
+    for (uint r = row - 1; r != row + 2; r++) {
+        for (uint c = col - 1; c != col + 2; c++) {
+            bool corner = r != row && c != col;
+            if ((corner && this->stencil != Sim::Stencil::Moore) ||
+                !this->board->contains(r, c))
+                continue;
+            size_t tile = (size_t)(r / tile_size) * this->tile_cols +
+                          c / tile_size;
+            this->tile_active[tile] = 1;
+            this->tile_quiet[tile] = 0;
+        }
+    }
+}
+
+/* Runs are made of groups of this many cells, a group being linked when
+ * any of its cells is, so that short gaps are left to the kernels, which
+ * step over them faster than they start on a new run, and vectorised ones
+ * are not handed runs too short for them. */
+static constexpr size_t run_group = 8;
+
+void Sim::findRuns(uint row, std::vector<LinkRun>* runs) {
+    const uchar* links = this->board->getLinks();
+    size_t begin = this->board->indexOf(row, 0);
+    size_t end = begin + this->board->getWidth();
+    size_t run_begin = begin;
+    bool open = false;
+    for (size_t group = begin; group < end; group += run_group) {
+        size_t group_end = std::min(group + run_group, end);
+        bool linked = skipUnlinked(links, group, group_end) < group_end;
+        if (linked && !open) run_begin = group;
+        if (!linked && open) runs->push_back({run_begin, group});
+        open = linked;
+    }
+    if (open) runs->push_back({run_begin, end});
+}
+
+void Sim::resetRuns() {
+    uint height = this->board->getHeight();
+    this->runs.clear();
+    this->run_rows.assign(height + 1, 0);
+    for (uint row = 0; row < height; row++) {
+        this->run_rows[row] = this->runs.size();
+        this->findRuns(row, &this->runs);
+    }
+    this->run_rows[height] = this->runs.size();
+    this->runs_stale = false;
+}
+
+void Sim::resetRuns(uint row) {
+    std::vector<LinkRun> row_runs;
+    this->findRuns(row, &row_runs);
+    size_t begin = this->run_rows[row], end = this->run_rows[row + 1];
+    this->runs.erase(this->runs.begin() + begin, this->runs.begin() + end);
+    this->runs.insert(this->runs.begin() + begin, row_runs.begin(),
+                      row_runs.end());
+    ptrdiff_t shift = (ptrdiff_t)row_runs.size() - (ptrdiff_t)(end - begin);
+    for (size_t next = row + 1; next < this->run_rows.size(); next++)
+        this->run_rows[next] += shift;
+}
+
+void Sim::unsync(uint begin, uint end) {
+    if (begin >= end) return;
+    if (this->unsynced_begin >= this->unsynced_end) {
+        this->unsynced_begin = begin;
+        this->unsynced_end = end;
+        return;
+    }
+    this->unsynced_begin = std::min(this->unsynced_begin, begin);
+    this->unsynced_end = std::max(this->unsynced_end, end);
+}
+
+/**
+ * @brief Add up the smoke each escape takes in over a tick, like the
+ * transition function does, from the densities the tick starts from.
+ */
+template <typename T>
+void Sim::measureOutflow(const KernelArgs& args, const T* density) {
+    this->escape_outflows.assign(this->escape_cells.size(), 0.);
+    for (auto& outlet : this->outlets) {
+        size_t escape = this->escape_cells[outlet.escape];
+        Real<T> rate = args.escape_rate;
+        if (args.rates != nullptr) rate *= args.rates[args.rate_index[escape]];
+        Real<T> flow_out =
+            args.uniform_flow ? .25f : args.flow_out[outlet.dir][outlet.idx];
+        this->escape_outflows[outlet.escape] +=
+            rate * flow_out * decodeDensity(density[outlet.idx]);
+    }
+    this->outflow = 0.;
+    for (double escape_outflow : this->escape_outflows)
+        this->outflow += escape_outflow;
+}
+
+/* Smoke moves by at most one cell per synchronous tick, so only the tiles
+ * that are live or border a live tile can change in the next one, on a
+ * corner too when it flows diagonally. */
+void Sim::updateActivity(bool diagonal) {
+    this->tile_was_active.swap(this->tile_active);
+    for (uint tile_row = 0; tile_row < this->tile_rows; tile_row++) {
+        for (uint tile_col = 0; tile_col < this->tile_cols; tile_col++) {
+            size_t tile = (size_t)tile_row * this->tile_cols + tile_col;
+            const uchar* live = this->tile_live.data();
+            bool north = tile_row > 0, south = tile_row + 1 < this->tile_rows;
+            bool west = tile_col > 0, east = tile_col + 1 < this->tile_cols;
+            this->tile_active[tile] =
+                live[tile] || (north && live[tile - this->tile_cols]) ||
+                (south && live[tile + this->tile_cols]) ||
+                (west && live[tile - 1]) || (east && live[tile + 1]) ||
+                (diagonal &&
+                 ((north && west && live[tile - this->tile_cols - 1]) ||
+                  (north && east && live[tile - this->tile_cols + 1]) ||
+                  (south && west && live[tile + this->tile_cols - 1]) ||
+                  (south && east && live[tile + this->tile_cols + 1])));
+        }
+    }
+    std::fill(this->tile_live.begin(), this->tile_live.end(), 0);
+}
+
+/**
+ * @brief Compute the net flow of smoke into a floor cell over one tick.
+ *
+ * Specialised on whether the weights are uniform, so the coefficients are
+ * constants, on whether the cell may border an emitter or escape, and on
+ * whether their rates are read from the rate table. The types of the
+ * neighbours are unpacked from the links of the cell, one byte instead of
+ * four.
+ */
+template <typename T, bool Uniform, bool Sources, bool Rated>
+static inline Real<T> cellFlux(const KernelArgs& args, size_t cur) {
+    const uchar links = args.links[cur];
+    const T* src = sourceOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    Real<T> density = decodeDensity(src[cur]);
+    Real<T> cur_flow_in = Uniform ? .25f : args.flow_in[cur];
+    Real<T> intake = .0f, outtake = .0f;
+    for (int dir = 0; dir < 4; dir++) {
+        size_t adj = cur + offsets[dir];
+        // The flow from the neighbour comes in the opposite direction
+        Real<T> cur_flow_out = Uniform ? .25f : args.flow_out[dir][cur];
+        Real<T> adj_flow_out = Uniform ? .25f : args.flow_out[dir ^ 1][adj];
+        Real<T> adj_density = decodeDensity(src[adj]);
+        Cell::Type type = linkOf(links, dir);
+        if (type == Cell::Floor) {
+            Real<T> adj_flow_in = Uniform ? .25f : args.flow_in[adj];
+            outtake += std::min(cur_flow_out * density,
+                                adj_flow_in * (1 - adj_density));
+            intake += std::min(adj_flow_out * adj_density,
+                               cur_flow_in * (1 - density));
+        } else if (Sources && type == Cell::Emitter) {
+            Real<T> rate = args.emitter_rate;
+            if (Rated) rate *= args.rates[args.rate_index[adj]];
+            intake += rate * std::min(adj_flow_out * adj_density,
+                                      cur_flow_in * (1 - density));
+        } else if (Sources && type == Cell::Escape) {
+            Real<T> rate = args.escape_rate;
+            if (Rated) rate *= args.rates[args.rate_index[adj]];
+            outtake += rate * cur_flow_out * density;
+        }
+    }
+    return intake - outtake;
+}
+
+/**
+ * @brief Run the scalar transition function on the cells in [begin, end).
+ *
+ * Unless max is null, also adds the change of each density to max and
+ * squares, like measureChange().
+ */
+template <typename T, bool Uniform, bool Sources, bool Rated>
+static void updateSpanScalar(const KernelArgs& args, size_t begin, size_t end,
+                             float* max, double* squares) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    float span_max = max != nullptr ? *max : 0.f, span_squares = 0.f;
+    for (size_t cur = begin; cur < end; cur++) {
+        if (args.links[cur] == 0) {
+            // Walls, sources and walled-in floors keep their densities
+            size_t next = skipUnlinked(args.links, cur, end);
+            if (dst != src) std::copy(src + cur, src + next, dst + cur);
+            cur = next - 1;
+            continue;
+        }
+        Real<T> density = decodeDensity(src[cur]);
+        storeDensity(dst + cur,
+                     density + cellFlux<T, Uniform, Sources, Rated>(args, cur));
+        if (max != nullptr) {
+            float delta = std::fabs(decodeDensity(dst[cur]) - density);
+            span_max = std::max(span_max, delta);
+            span_squares += delta * delta;
+        }
+    }
+    if (max != nullptr) {
+        *max = span_max;
+        *squares += span_squares;
+    }
+}
+
+typedef void (*SpanKernel)(const KernelArgs& args, size_t begin, size_t end,
+                           float* max, double* squares);
+
+/* Kernels by storage, then by uniform weights, sources and rate table in
+ * binary order. */
+static const SpanKernel span_kernels[24] = {
+    updateSpanScalar<float, false, false, false>,
+    updateSpanScalar<float, false, false, true>,
+    updateSpanScalar<float, false, true, false>,
+    updateSpanScalar<float, false, true, true>,
+    updateSpanScalar<float, true, false, false>,
+    updateSpanScalar<float, true, false, true>,
+    updateSpanScalar<float, true, true, false>,
+    updateSpanScalar<float, true, true, true>,
+    updateSpanScalar<Fixed16, false, false, false>,
+    updateSpanScalar<Fixed16, false, false, true>,
+    updateSpanScalar<Fixed16, false, true, false>,
+    updateSpanScalar<Fixed16, false, true, true>,
+    updateSpanScalar<Fixed16, true, false, false>,
+    updateSpanScalar<Fixed16, true, false, true>,
+    updateSpanScalar<Fixed16, true, true, false>,
+    updateSpanScalar<Fixed16, true, true, true>,
+    updateSpanScalar<double, false, false, false>,
+    updateSpanScalar<double, false, false, true>,
+    updateSpanScalar<double, false, true, false>,
+    updateSpanScalar<double, false, true, true>,
+    updateSpanScalar<double, true, false, false>,
+    updateSpanScalar<double, true, false, true>,
+    updateSpanScalar<double, true, true, false>,
+    updateSpanScalar<double, true, true, true>};
+
+/**
+ * @brief Run the scalar kernel specialised for a span of cells.
+ *
+ * @param sources Whether any cell of the span borders an emitter or escape.
+ */
+static inline void updateSpan(const KernelArgs& args, size_t begin,
+                              size_t end, bool sources, float* max = nullptr,
+                              double* squares = nullptr) {
+    int storage = args.src_fixed != nullptr    ? 1
+                  : args.src_double != nullptr ? 2
+                                               : 0;
+    span_kernels[storage << 3 | args.uniform_flow << 2 | sources << 1 |
+                 (args.rates != nullptr)](args, begin, end, max, squares);
+}
+
+/**
+ * @brief Run the in-place transition function on every other cell of
+ * [begin, end), from begin, like updateSpanScalar().
+ */
+template <typename T, bool Uniform, bool Sources, bool Rated>
+static void updateCheckerScalar(const KernelArgs& args, size_t begin,
+                                size_t end, float* max, double* squares) {
+    T* density = targetOf<T>(args);
+    float span_max = max != nullptr ? *max : 0.f, span_squares = 0.f;
+    for (size_t cur = begin; cur < end; cur += 2) {
+        if (args.links[cur] == 0) continue;
+        Real<T> before = decodeDensity(density[cur]);
+        storeDensity(density + cur,
+                     before + cellFlux<T, Uniform, Sources, Rated>(args, cur));
+        if (max != nullptr) {
+            float delta = std::fabs(decodeDensity(density[cur]) - before);
+            span_max = std::max(span_max, delta);
+            span_squares += delta * delta;
+        }
+    }
+    if (max != nullptr) {
+        *max = span_max;
+        *squares += span_squares;
+    }
+}
+
+/* Kernels by storage, float or double, then by uniform weights, sources and
+ * rate table in binary order. */
+static const SpanKernel checker_kernels[16] = {
+    updateCheckerScalar<float, false, false, false>,
+    updateCheckerScalar<float, false, false, true>,
+    updateCheckerScalar<float, false, true, false>,
+    updateCheckerScalar<float, false, true, true>,
+    updateCheckerScalar<float, true, false, false>,
+    updateCheckerScalar<float, true, false, true>,
+    updateCheckerScalar<float, true, true, false>,
+    updateCheckerScalar<float, true, true, true>,
+    updateCheckerScalar<double, false, false, false>,
+    updateCheckerScalar<double, false, false, true>,
+    updateCheckerScalar<double, false, true, false>,
+    updateCheckerScalar<double, false, true, true>,
+    updateCheckerScalar<double, true, false, false>,
+    updateCheckerScalar<double, true, false, true>,
+    updateCheckerScalar<double, true, true, false>,
+    updateCheckerScalar<double, true, true, true>};
+
+/**
+ * @brief Run the checker kernel specialised for every other cell of a span.
+ */
+static inline void updateChecker(const KernelArgs& args, size_t begin,
+                                 size_t end, bool sources, float* max,
+                                 double* squares) {
+    int storage = args.src_double != nullptr;
+    checker_kernels[storage << 3 | args.uniform_flow << 2 | sources << 1 |
+                    (args.rates != nullptr)](args, begin, end, max, squares);
+}
+
+/**
+ * @brief Run the transition function of the Moore stencil on the cells in
+ * [begin, end), like updateSpanScalar() with uniform weights.
+ *
+ * The side neighbours are unpacked from the links of the cell, and each
+ * corner neighbour is only read when neither side neighbour next to it is a
+ * wall, see Sim::Stencil.
+ */
+template <typename T, bool Sources, bool Rated>
+static void updateMooreScalar(const KernelArgs& args, size_t begin,
+                              size_t end, float* max, double* squares) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    float span_max = max != nullptr ? *max : 0.f, span_squares = 0.f;
+    for (size_t cur = begin; cur < end; cur++) {
+        const uchar links = args.links[cur];
+        if (links == 0) {
+            // Cells walled in on every side are walled in on every corner
+            size_t next = skipUnlinked(args.links, cur, end);
+            if (dst != src) std::copy(src + cur, src + next, dst + cur);
+            cur = next - 1;
+            continue;
+        }
+        Real<T> density = decodeDensity(src[cur]);
+        Real<T> intake = .0f, outtake = .0f;
+        // The sides in N/S/W/E order, then the corners from NW to SE
+        for (int dir = 0; dir < 8; dir++) {
+            size_t adj;
+            Cell::Type type;
+            Real<T> weight;
+            if (dir < 4) {
+                adj = cur + offsets[dir];
+                type = linkOf(links, dir);
+                weight = moore_side;
+            } else {
+                int vertical = (dir - 4) >> 1, horizontal = 2 + (dir & 1);
+                if (linkOf(links, vertical) == Cell::Wall ||
+                    linkOf(links, horizontal) == Cell::Wall)
+                    continue;
+                adj = cur + offsets[vertical] + offsets[horizontal];
+                type = args.type[adj];
+                weight = moore_corner;
+            }
+            Real<T> adj_density = decodeDensity(src[adj]);
+            if (type == Cell::Floor) {
+                outtake += std::min(weight * density,
+                                    weight * (1 - adj_density));
+                intake += std::min(weight * adj_density,
+                                   weight * (1 - density));
+            } else if (Sources && type == Cell::Emitter) {
+                Real<T> rate = args.emitter_rate;
+                if (Rated) rate *= args.rates[args.rate_index[adj]];
+                intake += rate * std::min(weight * adj_density,
+                                          weight * (1 - density));
+            } else if (Sources && type == Cell::Escape) {
+                Real<T> rate = args.escape_rate;
+                if (Rated) rate *= args.rates[args.rate_index[adj]];
+                outtake += rate * weight * density;
+            }
+        }
+        storeDensity(dst + cur, density + (intake - outtake));
+        if (max != nullptr) {
+            float delta = std::fabs(decodeDensity(dst[cur]) - density);
+            span_max = std::max(span_max, delta);
+            span_squares += delta * delta;
+        }
+    }
+    if (max != nullptr) {
+        *max = span_max;
+        *squares += span_squares;
+    }
+}
+
+/* Moore kernels by storage, then by sources and rate table in binary
+ * order. */
+static const SpanKernel moore_kernels[12] = {
+    updateMooreScalar<float, false, false>,
+    updateMooreScalar<float, false, true>,
+    updateMooreScalar<float, true, false>,
+    updateMooreScalar<float, true, true>,
+    updateMooreScalar<Fixed16, false, false>,
+    updateMooreScalar<Fixed16, false, true>,
+    updateMooreScalar<Fixed16, true, false>,
+    updateMooreScalar<Fixed16, true, true>,
+    updateMooreScalar<double, false, false>,
+    updateMooreScalar<double, false, true>,
+    updateMooreScalar<double, true, false>,
+    updateMooreScalar<double, true, true>};
+
+/**
+ * @brief Run the scalar Moore kernel specialised for a span of cells.
+ *
+ * @param sources Whether any cell of the span borders an emitter or escape,
+ * corners included.
+ */
+static inline void updateMoore(const KernelArgs& args, size_t begin,
+                               size_t end, bool sources) {
+    int storage = args.src_fixed != nullptr    ? 1
+                  : args.src_double != nullptr ? 2
+                                               : 0;
+    moore_kernels[storage << 2 | sources << 1 | (args.rates != nullptr)](
+        args, begin, end, nullptr, nullptr);
+}
+
+/* What a stochastic tick draws the shares of the flows it lets through
+ * from, see Sim::draft_noise. */
+struct Draft {
+    Philox::Key key;
+    uint tick;
+    float noise;
+};
+
+static inline Draft draftOf(float noise, uint64_t seed, uint tick) {
+    return {{(uint32_t)seed, (uint32_t)(seed >> 32)}, tick, noise};
+}
+
+/**
+ * @brief Draw the shares of the flows across the edges east and south of a
+ * cell that a draft lets through on its tick.
+ *
+ * Every edge is drawn by the cell north or west of it, so the cells on both
+ * sides of an edge get the same share.
+ */
+static inline void drawShares(const Draft& draft, size_t cell, float* east,
+                              float* south) {
+    Philox::Counter words = Philox::scramble(
+        {(uint32_t)cell, (uint32_t)((uint64_t)cell >> 32), draft.tick, 0},
+        draft.key);
+    *east = 1.f - draft.noise * Philox::toUnit(words[0]);
+    *south = 1.f - draft.noise * Philox::toUnit(words[1]);
+}
+
+/**
+ * @brief Run the stochastic transition function on the cells in [begin,
+ * end), like updateSpanScalar().
+ *
+ * Every flow across an edge, the source terms included, is scaled by the
+ * share the draft lets through. Shares are at most 1, so densities stay in
+ * [0, 1].
+ */
+template <typename T>
+static void updateSpanDrafted(const KernelArgs& args, const Draft& draft,
+                              size_t begin, size_t end, float* max,
+                              double* squares) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    float span_max = max != nullptr ? *max : 0.f, span_squares = 0.f;
+    float share[4], unused;
+    // The west edge of each cell is the east edge of the one before
+    drawShares(draft, begin - 1, &share[3], &unused);
+    for (size_t cur = begin; cur < end; cur++) {
+        share[2] = share[3];
+        drawShares(draft, cur, &share[3], &share[1]);
+        Real<T> density = decodeDensity(src[cur]);
+        const uchar links = args.links[cur];
+        if (links == 0) {
+            dst[cur] = src[cur];
+            continue;
+        }
+        drawShares(draft, cur - stride, &unused, &share[0]);
+        Real<T> cur_flow_in = args.uniform_flow ? .25f : args.flow_in[cur];
+        Real<T> intake = .0f, outtake = .0f;
+        for (int dir = 0; dir < 4; dir++) {
+            size_t adj = cur + offsets[dir];
+            Real<T> cur_flow_out =
+                args.uniform_flow ? .25f : args.flow_out[dir][cur];
+            Real<T> adj_flow_out =
+                args.uniform_flow ? .25f : args.flow_out[dir ^ 1][adj];
+            Real<T> adj_density = decodeDensity(src[adj]);
+            Real<T> rate = share[dir];
+            Cell::Type type = linkOf(links, dir);
+            if (type == Cell::Floor) {
+                Real<T> adj_flow_in =
+                    args.uniform_flow ? .25f : args.flow_in[adj];
+                outtake += rate * std::min(cur_flow_out * density,
+                                           adj_flow_in * (1 - adj_density));
+                intake += rate * std::min(adj_flow_out * adj_density,
+                                          cur_flow_in * (1 - density));
+                continue;
+            }
+            if (type == Cell::Wall) continue;
+            if (args.rates != nullptr) rate *= args.rates[args.rate_index[adj]];
+            if (type == Cell::Emitter) {
+                intake += rate * args.emitter_rate *
+                          std::min(adj_flow_out * adj_density,
+                                   cur_flow_in * (1 - density));
+            } else {
+                outtake += rate * args.escape_rate * cur_flow_out * density;
+            }
+        }
+        storeDensity(dst + cur, density + (intake - outtake));
+        if (max != nullptr) {
+            float delta = std::fabs(decodeDensity(dst[cur]) - density);
+            span_max = std::max(span_max, delta);
+            span_squares += delta * delta;
+        }
+    }
+    if (max != nullptr) {
+        *max = span_max;
+        *squares += span_squares;
+    }
+}
+
+/**
+ * @brief Run the stochastic kernel for the storage of the densities on a
+ * span of cells.
+ */
+static inline void updateSpan(const KernelArgs& args, const Draft& draft,
+                              size_t begin, size_t end, float* max = nullptr,
+                              double* squares = nullptr) {
+    if (args.src_fixed != nullptr) {
+        updateSpanDrafted<Fixed16>(args, draft, begin, end, max, squares);
+    } else if (args.src_double != nullptr) {
+        updateSpanDrafted<double>(args, draft, begin, end, max, squares);
+    } else {
+        updateSpanDrafted<float>(args, draft, begin, end, max, squares);
+    }
+}
+
+/**
+ * @brief Add the changes in [begin, end) between two density buffers.
+ */
+template <typename T>
+static void measureChange(const T* src, const T* dst, size_t begin,
+                          size_t end, float* max, double* squares) {
+    float span_max = *max, span_squares = 0.f;
+    for (size_t idx = begin; idx < end; idx++) {
+        float change =
+            std::fabs(decodeDensity(dst[idx]) - decodeDensity(src[idx]));
+        span_max = std::max(span_max, change);
+        span_squares += change * change;
+    }
+    *max = span_max;
+    *squares += span_squares;
+}
+
+/**
+ * @brief Add the floor densities in [begin, end) to a compensated sum.
+ *
+ * A span is short enough to be added up in double precision on its own, over
+ * a few independent partial sums so that the additions can overlap, and only
+ * the sums of the spans are compensated.
+ */
+template <typename T>
+static void measureMass(const Cell::Type* type, const T* density,
+                        size_t begin, size_t end, double* sum, double* carry) {
+    auto floor = [&](size_t idx) -> double {
+        return type[idx] == Cell::Floor ? decodeDensity(density[idx]) : 0.;
+    };
+    double sum0 = 0., sum1 = 0., sum2 = 0., sum3 = 0.;
+    size_t idx = begin;
+    for (; idx + 4 <= end; idx += 4) {
+        sum0 += floor(idx);
+        sum1 += floor(idx + 1);
+        sum2 += floor(idx + 2);
+        sum3 += floor(idx + 3);
+    }
+    for (; idx < end; idx++) sum0 += floor(idx);
+    addCompensated(sum, carry, (sum0 + sum1) + (sum2 + sum3));
+}
+
+/**
+ * @brief Count the floor cells in [begin, end) into the bins of a histogram
+ * by their densities, see Sim::histogram_bins.
+ */
+template <typename T>
+static void measureHistogram(const Cell::Type* type, const T* density,
+                             size_t begin, size_t end, float occupied,
+                             DensityHistogram* histogram) {
+    uint bins = histogram->bins.size();
+    size_t* counts = histogram->bins.data();
+    float max = histogram->max;
+    for (size_t idx = begin; idx < end; idx++) {
+        if (type[idx] != Cell::Floor) continue;
+        float value = decodeDensity(density[idx]);
+        // Full cells go in the last bin, and rounding below 0 in the first
+        uint bin = value > 0.f ? std::min((uint)(value * bins), bins - 1) : 0;
+        counts[bin]++;
+        histogram->cells++;
+        histogram->occupied += value > occupied;
+        max = std::max(max, value);
+    }
+    histogram->max = max;
+}
+
+/**
+ * @brief Add the densities of the floor cells in [begin, end) to their
+ * doses.
+ */
+template <typename T>
+static void measureDose(const Cell::Type* type, const T* density,
+                        size_t begin, size_t end, double* doses) {
+    // Without a branch, so that it vectorises like the kernels
+    for (size_t idx = begin; idx < end; idx++) {
+        double value = decodeDensity(density[idx]);
+        doses[idx] += type[idx] == Cell::Floor ? value : 0.;
+    }
+}
+
+/**
+ * @brief Mark the floor cells in [begin, end) whose density exceeds the
+ * threshold for the first time as arrived at a tick.
+ */
+template <typename T>
+static void measureArrival(const Cell::Type* type, const T* density,
+                           size_t begin, size_t end, float threshold,
+                           uint tick, uint* arrivals) {
+    // The map is only read where the density is over the threshold
+    for (size_t idx = begin; idx < end; idx++) {
+        if (decodeDensity(density[idx]) > threshold &&
+            type[idx] == Cell::Floor && arrivals[idx] == Sim::not_arrived)
+            arrivals[idx] = tick;
+    }
+}
+
+/**
+ * @brief Run the synchronous transition function on a block of tiles.
+ *
+ * A block is a run of tiles along one row of tiles. Its rows are traversed
+ * from end to end, and consecutive active tiles are updated as one span, so
+ * that the kernel streams through memory. Distinct blocks can be updated
+ * concurrently.
+ */
+template <typename T>
+void Sim::updateBlock(const KernelArgs& args, size_t block, Change* change,
+                      Mass* mass, DensityHistogram* histogram) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    uint blocks = (this->tile_cols + this->block_tiles - 1) / this->block_tiles;
+    uint tile_row = block / blocks;
+    uint row_begin = tile_row * tile_size;
+    uint row_end = std::min(row_begin + tile_size, height);
+    size_t tile_begin = (size_t)tile_row * this->tile_cols +
+                        block % blocks * this->block_tiles;
+    size_t tile_end = std::min(tile_begin + this->block_tiles,
+                               (size_t)(tile_row + 1) * this->tile_cols);
+    bool vectorise = this->kernel == Sim::Kernel::Simd;
+    bool drafted = this->draft_noise > 0.f;
+    bool moore = this->stencil == Sim::Stencil::Moore;
+    Draft draft = draftOf(this->draft_noise, this->draft_seed, this->ticks);
+    bool quiet = this->quiet_tracked;
+    if (quiet) {
+        std::fill(this->tile_change.begin() + tile_begin,
+                  this->tile_change.begin() + tile_end, 0.f);
+    }
+    for (uint row = row_begin; row < row_end; row++) {
+        size_t row_idx = this->board->indexOf(row, 0);
+        const LinkRun* run = this->runs.data() + this->run_rows[row];
+        const LinkRun* last_run = this->runs.data() + this->run_rows[row + 1];
+        for (size_t tile = tile_begin; tile < tile_end;) {
+            uint col = (tile % this->tile_cols) * tile_size;
+            size_t idx = row_idx + col;
+            if (this->activity_tracked && !this->tile_active[tile]) {
+                // Clear what the tile held two ticks ago
+                if (this->tile_was_active[tile]) {
+                    size_t end = idx + std::min(tile_size, width - col);
+                    std::copy(src + idx, src + end, dst + idx);
+                }
+                tile++;
+                continue;
+            }
+            // Spans only run the source terms where they are needed
+            bool sources = this->tile_sources[tile];
+            bool skipped = quiet && this->tile_skipped[tile];
+            size_t span_end = tile + 1;
+            while (span_end < tile_end &&
+                   (!this->activity_tracked || this->tile_active[span_end]) &&
+                   this->tile_sources[span_end] == sources &&
+                   (!quiet || this->tile_skipped[span_end] == skipped))
+                span_end++;
+            uint span_cols =
+                std::min((uint)(span_end - tile) * tile_size, width - col);
+            size_t end = idx + span_cols;
+            // Only the runs of linked cells change, see runs
+            while (run != last_run && run->end <= idx) run++;
+            if (skipped) {
+                std::copy(src + idx, src + end, dst + idx);
+                this->flowIntoSkipped<T>(args, row, tile, span_end);
+            }
+            for (const LinkRun* next = run;
+                 !skipped && next != last_run && next->begin < end; next++) {
+                size_t cur = std::max(next->begin, idx);
+                size_t run_end = std::min(next->end, end);
+                if (drafted) {
+                    updateSpan(args, draft, cur, run_end);
+                } else if (moore) {
+                    if (vectorise)
+                        cur += updateMooreSimd(args, cur, run_end, sources);
+                    updateMoore(args, cur, run_end, sources);
+                } else {
+                    if (vectorise)
+                        cur += updateSpanSimd(args, cur, run_end, sources);
+                    updateSpan(args, cur, run_end, sources);
+                }
+            }
+            if (change != nullptr) {
+                measureChange(src, dst, idx, end, &change->max,
+                              &change->squares);
+            }
+            if (mass != nullptr) {
+                measureMass(args.type, dst, idx, end, &mass->sum,
+                            &mass->carry);
+            }
+            if (histogram != nullptr) {
+                measureHistogram(args.type, dst, idx, end,
+                                 this->occupied_density, histogram);
+            }
+            if (this->arrivals_tracked) {
+                measureArrival(args.type, dst, idx, end,
+                               this->arrivals_threshold, this->ticks + 1,
+                               this->arrivals.data());
+            }
+            if (this->doses_tracked) {
+                measureDose(args.type, dst, idx, end, this->doses.data());
+            }
+            for (; this->activity_tracked && tile < span_end;
+                 tile++, idx += tile_size) {
+                size_t tile_end_idx = std::min(idx + tile_size, end);
+                if (quiet) {
+                    double squares = 0.;
+                    measureChange(src, dst, idx, tile_end_idx,
+                                  &this->tile_change[tile], &squares);
+                }
+                if (this->tile_live[tile]) continue;
+                this->tile_live[tile] =
+                    std::any_of(dst + idx, dst + tile_end_idx,
+                                [](T density) { return density != 0; });
+            }
+            tile = span_end;
+        }
+    }
+    // Skipped tiles only change across their edges, which can wake them up
+    for (size_t tile = tile_begin; quiet && tile < tile_end; tile++) {
+        this->tile_quiet[tile] =
+            this->tile_active[tile] &&
+            this->tile_change[tile] < this->quiet_threshold;
+    }
+}
+
+/**
+ * @brief Take the flow across the edge from a cell of a skipped tile to its
+ * neighbour in a direction, which an updated tile holds.
+ *
+ * The neighbour took the same flow the other way, both reading the
+ * densities from before the tick, so no smoke is created or lost. Flows
+ * to emitters and escapes are held back with the rest of the tile.
+ */
+template <typename T>
+static inline void flowAcross(const KernelArgs& args, size_t cur, Dir dir) {
+    if (linkOf(args.links[cur], dir) != Cell::Floor) return;
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    const ptrdiff_t stride = args.stride;
+    const ptrdiff_t offsets[4] = {-stride, stride, -1, 1};
+    size_t adj = cur + offsets[dir];
+    bool uniform = args.uniform_flow;
+    Real<T> density = decodeDensity(src[cur]);
+    Real<T> adj_density = decodeDensity(src[adj]);
+    Real<T> cur_flow_in = uniform ? .25f : args.flow_in[cur];
+    Real<T> cur_flow_out = uniform ? .25f : args.flow_out[dir][cur];
+    Real<T> adj_flow_in = uniform ? .25f : args.flow_in[adj];
+    Real<T> adj_flow_out = uniform ? .25f : args.flow_out[dir ^ 1][adj];
+    Real<T> outtake =
+        std::min(cur_flow_out * density, adj_flow_in * (1 - adj_density));
+    Real<T> intake =
+        std::min(adj_flow_out * adj_density, cur_flow_in * (1 - density));
+    storeDensity(dst + cur, decodeDensity(dst[cur]) + (intake - outtake));
+}
+
+/**
+ * @brief Take the flows across the edges of the cells of a row of skipped
+ * tiles [tile, span_end) with the tiles updated next to them.
+ */
+template <typename T>
+void Sim::flowIntoSkipped(const KernelArgs& args, uint row, size_t tile,
+                          size_t span_end) {
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    auto updated = [&](size_t other) {
+        return this->tile_active[other] && !this->tile_skipped[other];
+    };
+    bool top = row % tile_size == 0 && row > 0;
+    bool bottom = (row + 1) % tile_size == 0 && row + 1 < height;
+    for (; tile < span_end; tile++) {
+        uint col = (tile % this->tile_cols) * tile_size;
+        size_t first = this->board->indexOf(row, col);
+        size_t last = first + std::min(tile_size, width - col) - 1;
+        if (col > 0 && updated(tile - 1))
+            flowAcross<T>(args, first, Dir::West);
+        if (col + tile_size < width && updated(tile + 1))
+            flowAcross<T>(args, last, Dir::East);
+        if (top && updated(tile - this->tile_cols)) {
+            for (size_t cur = first; cur <= last; cur++)
+                flowAcross<T>(args, cur, Dir::North);
+        }
+        if (bottom && updated(tile + this->tile_cols)) {
+            for (size_t cur = first; cur <= last; cur++)
+                flowAcross<T>(args, cur, Dir::South);
+        }
+    }
+}
+
+/* Blocks of tiles advanced over several ticks at a time, see Sim::advance().
+ * They are small enough for their densities and coefficients, halo included,
+ * to stay in cache from one tick to the next. */
+static constexpr uint time_block_rows = 2;
+static constexpr uint time_block_cols = 16;
+
+/**
+ * @brief Get the length of the scratch buffers of each worker of a time
+ * block, as wide as the board and as tall as the tallest block with its
+ * halo.
+ */
+static size_t blockScratchSize(size_t stride) {
+    return 2 * ((size_t)(time_block_rows + 2) * Sim::tile_size + 2) * stride;
+}
+
+/**
+ * @brief Point the kernel arguments at other densities of their storage.
+ */
+static inline void retarget(KernelArgs* args, const float* src, float* dst) {
+    args->src = src;
+    args->dst = dst;
+}
+static inline void retarget(KernelArgs* args, const Fixed16* src,
+                            Fixed16* dst) {
+    args->src_fixed = src;
+    args->dst_fixed = dst;
+}
+static inline void retarget(KernelArgs* args, const double* src,
+                            double* dst) {
+    args->src_double = src;
+    args->dst_double = dst;
+}
+
+/**
+ * @brief Advance a block of tiles by several synchronous ticks at once.
+ *
+ * The block is updated as a whole if any of its tiles is due, along with a
+ * halo as deep as the number of ticks on the first one, which shrinks by a
+ * cell on each of the next, so that the last one only writes the block. The
+ * ticks in between go to two scratch buffers as wide as the board and as
+ * tall as the block and its halo, addressed like the board from the first of
+ * their rows, so the kernels read the coefficients of the board unchanged.
+ */
+template <typename T>
+void Sim::advanceBlock(const KernelArgs& args, size_t block, uint depth,
+                       const uchar* due, T* scratch) {
+    const T* src = sourceOf<T>(args);
+    T* dst = targetOf<T>(args);
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    size_t stride = this->board->getStride();
+    uint blocks = (this->tile_cols + time_block_cols - 1) / time_block_cols;
+    uint tile_row_begin = block / blocks * time_block_rows;
+    uint tile_row_end = std::min(tile_row_begin + time_block_rows,
+                                 this->tile_rows);
+    uint tile_col_begin = block % blocks * time_block_cols;
+    uint tile_col_end = std::min(tile_col_begin + time_block_cols,
+                                 this->tile_cols);
+    uint row_begin = tile_row_begin * tile_size;
+    uint row_end = std::min(tile_row_end * tile_size, height);
+    uint col_begin = tile_col_begin * tile_size;
+    uint col_end = std::min(tile_col_end * tile_size, width);
+    bool update = due == nullptr;
+    for (uint tile_row = tile_row_begin; !update && tile_row < tile_row_end;
+         tile_row++) {
+        for (uint tile_col = tile_col_begin; tile_col < tile_col_end;
+             tile_col++)
+            update |= due[(size_t)tile_row * this->tile_cols + tile_col];
+    }
+    if (!update) {
+        // Clear what the tiles held before the last tick, like updateBlock()
+        for (uint row = row_begin; row < row_end; row++) {
+            size_t tile = (size_t)(row / tile_size) * this->tile_cols;
+            for (uint tile_col = tile_col_begin; tile_col < tile_col_end;
+                 tile_col++) {
+                if (!this->tile_was_active[tile + tile_col]) continue;
+                uint col = tile_col * tile_size;
+                size_t idx = this->board->indexOf(row, col);
+                size_t end = idx + std::min(tile_size, width - col);
+                std::copy(src + idx, src + end, dst + idx);
+            }
+        }
+        return;
+    }
+    // Padded rows of the board the scratch buffers start and end at
+    uint first = row_begin + 1 > depth ? row_begin + 1 - depth : 0;
+    uint last = std::min(row_end + 1 + depth, height + 2);
+    size_t base = (size_t)first * stride;
+    size_t size = (size_t)(last - first) * stride;
+    KernelArgs local = args;
+    local.type = args.type + base;
+    local.links = args.links + base;
+    if (args.flow_in != nullptr) local.flow_in = args.flow_in + base;
+    const float* flow_out[4] = {};
+    for (int dir = 0; dir < 4 && args.flow_out != nullptr; dir++) {
+        if (args.flow_out[dir] != nullptr)
+            flow_out[dir] = args.flow_out[dir] + base;
+    }
+    local.flow_out = flow_out;
+    if (args.rate_index != nullptr)
+        local.rate_index = args.rate_index + base;
+    T* buffers[2] = {scratch, scratch + size};
+    bool vectorise = this->kernel == Sim::Kernel::Simd;
+    for (uint tick = 1; tick <= depth; tick++) {
+        retarget(&local, tick == 1 ? src + base : buffers[(tick - 1) % 2],
+                 tick == depth ? dst + base : buffers[tick % 2]);
+        uint halo = depth - tick;
+        uint top = row_begin > halo ? row_begin - halo : 0;
+        uint bottom = std::min(row_end + halo, height);
+        uint left = col_begin > halo ? col_begin - halo : 0;
+        uint right = std::min(col_end + halo, width);
+        for (uint row = top; row < bottom; row++) {
+            size_t row_idx = this->board->indexOf(row, 0) - base;
+            // Spans only run the source terms where they are needed
+            const uchar* row_sources =
+                this->tile_sources.data() +
+                (size_t)(row / tile_size) * this->tile_cols;
+            for (uint col = left; col < right;) {
+                bool sources = row_sources[col / tile_size];
+                uint span_end = col;
+                while (span_end < right &&
+                       row_sources[span_end / tile_size] == sources) {
+                    span_end = std::min(
+                        (span_end / tile_size + 1) * tile_size, right);
+                }
+                size_t cur = row_idx + col, end = row_idx + span_end;
+                if (vectorise)
+                    cur += updateSpanSimd(local, cur, end, sources);
+                updateSpan(local, cur, end, sources);
+                col = span_end;
+            }
+        }
+    }
+    for (uint tile_row = tile_row_begin;
+         this->activity_tracked && tile_row < tile_row_end; tile_row++) {
+        for (uint tile_col = tile_col_begin; tile_col < tile_col_end;
+             tile_col++) {
+            size_t tile = (size_t)tile_row * this->tile_cols + tile_col;
+            this->tile_active[tile] = 1;
+            uint col = tile_col * tile_size;
+            uint cols = std::min(tile_size, width - col);
+            for (uint row = tile_row * tile_size;
+                 !this->tile_live[tile] &&
+                 row < std::min((tile_row + 1) * tile_size, height);
+                 row++) {
+                size_t idx = this->board->indexOf(row, col);
+                this->tile_live[tile] =
+                    std::any_of(dst + idx, dst + idx + cols,
+                                [](T density) { return density != 0; });
+            }
+        }
+    }
+}
+
+bool Sim::canAdvanceBlocked() {
+    return this->update_mode == Sim::Update::Synchronous &&
+           this->backend == nullptr && this->tolerance == 0.f &&
+           !this->track_mass && this->histogram_bins == 0 &&
+           this->arrival_threshold == 0.f &&
+           !this->track_dose && !this->track_outflow &&
+           this->curves.empty() && this->draft_noise == 0.f &&
+           this->stencil == Sim::Stencil::VonNeumann &&
+           this->quiet_threshold == 0.f;
+}
+
+/* Smoke moves by at most one cell per tick, so over at most tile_size ticks
+ * it can only reach the tiles that would be active in the next tick and
+ * their neighbours, diagonal ones included, which are the only ones that
+ * have to be updated. */
+void Sim::tickBlocked(uint depth) {
+    TraceScope trace(this->tracer, "time block", "tick", this->ticks);
+    CounterScope count(this->counters);
+    Board::Storage storage = this->board->getStorage();
+    this->board->ownDensities();
+    this->activity_tracked = this->track_activity;
+    if (!this->activity_tracked || !this->activity_synchronous)
+        this->activity_stale = true;
+    if (this->activity_stale) this->resetActivity();
+    uint threads = std::max(1u, this->threads);
+    WorkerPool* workers = this->workerPool(threads);
+    KernelArgs args = this->kernelArgs(
+        storage == Board::Storage::Float ? this->board->getDensities()
+                                         : nullptr,
+        this->board->getNextDensities(), this->emitter_rate,
+        this->escape_rate, this->use_precalc_weights, workers);
+    std::vector<uchar> due;
+    if (this->activity_tracked) {
+        due.assign(this->tile_active.size(), 0);
+        for (uint tile_row = 0; tile_row < this->tile_rows; tile_row++) {
+            for (uint tile_col = 0; tile_col < this->tile_cols; tile_col++) {
+                size_t tile = (size_t)tile_row * this->tile_cols + tile_col;
+                const uchar* active = this->tile_active.data();
+                due[tile] = active[tile] ||
+                            (tile_row > 0 && active[tile - this->tile_cols]) ||
+                            (tile_row + 1 < this->tile_rows &&
+                             active[tile + this->tile_cols]) ||
+                            (tile_col > 0 && active[tile - 1]) ||
+                            (tile_col + 1 < this->tile_cols &&
+                             active[tile + 1]);
+            }
+        }
+        // Rebuilt from the tiles that are written
+        std::fill(this->tile_active.begin(), this->tile_active.end(), 0);
+    }
+    size_t block_rows =
+        (this->tile_rows + time_block_rows - 1) / time_block_rows;
+    size_t row_blocks =
+        (this->tile_cols + time_block_cols - 1) / time_block_cols;
+    // Each worker has scratch buffers of its own, for the tallest block
+    size_t scratch_size = blockScratchSize(this->board->getStride());
+    const uchar* due_tiles = this->activity_tracked ? due.data() : nullptr;
+    auto run = [&](auto* scratch) {
+        this->runBlocks(workers, threads, block_rows, row_blocks,
+                        [&](uint worker, size_t block) {
+                            this->advanceBlock(args, block, depth, due_tiles,
+                                               scratch[worker].data());
+                        });
+    };
+    switch (storage) {
+        case Board::Storage::Float: {
+            std::vector<std::vector<float>> scratch(
+                threads, std::vector<float>(scratch_size));
+            run(&scratch[0]);
+            break;
+        }
+        case Board::Storage::Fixed: {
+            std::vector<std::vector<Fixed16>> scratch(
+                threads, std::vector<Fixed16>(scratch_size));
+            run(&scratch[0]);
+            break;
+        }
+        case Board::Storage::Double: {
+            std::vector<std::vector<double>> scratch(
+                threads, std::vector<double>(scratch_size));
+            run(&scratch[0]);
+            break;
+        }
+    }
+    this->board->swapDensities();
+    this->escape_outflows.assign(this->escape_cells.size(), 0.);
+    this->outflow = 0.;
+    this->max_change = 0.f;
+    this->change_norm = 0.;
+    this->converged = false;
+    this->mass = 0.;
+    this->histogram = DensityHistogram();
+    this->markUpdatedRows();
+    if (this->activity_tracked) this->updateActivity(false);
+    this->activity_synchronous = true;
+    this->activity_diagonal = false;
+    this->ticks += depth;
+}
+
+unsigned long Sim::advance(unsigned long count) {
+    unsigned long ticks = 0;
+    while (ticks < count) {
+        uint depth = std::min({(unsigned long)this->time_block,
+                               (unsigned long)tile_size, count - ticks});
+        if (depth > 1 && this->canAdvanceBlocked()) {
+            this->tickBlocked(depth);
+            ticks += depth;
+            continue;
+        }
+        this->tick();
+        ticks++;
+        if (this->converged) break;
+    }
+    return ticks;
+}
+
+/**
+ * @brief Run the in-place transition function over the whole board.
+ *
+ * Cells are visited in row-major order, which the results depend on. Smoke
+ * can cross any number of cells south and east in a single in-place tick, so
+ * an inactive tile is woken up as soon as smoke reaches its north or west
+ * edge during the tick.
+ */
+template <typename T>
+void Sim::updateInPlace(float emitter_rate, float escape_rate,
+                        bool use_precalc_weights, Change* change, Mass* mass,
+                        DensityHistogram* histogram) {
+    KernelArgs args = this->kernelArgs(nullptr, nullptr, emitter_rate,
+                                       escape_rate, use_precalc_weights);
+    if (std::is_same<T, double>::value) {
+        args.dst_double = this->board->getDoubleDensities();
+    } else {
+        args.src = args.dst = this->board->getDensities();
+    }
+    args.src_double = args.dst_double;
+    T* density = targetOf<T>(args);
+    bool drafted = this->draft_noise > 0.f;
+    Draft draft = draftOf(this->draft_noise, this->draft_seed, this->ticks);
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    size_t stride = this->board->getStride();
+    for (uint row = 0; row < height; row++) {
+        size_t tile = (size_t)(row / tile_size) * this->tile_cols;
+        bool first_row = row % tile_size == 0;
+        for (uint col = 0; col < width; col += tile_size, tile++) {
+            size_t idx = this->board->indexOf(row, col);
+            size_t end = idx + std::min(tile_size, width - col);
+            if (this->activity_tracked && !this->tile_active[tile]) {
+                bool reached = density[idx - 1] != 0;
+                for (size_t adj = idx - stride; first_row && !reached &&
+                                                adj < end - stride;
+                     adj++) {
+                    reached = density[adj] != 0;
+                }
+                if (!reached) continue;
+                this->tile_active[tile] = 1;
+            }
+            bool sources = this->tile_sources[tile];
+            float* max = change != nullptr ? &change->max : nullptr;
+            double* squares = change != nullptr ? &change->squares : nullptr;
+            if (drafted) {
+                updateSpan(args, draft, idx, end, max, squares);
+            } else {
+                updateSpan(args, idx, end, sources, max, squares);
+            }
+            if (mass != nullptr) {
+                measureMass(args.type, density, idx, end, &mass->sum,
+                            &mass->carry);
+            }
+            if (histogram != nullptr) {
+                measureHistogram(args.type, density, idx, end,
+                                 this->occupied_density, histogram);
+            }
+            if (this->arrivals_tracked) {
+                measureArrival(args.type, density, idx, end,
+                               this->arrivals_threshold, this->ticks + 1,
+                               this->arrivals.data());
+            }
+            if (this->doses_tracked) {
+                measureDose(args.type, density, idx, end,
+                            this->doses.data());
+            }
+            if (this->activity_tracked && !this->tile_live[tile]) {
+                this->tile_live[tile] =
+                    std::any_of(density + idx, density + end,
+                                [](T density) { return density != 0; });
+            }
+        }
+    }
+    this->board->touchDensities();
+}
+
+/**
+ * @brief Run the red-black transition function over the whole board.
+ *
+ * Each cell only reads its side neighbours, all of the other colour, so the
+ * cells of a colour do not depend on each other and the workers share the
+ * rows of tiles of each half of the sweep with the same results whatever
+ * their number. Smoke crosses at most two cells per tick, around a corner
+ * too, so activity spreads to the tiles on the corners of live ones.
+ */
+template <typename T>
+void Sim::updateRedBlack(KernelArgs args, WorkerPool* workers, uint threads,
+                         std::vector<Change>* changes,
+                         std::vector<Mass>* masses,
+                         std::vector<DensityHistogram>* histograms) {
+    if (std::is_same<T, double>::value) {
+        args.dst_double = this->board->getDoubleDensities();
+    } else {
+        args.src = args.dst = this->board->getDensities();
+    }
+    args.src_double = args.dst_double;
+    T* density = targetOf<T>(args);
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    for (uint colour = 0; colour < 2; colour++) {
+        // Cells are only measured once both colours are done
+        bool done = colour == 1;
+        this->runBlocks(
+            workers, threads, this->tile_rows, 1,
+            [&](uint worker, size_t tile_row) {
+                Change* change =
+                    changes != nullptr ? &(*changes)[worker] : nullptr;
+                float* max = change != nullptr ? &change->max : nullptr;
+                double* squares =
+                    change != nullptr ? &change->squares : nullptr;
+                Mass* mass = masses != nullptr && done
+                                 ? &(*masses)[tile_row]
+                                 : nullptr;
+                DensityHistogram* histogram =
+                    histograms != nullptr && done ? &(*histograms)[worker]
+                                                  : nullptr;
+                uint row_end = std::min<uint>(
+                    height, (tile_row + 1) * tile_size);
+                for (uint row = tile_row * tile_size; row < row_end; row++) {
+                    size_t tile = tile_row * this->tile_cols;
+                    for (uint col = 0; col < width;
+                         col += tile_size, tile++) {
+                        if (this->activity_tracked && !this->tile_active[tile])
+                            continue;
+                        size_t idx = this->board->indexOf(row, col);
+                        size_t end = idx + std::min(tile_size, width - col);
+                        updateChecker(args, idx + ((row + col + colour) & 1),
+                                      end, this->tile_sources[tile], max,
+                                      squares);
+                        if (!done) continue;
+                        if (mass != nullptr) {
+                            measureMass(args.type, density, idx, end,
+                                        &mass->sum, &mass->carry);
+                        }
+                        if (histogram != nullptr) {
+                            measureHistogram(args.type, density, idx, end,
+                                             this->occupied_density,
+                                             histogram);
+                        }
+                        if (this->arrivals_tracked) {
+                            measureArrival(args.type, density, idx, end,
+                                           this->arrivals_threshold,
+                                           this->ticks + 1,
+                                           this->arrivals.data());
+                        }
+                        if (this->doses_tracked) {
+                            measureDose(args.type, density, idx, end,
+                                        this->doses.data());
+                        }
+                        if (this->activity_tracked && !this->tile_live[tile]) {
+                            this->tile_live[tile] = std::any_of(
+                                density + idx, density + end,
+                                [](T density) { return density != 0; });
+                        }
+                    }
+                }
+            });
+    }
+    this->board->touchDensities();
+}
+
+static constexpr unsigned long solve_window = 64;
+
+/**
+ * @brief Run an over-relaxed in-place update on the cells in [begin, end),
+ * adding the change of each density to max and squares.
+ */
+template <bool Uniform, bool Rated>
+static void relaxSpan(const KernelArgs& args, size_t begin, size_t end,
+                      float relaxation, float* max, double* squares) {
+    float* density = args.dst;
+    float span_max = *max, span_squares = 0.f;
+    for (size_t idx = begin; idx < end; idx++) {
+        if (args.links[idx] == 0) continue;
+        float flux = cellFlux<float, Uniform, true, Rated>(args, idx);
+        float next = density[idx] + relaxation * flux;
+        next = std::min(std::max(next, 0.f), 1.f);
+        float delta = std::fabs(next - density[idx]);
+        span_max = std::max(span_max, delta);
+        span_squares += delta * delta;
+        density[idx] = next;
+    }
+    *max = span_max;
+    *squares += span_squares;
+}
+
+typedef void (*RelaxKernel)(const KernelArgs& args, size_t begin, size_t end,
+                            float relaxation, float* max, double* squares);
+
+/* Kernels by uniform weights and rate table, in binary order. */
+static const RelaxKernel relax_kernels[4] = {
+    relaxSpan<false, false>, relaxSpan<false, true>, relaxSpan<true, false>,
+    relaxSpan<true, true>};
+
+/* Successive over-relaxation: a steady state is a field where the net flow
+ * into every floor cell is zero, and Gauss-Seidel sweeps that overshoot each
+ * in-place update by the relaxation factor get there in far fewer sweeps
+ * than ticking. Densities are kept in [0, 1], where the flows are defined. */
+unsigned long Sim::solve(float tolerance, unsigned long max_sweeps,
+                         float relaxation) {
+    if (this->backend != nullptr) {
+        throw std::runtime_error(
+            "The steady-state solver can only run on the CPU.");
+    }
+    if (this->board->getStorage() != Board::Storage::Float) {
+        throw std::runtime_error(
+            "The steady-state solver needs float densities.");
+    }
+    if (this->stencil != Sim::Stencil::VonNeumann) {
+        throw std::runtime_error(
+            "The steady-state solver only runs the von Neumann stencil.");
+    }
+    this->board->ownDensities();
+    float* density = this->board->getDensities();
+    KernelArgs args =
+        this->kernelArgs(density, density, this->emitter_rate,
+                         this->escape_rate, this->use_precalc_weights);
+    RelaxKernel relax = relax_kernels[args.uniform_flow << 1 |
+                                      (args.rates != nullptr)];
+    uint width = this->board->getWidth(), height = this->board->getHeight();
+    // The densities change behind the back of activity tracking
+    this->activity_stale = true;
+    this->converged = false;
+    unsigned long sweeps = 0;
+    float window_max = 0.f, last_window_max = INFINITY;
+    while (sweeps < max_sweeps && !this->converged) {
+        Change change;
+        for (uint row = 0; row < height; row++) {
+            size_t idx = this->board->indexOf(row, 0);
+            relax(args, idx, idx + width, relaxation, &change.max,
+                  &change.squares);
+        }
+        sweeps++;
+        this->max_change = change.max;
+        this->change_norm = std::sqrt(change.squares);
+        this->converged = this->max_change < tolerance;
+        /* Over-relaxing too much makes the densities oscillate instead of
+         * settling: back off towards plain sweeps whenever a window of
+         * sweeps made no progress over the previous one. */
+        window_max = std::max(window_max, this->max_change);
+        if (sweeps % solve_window == 0) {
+            if (window_max >= last_window_max)
+                relaxation = 1.f + (relaxation - 1.f) * .5f;
+            last_window_max = window_max;
+            window_max = 0.f;
+        }
+    }
+    this->board->markRows(0, height);
+    return sweeps;
+}
+
+void Sim::addFootprint(Footprint* footprint) {
+    this->board->addFootprint(footprint);
+    footprint->add(
+        "tiles",
+        this->tile_active.capacity() + this->tile_was_active.capacity() +
+            this->tile_live.capacity() + this->tile_quiet.capacity() +
+            this->tile_change.capacity() * sizeof(float) +
+            this->tile_skipped.capacity() + this->tile_sources.capacity() +
+            this->runs.capacity() * sizeof(LinkRun) +
+            this->run_rows.capacity() * sizeof(size_t));
+    footprint->add(
+        "tracking",
+        this->arrivals.capacity() * sizeof(uint) +
+            this->doses.capacity() * sizeof(double) +
+            this->histogram.bins.capacity() * sizeof(size_t) +
+            this->outlets.capacity() * sizeof(Outlet) +
+            this->escape_outflows.capacity() * sizeof(double));
+}
+
+void Sim::planFootprint(Footprint* footprint, Board::Storage storage,
+                        bool decoded) {
+    Board* board = this->board;
+    board->planFootprint(footprint, storage, decoded);
+    size_t size = board->getPaddedSize();
+    size_t tiles = (size_t)((board->getHeight() + tile_size - 1) / tile_size) *
+                   ((board->getWidth() + tile_size - 1) / tile_size);
+    // At least a run per row once they are found
+    size_t runs = std::max<size_t>(this->runs.size(), board->getHeight());
+    footprint->add("tiles", tiles * (6 + sizeof(float)) +
+                                runs * sizeof(LinkRun) +
+                                (board->getHeight() + 1) * sizeof(size_t));
+    size_t tracking = this->histogram_bins * sizeof(size_t) +
+                      this->outlets.capacity() * sizeof(Outlet) +
+                      this->escape_outflows.capacity() * sizeof(double);
+    if (this->arrival_threshold > 0.f) tracking += size * sizeof(uint);
+    if (this->track_dose) tracking += size * sizeof(double);
+    footprint->add("tracking", tracking);
+    // Time blocks allocate their scratch buffers for as long as they run
+    if (this->time_block > 1 && this->canAdvanceBlocked()) {
+        size_t bytes = storage == Board::Storage::Fixed    ? sizeof(Fixed16)
+                       : storage == Board::Storage::Double ? sizeof(double)
+                                                           : sizeof(float);
+        footprint->add("scratch", std::max(1u, this->threads) *
+                                      blockScratchSize(board->getStride()) *
+                                      bytes);
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file sim_loader.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_loader.hpp"
+
+#include <stdexcept>
+
+#include "board_file.hpp"
+#include "checkpoint.hpp"
+
+SimLoader::~SimLoader() {
+    if (this->thread.joinable()) this->thread.join();
+    delete this->sim;
+}
+
+void SimLoader::loadLayout(const std::string& path, uint emitter_row,
+                           uint emitter_col) {
+    this->thread = std::thread(&SimLoader::buildLayout, this, path,
+                               emitter_row, emitter_col);
+}
+
+void SimLoader::loadCheckpoint(const std::string& path) {
+    this->thread = std::thread(&SimLoader::buildCheckpoint, this, path);
+}
+
+Sim* SimLoader::take() {
+    if (!this->done) {
+        throw std::runtime_error("The simulation is still loading.");
+    }
+    if (this->thread.joinable()) this->thread.join();
+    if (this->sim == nullptr) throw std::runtime_error(this->error);
+    Sim* sim = this->sim;
+    this->sim = nullptr;
+    return sim;
+}
+
+void SimLoader::buildLayout(std::string path, uint emitter_row,
+                            uint emitter_col) {
+    try {
+        this->stage = "Reading layout";
+        Board* board;
+        // Binary layouts and images come with their own emitters
+        if (hasOwnEmitters(path)) {
+            bool has_weights;
+            board = loadBoard(path, &has_weights);
+        } else {
+            board = loadCachedLayout(path);
+            try {
+                board->placeEmitter(emitter_row, emitter_col);
+                board->computeWeightsAround(emitter_row, emitter_col);
+            } catch (std::runtime_error& e) {
+                delete board;
+                throw;
+            }
+        }
+        this->sim = new Sim(board);
+    } catch (std::exception& e) {
+        // Anything escaping the thread would terminate the program
+        this->error = e.what();
+    }
+    this->progress = 1.f;
+    this->done = true;
+}
+
+void SimLoader::buildCheckpoint(std::string path) {
+    try {
+        this->stage = "Reading checkpoint";
+        this->sim = readCheckpoint(path);
+    } catch (std::exception& e) {
+        this->error = e.what();
+    }
+    this->progress = 1.f;
+    this->done = true;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file sim_run.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_run.hpp"
+
+#include <algorithm>
+
+unsigned long SimRun::resume(unsigned long ticks) {
+    if (this->isDone()) return 0;
+    unsigned long run =
+        this->sim->advance(std::min(ticks, this->count - this->ticks));
+    this->ticks += run;
+    this->converged = this->sim->hasConverged();
+    return run;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file sim_thread.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_thread.hpp"
+
+#include <chrono>
+
+void SimThread::start(unsigned long tick_limit) {
+    this->stop();
+    this->tick_limit = tick_limit;
+    this->running = true;
+    this->thread = std::thread(&SimThread::loop, this);
+}
+
+void SimThread::stop() {
+    this->running = false;
+    if (this->thread.joinable()) this->thread.join();
+}
+
+std::unique_lock<std::mutex> SimThread::acquire() {
+    // Shows how long the thread holds the simulation up for
+    TraceScope trace(this->sim->tracer, "acquire");
+    this->waiting++;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->waiting--;
+    return lock;
+}
+
+void SimThread::loop() {
+    using clock = std::chrono::steady_clock;
+    auto begin = clock::now();
+    unsigned long ticks = 0, paced = 0;
+    double rate = this->target_rate;
+    while (this->running) {
+        // Let whoever is waiting for the simulation go first
+        while (this->waiting > 0) std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->sim->tick();
+            TraceScope trace(this->sim->tracer, "snapshot");
+            this->snapshots.publish(*this->sim, this->snapshot_arrivals,
+                                    this->snapshot_doses);
+        }
+        ticks++;
+        paced++;
+        if (this->tick_limit != 0 && ticks >= this->tick_limit) break;
+        if (this->sim->hasConverged()) break;
+        if (this->target_rate != rate) {
+            // Restart pacing from here when the target changes
+            rate = this->target_rate;
+            begin = clock::now();
+            paced = 0;
+        }
+        if (rate > 0.) {
+            std::this_thread::sleep_until(
+                begin + std::chrono::duration_cast<clock::duration>(
+                            std::chrono::duration<double>(paced / rate)));
+        }
+    }
+    this->running = false;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file snapshot.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snapshot.hpp"
+
+#include <algorithm>
+
+void SnapshotBuffer::publish(Sim& sim, bool arrivals, bool doses) {
+    Snapshot& snapshot = this->slots[this->back];
+    Board* board = sim.board;
+    size_t size = board->getPaddedSize(), stride = board->getStride();
+    uint begin = 0, end = board->getHeight();
+    if (snapshot.board != board || snapshot.densities.size() != size) {
+        snapshot.densities.assign(size, 0.f);
+        snapshot.arrivals.clear();
+        snapshot.doses.clear();
+        snapshot.board = board;
+    } else {
+        board->getChangedRows(snapshot.generation, &begin, &end);
+    }
+    // Maps are copied whole, as they are reset without changing any row
+    const uint* map = arrivals ? sim.getArrivals() : nullptr;
+    if (map != nullptr) {
+        snapshot.arrivals.assign(map, map + size);
+    } else {
+        snapshot.arrivals.clear();
+    }
+    const double* dose = doses ? sim.getDoses() : nullptr;
+    if (dose != nullptr) {
+        snapshot.doses.assign(dose, dose + size);
+    } else {
+        snapshot.doses.clear();
+    }
+    if (begin < end) {
+        // Padded rows, as the padding never changes
+        size_t first = (begin + 1) * stride, last = (end + 1) * stride;
+        if (board->getStorage() == Board::Storage::Float) {
+            const float* density = board->getDensities();
+            std::copy(density + first, density + last,
+                      snapshot.densities.begin() + first);
+        } else {
+            // Decoding the whole board would cost more than the copy
+            for (uint row = begin; row < end; row++) {
+                size_t idx = board->indexOf(row, 0);
+                for (uint col = 0; col < board->getWidth(); col++)
+                    snapshot.densities[idx + col] = sim.getDensity(row, col);
+            }
+        }
+    }
+    snapshot.ticks = sim.getTicks();
+    snapshot.generation = board->getGeneration();
+    // Releases the copy to the reader and acquires the slot it gave back
+    this->back =
+        this->shared.exchange(this->back | fresh, std::memory_order_acq_rel) &
+        ~fresh;
+}
+
+const Snapshot* SnapshotBuffer::take(bool* taken) {
+    bool newer = this->shared.load(std::memory_order_relaxed) & fresh;
+    if (newer) {
+        this->front =
+            this->shared.exchange(this->front, std::memory_order_acq_rel) &
+            ~fresh;
+    }
+    if (taken != nullptr) *taken = newer;
+    const Snapshot& snapshot = this->slots[this->front];
+    return snapshot.board != nullptr ? &snapshot : nullptr;
+}
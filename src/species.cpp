@@ -0,0 +1,126 @@
+/**
+ * @file species.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "species.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "kernel.hpp"
+
+// Species advanced by each vector of the sweep
+static constexpr uint vector_lanes = 4;
+
+Species::Species(Board* layout, uint count,
+                 const std::vector<SpeciesSource>& sources) {
+    if (count == 0) {
+        throw std::runtime_error("There must be at least one species.");
+    }
+    if (layout->getStorage() != Board::Storage::Float) {
+        throw std::runtime_error("Species only support float storage.");
+    }
+    for (auto& source : sources) {
+        if (source.species >= count) {
+            throw std::runtime_error("Emitter of an unknown species.");
+        }
+    }
+    this->board = layout->fork();
+    try {
+        for (auto& source : sources) {
+            this->board->placeEmitter(source.row, source.col, source.rate);
+            this->board->computeWeightsAround(source.row, source.col);
+        }
+    } catch (std::runtime_error& e) {
+        delete this->board;
+        throw;
+    }
+    this->count = count;
+    this->lanes =
+        (count + vector_lanes - 1) / vector_lanes * vector_lanes;
+    size_t size = this->board->getPaddedSize();
+    const float* density = layout->getDensities();
+    this->density.assign(size * this->lanes, 0.f);
+    for (size_t idx = 0; idx < size; idx++)
+        this->density[idx * this->lanes] = density[idx];
+    // Emitters are full of their own species alone
+    for (auto& source : sources) {
+        size_t idx = this->board->indexOf(source.row, source.col);
+        this->density[idx * this->lanes] = 0.f;
+        this->density[idx * this->lanes + source.species] = 1.f;
+    }
+    this->density_next = this->density;
+}
+
+void Species::tick() {
+    bool precalc = this->use_precalc_weights;
+    float bias = this->elevation_bias;
+    if (!this->board->hasFlowCoefficients(precalc, bias))
+        this->board->computeFlowCoefficients(precalc, bias);
+    bool uniform = this->board->hasUniformRates();
+    KernelArgs args = {};
+    args.type = this->board->getTypes();
+    args.links = this->board->getLinks();
+    args.flow_in = this->board->getInflowCoefficients();
+    args.flow_out = this->board->getOutflowCoefficients();
+    args.src = this->density.data();
+    args.dst = this->density_next.data();
+    args.rate_index = uniform ? nullptr : this->board->getRateIndices();
+    args.rates = uniform ? nullptr : this->board->getRates();
+    args.stride = this->board->getStride();
+    args.emitter_rate = this->emitter_rate;
+    args.escape_rate = this->escape_rate;
+    const ptrdiff_t offsets[4] = {-(ptrdiff_t)args.stride,
+                                  (ptrdiff_t)args.stride, -1, 1};
+    const size_t lanes = this->lanes;
+    for (uint row = 0; row < this->board->getHeight(); row++) {
+        size_t begin = this->board->indexOf(row, 0);
+        size_t end = begin + this->board->getWidth();
+        if (updateCellsSimd(args, lanes, begin, end)) continue;
+        for (size_t cur = begin; cur < end; cur++) {
+            const float* density = args.src + cur * lanes;
+            if (args.links[cur] == 0) {
+                std::copy_n(density, lanes, args.dst + cur * lanes);
+                continue;
+            }
+            CellFlows flows;
+            const float* adj_density[4];
+            gatherFlows(args, cur, &flows);
+            for (int dir = 0; dir < 4; dir++)
+                adj_density[dir] = args.src + (cur + offsets[dir]) * lanes;
+            updateLanes(flows, density, adj_density, args.dst + cur * lanes,
+                        lanes);
+        }
+    }
+    std::swap(this->density, this->density_next);
+    this->ticks++;
+}
+
+double Species::getMass(uint species) {
+    const Cell::Type* type = this->board->getTypes();
+    double mass = 0.;
+    for (uint row = 0; row < this->board->getHeight(); row++) {
+        size_t cur = this->board->indexOf(row, 0);
+        for (uint col = 0; col < this->board->getWidth(); col++, cur++) {
+            if (type[cur] == Cell::Floor)
+                mass += this->density[cur * this->lanes + species];
+        }
+    }
+    return mass;
+}
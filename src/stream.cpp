@@ -0,0 +1,452 @@
+/**
+ * @file stream.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stream.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief A page that connects back to the stream it was served by and draws
+ * its frames.
+ */
+static const char viewer_page[] = R"html(<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>smokey</title>
+<style>body{margin:0;background:#222;color:#ccc;font:14px sans-serif}
+canvas{display:block;margin:auto;image-rendering:pixelated;max-width:100vw;
+max-height:90vh;width:90vmin}p{text-align:center}</style></head>
+<body><p id="status">Connecting...</p><canvas id="board"></canvas><script>
+const status = document.getElementById("status");
+const canvas = document.getElementById("board");
+const context = canvas.getContext("2d");
+let cells = null, image = null, queue = Promise.resolve();
+async function show(data) {
+  const view = new DataView(data);
+  const tick = view.getUint32(4, true), width = view.getUint32(8, true);
+  const height = view.getUint32(12, true), key = view.getUint32(16, true) & 1;
+  const stream = new Blob([data.slice(20)]).stream()
+      .pipeThrough(new DecompressionStream("deflate"));
+  const bytes = new Uint8Array(await new Response(stream).arrayBuffer());
+  if (key || cells === null || cells.length !== bytes.length) {
+    cells = bytes;
+    canvas.width = width;
+    canvas.height = height;
+    image = context.createImageData(width, height);
+  } else {
+    for (let i = 0; i < bytes.length; i++) cells[i] = cells[i] + bytes[i];
+  }
+  for (let i = 0; i < cells.length; i++) {
+    const shade = 255 - cells[i];
+    image.data.set([shade, shade, shade, 255], i * 4);
+  }
+  context.putImageData(image, 0, 0);
+  status.textContent = "Tick " + tick;
+}
+const socket = new WebSocket("ws://" + location.host + "/");
+socket.binaryType = "arraybuffer";
+socket.onmessage = (event) => { queue = queue.then(() => show(event.data)); };
+socket.onclose = () => { status.textContent += " (disconnected)"; };
+</script></body></html>
+)html";
+
+/**
+ * @brief Compute the SHA-1 digest of a message, which the WebSocket
+ * handshake needs.
+ */
+static std::string sha1(const std::string& message) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                     0xC3D2E1F0};
+    std::string data = message;
+    uint64_t bits = (uint64_t)message.size() * 8;
+    data += (char)0x80;
+    while (data.size() % 64 != 56) data += (char)0;
+    for (int shift = 56; shift >= 0; shift -= 8) data += (char)(bits >> shift);
+    auto rotate = [](uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    };
+    for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = 0;
+            for (int byte = 0; byte < 4; byte++)
+                w[i] = w[i] << 8 | (unsigned char)data[chunk + i * 4 + byte];
+        }
+        for (int i = 16; i < 80; i++)
+            w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t next = rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotate(b, 30);
+            b = a;
+            a = next;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    std::string digest;
+    for (uint32_t word : h) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            digest += (char)(word >> shift);
+    }
+    return digest;
+}
+
+static std::string base64(const std::string& data) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string text;
+    for (size_t idx = 0; idx < data.size(); idx += 3) {
+        uint32_t group = (unsigned char)data[idx] << 16;
+        if (idx + 1 < data.size()) group |= (unsigned char)data[idx + 1] << 8;
+        if (idx + 2 < data.size()) group |= (unsigned char)data[idx + 2];
+        text += digits[group >> 18 & 63];
+        text += digits[group >> 12 & 63];
+        text += idx + 1 < data.size() ? digits[group >> 6 & 63] : '=';
+        text += idx + 2 < data.size() ? digits[group & 63] : '=';
+    }
+    return text;
+}
+
+/**
+ * @brief Get the value of a header of an HTTP request, or an empty string.
+ */
+static std::string headerOf(const std::string& request,
+                            const std::string& name) {
+    std::string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    size_t at = lower.find("\r\n" + name + ":");
+    if (at == std::string::npos) return "";
+    size_t begin = request.find_first_not_of(" \t", at + name.size() + 3);
+    size_t end = request.find("\r\n", at + 2);
+    if (begin == std::string::npos || begin >= end) return "";
+    return request.substr(begin, request.find_last_not_of(" \t", end - 1) -
+                                     begin + 1);
+}
+
+FrameStream::FrameStream(uint port, uint width, uint height, float rate,
+                         size_t max_pending) {
+    if (!(rate > 0.f))
+        throw std::runtime_error("Streams need a positive frame rate.");
+    this->width = width;
+    this->height = height;
+    this->interval = std::chrono::duration_cast<
+        std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1. / rate));
+    this->due = std::chrono::steady_clock::now();
+    this->max_pending = std::max(max_pending, (size_t)1);
+    this->listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int reuse = 1;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (this->listener == -1 ||
+        setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                   sizeof(reuse)) != 0 ||
+        bind(this->listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(this->listener, 16) != 0 ||
+        pipe2(this->wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+        if (this->listener != -1) close(this->listener);
+        throw std::runtime_error(
+            "An I/O error occurred while listening for viewers.");
+    }
+    this->thread = std::thread(&FrameStream::loop, this);
+}
+
+FrameStream::~FrameStream() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->quit = true;
+    }
+    char byte = 0;
+    if (write(this->wake[1], &byte, 1) < 0) {
+        // The pipe is full, so the thread is already woken up
+    }
+    this->thread.join();
+    for (Client& client : this->clients) close(client.fd);
+    close(this->listener);
+    close(this->wake[0]);
+    close(this->wake[1]);
+}
+
+void FrameStream::offer(Sim& sim) {
+    auto now = std::chrono::steady_clock::now();
+    if (now < this->due) return;
+    this->due = std::max(this->due + this->interval, now);
+    TraceScope trace(sim.tracer, "stream");
+    Board* board = sim.board;
+    if (board->getWidth() != this->width ||
+        board->getHeight() != this->height)
+        throw std::runtime_error("The board does not match the stream.");
+    std::vector<unsigned char> densities;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->spare.empty()) {
+            densities = std::move(this->spare.back());
+            this->spare.pop_back();
+        }
+    }
+    densities.resize((size_t)this->width * this->height);
+    const float* src = board->getDensities();
+    for (uint row = 0; row < this->height; row++) {
+        const float* density = src + board->indexOf(row, 0);
+        unsigned char* cell = densities.data() + (size_t)row * this->width;
+        for (uint col = 0; col < this->width; col++) {
+            cell[col] = std::lrint(
+                std::min(std::max(density[col], 0.f), 1.f) * 255.f);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->pending.size() >= this->max_pending) {
+            this->spare.push_back(std::move(this->pending.front().densities));
+            this->pending.pop_front();
+            this->dropped++;
+        }
+        this->pending.push_back({sim.getTicks(), std::move(densities)});
+    }
+    char byte = 0;
+    if (write(this->wake[1], &byte, 1) < 0) {
+        // The pipe is full, so the thread is already woken up
+    }
+}
+
+unsigned long FrameStream::getDropped() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->dropped;
+}
+
+void FrameStream::loop() {
+    std::vector<pollfd> polled;
+    for (;;) {
+        polled.assign(
+            {{this->wake[0], POLLIN, 0}, {this->listener, POLLIN, 0}});
+        for (Client& client : this->clients) {
+            short events = POLLIN;
+            if (!client.output.empty()) events |= POLLOUT;
+            polled.push_back({client.fd, events, 0});
+        }
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        // Clients first, as accepting and sending change the list
+        for (size_t idx = 0; idx < this->clients.size(); idx++) {
+            Client& client = this->clients[idx];
+            short events = polled[idx + 2].revents;
+            if (events & (POLLIN | POLLERR | POLLHUP)) this->receive(client);
+            if (events & POLLOUT) this->flush(client);
+        }
+        this->clients.erase(
+            std::remove_if(this->clients.begin(), this->clients.end(),
+                           [](Client& client) { return client.fd == -1; }),
+            this->clients.end());
+        if (polled[1].revents & POLLIN) this->accept();
+        if (polled[0].revents & POLLIN) {
+            char bytes[64];
+            while (read(this->wake[0], bytes, sizeof(bytes)) > 0) {
+            }
+            Frame frame;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->quit) return;
+                if (this->pending.empty()) continue;
+                // Only the latest frame is worth sending
+                while (this->pending.size() > 1) {
+                    this->spare.push_back(
+                        std::move(this->pending.front().densities));
+                    this->pending.pop_front();
+                    this->dropped++;
+                }
+                frame = std::move(this->pending.front());
+                this->pending.pop_front();
+            }
+            this->send(frame);
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->spare.push_back(std::move(frame.densities));
+        }
+    }
+}
+
+void FrameStream::accept() {
+    for (;;) {
+        int fd = accept4(this->listener, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) return;
+        Client client;
+        client.fd = fd;
+        this->clients.push_back(client);
+    }
+}
+
+void FrameStream::receive(Client& client) {
+    char bytes[4096];
+    for (;;) {
+        ssize_t size = recv(client.fd, bytes, sizeof(bytes), 0);
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (size <= 0) {
+            this->disconnect(client);
+            return;
+        }
+        // Messages from viewers are ignored, they close the connection
+        if (client.upgraded || client.closing) continue;
+        client.request.append(bytes, size);
+        if (client.request.size() > 8192) {
+            this->disconnect(client);
+            return;
+        }
+    }
+    if (client.upgraded || client.closing ||
+        client.request.find("\r\n\r\n") == std::string::npos)
+        return;
+    std::string key = headerOf(client.request, "sec-websocket-key");
+    if (!key.empty()) {
+        client.output =
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " +
+            base64(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11")) +
+            "\r\n\r\n";
+        client.upgraded = true;
+    } else if (client.request.compare(0, 6, "GET / ") == 0) {
+        client.output = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/html; charset=utf-8\r\n"
+                        "Content-Length: " +
+                        std::to_string(sizeof(viewer_page) - 1) +
+                        "\r\nConnection: close\r\n\r\n" + viewer_page;
+        client.closing = true;
+    } else {
+        client.output = "HTTP/1.1 404 Not Found\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n\r\n";
+        client.closing = true;
+    }
+    client.request.clear();
+    this->flush(client);
+}
+
+void FrameStream::flush(Client& client) {
+    while (client.fd != -1 && !client.output.empty()) {
+        ssize_t size = ::send(client.fd, client.output.data(),
+                              client.output.size(), MSG_NOSIGNAL);
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (size <= 0) {
+            this->disconnect(client);
+            return;
+        }
+        client.output.erase(0, size);
+    }
+    if (client.closing && client.output.empty()) this->disconnect(client);
+}
+
+void FrameStream::disconnect(Client& client) {
+    if (client.fd == -1) return;
+    close(client.fd);
+    client.fd = -1;
+}
+
+void FrameStream::send(Frame& frame) {
+    std::string key, delta;
+    for (Client& client : this->clients) {
+        if (client.fd == -1 || !client.upgraded || client.closing) continue;
+        // A client still busy with a frame skips this one
+        if (!client.output.empty()) {
+            client.synced = false;
+            continue;
+        }
+        std::string& message = client.synced ? delta : key;
+        if (message.empty()) message = this->encode(frame, !client.synced);
+        client.output = message;
+        client.synced = true;
+        this->flush(client);
+    }
+    // The frame becomes the base of the next one
+    std::swap(this->previous, frame.densities);
+}
+
+std::string FrameStream::encode(const Frame& frame, bool key) {
+    size_t cells = frame.densities.size();
+    std::vector<unsigned char> planes(frame.densities);
+    if (!key) {
+        for (size_t idx = 0; idx < cells; idx++)
+            planes[idx] -= this->previous[idx];
+    }
+    uLongf size = compressBound(cells);
+    std::string payload(sizeof(StreamHeader) + size, '\0');
+    StreamHeader header;
+    std::memcpy(header.magic, stream_magic, sizeof(header.magic));
+    header.tick = frame.tick;
+    header.width = this->width;
+    header.height = this->height;
+    header.flags = key ? Streaming::KeyFrame : 0u;
+    std::memcpy(&payload[0], &header, sizeof(header));
+    if (compress2((unsigned char*)&payload[sizeof(header)], &size,
+                  planes.data(), cells, Z_BEST_SPEED) != Z_OK)
+        throw std::runtime_error("Failed to compress a frame.");
+    payload.resize(sizeof(header) + size);
+    // A binary WebSocket frame, its length in as few bytes as it fits in
+    std::string message(1, (char)0x82);
+    uint64_t length = payload.size();
+    if (length < 126) {
+        message += (char)length;
+    } else if (length < 65536) {
+        message += (char)126;
+        message += (char)(length >> 8);
+        message += (char)length;
+    } else {
+        message += (char)127;
+        for (int shift = 56; shift >= 0; shift -= 8)
+            message += (char)(length >> shift);
+    }
+    return message + payload;
+}
@@ -0,0 +1,342 @@
+/**
+ * @file sweep.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sweep.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+
+#include "ensemble.hpp"
+#include "workers.hpp"
+
+/**
+ * @brief Add up the densities of a board and find the highest.
+ */
+static void measure(Board* board, SweepResult* result) {
+    const float* density = board->getDensities();
+    for (uint row = 0; row < board->getHeight(); row++) {
+        size_t idx = board->indexOf(row, 0);
+        for (uint col = 0; col < board->getWidth(); col++, idx++) {
+            result->mass += density[idx];
+            if (density[idx] > result->peak) result->peak = density[idx];
+        }
+    }
+}
+
+/**
+ * @brief Run jobs on a pool of workers, handing them out one at a time.
+ *
+ * Each job is called with the worker that runs it and its index.
+ */
+static void runJobs(size_t count, uint jobs,
+                    const std::function<void(uint, size_t)>& job) {
+    if (jobs == 0) jobs = 1;
+    std::vector<std::exception_ptr> errors(jobs);
+    std::atomic<size_t> next{0};
+    WorkerPool workers(jobs);
+    workers.run([&](uint worker) {
+        try {
+            for (size_t idx = next++; idx < count; idx = next++)
+                job(worker, idx);
+        } catch (...) {
+            // Stop handing out jobs and report the error on this thread
+            next = count;
+            errors[worker] = std::current_exception();
+        }
+    });
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+SweepResult Sweep::run(const SweepPoint& point, Arena* arena) {
+    Board* board = new Board(*this->layout, arena);
+    if (point.place_emitter) {
+        try {
+            board->placeEmitter(point.emitter_row, point.emitter_col);
+        } catch (std::runtime_error& e) {
+            delete board;
+            throw;
+        }
+        board->computeWeightsAround(point.emitter_row, point.emitter_col);
+    }
+    board->setStorage(point.storage);
+    Sim sim(board);
+    sim.emitter_rate = point.emitter_rate;
+    sim.escape_rate = point.escape_rate;
+    sim.use_precalc_weights = point.use_precalc_weights;
+    sim.update_mode = this->update_mode;
+    sim.kernel = this->kernel;
+    sim.tolerance = this->tolerance;
+    if (point.curve) sim.setEmitterCurves(point.curve);
+    for (unsigned long tick = 0; tick < this->ticks; tick++) {
+        sim.tick();
+        if (sim.hasConverged()) break;
+    }
+
+    SweepResult result;
+    result.ticks = sim.getTicks();
+    measure(board, &result);
+    return result;
+}
+
+void Sweep::runEnsemble(const std::vector<SweepPoint>& points,
+                        const std::vector<size_t>& members,
+                        std::vector<SweepResult>* results) {
+    const SweepPoint& first = points[members[0]];
+    std::vector<std::pair<uint, uint>> emitters;
+    for (size_t idx : members)
+        emitters.emplace_back(points[idx].emitter_row, points[idx].emitter_col);
+    Ensemble ensemble(this->layout, emitters);
+    ensemble.emitter_rate = first.emitter_rate;
+    ensemble.escape_rate = first.escape_rate;
+    ensemble.use_precalc_weights = first.use_precalc_weights;
+    ensemble.measure_change = this->tolerance > 0.f;
+    // Members that converge are measured then, and ignored afterwards
+    std::vector<bool> done(members.size(), false);
+    size_t running = members.size();
+    auto finish = [&](uint member) {
+        SweepResult& result = (*results)[members[member]];
+        result.ticks = ensemble.getTicks();
+        for (uint row = 0; row < this->layout->getHeight(); row++) {
+            for (uint col = 0; col < this->layout->getWidth(); col++) {
+                float density = ensemble.getDensity(member, row, col);
+                result.mass += density;
+                if (density > result.peak) result.peak = density;
+            }
+        }
+        done[member] = true;
+        running--;
+    };
+    for (unsigned long tick = 0; tick < this->ticks && running > 0; tick++) {
+        ensemble.tick();
+        for (uint member = 0; member < members.size(); member++) {
+            if (!done[member] && ensemble.measure_change &&
+                ensemble.getMaxChange(member) < this->tolerance)
+                finish(member);
+        }
+    }
+    for (uint member = 0; member < members.size(); member++) {
+        if (!done[member]) finish(member);
+    }
+}
+
+std::vector<SweepResult> Sweep::run(const std::vector<SweepPoint>& points,
+                                    uint jobs) {
+    /* Runs that only differ in their emitter are grouped into ensembles,
+     * each group is then one job. */
+    std::vector<std::vector<size_t>> groups;
+    // Groups that still have room for more members
+    std::vector<size_t> open;
+    for (size_t idx = 0; idx < points.size(); idx++) {
+        const SweepPoint& point = points[idx];
+        if (this->ensemble_size <= 1 || !point.place_emitter ||
+            point.storage != Board::Storage::Float || point.curve) {
+            groups.push_back({idx});
+            continue;
+        }
+        if (this->update_mode != Sim::Update::Synchronous) {
+            throw std::runtime_error("Ensembles need synchronous updates.");
+        }
+        auto group = std::find_if(open.begin(), open.end(), [&](size_t group) {
+            const SweepPoint& other = points[groups[group][0]];
+            return other.emitter_rate == point.emitter_rate &&
+                   other.escape_rate == point.escape_rate &&
+                   other.use_precalc_weights == point.use_precalc_weights;
+        });
+        if (group == open.end()) {
+            groups.emplace_back();
+            group = open.insert(open.end(), groups.size() - 1);
+        }
+        std::vector<size_t>& members = groups[*group];
+        members.push_back(idx);
+        if (members.size() == this->ensemble_size) open.erase(group);
+    }
+
+    std::vector<SweepResult> results(points.size());
+    /* Every run of a worker allocates its board from the same arena, which
+     * ends up holding all of its arrays at once and is reused as is. */
+    std::vector<Arena> arenas(std::max(jobs, 1u));
+    runJobs(groups.size(), jobs, [&](uint worker, size_t idx) {
+        if (groups[idx].size() > 1) {
+            this->runEnsemble(points, groups[idx], &results);
+            return;
+        }
+        size_t point = groups[idx][0];
+        results[point] = this->run(points[point], &arenas[worker]);
+        arenas[worker].reset();
+    });
+    return results;
+}
+
+std::vector<std::pair<uint, uint>> EscapeSearch::findCandidates(Board* layout,
+                                                                uint step) {
+    if (step == 0) throw std::runtime_error("The candidate step must be 1+.");
+    const Cell::Type* type = layout->getTypes();
+    const ptrdiff_t stride = layout->getStride();
+    std::vector<std::pair<uint, uint>> cells;
+    size_t found = 0;
+    for (uint row = 0; row < layout->getHeight(); row++) {
+        for (uint col = 0; col < layout->getWidth(); col++) {
+            size_t idx = layout->indexOf(row, col);
+            if (type[idx] != Cell::Floor) continue;
+            // The padding around the board is made of walls
+            if (type[idx - stride] != Cell::Wall &&
+                type[idx + stride] != Cell::Wall &&
+                type[idx - 1] != Cell::Wall && type[idx + 1] != Cell::Wall)
+                continue;
+            if (found++ % step == 0) cells.emplace_back(row, col);
+        }
+    }
+    return cells;
+}
+
+void EscapeSearch::runEnsemble(const std::vector<size_t>& members,
+                               std::vector<EscapeCandidate>* candidates) {
+    std::vector<std::pair<uint, uint>> cells;
+    for (size_t idx : members)
+        cells.emplace_back((*candidates)[idx].row, (*candidates)[idx].col);
+    Ensemble ensemble(this->layout, cells, Cell::Escape);
+    ensemble.emitter_rate = this->emitter_rate;
+    ensemble.escape_rate = this->escape_rate;
+    ensemble.use_precalc_weights = this->use_precalc_weights;
+    const Cell::Type* type = this->layout->getTypes();
+    size_t floors = 0;
+    for (uint row = 0; row < this->layout->getHeight(); row++) {
+        size_t idx = this->layout->indexOf(row, 0);
+        for (uint col = 0; col < this->layout->getWidth(); col++, idx++)
+            floors += type[idx] == Cell::Floor;
+    }
+    if (floors == 0) throw std::runtime_error("The layout has no floor.");
+    const size_t lanes = ensemble.getLanes();
+    const bool dose = this->metric == EscapeSearch::Metric::Dose;
+    const float threshold = this->threshold;
+    std::vector<double> sums(lanes);
+    size_t running = members.size();
+    for (unsigned long tick = 0; tick < this->ticks && running > 0; tick++) {
+        ensemble.tick();
+        // The cell of a member is an escape, with nothing to add up
+        std::fill(sums.begin(), sums.end(), 0.);
+        const float* density = ensemble.getDensities();
+        for (uint row = 0; row < this->layout->getHeight(); row++) {
+            size_t idx = this->layout->indexOf(row, 0);
+            for (uint col = 0; col < this->layout->getWidth(); col++, idx++) {
+                if (type[idx] != Cell::Floor) continue;
+                const float* cell = density + idx * lanes;
+                for (size_t lane = 0; lane < lanes; lane++) {
+                    sums[lane] +=
+                        dose ? cell[lane] : (double)(cell[lane] > threshold);
+                }
+            }
+        }
+        double bound = this->bound.load();
+        for (uint member = 0; member < members.size(); member++) {
+            EscapeCandidate& candidate = (*candidates)[members[member]];
+            if (candidate.pruned) continue;
+            candidate.score += sums[member] / floors;
+            candidate.ticks = ensemble.getTicks();
+            if (candidate.score > bound) {
+                candidate.pruned = true;
+                running--;
+            }
+        }
+    }
+    for (size_t idx : members) {
+        const EscapeCandidate& candidate = (*candidates)[idx];
+        if (candidate.pruned) continue;
+        double bound = this->bound.load();
+        while (candidate.score < bound &&
+               !this->bound.compare_exchange_weak(bound, candidate.score)) {
+        }
+    }
+}
+
+std::vector<EscapeCandidate> EscapeSearch::run(
+    const std::vector<std::pair<uint, uint>>& cells, uint jobs) {
+    if (this->ensemble_size == 0)
+        throw std::runtime_error("Ensembles need at least one member.");
+    std::vector<EscapeCandidate> candidates(cells.size());
+    for (size_t idx = 0; idx < cells.size(); idx++) {
+        candidates[idx].row = cells[idx].first;
+        candidates[idx].col = cells[idx].second;
+    }
+    this->bound = std::numeric_limits<double>::infinity();
+    size_t groups =
+        (cells.size() + this->ensemble_size - 1) / this->ensemble_size;
+    runJobs(groups, jobs, [&](uint, size_t group) {
+        size_t begin = group * this->ensemble_size;
+        size_t end = std::min(begin + this->ensemble_size, cells.size());
+        std::vector<size_t> members;
+        for (size_t idx = begin; idx < end; idx++) members.push_back(idx);
+        this->runEnsemble(members, &candidates);
+    });
+    return candidates;
+}
+
+static void applyChange(Board* board, const BranchChange& change) {
+    if (!board->contains(change.row, change.col)) {
+        throw std::runtime_error("Branch coordinates out of bounds.");
+    }
+    size_t idx = board->indexOf(change.row, change.col);
+    if (board->getTypes()[idx] == Cell::Escape) {
+        board->setEscapeRate(change.row, change.col, change.rate);
+    } else {
+        board->placeEmitter(change.row, change.col, change.rate);
+        board->computeWeightsAround(change.row, change.col);
+    }
+}
+
+std::vector<SweepResult> runBranches(
+    Sim& trunk, const std::vector<std::vector<BranchChange>>& branches,
+    unsigned long ticks, uint jobs,
+    const std::function<void(size_t, Sim&)>& finish) {
+    // Forking reads the trunk, so every branch forks before any runs
+    std::vector<Sim*> sims;
+    std::vector<SweepResult> results(branches.size());
+    try {
+        for (size_t idx = 0; idx < branches.size(); idx++) {
+            sims.push_back(trunk.fork());
+            sims.back()->threads = 1;
+        }
+        runJobs(branches.size(), jobs, [&](uint, size_t idx) {
+            Sim& sim = *sims[idx];
+            for (auto& change : branches[idx])
+                applyChange(sim.board, change);
+            sim.touchBoard();
+            for (unsigned long tick = 0; tick < ticks; tick++) {
+                sim.tick();
+                if (sim.hasConverged()) break;
+            }
+            results[idx].ticks = sim.getTicks();
+            measure(sim.board, &results[idx]);
+            if (finish) finish(idx, sim);
+            // Free the arrays of the branch as soon as it is done
+            delete sims[idx];
+            sims[idx] = nullptr;
+        });
+    } catch (...) {
+        for (Sim* sim : sims) delete sim;
+        throw;
+    }
+    return results;
+}
@@ -0,0 +1,326 @@
+/**
+ * @file synthetic.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "synthetic.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include "philox.hpp"
+#include "workers.hpp"
+
+// Streams of random numbers the generators draw from
+enum Stream : uint32_t { Pillar, RoomDoor, MazeClose, MazePick };
+
+// Most of a hall the pillars cover, beyond which the floor breaks apart
+constexpr float hall_max_walls = .4f;
+
+/**
+ * @brief Draw the random word of a cell, or of a room or maze cell, from one
+ * of the streams of a layout.
+ */
+static uint32_t draw(const Synthetic& synthetic, Stream stream, uint row,
+                     uint col) {
+    return Philox::scramble({stream, row, col, 0},
+                            {synthetic.seed, (uint32_t)synthetic.kind})[0];
+}
+
+Synthetic Synthetic::parse(const std::string& spec) {
+    std::vector<std::string> fields;
+    for (size_t begin = 0;;) {
+        size_t colon = spec.find(':', begin);
+        fields.push_back(spec.substr(begin, colon - begin));
+        if (colon == std::string::npos) break;
+        begin = colon + 1;
+    }
+    if (fields.size() < 2 || fields.size() > 4) {
+        throw std::runtime_error(
+            "Synthetic layouts are given as KIND:WIDTHxHEIGHT[:WALLS[:SEED]].");
+    }
+    Synthetic synthetic;
+    if (fields[0] == "rooms") {
+        synthetic.kind = Synthetic::Rooms;
+    } else if (fields[0] == "maze") {
+        synthetic.kind = Synthetic::Maze;
+    } else if (fields[0] == "hall") {
+        synthetic.kind = Synthetic::Hall;
+    } else {
+        throw std::runtime_error(
+            "Synthetic layouts are rooms, maze or hall.");
+    }
+    char rest;
+    if (sscanf(fields[1].c_str(), "%ux%u%c", &synthetic.width,
+               &synthetic.height, &rest) != 2 ||
+        synthetic.width == 0 || synthetic.height == 0)
+        throw std::runtime_error("Invalid synthetic layout size.");
+    if (fields.size() > 2) {
+        float walls;
+        bool none_allowed = synthetic.kind == Synthetic::Hall;
+        if (sscanf(fields[2].c_str(), "%f%c", &walls, &rest) != 1 ||
+            !(walls >= 0.f && walls < 1.f) || (walls == 0.f && !none_allowed))
+            throw std::runtime_error("Invalid wall fraction.");
+        synthetic.wall_fraction = walls;
+    }
+    if (fields.size() > 3 &&
+        sscanf(fields[3].c_str(), "%u%c", &synthetic.seed, &rest) != 1)
+        throw std::runtime_error("Invalid synthetic layout seed.");
+    return synthetic;
+}
+
+bool isSyntheticLayout(const std::string& path) {
+    return path.compare(0, std::strlen(synthetic_prefix), synthetic_prefix) ==
+           0;
+}
+
+/**
+ * @brief Width of the doors between rooms of a pitch.
+ */
+static uint doorOf(uint pitch) { return std::max(1u, (pitch - 1) / 4); }
+
+/**
+ * @brief Pitch of the rooms whose walls come closest to a wall fraction.
+ *
+ * Three rows and three columns of rooms in four have walls, of pitch - 1
+ * cells but for the door, and a corner each, so the walls of rooms of the
+ * smallest pitch, 4, cover a quarter of the layout.
+ */
+static uint pitchOf(float walls) {
+    auto share = [](uint pitch) {
+        return (1.5f * (pitch - 1 - doorOf(pitch)) + 1.f) / (pitch * pitch);
+    };
+    uint pitch = 4;
+    while (pitch < 65536 && std::fabs(share(pitch + 1) - walls) <
+                                std::fabs(share(pitch) - walls))
+        pitch++;
+    return pitch;
+}
+
+/**
+ * @brief Generate rows of a grid of rooms, see Synthetic::Kind.
+ *
+ * Rooms are pitch - 1 cells wide, with the last row and column of each
+ * pitch being walls.
+ */
+static void generateRooms(const Synthetic& synthetic, uint begin, uint end,
+                          char* layout) {
+    uint width = synthetic.width;
+    uint pitch = pitchOf(synthetic.wall_fraction);
+    uint door = doorOf(pitch);
+    // Corridors run along every fourth row and column of rooms
+    auto below = [](uint, uint room_col) { return room_col % 4 != 0; };
+    auto right = [](uint room_row, uint) { return room_row % 4 != 0; };
+    auto isDoor = [&](uint room_row, uint room_col, uint side, uint offset) {
+        uint at = draw(synthetic, RoomDoor, room_row, 2 * room_col + side) %
+                  (pitch - door);
+        return offset >= at && offset < at + door;
+    };
+    for (uint row = begin; row < end; row++) {
+        char* line = layout + (size_t)row * width;
+        uint room_row = row / pitch, y = row % pitch;
+        for (uint col = 0; col < width; col++) {
+            uint room_col = col / pitch, x = col % pitch;
+            bool wall;
+            if (y < pitch - 1 && x < pitch - 1) {
+                wall = false;
+            } else if (x < pitch - 1) {
+                wall = below(room_row, room_col) &&
+                       !isDoor(room_row, room_col, 0, x);
+            } else if (y < pitch - 1) {
+                wall = right(room_row, room_col) &&
+                       !isDoor(room_row, room_col, 1, y);
+            } else {
+                // Corners stand unless no wall meets them
+                wall = below(room_row, room_col) ||
+                       below(room_row, room_col + 1) ||
+                       right(room_row, room_col) ||
+                       right(room_row + 1, room_col);
+            }
+            line[col] = wall ? '/' : '0';
+        }
+    }
+}
+
+/**
+ * @brief Open the walls of a row of maze cells with the sidewinder algorithm,
+ * which only looks at the row itself: runs of cells are joined eastwards,
+ * and each run opens north through one of its cells.
+ */
+static void carveMazeRow(const Synthetic& synthetic, uint maze_row,
+                         std::vector<bool>* east, std::vector<bool>* north) {
+    uint cols = east->size();
+    std::fill(east->begin(), east->end(), false);
+    std::fill(north->begin(), north->end(), false);
+    if (maze_row == 0) {
+        std::fill(east->begin(), east->end() - 1, true);
+        return;
+    }
+    for (uint col = 0, run = 0; col < cols; col++) {
+        if (col + 1 < cols &&
+            (draw(synthetic, MazeClose, maze_row, col) & 1)) {
+            (*east)[col] = true;
+            continue;
+        }
+        uint pick = draw(synthetic, MazePick, maze_row, col) % (col - run + 1);
+        (*north)[run + pick] = true;
+        run = col + 1;
+    }
+}
+
+/**
+ * @brief Generate rows of a perfect maze, see Synthetic::Kind.
+ *
+ * Maze cells are corridor cells wide, followed by a wall, and every cell
+ * opens to one other, so the walls cover about 1 / (corridor + 1) of the
+ * layout.
+ */
+static void generateMaze(const Synthetic& synthetic, uint begin, uint end,
+                         char* layout) {
+    uint width = synthetic.width;
+    uint corridor =
+        std::max(1l, std::lround(1.f / synthetic.wall_fraction - 1.f));
+    uint pitch = corridor + 1;
+    uint cols = (width + pitch - 1) / pitch;
+    uint rows = (synthetic.height + pitch - 1) / pitch;
+    std::vector<bool> east(cols), north(cols), next_east(cols),
+        next_north(cols);
+    uint carved = UINT_MAX;
+    for (uint row = begin; row < end; row++) {
+        char* line = layout + (size_t)row * width;
+        uint maze_row = row / pitch, y = row % pitch;
+        if (maze_row != carved) {
+            carveMazeRow(synthetic, maze_row, &east, &north);
+            if (maze_row + 1 < rows)
+                carveMazeRow(synthetic, maze_row + 1, &next_east, &next_north);
+            else
+                std::fill(next_north.begin(), next_north.end(), false);
+            carved = maze_row;
+        }
+        for (uint col = 0; col < width; col++) {
+            uint maze_col = col / pitch, x = col % pitch;
+            bool floor;
+            if (y < corridor)
+                floor = x < corridor || east[maze_col];
+            else
+                floor = x < corridor && next_north[maze_col];
+            line[col] = floor ? '0' : '/';
+        }
+    }
+}
+
+/**
+ * @brief Generate rows of an open hall with pillars, see Synthetic::Kind.
+ */
+static void generateHall(const Synthetic& synthetic, uint begin, uint end,
+                         char* layout) {
+    uint width = synthetic.width;
+    float walls = std::min(synthetic.wall_fraction, hall_max_walls);
+    for (uint row = begin; row < end; row++) {
+        char* line = layout + (size_t)row * width;
+        // Each 2x2 block is a pillar or floor as a whole, and each counter
+        // gives the words of four blocks side by side
+        for (uint col = 0; col < width; col += 8) {
+            Philox::Counter words = Philox::scramble(
+                {Pillar, row / 2, col / 8, 0},
+                {synthetic.seed, (uint32_t)synthetic.kind});
+            for (uint i = 0; i < 8 && col + i < width; i++)
+                line[col + i] =
+                    Philox::toUnit(words[i / 2]) < walls ? '/' : '0';
+        }
+    }
+}
+
+/**
+ * @brief Find the floor cell of a layout closest to a cell, looking in
+ * growing squares around it.
+ * @return Whether the layout has any floor.
+ */
+static bool findFloor(const std::vector<char>& layout, uint width,
+                      uint height, uint row, uint col, uint* floor_row,
+                      uint* floor_col) {
+    long reach = std::max(width, height);
+    for (long ring = 0; ring <= reach; ring++) {
+        for (long r = (long)row - ring; r <= (long)row + ring; r++) {
+            if (r < 0 || r >= height) continue;
+            bool edge = r == (long)row - ring || r == (long)row + ring;
+            long step = edge ? 1 : std::max(2 * ring, 1l);
+            for (long c = (long)col - ring; c <= (long)col + ring; c += step) {
+                if (c < 0 || c >= width) continue;
+                if (layout[(size_t)r * width + c] == '0') {
+                    *floor_row = r;
+                    *floor_col = c;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<char> generateLayout(const Synthetic& synthetic, uint threads) {
+    uint width = synthetic.width, height = synthetic.height;
+    if (width == 0 || height == 0)
+        throw std::runtime_error("The layout must not be empty.");
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, height);
+    std::vector<char> layout((size_t)width * height);
+    WorkerPool workers(threads);
+    workers.run([&](uint worker) {
+        size_t begin, end;
+        WorkerPool::getBand(worker, threads, height, 1, &begin, &end);
+        switch (synthetic.kind) {
+            case Synthetic::Rooms:
+                generateRooms(synthetic, begin, end, layout.data());
+                break;
+            case Synthetic::Maze:
+                generateMaze(synthetic, begin, end, layout.data());
+                break;
+            case Synthetic::Hall:
+                generateHall(synthetic, begin, end, layout.data());
+                break;
+        }
+    });
+    uint corners[4][2] = {
+        {0, 0}, {0, width - 1}, {height - 1, 0}, {height - 1, width - 1}};
+    for (auto& corner : corners) {
+        uint row, col;
+        if (findFloor(layout, width, height, corner[0], corner[1], &row,
+                      &col))
+            layout[(size_t)row * width + col] = ':';
+    }
+    return layout;
+}
+
+Board* generateBoard(const Synthetic& synthetic, uint threads) {
+    std::vector<char> layout = generateLayout(synthetic, threads);
+    uint row, col;
+    if (!findFloor(layout, synthetic.width, synthetic.height,
+                   synthetic.height / 2, synthetic.width / 2, &row, &col))
+        throw std::runtime_error("The layout has no floor.");
+    Board* board = new Board(synthetic.width, synthetic.height, layout.data());
+    board->placeEmitter(row, col);
+    board->computeWeightsAround(row, col);
+    return board;
+}
@@ -0,0 +1,422 @@
+/**
+ * @file texture.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include "texture.hpp"
+
+#include <GL/glext.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gl_util.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+
+// Textures grow in whole blocks, so that scrolling does not resize them
+static constexpr uint texture_block = 64;
+
+/* Levels and cells are laid out like the display, one texel per cell of the
+ * view. Arrivals go from red to yellow, like densities they are levels. */
+static const std::string display_shader = std::string(cell_colour_shader) + R"(
+uniform sampler2D density;
+uniform sampler2D cells;
+uniform bool show_arrivals;
+out vec4 color;
+const int NOT_ARRIVED = 255;
+void main() {
+    ivec2 cur = ivec2(gl_FragCoord.xy);
+    vec2 cell = texelFetch(cells, cur, 0).rg;
+    int level = int(texelFetch(density, cur, 0).r * 255.0 + 0.5);
+    if (show_arrivals && cell.r == FLOOR) {
+        color = level == NOT_ARRIVED
+                    ? vec4(1.0)
+                    : vec4(1.0, float(level) / float(NOT_ARRIVED - 1), 0.0,
+                           1.0);
+    } else {
+        color = cellColour(cell.r, cell.g, level);
+    }
+}
+)";
+
+/* The densities of the board and of the reference are floats, and their
+ * difference goes from blue, where the reference is denser, through white
+ * to red. */
+static const std::string difference_shader =
+    std::string(cell_colour_shader) + R"(
+uniform sampler2D density;
+uniform sampler2D reference;
+uniform sampler2D cells;
+uniform float difference_scale;
+out vec4 color;
+const vec4 DENSER = vec4(0xB2, 0x18, 0x2B, 0xFF) / 255.0;
+const vec4 CLEARER = vec4(0x21, 0x66, 0xAC, 0xFF) / 255.0;
+void main() {
+    ivec2 cur = ivec2(gl_FragCoord.xy);
+    vec2 cell = texelFetch(cells, cur, 0).rg;
+    if (cell.r != FLOOR) {
+        color = cellColour(cell.r, cell.g, 0);
+        return;
+    }
+    float diff = texelFetch(density, cur, 0).r -
+                 texelFetch(reference, cur, 0).r;
+    float t = clamp(diff / difference_scale, -1.0, 1.0);
+    color = mix(vec4(1.0), t >= 0.0 ? DENSER : CLEARER, abs(t));
+}
+)";
+
+BoardTexture::~BoardTexture() { this->release(); }
+
+void BoardTexture::release() {
+    if (this->program == 0) return;
+    glDeleteBuffers(2, this->pbos);
+    glDeleteVertexArrays(1, &this->vertex_array);
+    glDeleteFramebuffers(1, &this->framebuffer);
+    glDeleteTextures(1, &this->display);
+    glDeleteTextures(1, &this->levels);
+    glDeleteTextures(1, &this->cells);
+    glDeleteTextures(1, &this->palette_texture);
+    glDeleteTextures(1, &this->values);
+    glDeleteTextures(1, &this->reference_values);
+    glDeleteProgram(this->program);
+    glDeleteProgram(this->difference_program);
+}
+
+void BoardTexture::addFootprint(Footprint* footprint) {
+    size_t texels = (size_t)this->width * this->height;
+    // Levels, cell types and rates, and the colours displayed
+    size_t bytes = texels * (1 + 2 * sizeof(float) + 4);
+    if (this->values != 0) bytes += 2 * texels * sizeof(float);
+    footprint->add("textures", bytes);
+    footprint->add("pixmap", this->pbo_bytes[0] + this->pbo_bytes[1]);
+}
+
+void BoardTexture::allocate(uint width, uint height) {
+    width = (width + texture_block - 1) / texture_block * texture_block;
+    height = (height + texture_block - 1) / texture_block * texture_block;
+    if (this->program == 0) {
+        this->program = linkProgram(display_shader);
+        glGenVertexArrays(1, &this->vertex_array);
+        glGenBuffers(2, this->pbos);
+    }
+    glDeleteFramebuffers(1, &this->framebuffer);
+    glDeleteTextures(1, &this->display);
+    glDeleteTextures(1, &this->levels);
+    glDeleteTextures(1, &this->cells);
+    // Only allocated while a reference is shown
+    glDeleteTextures(1, &this->values);
+    glDeleteTextures(1, &this->reference_values);
+    this->values = this->reference_values = 0;
+    this->framebuffer = 0;
+    this->width = this->height = 0;
+    this->levels = createTexture(GL_R8, width, height, GL_RED,
+                                 GL_UNSIGNED_BYTE, nullptr);
+    this->cells =
+        createTexture(GL_RG32F, width, height, GL_RG, GL_FLOAT, nullptr);
+    this->display = createTexture(GL_RGBA8, width, height, GL_RGBA,
+                                  GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (glGetError() != GL_NO_ERROR)
+        throw std::runtime_error("Failed to allocate texture storage.");
+    this->framebuffer = createFramebuffer(this->display);
+    this->width = width;
+    this->height = height;
+}
+
+void BoardTexture::uploadLevels(Sim& sim, const float* densities,
+                                const uint* arrivals, const double* doses,
+                                uint begin, uint end) {
+    uint width = this->view_shown.getWidth(), rows = end - begin;
+    size_t bytes = (size_t)width * rows;
+    glBindTexture(GL_TEXTURE_2D, this->levels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->pbos[this->next_pbo]);
+    this->pbo_bytes[this->next_pbo] = bytes;
+    this->next_pbo ^= 1;
+    // Orphan the previous storage so we never wait for a pending upload
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    auto mapped = (uint8_t*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // Fall back to a synchronous upload from client memory
+    std::vector<uint8_t> fallback(mapped != nullptr ? 0 : bytes);
+    if (mapped == nullptr) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    uint8_t* levels = mapped != nullptr ? mapped : fallback.data();
+    {
+        ScopedTimer timer(&this->pixmap_time);
+        TraceScope trace(sim.tracer, "pixmap");
+        if (arrivals != nullptr) {
+            toArrivalLevels(sim, this->view_shown, levels, arrivals);
+        } else if (doses != nullptr) {
+            toDoseLevels(sim, this->view_shown, levels, doses,
+                         this->dose_limit, begin, end);
+        } else {
+            toDensityLevels(sim, this->view_shown, levels, densities, begin,
+                            end);
+        }
+    }
+    if (mapped != nullptr) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, begin, width, rows, GL_RED,
+                    GL_UNSIGNED_BYTE, mapped != nullptr ? nullptr : levels);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void BoardTexture::uploadValues(GLuint texture, Board* board,
+                                const float* densities, uint begin,
+                                uint end) {
+    const BoardView& view = this->view_shown;
+    uint width = view.getWidth(), rows = end - begin;
+    size_t count = (size_t)width * rows;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->pbos[this->next_pbo]);
+    this->pbo_bytes[this->next_pbo] = count * sizeof(float);
+    this->next_pbo ^= 1;
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, count * sizeof(float), nullptr,
+                 GL_STREAM_DRAW);
+    auto mapped = (float*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, count * sizeof(float),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    std::vector<float> fallback(mapped != nullptr ? 0 : count);
+    if (mapped == nullptr) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    {
+        ScopedTimer timer(&this->pixmap_time);
+        const float* density =
+            densities != nullptr ? densities : board->getDensities();
+        float* value = mapped != nullptr ? mapped : fallback.data();
+        for (uint row = begin; row < end; row++) {
+            size_t idx = board->indexOf(view.row + row * view.step, view.col);
+            for (uint col = 0; col < width; col++, idx += view.step)
+                *value++ = density[idx];
+        }
+    }
+    if (mapped != nullptr) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, begin, width, rows, GL_RED,
+                    GL_FLOAT, mapped != nullptr ? nullptr : fallback.data());
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void BoardTexture::uploadCells(Sim& sim) {
+    Board* board = sim.board;
+    const Cell::Type* type = board->getTypes();
+    const BoardView& view = this->view_shown;
+    uint width = view.getWidth(), height = view.getHeight();
+    std::vector<float> cells((size_t)width * height * 2);
+    float* cell = cells.data();
+    for (uint row = 0; row < height; row++) {
+        size_t idx = board->indexOf(view.row + row * view.step, view.col);
+        for (uint col = 0; col < width; col++, idx += view.step) {
+            *cell++ = type[idx];
+            *cell++ = board->getRate(idx);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, this->cells);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RG, GL_FLOAT,
+                    cells.data());
+}
+
+BoardView BoardTexture::clampView(Board* board) {
+    BoardView view = this->view;
+    uint rows = board->getHeight(), cols = board->getWidth();
+    if (view.rows == 0 || view.cols == 0) {
+        view.row = view.col = 0;
+        view.rows = rows;
+        view.cols = cols;
+    }
+    view.row = std::min(view.row, rows);
+    view.col = std::min(view.col, cols);
+    view.rows = std::min(view.rows, rows - view.row);
+    view.cols = std::min(view.cols, cols - view.col);
+    view.step = std::max(view.step, 1u);
+    return view;
+}
+
+void BoardTexture::getChangedRows(Board* board, unsigned long since,
+                                  uint* begin, uint* end) {
+    const BoardView& view = this->view_shown;
+    uint first, last;
+    board->getChangedRows(since, &first, &last);
+    first = std::max(first, view.row) - view.row;
+    last = std::min(last, view.row + view.rows);
+    last = last > view.row ? last - view.row : 0;
+    *begin = (first + view.step - 1) / view.step;
+    *end = std::max((last + view.step - 1) / view.step, *begin);
+}
+
+void BoardTexture::render() {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+    glViewport(0, 0, this->view_shown.getWidth(),
+               this->view_shown.getHeight());
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    GLuint program =
+        this->showed_difference ? this->difference_program : this->program;
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D,
+                  this->showed_difference ? this->reference_values : 0);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, this->palette_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, this->cells);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D,
+                  this->showed_difference ? this->values : this->levels);
+    glUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "emitter_rate"),
+                this->emitter_rate);
+    glUniform1f(glGetUniformLocation(program, "escape_rate"),
+                this->escape_rate);
+    glUniform1i(glGetUniformLocation(program, "show_arrivals"),
+                this->showed_arrivals);
+    glUniform1f(glGetUniformLocation(program, "difference_scale"),
+                this->difference_scale_shown);
+    glBindVertexArray(this->vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    for (GLenum unit : {GL_TEXTURE3, GL_TEXTURE2, GL_TEXTURE1, GL_TEXTURE0}) {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void BoardTexture::update(Sim& sim, const float* densities,
+                          const uint* arrivals, const double* doses) {
+    TraceScope trace(sim.tracer, "upload");
+    // Everything but quantising counts as uploading
+    double pixmap_time = this->pixmap_time;
+    ScopedTimer timer(&this->upload_time);
+    Board* board = sim.board;
+    BoardView view = this->clampView(board);
+    uint width = view.getWidth(), height = view.getHeight();
+    if (width == 0 || height == 0) return;
+    if (this->program == 0 || width > this->width || height > this->height) {
+        this->allocate(width, height);
+        this->generation = this->cell_generation = 0;
+        this->reference_generation = 0;
+    }
+    if (view != this->view_shown) {
+        this->view_shown = view;
+        this->generation = this->cell_generation = 0;
+        this->reference_generation = 0;
+    }
+    bool show_difference = this->reference != nullptr;
+    if (show_difference) {
+        if (this->reference->getWidth() != board->getWidth() ||
+            this->reference->getHeight() != board->getHeight()) {
+            throw std::runtime_error(
+                "The reference does not match the board.");
+        }
+        if (this->difference_program == 0) {
+            this->difference_program = linkProgram(difference_shader);
+            glUseProgram(this->difference_program);
+            glUniform1i(glGetUniformLocation(this->difference_program,
+                                             "reference"),
+                        3);
+            glUseProgram(0);
+        }
+        if (this->values == 0) {
+            this->values = createTexture(GL_R32F, this->width, this->height,
+                                         GL_RED, GL_FLOAT, nullptr);
+            this->reference_values =
+                createTexture(GL_R32F, this->width, this->height, GL_RED,
+                              GL_FLOAT, nullptr);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            this->generation = this->reference_generation = 0;
+        }
+        if (this->reference != this->reference_shown)
+            this->reference_generation = 0;
+        arrivals = nullptr;
+        doses = nullptr;
+    }
+    // Snapshots carry no generation, and the overlay changes every level
+    bool show_arrivals = arrivals != nullptr;
+    bool show_doses = !show_arrivals && doses != nullptr;
+    if (densities != nullptr || show_arrivals != this->showed_arrivals ||
+        show_doses != this->showed_doses ||
+        show_difference != this->showed_difference ||
+        (show_doses && this->dose_limit != this->dose_limit_shown))
+        this->generation = 0;
+    uint begin = 0, end = height;
+    if (densities == nullptr) {
+        // Only the changed rows that are displayed are uploaded
+        this->getChangedRows(board, this->generation, &begin, &end);
+        if ((show_arrivals || show_doses) && begin < end) {
+            begin = 0;
+            end = height;
+        }
+    }
+    uint reference_begin = 0, reference_end = 0;
+    if (show_difference) {
+        if (this->reference_generation == 0) {
+            reference_end = height;
+        } else {
+            this->getChangedRows(this->reference, this->reference_generation,
+                                 &reference_begin, &reference_end);
+        }
+    }
+    bool cells_changed = board->getCellGeneration() != this->cell_generation;
+    bool palette_changed =
+        this->palette_texture == 0 || this->palette != this->palette_shown;
+    bool rates_changed = sim.emitter_rate != this->emitter_rate ||
+                         sim.escape_rate != this->escape_rate;
+    bool scale_changed =
+        show_difference &&
+        this->difference_scale != this->difference_scale_shown;
+    if (begin == end && reference_begin == reference_end && !cells_changed &&
+        !palette_changed && !rates_changed && !scale_changed)
+        return;
+    if (begin < end && show_difference) {
+        this->uploadValues(this->values, board, densities, begin, end);
+    } else if (begin < end) {
+        this->uploadLevels(sim, densities, arrivals,
+                           show_doses ? doses : nullptr, begin, end);
+    }
+    if (reference_begin < reference_end) {
+        this->uploadValues(this->reference_values, this->reference, nullptr,
+                           reference_begin, reference_end);
+    }
+    if (cells_changed) this->uploadCells(sim);
+    if (palette_changed) {
+        glDeleteTextures(1, &this->palette_texture);
+        this->palette_texture = createPaletteTexture(this->palette);
+        this->palette_shown = this->palette;
+    }
+    this->generation = densities == nullptr ? board->getGeneration() : 0;
+    this->cell_generation = board->getCellGeneration();
+    this->showed_arrivals = show_arrivals;
+    this->showed_doses = show_doses;
+    this->showed_difference = show_difference;
+    this->reference_shown = this->reference;
+    this->reference_generation =
+        show_difference ? this->reference->getGeneration() : 0;
+    this->difference_scale_shown = this->difference_scale;
+    this->dose_limit_shown = this->dose_limit;
+    this->emitter_rate = sim.emitter_rate;
+    this->escape_rate = sim.escape_rate;
+    this->render();
+    this->upload_time -= this->pixmap_time - pixmap_time;
+}
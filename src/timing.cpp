@@ -0,0 +1,63 @@
+/**
+ * @file timing.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void RollingStats::add(float sample) {
+    this->samples[this->next] = sample;
+    this->next = (this->next + 1) % this->samples.size();
+    this->count = std::min(this->count + 1, this->samples.size());
+}
+
+float RollingStats::getMin() const {
+    if (this->count == 0) return 0.f;
+    return *std::min_element(this->samples.begin(),
+                             this->samples.begin() + this->count);
+}
+
+float RollingStats::getMax() const {
+    if (this->count == 0) return 0.f;
+    return *std::max_element(this->samples.begin(),
+                             this->samples.begin() + this->count);
+}
+
+float RollingStats::getSum() const {
+    double sum = 0.;
+    for (size_t idx = 0; idx < this->count; idx++) sum += this->samples[idx];
+    return sum;
+}
+
+float RollingStats::getAverage() const {
+    return this->count > 0 ? this->getSum() / this->count : 0.f;
+}
+
+float RollingStats::getPercentile(float fraction) const {
+    if (this->count == 0) return 0.f;
+    this->sorted.assign(this->samples.begin(),
+                        this->samples.begin() + this->count);
+    size_t rank = (size_t)std::ceil(fraction * this->count);
+    rank = std::min(std::max(rank, (size_t)1), this->count) - 1;
+    std::nth_element(this->sorted.begin(), this->sorted.begin() + rank,
+                     this->sorted.end());
+    return this->sorted[rank];
+}
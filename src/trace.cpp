@@ -0,0 +1,96 @@
+/**
+ * @file trace.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+/* Threads are numbered in the order they first record an event, which is
+ * easier to read in a trace than their native ids. */
+static uint currentThread() {
+    static std::atomic<uint> threads{0};
+    thread_local uint thread = threads++;
+    return thread;
+}
+
+Tracer::Tracer(size_t capacity) : events(std::max(capacity, (size_t)1)) {
+    this->epoch = std::chrono::steady_clock::now();
+}
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - this->epoch)
+        .count();
+}
+
+void Tracer::record(const char* name, int64_t begin, const char* arg_name,
+                    long arg) {
+    Event event = {name,     currentThread(), begin, this->now() - begin,
+                   arg_name, arg};
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->events[this->next] = event;
+    this->next = (this->next + 1) % this->events.size();
+    this->count = std::min(this->count + 1, this->events.size());
+}
+
+void Tracer::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->next = this->count = 0;
+}
+
+void Tracer::write(const std::string& path) {
+    std::vector<Event> events;
+    {
+        // Copy the events out, oldest first, so tracing goes on meanwhile
+        std::lock_guard<std::mutex> lock(this->mutex);
+        size_t first = this->count < this->events.size() ? 0 : this->next;
+        for (size_t idx = 0; idx < this->count; idx++)
+            events.push_back(
+                this->events[(first + idx) % this->events.size()]);
+    }
+    FILE* fp = fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        throw std::runtime_error(
+            "An I/O error occurred while opening the file for writing.");
+    }
+    // Timestamps are in microseconds, as the format expects
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (size_t idx = 0; idx < events.size(); idx++) {
+        const Event& event = events[idx];
+        fprintf(fp,
+                "%s\n{\"name\":\"%s\",\"cat\":\"smokey\",\"ph\":\"X\","
+                "\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                idx == 0 ? "" : ",", event.name, event.thread,
+                event.begin / 1000., event.duration / 1000.);
+        if (event.arg_name != nullptr) {
+            fprintf(fp, ",\"args\":{\"%s\":%ld}", event.arg_name,
+                    event.arg);
+        }
+        fputc('}', fp);
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) {
+        throw std::runtime_error(
+            "An I/O error occurred while writing the file.");
+    }
+}
@@ -0,0 +1,552 @@
+/**
+ * @file validate.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project Includes
+#include "board_file.hpp"
+#include "graph.hpp"
+#include "sim.hpp"
+#include "species.hpp"
+
+#ifdef SMOKEY_VALIDATE_GPU
+#include "egl_context.hpp"
+#include "gpu_backend.hpp"
+#endif
+
+/* Every variant of the transition function runs a copy of each layout for
+ * the same ticks, under each case, and its densities are compared with those
+ * of the scalar kernel updating the whole board with the same update mode,
+ * stencil and case: bit for bit where the variant adds the same flows up in
+ * the same order, or else within a tolerance. */
+
+enum Reference { Synchronous, InPlace, Moore, RedBlack, ReferenceCount };
+
+static const char* const reference_names[] = {"scalar", "inplace",
+                                              "moore_scalar", "redblack"};
+
+/* How close a variant has to come: bit for bit, within the tolerance, or
+ * within that of densities stored with fewer bits, whose rounding adds up
+ * tick after tick. */
+enum Match { Exact, Close, Reduced };
+
+static const char* const match_names[] = {"exact", "close", "reduced"};
+
+struct Variant {
+    const char* name;
+    Reference reference;
+    Match match;
+    void (*setUp)(Sim& sim);
+    bool gpu;
+};
+
+static uint threadCount() {
+    // At least two, so that the board is split even on a single core
+    return std::max(2u, std::thread::hardware_concurrency());
+}
+
+static const Variant variants[] = {
+    {"simd", Synchronous, Match::Exact,
+     [](Sim& sim) { sim.kernel = Sim::Kernel::Simd; }, false},
+    {"tiles", Synchronous, Match::Exact,
+     [](Sim& sim) {
+         sim.kernel = Sim::Kernel::Simd;
+         sim.track_activity = true;
+     },
+     false},
+    {"threaded", Synchronous, Match::Exact,
+     [](Sim& sim) {
+         sim.kernel = Sim::Kernel::Simd;
+         sim.threads = threadCount();
+     },
+     false},
+    {"time_block", Synchronous, Match::Exact,
+     [](Sim& sim) {
+         sim.kernel = Sim::Kernel::Simd;
+         sim.track_activity = true;
+         sim.time_block = 8;
+     },
+     false},
+    // As -L makes the graph of the board before the first tick
+    {"save_graph", Synchronous, Match::Exact,
+     [](Sim& sim) {
+         Graph(sim.board, sim.use_precalc_weights, sim.elevation_bias);
+     },
+     false},
+    {"double", Synchronous, Match::Close,
+     [](Sim& sim) { sim.board->setStorage(Board::Storage::Double); }, false},
+    {"fixed16", Synchronous, Match::Reduced,
+     [](Sim& sim) { sim.board->setStorage(Board::Storage::Fixed); }, false},
+    {"gpu", Synchronous, Match::Close, [](Sim&) {}, true},
+    {"inplace_tiles", InPlace, Match::Exact,
+     [](Sim& sim) { sim.track_activity = true; }, false},
+    {"redblack_tiles", RedBlack, Match::Exact,
+     [](Sim& sim) { sim.track_activity = true; }, false},
+    {"redblack_threaded", RedBlack, Match::Exact,
+     [](Sim& sim) {
+         sim.track_activity = true;
+         sim.threads = threadCount();
+     },
+     false},
+    {"moore_simd", Moore, Match::Exact,
+     [](Sim& sim) { sim.kernel = Sim::Kernel::Simd; }, false},
+    {"moore_threaded", Moore, Match::Exact,
+     [](Sim& sim) {
+         sim.kernel = Sim::Kernel::Simd;
+         sim.threads = threadCount();
+     },
+     false},
+};
+
+/* What a layout is run under, set up on its board and on every simulation of
+ * it, the references included. Variants whose reference, or the GPU, cannot
+ * run a case are skipped. */
+struct Case {
+    const char* name;
+    void (*setUpBoard)(Board* board);
+    void (*setUpSim)(Sim& sim);
+    // A bit for each reference that runs the case
+    uint references;
+    bool gpu;
+    // Whether fixed-point densities are compared, their rounding changing
+    // which tiles are quiet
+    bool reduced;
+};
+
+static const uint all_references = (1u << ReferenceCount) - 1;
+
+/**
+ * @brief Find the floor cell closest to a cell of a board.
+ * @return Whether the board has any floor.
+ */
+static bool nearestFloor(Board* board, uint row, uint col, uint* floor_row,
+                         uint* floor_col) {
+    long best = -1;
+    for (uint r = 0; r < board->getHeight(); r++) {
+        for (uint c = 0; c < board->getWidth(); c++) {
+            if (board->getTypes()[board->indexOf(r, c)] != Cell::Floor)
+                continue;
+            long drow = (long)r - row, dcol = (long)c - col;
+            long distance = drow * drow + dcol * dcol;
+            if (best < 0 || distance < best) {
+                best = distance;
+                *floor_row = r;
+                *floor_col = c;
+            }
+        }
+    }
+    return best >= 0;
+}
+
+static const Case cases[] = {
+    {"uniform", [](Board*) {}, [](Sim&) {}, all_references, true, true},
+    // Rates that are not powers of two round their products, and a table of
+    // them is read by each cell
+    {"rates",
+     [](Board* board) {
+         uint rows = board->getHeight(), cols = board->getWidth();
+         const uint spots[][2] = {{rows / 4, cols / 4},
+                                  {rows * 3 / 4, cols * 3 / 4}};
+         const float emitter_rates[] = {.37f, .81f};
+         for (uint i = 0; i < 2; i++) {
+             uint row, col;
+             if (!nearestFloor(board, spots[i][0], spots[i][1], &row, &col))
+                 continue;
+             board->placeEmitter(row, col, emitter_rates[i]);
+             board->computeWeightsAround(row, col);
+         }
+         const float escape_rates[] = {.55f, .9f, .3f};
+         uint escapes = 0;
+         for (uint row = 0; row < rows; row++) {
+             for (uint col = 0; col < cols; col++) {
+                 if (board->getTypes()[board->indexOf(row, col)] !=
+                     Cell::Escape)
+                     continue;
+                 board->setEscapeRate(row, col, escape_rates[escapes++ % 3]);
+             }
+         }
+     },
+     [](Sim& sim) {
+         sim.emitter_rate = .7f;
+         sim.escape_rate = .3f;
+     },
+     all_references, true, true},
+    // Precalculated weights, floors of several heights and a wind, which the
+    // Moore stencil and the GPU do not model
+    {"terrain",
+     [](Board* board) {
+         uint rows = board->getHeight(), cols = board->getWidth();
+         for (uint row = 0; row < rows; row++) {
+             for (uint col = 0; col < cols; col++) {
+                 size_t idx = board->indexOf(row, col);
+                 if (board->getTypes()[idx] == Cell::Floor)
+                     board->getCosts()[idx] = (row / 2 + col / 3) % 4;
+             }
+         }
+         board->computeWeights();
+         board->addWind({rows / 4, cols / 4, std::max(rows / 2, 1u),
+                         std::max(cols / 2, 1u), Dir::East, .5f});
+     },
+     [](Sim& sim) {
+         sim.use_precalc_weights = true;
+         sim.elevation_bias = .4f;
+     },
+     all_references & ~(1u << Moore), false, true},
+    // Tiles that barely change skip ticks, the same ones whatever the kernel,
+    // threads or tracking; they need synchronous von Neumann ticks
+    {"quiet", [](Board*) {},
+     [](Sim& sim) {
+         sim.track_activity = true;
+         sim.quiet_threshold = 1e-3f;
+     },
+     1u << Synchronous, false, false},
+    // Random drafts, drawn the same whatever the threads, which neither
+    // red-black updates, the Moore stencil nor the GPU run
+    {"drafts", [](Board*) {},
+     [](Sim& sim) {
+         sim.draft_noise = .5f;
+         sim.draft_seed = 42;
+     },
+     (1u << Synchronous) | (1u << InPlace), false, true},
+};
+
+struct Options {
+    unsigned long ticks = 200;
+    double tolerance = 1e-4;
+    double reduced_tolerance = 1e-3;
+    std::vector<std::string> layouts;
+};
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] [LAYOUT|DIR]...\n"
+            "Compare every variant of the transition function with the\n"
+            "scalar kernel on each layout (default: the text layouts in\n"
+            "%s)\n"
+            "  -n, --ticks N          Ticks to run (default: 200)\n"
+            "  -t, --tolerance T      Largest difference of a density\n"
+            "                         allowed where results cannot be the\n"
+            "                         same bit for bit (default: 1e-4)\n"
+            "  -T, --reduced-tolerance T\n"
+            "                         Largest difference allowed for\n"
+            "                         fixed-point densities (default: 1e-3)\n"
+            "  -h, --help             Show this message\n",
+            argv0, SMOKEY_LAYOUT_DIR);
+}
+
+static Options parseOptions(int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"ticks", required_argument, nullptr, 'n'},
+        {"tolerance", required_argument, nullptr, 't'},
+        {"reduced-tolerance", required_argument, nullptr, 'T'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+    Options opts;
+    int c;
+    while ((c = getopt_long(argc, argv, "n:t:T:h", long_options, nullptr)) !=
+           -1) {
+        switch (c) {
+            case 'n':
+                opts.ticks = std::stoul(optarg);
+                break;
+            case 't':
+                opts.tolerance = std::stod(optarg);
+                break;
+            case 'T':
+                opts.reduced_tolerance = std::stod(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    std::vector<std::string> paths(argv + optind, argv + argc);
+    if (paths.empty()) paths.push_back(SMOKEY_LAYOUT_DIR);
+    for (auto& path : paths) {
+        if (!std::filesystem::is_directory(path)) {
+            opts.layouts.push_back(path);
+            continue;
+        }
+        std::vector<std::string> found;
+        for (auto& entry : std::filesystem::directory_iterator(path)) {
+            if (entry.path().extension() == ".txt")
+                found.push_back(entry.path().string());
+        }
+        std::sort(found.begin(), found.end());
+        opts.layouts.insert(opts.layouts.end(), found.begin(), found.end());
+    }
+    return opts;
+}
+
+/**
+ * @brief Place an emitter on the floor cell closest to the centre of a board
+ * and compute its weights.
+ */
+static void placeCentralEmitter(Board* board) {
+    uint row, col;
+    if (!nearestFloor(board, board->getHeight() / 2, board->getWidth() / 2,
+                      &row, &col))
+        throw std::runtime_error("The board has no floor.");
+    board->placeEmitter(row, col);
+    board->computeWeightsAround(row, col);
+}
+
+/**
+ * @brief Make a simulation of a copy of a board set up as a reference.
+ */
+static Sim* makeReference(const Board* prototype, Reference reference,
+                          const Case& test) {
+    Sim* sim = new Sim(new Board(*prototype));
+    sim->update_mode = reference == Reference::InPlace ? Sim::Update::InPlace
+                       : reference == Reference::RedBlack
+                           ? Sim::Update::RedBlack
+                           : Sim::Update::Synchronous;
+    if (reference == Reference::Moore) sim->stencil = Sim::Stencil::Moore;
+    sim->kernel = Sim::Kernel::Scalar;
+    sim->track_activity = false;
+    test.setUpSim(*sim);
+    return sim;
+}
+
+/**
+ * @brief Run a variant for some ticks.
+ * @return Whether it could be run, the GPU needing an OpenGL context.
+ */
+static bool runVariant(Sim& sim, const Variant& variant,
+                       unsigned long ticks) {
+    if (!variant.gpu) {
+        sim.advance(ticks);
+        return true;
+    }
+#ifdef SMOKEY_VALIDATE_GPU
+    if (!makeHeadlessContext()) return false;
+    GpuBackend gpu(sim);
+    sim.setBackend(&gpu);
+    for (unsigned long tick = 0; tick < ticks; tick++) sim.tick();
+    // Reads the densities back
+    sim.setBackend(nullptr);
+    return true;
+#else
+    return false;
+#endif
+}
+
+static double maxDifference(Sim& sim, Sim& reference) {
+    double difference = 0.;
+    for (uint row = 0; row < sim.board->getHeight(); row++) {
+        for (uint col = 0; col < sim.board->getWidth(); col++) {
+            double a = sim.getDensity(row, col);
+            double b = reference.getDensity(row, col);
+            // NaNs never compare equal, so they always fail
+            difference = std::max(difference, a == b ? 0. : std::fabs(a - b));
+            if (std::isnan(a) || std::isnan(b)) difference = INFINITY;
+        }
+    }
+    return difference;
+}
+
+/**
+ * @brief Carry three species through a board, from its emitters and from
+ * two of their own, and compare each with the scalar kernel updating a copy
+ * of the board that holds that species alone, as Species promises.
+ * @return The largest difference of each species, or none for cases with
+ * drafts or quiet tiles, which species do not run.
+ */
+static std::vector<double> compareSpecies(Board* prototype,
+                                          const Case& test,
+                                          unsigned long ticks) {
+    // The settings of the case, for the species to take them
+    std::unique_ptr<Sim> settings(makeReference(prototype, Synchronous, test));
+    if (settings->draft_noise > 0.f || settings->quiet_threshold > 0.f)
+        return {};
+    uint rows = prototype->getHeight(), cols = prototype->getWidth();
+    const uint spots[][2] = {{rows / 4, cols * 3 / 4},
+                             {rows * 3 / 4, cols / 4}};
+    Board scratch(*prototype);
+    std::vector<SpeciesSource> sources;
+    for (uint i = 0; i < 2; i++) {
+        uint row, col;
+        if (!nearestFloor(&scratch, spots[i][0], spots[i][1], &row, &col))
+            continue;
+        sources.push_back({i + 1, row, col, i == 0 ? .6f : 1.f});
+        // Keeps the other source off this cell
+        scratch.placeEmitter(row, col);
+    }
+    Board layout(*prototype);
+    Species species(&layout, 3, sources);
+    species.emitter_rate = settings->emitter_rate;
+    species.escape_rate = settings->escape_rate;
+    species.use_precalc_weights = settings->use_precalc_weights;
+    species.elevation_bias = settings->elevation_bias;
+    std::vector<std::unique_ptr<Sim>> alone;
+    for (uint each = 0; each < species.getSize(); each++) {
+        Board copy(*species.getBoard());
+        float* density = copy.getDensities();
+        for (size_t idx = 0; idx < copy.getPaddedSize(); idx++)
+            density[idx] =
+                species.getDensities()[idx * species.getLanes() + each];
+        copy.touchDensities();
+        alone.emplace_back(makeReference(&copy, Synchronous, test));
+    }
+    std::vector<double> differences;
+    for (unsigned long tick = 0; tick < ticks; tick++) species.tick();
+    for (uint each = 0; each < species.getSize(); each++) {
+        Sim& sim = *alone[each];
+        sim.advance(ticks);
+        double difference = 0.;
+        for (uint row = 0; row < rows; row++) {
+            for (uint col = 0; col < cols; col++) {
+                double a = species.getDensity(each, row, col);
+                double b = sim.getDensity(row, col);
+                difference =
+                    std::max(difference, a == b ? 0. : std::fabs(a - b));
+                if (std::isnan(a) || std::isnan(b)) difference = INFINITY;
+            }
+        }
+        differences.push_back(difference);
+    }
+    return differences;
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        opts = parseOptions(argc, argv);
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    uint failures = 0;
+    printf("%-20s %-8s %-18s %-13s %-8s %-7s %s\n", "layout", "case",
+           "variant", "reference", "match", "result", "max difference");
+    for (auto& path : opts.layouts) {
+        std::string name = std::filesystem::path(path).stem().string();
+        Board* board = nullptr;
+        try {
+            bool has_weights;
+            board = loadBoard(path, &has_weights);
+            if (!has_weights) board->computeWeights();
+            placeCentralEmitter(board);
+        } catch (std::exception& e) {
+            fflush(stdout);
+            fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+            failures++;
+            delete board;
+            continue;
+        }
+        for (auto& test : cases) {
+            Board* prototype = nullptr;
+            Sim* references[ReferenceCount] = {};
+            try {
+                prototype = new Board(*board);
+                test.setUpBoard(prototype);
+                for (int reference = 0; reference < ReferenceCount;
+                     reference++) {
+                    if (!(test.references & (1u << reference))) continue;
+                    references[reference] =
+                        makeReference(prototype, (Reference)reference, test);
+                    references[reference]->advance(opts.ticks);
+                }
+                for (auto& variant : variants) {
+                    const char* result;
+                    double difference = 0.;
+                    if (!(test.references & (1u << variant.reference)) ||
+                        (variant.gpu && !test.gpu) ||
+                        (variant.match == Match::Reduced && !test.reduced)) {
+                        printf("%-20s %-8s %-18s %-13s %-8s %-7s %g\n",
+                               name.c_str(), test.name, variant.name,
+                               reference_names[variant.reference],
+                               match_names[variant.match], "skip",
+                               difference);
+                        continue;
+                    }
+                    Sim* sim =
+                        makeReference(prototype, variant.reference, test);
+                    try {
+                        variant.setUp(*sim);
+                        if (runVariant(*sim, variant, opts.ticks)) {
+                            difference = maxDifference(
+                                *sim, *references[variant.reference]);
+                            double tolerance = 0.;
+                            if (variant.match == Match::Close)
+                                tolerance = opts.tolerance;
+                            if (variant.match == Match::Reduced)
+                                tolerance = opts.reduced_tolerance;
+                            bool passed = difference <= tolerance;
+                            result = passed ? "pass" : "FAIL";
+                            if (!passed) failures++;
+                        } else {
+                            result = "skip";
+                        }
+                    } catch (...) {
+                        delete sim;
+                        throw;
+                    }
+                    delete sim;
+                    printf("%-20s %-8s %-18s %-13s %-8s %-7s %g\n",
+                           name.c_str(), test.name, variant.name,
+                           reference_names[variant.reference],
+                           match_names[variant.match], result, difference);
+                }
+                std::vector<double> species =
+                    compareSpecies(prototype, test, opts.ticks);
+                for (size_t each = 0; each < species.size(); each++) {
+                    bool passed = species[each] == 0.;
+                    if (!passed) failures++;
+                    std::string variant = "species_" + std::to_string(each);
+                    printf("%-20s %-8s %-18s %-13s %-8s %-7s %g\n",
+                           name.c_str(), test.name, variant.c_str(),
+                           reference_names[Synchronous],
+                           match_names[Match::Exact],
+                           passed ? "pass" : "FAIL", species[each]);
+                }
+            } catch (std::exception& e) {
+                fflush(stdout);
+                fprintf(stderr, "%s (%s): %s\n", path.c_str(), test.name,
+                        e.what());
+                failures++;
+            }
+            for (Sim* reference : references) delete reference;
+            // Each simulation was given a copy of its own
+            delete prototype;
+        }
+        delete board;
+    }
+    if (failures > 0) {
+        fflush(stdout);
+        fprintf(stderr, "%u comparisons failed.\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/**
+ * @file video.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "video.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * @brief Quote a string for the shell, in single quotes.
+ */
+static std::string quote(const std::string& text) {
+    std::string quoted = "'";
+    for (char c : text) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+/**
+ * @brief Fit a board in a video at most width pixels across, downsampling
+ * the cells shown or drawing each as a square of scale pixels.
+ */
+static void fitView(uint board_width, uint board_height, uint width,
+                    BoardView* view, uint* scale) {
+    view->rows = board_height;
+    view->cols = board_width;
+    if (width < board_width) {
+        view->step = (board_width + width - 1) / width;
+        *scale = 1;
+    } else {
+        *scale = width / board_width;
+    }
+}
+
+void VideoExporter::planFootprint(Footprint* footprint, uint board_width,
+                                  uint board_height, uint width,
+                                  size_t max_pending) {
+    BoardView view;
+    uint scale;
+    fitView(board_width, board_height, std::max(width, 1u), &view, &scale);
+    size_t cells = (size_t)view.getWidth() * view.getHeight();
+    // Besides those queued, one frame is filled and one written at a time
+    size_t frames = std::max(max_pending, (size_t)1) + 1;
+    // Colours of the cells of the frames queued and of the next ones
+    size_t colors = 2 * cells * sizeof(uint32_t);
+    size_t pixels = cells * scale * scale * 3;
+    footprint->add("recorder buffers", frames * cells + colors + pixels);
+}
+
+VideoExporter::VideoExporter(const std::string& path, uint board_width,
+                             uint board_height, uint width, uint every,
+                             float fps, Palette palette, size_t max_pending) {
+    if (every == 0)
+        throw std::runtime_error("Frames must be at least a tick apart.");
+    if (width == 0)
+        throw std::runtime_error("Videos must be at least a pixel wide.");
+    if (!(fps > 0.f))
+        throw std::runtime_error("Videos need a positive frame rate.");
+    this->board_width = board_width;
+    this->board_height = board_height;
+    this->every = every;
+    fitView(board_width, board_height, width, &this->view, &this->scale);
+    this->max_pending = std::max(max_pending, (size_t)1);
+    buildPalette(palette, this->colors);
+    // Encoders want an even size, so odd frames get a row or column more
+    std::stringstream command;
+    command << "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgb24 -s "
+            << this->getWidth() << "x" << this->getHeight() << " -r " << fps
+            << " -i - -vf 'pad=ceil(iw/2)*2:ceil(ih/2)*2' -pix_fmt yuv420p "
+            << quote(path);
+    this->pipe = popen(command.str().c_str(), "w");
+    if (this->pipe == nullptr)
+        throw std::runtime_error("Failed to start ffmpeg.");
+    this->thread = std::thread(&VideoExporter::loop, this);
+}
+
+VideoExporter::~VideoExporter() {
+    try {
+        this->close();
+    } catch (...) {
+    }
+}
+
+void VideoExporter::paintCells(Sim& sim) {
+    Board* board = sim.board;
+    auto cells = std::make_shared<std::vector<uint32_t>>(
+        (size_t)this->view.getWidth() * this->view.getHeight(), 0);
+    const Cell::Type* types = board->getTypes();
+    size_t pixel = 0;
+    for (uint row = 0; row < this->view.getHeight(); row++) {
+        size_t idx = board->indexOf(row * this->view.step, 0);
+        for (uint col = 0; col < this->view.getWidth();
+             col++, idx += this->view.step, pixel++) {
+            switch (types[idx]) {
+                case Cell::Type::Floor:
+                    break;
+                case Cell::Type::Emitter:
+                    (*cells)[pixel] = getCellColor(
+                        Cell::Type::Emitter,
+                        sim.emitter_rate * board->getRate(idx));
+                    break;
+                case Cell::Type::Escape:
+                    (*cells)[pixel] = getCellColor(
+                        Cell::Type::Escape,
+                        sim.escape_rate * board->getRate(idx));
+                    break;
+                default:
+                    (*cells)[pixel] = wall_color;
+            }
+        }
+    }
+    this->cells = std::move(cells);
+    this->cell_generation = board->getCellGeneration();
+    this->emitter_rate = sim.emitter_rate;
+    this->escape_rate = sim.escape_rate;
+}
+
+void VideoExporter::capture(Sim& sim) {
+    unsigned int tick = sim.getTicks();
+    if (tick % this->every != 0) return;
+    TraceScope trace(sim.tracer, "video", "tick", tick);
+    Board* board = sim.board;
+    if (board->getWidth() != this->board_width ||
+        board->getHeight() != this->board_height)
+        throw std::runtime_error("The board does not match the video.");
+    // Walls, emitters and escapes are only painted again when they change
+    if (!this->cells || board->getCellGeneration() != this->cell_generation ||
+        sim.emitter_rate != this->emitter_rate ||
+        sim.escape_rate != this->escape_rate)
+        this->paintCells(sim);
+    std::vector<uint8_t> levels;
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto ready = [&] {
+            return this->error || this->pending.size() < this->max_pending;
+        };
+        if (!ready()) {
+            this->stalls++;
+            this->room.wait(lock, ready);
+        }
+        if (this->error) std::rethrow_exception(this->error);
+        if (!this->spare.empty()) {
+            levels = std::move(this->spare.back());
+            this->spare.pop_back();
+        }
+    }
+    // Only quantise, the exporter thread colours and scales the frame
+    levels.resize((size_t)this->view.getWidth() * this->view.getHeight());
+    toDensityLevels(sim, this->view, levels.data());
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back({std::move(levels), this->cells});
+    }
+    this->wake.notify_one();
+}
+
+void VideoExporter::close() {
+    if (this->thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->quit = true;
+        }
+        this->wake.notify_one();
+        this->thread.join();
+    }
+    if (this->pipe != nullptr) {
+        // Closing the pipe ends the video, and waits for ffmpeg to write it
+        int status = pclose(this->pipe);
+        this->pipe = nullptr;
+        bool ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok && !this->error) {
+            this->error = std::make_exception_ptr(
+                std::runtime_error("ffmpeg failed to encode the video."));
+        }
+    }
+    if (this->error) std::rethrow_exception(this->error);
+}
+
+void VideoExporter::loop() {
+    // A write to an encoder that quit fails instead of killing the process
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(
+                lock, [&] { return this->quit || !this->pending.empty(); });
+            // Pending frames are encoded before quitting
+            if (this->pending.empty()) return;
+            frame = std::move(this->pending.front());
+            this->pending.pop_front();
+        }
+        this->room.notify_one();
+        try {
+            this->write(frame);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->error = std::current_exception();
+            this->room.notify_all();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->spare.push_back(std::move(frame.levels));
+    }
+}
+
+void VideoExporter::write(const Frame& frame) {
+    uint cols = this->view.getWidth();
+    size_t line = (size_t)this->getWidth() * 3;
+    this->pixels.resize(line * this->getHeight());
+    uint8_t* out = this->pixels.data();
+    const uint8_t* level = frame.levels.data();
+    const uint32_t* cell = frame.cells->data();
+    for (uint row = 0; row < this->view.getHeight(); row++) {
+        uint8_t* first = out;
+        for (uint col = 0; col < cols; col++, level++, cell++) {
+            uint32_t color = *cell != 0 ? *cell : this->colors[*level];
+            for (uint repeat = 0; repeat < this->scale; repeat++) {
+                *out++ = color >> 24;
+                *out++ = color >> 16;
+                *out++ = color >> 8;
+            }
+        }
+        // Each cell is as tall as it is wide
+        for (uint repeat = 1; repeat < this->scale; repeat++, out += line)
+            std::memcpy(out, first, line);
+    }
+    if (fwrite(this->pixels.data(), 1, this->pixels.size(), this->pipe) !=
+        this->pixels.size()) {
+        throw std::runtime_error(
+            "ffmpeg stopped taking frames before the video was finished.");
+    }
+}
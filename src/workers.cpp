@@ -0,0 +1,96 @@
+/**
+ * @file workers.cpp
+ * @author Jacopo Maltagliati
+ * @brief Smoke Propagation Simulation using Cellular Automatas
+ *
+ * @copyright Copyright (c) 2023-2024 Jacopo Maltagliati.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workers.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+WorkerPool::WorkerPool(uint size, bool pin) {
+    this->pinned = pin;
+    for (uint worker = 1; worker < size; worker++) {
+        this->threads.emplace_back(&WorkerPool::loop, this, worker);
+    }
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (!pin || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    std::vector<int> cores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) cores.push_back(cpu);
+    }
+    if (cores.empty()) return;
+    for (uint worker = 1; worker < size; worker++) {
+        cpu_set_t core;
+        CPU_ZERO(&core);
+        CPU_SET(cores[worker % cores.size()], &core);
+        pthread_setaffinity_np(this->threads[worker - 1].native_handle(),
+                               sizeof(core), &core);
+    }
+#endif
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->quit = true;
+    }
+    this->wake.notify_all();
+    for (auto& thread : this->threads) thread.join();
+}
+
+void WorkerPool::loop(uint worker) {
+    unsigned long seen = 0;
+    for (;;) {
+        const std::function<void(uint)>* job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [&] {
+                return this->quit || this->generation != seen;
+            });
+            if (this->quit) return;
+            seen = this->generation;
+            job = this->job;
+        }
+        (*job)(worker);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->pending == 0) this->done.notify_one();
+        }
+    }
+}
+
+void WorkerPool::run(const std::function<void(uint)>& job) {
+    if (this->threads.empty()) {
+        job(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->job = &job;
+        this->pending = this->threads.size();
+        this->generation++;
+    }
+    this->wake.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->done.wait(lock, [&] { return this->pending == 0; });
+}